@@ -40,6 +40,27 @@ def build_sage_pyext(use_from_mcmc=False, verbose=False):
     const char *param_file, void **run_params);
     int finalize_sage(void *run_params);
 
+    /* API for repeated runs on the same forests */
+    int sage_params_from_file(const int ThisTask, const int NTasks,
+    const char *param_file, void **params);
+    int sage_params_from_keyvalues(const int ThisTask, const int NTasks,
+    const int nparams, const char * const *keys,
+    const char * const *values, void **params);
+    int sage_set_param(void *params, const char *key, const char *value);
+    int sage_init_context(void *params);
+    int sage_run(void *params);
+    int sage_finalize_run(void *params);
+    int sage_free_context(void *params);
+
+    /* Galaxies from the most recent run with OutputFormat = 'sage_memory' */
+    int sage_get_num_output_fields(void);
+    int sage_get_output_field_info(const int field_idx, const char **name,
+    const char **dtype);
+    int sage_get_output_snapshots(void *params, int *num_snaps,
+    const int32_t **snapnums);
+    int sage_get_output_field(void *params, const int snap_idx,
+    const char *field_name, void **data, int64_t *ngals);
+
     """)
 
     # set_source() gives the name of the python extension module to
@@ -100,6 +121,140 @@ def run_sage(paramfile, use_from_mcmc=False):
     return
 
 
+def _get_rank_and_ntasks():
+    rank = 0
+    ntasks = 1
+    try:
+        from mpi4py import MPI
+        comm = MPI.COMM_WORLD
+        rank = comm.Get_rank()
+        ntasks = comm.Get_size()
+    except ImportError:
+        pass
+
+    return rank, ntasks
+
+
+class SageModel:
+    """
+    Runs sage repeatedly on the same forests. The forests, snapshot list
+    and cooling tables are only setup once; only the recipe parameters
+    (e.g., 'SfrEfficiency') can be changed between runs.
+
+    The parameters are either read from the parameter file `paramfile`,
+    or taken from the dictionary `params` (with the output snapshots,
+    when required, as the value of the key '->').
+    """
+    def __init__(self, paramfile=None, params=None, use_from_mcmc=False):
+        if (paramfile is None) == (params is None):
+            raise ValueError("Error: Exactly one of 'paramfile' and 'params' must be specified")
+
+        try:
+            from _sage_cffi import ffi, lib
+        except ImportError:
+            build_sage_pyext(use_from_mcmc=use_from_mcmc)
+            from _sage_cffi import ffi, lib
+        self._ffi = ffi
+        self._lib = lib
+
+        rank, ntasks = _get_rank_and_ntasks()
+        self._params = ffi.new("void **")
+        if paramfile is not None:
+            fname = ffi.new("char []", paramfile.encode())
+            status = lib.sage_params_from_file(rank, ntasks, fname, self._params)
+        else:
+            keys = [ffi.new("char []", str(k).encode()) for k in params]
+            values = [ffi.new("char []", str(v).encode()) for v in params.values()]
+            status = lib.sage_params_from_keyvalues(rank, ntasks, len(keys),
+                                                    ffi.new("char *[]", keys),
+                                                    ffi.new("char *[]", values),
+                                                    self._params)
+        self._check(status, "read the parameters")
+        self._check(lib.sage_init_context(self._params[0]), "initialise sage")
+
+    def _check(self, status, what):
+        if status != 0:
+            raise RuntimeError(f"Error: Could not {what} (status = {status})")
+
+    def set_param(self, key, value):
+        status = self._lib.sage_set_param(self._params[0],
+                                          str(key).encode(), str(value).encode())
+        self._check(status, f"set the recipe parameter '{key}' to '{value}'")
+
+    def run(self, **recipe_params):
+        for key, value in recipe_params.items():
+            self.set_param(key, value)
+
+        self._check(self._lib.sage_run(self._params[0]), "run sage")
+        try:
+            from mpi4py import MPI
+            MPI.COMM_WORLD.Barrier()
+        except ImportError:
+            pass
+        self._check(self._lib.sage_finalize_run(self._params[0]),
+                    "finalize the output")
+
+    def output_snapshots(self):
+        num_snaps = self._ffi.new("int *")
+        snapnums = self._ffi.new("int32_t **")
+        self._check(self._lib.sage_get_output_snapshots(self._params[0], num_snaps, snapnums),
+                    "get the output snapshots")
+        return [snapnums[0][i] for i in range(num_snaps[0])]
+
+    def get_galaxies(self, snapnum, fields=None, copy=True):
+        """
+        Returns a dictionary of numpy arrays (one per field) with the galaxies at
+        snapshot `snapnum` from the most recent run. Requires
+        OutputFormat = 'sage_memory'. With `copy=False`, the arrays point
+        directly into the memory of sage and are only valid until the next run.
+        """
+        import numpy as np
+
+        ffi = self._ffi
+        lib = self._lib
+        snapnums = self.output_snapshots()
+        if snapnum not in snapnums:
+            raise ValueError(f"Error: Snapshot {snapnum} is not one of the output snapshots {snapnums}")
+        snap_idx = snapnums.index(snapnum)
+
+        dtypes = {}
+        name = ffi.new("char **")
+        dtype = ffi.new("char **")
+        for field_idx in range(lib.sage_get_num_output_fields()):
+            self._check(lib.sage_get_output_field_info(field_idx, name, dtype),
+                        "get the output field info")
+            dtypes[ffi.string(name[0]).decode()] = ffi.string(dtype[0]).decode()
+        if fields is None:
+            fields = list(dtypes)
+
+        galaxies = {}
+        data = ffi.new("void **")
+        ngals = ffi.new("int64_t *")
+        for field in fields:
+            if field not in dtypes:
+                raise ValueError(f"Error: Unknown output field '{field}'. Valid fields are {list(dtypes)}")
+            self._check(lib.sage_get_output_field(self._params[0], snap_idx,
+                                                  field.encode(), data, ngals),
+                        f"get the output field '{field}'")
+            dt = np.dtype(dtypes[field])
+            if ngals[0] == 0:
+                galaxies[field] = np.empty(0, dtype=dt)
+                continue
+            arr = np.frombuffer(ffi.buffer(data[0], ngals[0] * dt.itemsize), dtype=dt)
+            galaxies[field] = arr.copy() if copy else arr
+
+        return galaxies
+
+    def close(self):
+        params = getattr(self, "_params", None)
+        if params is not None and params[0] != self._ffi.NULL:
+            self._lib.sage_free_context(params[0])
+        self._params = None
+
+    def __del__(self):
+        self.close()
+
+
 if __name__ == "__main__":
     import os
     parfile = "tests/test_data/mini-millennium.par"
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <sys/time.h>
 
 #ifdef HDF5
 #include <hdf5.h>
@@ -49,6 +50,7 @@ enum Valid_OutputFormats
     sage_binary = 0, /* will be deprecated after version 1 release*/
     sage_hdf5 = 1,
     lhalo_binary_output = 2, /* special functionality to convert *any* supported input mergertree into a lhalo-binary format */
+    sage_memory = 3, /* keep the galaxies in memory for library callers (see sage_get_output_field) */
     num_output_format_types
 };
 
@@ -107,6 +109,7 @@ struct GALAXY
     int32_t   mergeType;  /* 0=none; 1=minor merger; 2=major merger; 3=disk instability; 4=disrupt to ICS */
     int32_t   mergeIntoID;
     int32_t   mergeIntoSnapNum;
+    int32_t   HaloGalIndex;/* index within HaloGal that this galaxy was copied from at the previous snapshot (-1 for new galaxies) */
     float dT;
 
     /* (sub)halo properties */
@@ -163,6 +166,44 @@ struct GALAXY
     float infallVmax;
 };
 
+/* Structure-of-arrays copy of the galaxy properties that are updated during the stripping and
+   cooling stage of each substep. Every satellite within a FOF group evolves independently during
+   this stage, so the satellites are processed as one batch over contiguous arrays */
+struct galaxy_batch
+{
+    int32_t n;/* number of galaxies currently in the batch */
+    int32_t capacity;
+    int32_t *index;/* index of each galaxy within the (AoS) galaxies array */
+    int32_t *Type;
+    double *dt;/* length of the current substep for each galaxy */
+
+    float *Mvir;
+    float *Rvir;
+    float *Vvir;
+
+    float *ColdGas;
+    float *StellarMass;
+    float *HotGas;
+    float *EjectedMass;
+    float *BlackHoleMass;
+    float *ICS;
+    float *MetalsColdGas;
+    float *MetalsHotGas;
+
+    double *Cooling;
+    double *Heating;
+    float *r_heat;
+
+    /* gas (and metals) stripped from each satellite that are added to the central galaxy */
+    double *strippedGas;
+    double *strippedGasMetals;
+
+    /* scratch space for the cooling calculation */
+    double *logTemp;
+    double *logZ;
+    double *lambda;
+};
+
 
 
 /* auxiliary halo data */
@@ -175,7 +216,6 @@ struct halo_aux_data
 #ifdef PROCESS_LHVT_STYLE
     int orig_index;
 #endif
-    int output_snap_n;
 };
 
 
@@ -199,6 +239,8 @@ struct lhalotree_info {
         hid_t *open_h5_fds;/* contains numfiles elements of open HDF5 file descriptors */
 #endif
     };
+    void **mmap_addr;/* numfiles elements: start of each memory-mapped (binary) file, NULL if the file is read with pread */
+    size_t *mmap_size;/* numfiles elements: number of bytes mapped for each file */
     int32_t numfiles;/* number of unique files being processed by this task,  must be >=1 and <= lastfile - firstfile + 1 */
     int32_t unused;/* unused, but present for alignment */
 };
@@ -225,7 +267,16 @@ struct ctrees_info {
     /* file level quantities */
     int *open_fds;/* contains numfiles elements of open file descriptors */
     int32_t numfiles;/* total number of files the forests are spread over (BOX_DIVISIONS^3 per Consistent trees terminology) */
-    int32_t unused;/* unused, but present for alignment */
+
+    /* binary cache of the post-processed forests (only used when the optional parameter 'ForestCacheDir' is set) */
+    int32_t cache_state;/* one of 'enum ctrees_cache_states' (defined in read_tree_consistentrees_ascii.c) */
+    int cache_fd;/* file descriptor for the cache file, -1 if there is no cache */
+    int64_t cache_nforests_written;/* number of forests written to a new cache file so far */
+    off_t cache_nbytes;/* number of bytes in the cache file (i.e., the offset to write the next forest to) */
+    int64_t *cache_nhalos_per_forest;/* contains nforests elements */
+    off_t *cache_offsets;/* contains nforests elements: the byte offset within the cache file for each forest */
+    char cache_filename[2*MAX_STRING_LEN + 64];
+    char cache_tmp_filename[2*MAX_STRING_LEN + 96];/* a new cache is written here and renamed to cache_filename once complete */
 };
 
 /* place-holder for future AHF i/o capabilities */
@@ -235,6 +286,7 @@ struct ahf_info {
 };
 
 #ifdef HDF5
+struct genesis_forest_batch;
 struct genesis_info {
     union{
         int64_t nforests;/* number of forests to process on this task */
@@ -243,14 +295,8 @@ struct genesis_info {
 
     int64_t start_forestnum;/* Global forestnumber to start processing from */
     int64_t maxforestsize; /* max. number of halos in any one single forest on any task */
-    int64_t *offset_for_global_forestnum;/* What would be the offset to add to file-local 'forestnum' to get the global forest num
+    int64_t *offset_for_global_forestnum;/* What would be the offset to add to task-local 'forestnr' to get the global forest num
                                             that is needed to access the metadata ("*foreststats*.hdf5") file  -- shape (lastfile + 1, ) */
-    int64_t *halo_offset_per_snap;/* Stores the current halo offsets to read from at each snapshot -- shape (maxsnaps, ).
-                                     Initialised to all 0's for every new file and incremented as forests are read in. This details
-                                     adds a loop-dependency - where later forests can not be correctly processed before all
-                                     preceeding forests have been processed. It had to be implemented this way because otherwise
-                                     the amount of RAM required to store the matrix offsets_per_forest_per_snap (with shape
-                                     '[nforests, maxsnaps]' would have been a roadblock in the future. */
     hid_t meta_fd;/* file descriptor for the metadata file*/
     hid_t *h5_fds;/* contains all the file descriptors for the individual files -- shape (lastfile + 1, ) */
 
@@ -259,9 +305,10 @@ struct genesis_info {
     int32_t totnfiles;/* total number of files requested to be processed (across all tasks)*/
     int32_t numfiles;/* total number of files to process on ThisTask (>=1)*/
     int32_t start_filenum;/* Which is the first file that this task is going to process  */
-    int32_t curr_filenum; /* What file is currently being worked on --
-                              required to reset the halo_offset_per_snap at the beginning of every new file */
 
+    struct genesis_forest_batch *batch;/* halo properties for a batch of consecutive forests, read in with one hyperslab per
+                                          property per snapshot (defined in 'io/read_tree_genesis_hdf5.c'). The batch is
+                                          located with the per-forest offsets from the file -> forests can be loaded in any order */
 };
 
 struct ctrees_h5_info {
@@ -287,6 +334,7 @@ struct ctrees_h5_info {
     int32_t end_filenum; /* the last file processed on this task (inclusive) */
 };
 
+struct gadget4_forest_batch;
 struct gadget4_info {
     int64_t nforests;/* number of forests to process on this task, scalar */
 
@@ -329,9 +377,28 @@ struct gadget4_info {
     int64_t *offset_in_nhalos_first_file_for_forests; /* offset counted in nhalos contained in all preceeding forests,
                                                         where to start reading the forest in the first files, nforests elements */
     // int64_t *offset_in_forests_first_file_for_forests; /* offset counted as the number of preceeding forests in that first file, nforests elements */
+
+    struct gadget4_forest_batch *batch;/* all the halos for a batch of consecutive forests, read in with one contiguous hyperslab per
+                                          property per file; the datasets stay open across batches (defined in 'io/read_tree_gadget4_hdf5.c') */
 };
 #endif
 
+/* The wall-clock time taken to load and evolve one forest */
+struct forest_timing {
+    int64_t nhalos;/* -1 if the forest was not processed (on this task) */
+    double seconds;
+};
+
+/* The halos of (a memory-budgeted subset of) the forests on this task, kept in
+   memory so that repeated runs on the same forests do not re-read them */
+struct resident_forests {
+    struct halo_data **halos;/* NULL for the forests that are not resident */
+    int64_t *nhalos;
+    int64_t nforests;
+    size_t nbytes;/* total size of all the resident halos */
+    size_t max_nbytes;
+};
+
 struct forest_info {
     union {
         struct lhalotree_info lht;
@@ -358,6 +425,7 @@ struct forest_info {
 
     /* Task level quantities -> unique for each task */
     int64_t nforests_this_task; // Total number of forests processed by **this** task.
+    int64_t start_forestnum_this_task; // The first forest (over all forests) processed by **this** task.
     int64_t nhalos_this_task;// Total number of halos to be processed by **this** task (if it can be calculated ahead of time, otherwise set to 0 e.g., in case of Consistent-Trees ascii)
 
     /* Forest-level quantities (per task) */
@@ -366,6 +434,8 @@ struct forest_info {
                     // first halos within the tree are to be found)
     int64_t *original_treenr; // The (file-local) tree number from the original tree files.
                               // Necessary because Task N's "Tree 0" could start at the middle of a file.
+    struct forest_timing *timings; // Only with `WriteForestTimings`: the number of halos and the time taken for each forest.
+    struct resident_forests *resident; // Only for repeated runs with `ResidentForestsMB`: the forests that are kept in memory between runs.
 };
 
 struct save_info {
@@ -378,6 +448,11 @@ struct save_info {
 
     int64_t *tot_ngals; // Number of galaxies **per snapshot**.
     int32_t **forest_ngals; // Number of galaxies **per snapshot** **per tree**; forest_ngals[snap][forest].
+    int64_t nforests_saved; // Number of forests saved so far. The forests are saved in the order they appear in the output
+                            // (i.e., this is also the index of the next forest within `forest_ngals`).
+    int64_t *forestnr_per_tree; // Only with `DynamicForestScheduling` or `HDF5SingleFile`: the forest number (over all forests) of each saved forest.
+    int64_t single_file_nrounds; // Only with `HDF5SingleFile`: the number of rounds of writes into the single file so far.
+    struct timeval last_checkpoint; // Only with `CheckpointInterval`: the time when the previous checkpoint was written.
 
 #ifdef HDF5
     char **name_output_fields;
@@ -390,11 +465,22 @@ struct save_info {
     int32_t buffer_size;
     int32_t *num_gals_in_buffer;
     struct HDF5_GALAXY_OUTPUT *buffer_output_gals;
+    struct hdf5_single_file *single_file;/* Only with `HDF5SingleFile`: the state of the (incremental) writes into the single file */
+#ifdef USE_ASYNC_WRITE
+    struct HDF5_GALAXY_OUTPUT *spare_output_gals;/* second buffer per snapshot; filled while the other buffer is being written */
+    struct hdf5_buffer_write_job *buffer_write_jobs;
+    int *buffer_in_flight;
+#endif
 #endif
 
+#ifdef USE_ASYNC_WRITE
+    struct async_writer *async_writer;/* Writes out the full galaxy buffers on a separate thread (NULL when writing synchronously) */
+#endif
 };
 
 
+struct galaxy_catalogue;
+
 struct params
 {
     int32_t    FirstFile;    /* first and last file for processing; only relevant for lhalotree style files (binary or hdf5) */
@@ -406,6 +492,13 @@ struct params
     char   TreeExtension[MAX_STRING_LEN]; // If the trees are in HDF5, they will have a .hdf5 extension. Otherwise they have no extension.
     char   SimulationDir[MAX_STRING_LEN];
     char   FileWithSnapList[MAX_STRING_LEN];
+    char   ForestCacheDir[MAX_STRING_LEN];/* optional: directory to store a binary cache of the (post-processed) input forests */
+    char   ForestTimingsFromRun[MAX_STRING_LEN];/* optional: '<OutputDir>/<FileNameGalaxies>' of a previous run with 'WriteForestTimings' ->
+                                                   the exponent of the forest cost is fitted to the timings from that run */
+    int32_t WriteForestTimings;/* write the time taken by each forest to '<OutputDir>/<FileNameGalaxies>_forest_timings_<task>.txt' */
+    double CheckpointInterval;/* flush the output and write '<OutputDir>/<FileNameGalaxies>_checkpoint_<task>.bin' every this many seconds (0 -> never) */
+    int32_t RestartFromCheckpoint;/* continue from the checkpoint of a previous (interrupted) run, if there is one */
+    double ResidentForestsMB;/* repeated runs only: keep up to this many MB of forests in memory after the first run (0 -> none, -1 -> all) */
 
     double Omega;
     double OmegaLambda;
@@ -420,6 +513,13 @@ struct params
     /* moving for alignment */
     int32_t NumSimulationTreeFiles;
 
+    /* (optional) filters and chunking for the sage_hdf5 output */
+    int32_t HDF5DeflateLevel;/* gzip compression level: 0 (no compression) to 9 */
+    int32_t HDF5Shuffle;/* shuffle the bytes before compression (only used when HDF5DeflateLevel > 0) */
+    int32_t HDF5Fletcher32;/* add a checksum to every chunk */
+    int32_t HDF5ChunkSize;/* number of galaxies per chunk */
+    int32_t HDF5SingleFile;/* write the galaxies from all tasks into one file (with one dataset per field per snapshot), in rounds during the run */
+
     /* recipe flags */
     int32_t    SFprescription;
     int32_t    AGNrecipeOn;
@@ -465,12 +565,15 @@ struct params
     int32_t Snaplistlen;
     enum Valid_TreeTypes TreeType;
     enum Valid_OutputFormats OutputFormat;
+    uint64_t OutputFieldsMask;/* the fields written by the 'sage_hdf5' and 'sage_binary' outputs (bit i -> i'th field in the 'sage_hdf5' order) */
 
     /* The combination of  ForestDistributionScheme = generic_power_in_nhalos and
        exponent_for_forest_dist_scheme = 0.7 seems to produce good work-load
        balance across MPI on the 512 Genesis test dataset - MS 16/01/2020 */
     enum Valid_Forest_Distribution_Schemes ForestDistributionScheme;
     double Exponent_Forest_Dist_Scheme;
+    int32_t DynamicForestScheduling; /* If set, tasks request chunks (contiguous ranges) of forests while running instead of
+                                        processing a fixed range of forests. Only supported for the 'sage_hdf5' output format */
 
     int64_t FileNr_Mulfac;
     int64_t ForestNr_Mulfac;
@@ -492,8 +595,16 @@ struct params
 
     double *Age;
 
+    /* Quantities that only depend on the redshift of each snapshot (and the recipe parameters). These are
+       computed once per run (rather than for every galaxy and substep) */
+    double VirialRadiusFac[ABSOLUTEMAXSNAPS];/* Rvir = cbrt(Mvir * VirialRadiusFac[snapnum]) */
+    double ReionizationMass[ABSOLUTEMAXSNAPS];/* max(filtering mass, characteristic mass) for the reionization recipe */
+
     int32_t interrupted;/* to re-print the progress-bar */
 
+    struct forest_info *forest_info;/* only set for repeated runs on the same forests (see sage_init_context) */
+    struct galaxy_catalogue *catalogue;/* only with OutputFormat = 'sage_memory': the galaxies from the most recent run */
+
     int32_t ThisTask;
     int32_t NTasks;
 };
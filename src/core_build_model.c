@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include <time.h>
 #include <signal.h>
 #include <unistd.h>
@@ -21,60 +22,149 @@
 #include "model_cooling_heating.h"
 
 
+static int construct_galaxies_in_fof(const int halonr, int *numgals, int *galaxycounter, int *maxgals, struct halo_data *halos,
+                                     struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
+                                     struct sage_arena *arena, struct params *run_params);
 static int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals, struct halo_data *halos,
-                           struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal, struct params *run_params);
+                           struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
+                           struct sage_arena *arena, struct params *run_params);
 static int join_galaxies_of_progenitors(const int halonr, const int ngalstart, int *galaxycounter, int *maxgals, struct halo_data *halos,
-                                        struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal, struct params *run_params);
+                                        struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
+                                        struct sage_arena *arena, struct params *run_params);
+static void grow_galaxy_arrays(int *maxgals, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal, struct sage_arena *arena);
+static void alloc_galaxy_batch(struct galaxy_batch *batch, const int32_t capacity, struct sage_arena *arena);
+static void add_galaxy_to_batch(struct galaxy_batch *batch, const int p, const double dt, const struct GALAXY *galaxies);
+static void update_galaxies_from_batch(const struct galaxy_batch *batch, struct GALAXY *galaxies);
 
 
 
-/* the only externally visible function */
+enum construct_stages
+{
+    CONSTRUCT_START = 0,/* halo has just been visited */
+    CONSTRUCT_PROGENITORS = 1,/* visiting the progenitors of this halo */
+    CONSTRUCT_FOF_PROGENITORS = 2,/* visiting the progenitors of all halos in the FOF group */
+    CONSTRUCT_EVOLVE = 3,/* all progenitors are done -> join and evolve the galaxies */
+};
+
+static int push_construct_frame(const int halonr, struct construct_frame *stack, int *nstack, const int maxstack)
+{
+    if(*nstack == maxstack) {
+        fprintf(stderr,"Error: Bug in code. The stack used to construct galaxies is full (%d elements) while pushing halonr = %d\n",
+                maxstack, halonr);
+        return EXIT_FAILURE;
+    }
+
+    struct construct_frame *frame = &stack[*nstack];
+    frame->halonr = halonr;
+    frame->stage = CONSTRUCT_START;
+    frame->prog = -1;
+    frame->fofhalo = -1;
+    (*nstack)++;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* the only externally visible function
+   Constructs (and evolves) the galaxies of halonr, after first constructing the galaxies of all
+   progenitors of all halos in the FOF group of halonr (depth-first). The traversal uses an explicit
+   stack rather than recursion, so the depth of the merger tree is only limited by the available memory.
+   The stack (with space for 'maxstack' frames) is provided by the caller and re-used for all the calls within a forest */
 int construct_galaxies(const int halonr, int *numgals, int *galaxycounter, int *maxgals, struct halo_data *halos,
                        struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
-                       struct params *run_params)
+                       struct construct_frame *stack, const int maxstack,
+                       struct sage_arena *arena, struct params *run_params)
 {
-  int prog, fofhalo;
+    int nstack = 0;
+    int status = push_construct_frame(halonr, stack, &nstack, maxstack);
+    while(nstack > 0 && status == EXIT_SUCCESS) {
+        struct construct_frame *frame = &stack[nstack - 1];
+        const int this_halo = frame->halonr;
+        int next_halo = -1;
+
+        switch(frame->stage) {
+        case CONSTRUCT_START:
+            haloaux[this_halo].DoneFlag = 1;
+            frame->prog = halos[this_halo].FirstProgenitor;
+            frame->stage = CONSTRUCT_PROGENITORS;
+            /* fall through */
+
+        case CONSTRUCT_PROGENITORS:
+            while(frame->prog >= 0 && next_halo < 0) {
+                if(haloaux[frame->prog].DoneFlag == 0) {
+                    next_halo = frame->prog;
+                }
+                frame->prog = halos[frame->prog].NextProgenitor;
+            }
+            if(next_halo >= 0) {
+                break;
+            }
 
-  haloaux[halonr].DoneFlag = 1;
+            frame->stage = CONSTRUCT_EVOLVE;
+            frame->fofhalo = halos[this_halo].FirstHaloInFOFgroup;
+            if(haloaux[frame->fofhalo].HaloFlag == 0) {
+                haloaux[frame->fofhalo].HaloFlag = 1;
+                frame->prog = halos[frame->fofhalo].FirstProgenitor;
+                frame->stage = CONSTRUCT_FOF_PROGENITORS;
+            }
+            /* fall through */
 
-  prog = halos[halonr].FirstProgenitor;
-  while(prog >= 0) {
-      if(haloaux[prog].DoneFlag == 0) {
-          int status = construct_galaxies(prog, numgals, galaxycounter, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, run_params);
+        case CONSTRUCT_FOF_PROGENITORS:
+            while(frame->stage == CONSTRUCT_FOF_PROGENITORS && frame->fofhalo >= 0 && next_halo < 0) {
+                while(frame->prog >= 0 && next_halo < 0) {
+                    if(haloaux[frame->prog].DoneFlag == 0) {
+                        next_halo = frame->prog;
+                    }
+                    frame->prog = halos[frame->prog].NextProgenitor;
+                }
+                if(next_halo >= 0) {
+                    break;
+                }
 
-          if(status != EXIT_SUCCESS) {
-              return status;
-          }
-      }
-      prog = halos[prog].NextProgenitor;
-  }
+                frame->fofhalo = halos[frame->fofhalo].NextHaloInFOFgroup;
+                if(frame->fofhalo >= 0) {
+                    frame->prog = halos[frame->fofhalo].FirstProgenitor;
+                }
+            }
+            if(next_halo >= 0) {
+                break;
+            }
+            frame->stage = CONSTRUCT_EVOLVE;
+            /* fall through */
+
+        case CONSTRUCT_EVOLVE:
+            // At this point, the galaxies for all progenitors of this halo have been
+            // properly constructed. Also, the galaxies of the progenitors of all other
+            // halos in the same FOF group have been constructed as well. We can hence go
+            // ahead and construct all galaxies for the subhalos in this FOF halo, and
+            // evolve them in time.
+            status = construct_galaxies_in_fof(this_halo, numgals, galaxycounter, maxgals, halos, haloaux,
+                                               ptr_to_galaxies, ptr_to_halogal, arena, run_params);
+            nstack--;
+            break;
+
+        default:
+            fprintf(stderr,"Error: Unknown stage = %d while constructing galaxies for halonr = %d\n", frame->stage, this_halo);
+            status = EXIT_FAILURE;
+            break;
+        }
 
-  fofhalo = halos[halonr].FirstHaloInFOFgroup;
-  if(haloaux[fofhalo].HaloFlag == 0) {
-      haloaux[fofhalo].HaloFlag = 1;
-      while(fofhalo >= 0) {
-          prog = halos[fofhalo].FirstProgenitor;
-          while(prog >= 0) {
-              if(haloaux[prog].DoneFlag == 0) {
-                  int status = construct_galaxies(prog, numgals, galaxycounter, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, run_params);
-
-                  if(status != EXIT_SUCCESS) {
-                      return status;
-                  }
-              }
-              prog = halos[prog].NextProgenitor;
-          }
-          fofhalo = halos[fofhalo].NextHaloInFOFgroup;
-      }
-  }
+        // the progenitor has to be constructed before continuing with the current halo
+        if(status == EXIT_SUCCESS && next_halo >= 0) {
+            status = push_construct_frame(next_halo, stack, &nstack, maxstack);
+        }
+    }
+
+    return status;
+}
+/* end of construct_galaxies*/
 
-  // At this point, the galaxies for all progenitors of this halo have been
-  // properly constructed. Also, the galaxies of the progenitors of all other
-  // halos in the same FOF group have been constructed as well. We can hence go
-  // ahead and construct all galaxies for the subhalos in this FOF halo, and
-  // evolve them in time.
 
-  fofhalo = halos[halonr].FirstHaloInFOFgroup;
+static int construct_galaxies_in_fof(const int halonr, int *numgals, int *galaxycounter, int *maxgals, struct halo_data *halos,
+                                     struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
+                                     struct sage_arena *arena, struct params *run_params)
+{
+  int fofhalo = halos[halonr].FirstHaloInFOFgroup;
 #ifdef USE_SAGE_IN_MCMC_MODE
   /* The extra condition stops sage from evolving any galaxies beyond the final output snapshot.
      This optimised processing reduces the values GalaxyIndex and CentralGalaxyIndex (since fewer galaxies are
@@ -92,14 +182,14 @@ int construct_galaxies(const int halonr, int *numgals, int *galaxycounter, int *
       haloaux[fofhalo].HaloFlag = 2;
 
       while(fofhalo >= 0) {
-          ngal = join_galaxies_of_progenitors(fofhalo, ngal, galaxycounter, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, run_params);
+          ngal = join_galaxies_of_progenitors(fofhalo, ngal, galaxycounter, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, arena, run_params);
           if(ngal < 0) {
               return EXIT_FAILURE;
           }
           fofhalo = halos[fofhalo].NextHaloInFOFgroup;
       }
 
-      int status = evolve_galaxies(halos[halonr].FirstHaloInFOFgroup, ngal, numgals, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, run_params);
+      int status = evolve_galaxies(halos[halonr].FirstHaloInFOFgroup, ngal, numgals, maxgals, halos, haloaux, ptr_to_galaxies, ptr_to_halogal, arena, run_params);
 
       if(status != EXIT_SUCCESS) {
           return status;
@@ -109,11 +199,12 @@ int construct_galaxies(const int halonr, int *numgals, int *galaxycounter, int *
 
   return EXIT_SUCCESS;
 }
-/* end of construct_galaxies*/
+
 
 
 int join_galaxies_of_progenitors(const int halonr, const int ngalstart, int *galaxycounter, int *maxgals, struct halo_data *halos,
-                                 struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal, struct params *run_params)
+                                 struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
+                                 struct sage_arena *arena, struct params *run_params)
 {
     int ngal, prog,  first_occupied, lenmax, lenoccmax;
     struct GALAXY *galaxies = *ptr_to_galaxies;
@@ -151,10 +242,7 @@ int join_galaxies_of_progenitors(const int halonr, const int ngalstart, int *gal
     while(prog >= 0) {
         for(int i = 0; i < haloaux[prog].NGalaxies; i++) {
             if(ngal == (*maxgals - 1)) {
-                *maxgals += 10000;
-
-                *ptr_to_galaxies = myrealloc(*ptr_to_galaxies, *maxgals * sizeof(struct GALAXY));
-                *ptr_to_halogal  = myrealloc(*ptr_to_halogal, *maxgals * sizeof(struct GALAXY));
+                grow_galaxy_arrays(maxgals, ptr_to_galaxies, ptr_to_halogal, arena);
                 galaxies = *ptr_to_galaxies;
                 halogal = *ptr_to_halogal;
             }
@@ -170,6 +258,7 @@ int join_galaxies_of_progenitors(const int halonr, const int ngalstart, int *gal
             // they are copied to the end of the list of permanent galaxies halogal[xxx]
 
             galaxies[ngal] = halogal[haloaux[prog].FirstGalaxy + i];
+            galaxies[ngal].HaloGalIndex = haloaux[prog].FirstGalaxy + i;
             galaxies[ngal].HaloNr = halonr;
 
             galaxies[ngal].dT = -1.0;
@@ -299,9 +388,103 @@ int join_galaxies_of_progenitors(const int halonr, const int ngalstart, int *gal
 }
 /* end of join_galaxies_of_progenitors */
 
+
+/* Geometric growth -> the total number of galaxies copied while growing is proportional to the final size */
+static void grow_galaxy_arrays(int *maxgals, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal, struct sage_arena *arena)
+{
+    int64_t newmax = (int64_t) GALGROWTHFAC * (*maxgals);
+    if(newmax > INT_MAX) newmax = INT_MAX;
+    *maxgals = (int) newmax;
+
+    *ptr_to_galaxies = arena_realloc(arena, *ptr_to_galaxies, *maxgals * sizeof(struct GALAXY));
+    *ptr_to_halogal  = arena_realloc(arena, *ptr_to_halogal, *maxgals * sizeof(struct GALAXY));
+}
+
+
+static void alloc_galaxy_batch(struct galaxy_batch *batch, const int32_t capacity, struct sage_arena *arena)
+{
+#define ALLOC_BATCH_ARRAY(field_name) {                                 \
+        batch->field_name = arena_malloc(arena, capacity * sizeof(batch->field_name[0])); \
+    }
+
+    batch->n = 0;
+    batch->capacity = capacity;
+
+    ALLOC_BATCH_ARRAY(index);
+    ALLOC_BATCH_ARRAY(Type);
+    ALLOC_BATCH_ARRAY(dt);
+    ALLOC_BATCH_ARRAY(Mvir);
+    ALLOC_BATCH_ARRAY(Rvir);
+    ALLOC_BATCH_ARRAY(Vvir);
+    ALLOC_BATCH_ARRAY(ColdGas);
+    ALLOC_BATCH_ARRAY(StellarMass);
+    ALLOC_BATCH_ARRAY(HotGas);
+    ALLOC_BATCH_ARRAY(EjectedMass);
+    ALLOC_BATCH_ARRAY(BlackHoleMass);
+    ALLOC_BATCH_ARRAY(ICS);
+    ALLOC_BATCH_ARRAY(MetalsColdGas);
+    ALLOC_BATCH_ARRAY(MetalsHotGas);
+    ALLOC_BATCH_ARRAY(Cooling);
+    ALLOC_BATCH_ARRAY(Heating);
+    ALLOC_BATCH_ARRAY(r_heat);
+    ALLOC_BATCH_ARRAY(strippedGas);
+    ALLOC_BATCH_ARRAY(strippedGasMetals);
+    ALLOC_BATCH_ARRAY(logTemp);
+    ALLOC_BATCH_ARRAY(logZ);
+    ALLOC_BATCH_ARRAY(lambda);
+
+#undef ALLOC_BATCH_ARRAY
+}
+
+
+static void add_galaxy_to_batch(struct galaxy_batch *batch, const int p, const double dt, const struct GALAXY *galaxies)
+{
+    const int32_t i = batch->n++;
+
+    batch->index[i] = p;
+    batch->Type[i] = galaxies[p].Type;
+    batch->dt[i] = dt;
+
+    batch->Mvir[i] = galaxies[p].Mvir;
+    batch->Rvir[i] = galaxies[p].Rvir;
+    batch->Vvir[i] = galaxies[p].Vvir;
+
+    batch->ColdGas[i] = galaxies[p].ColdGas;
+    batch->StellarMass[i] = galaxies[p].StellarMass;
+    batch->HotGas[i] = galaxies[p].HotGas;
+    batch->EjectedMass[i] = galaxies[p].EjectedMass;
+    batch->BlackHoleMass[i] = galaxies[p].BlackHoleMass;
+    batch->ICS[i] = galaxies[p].ICS;
+    batch->MetalsColdGas[i] = galaxies[p].MetalsColdGas;
+    batch->MetalsHotGas[i] = galaxies[p].MetalsHotGas;
+
+    batch->Cooling[i] = galaxies[p].Cooling;
+    batch->Heating[i] = galaxies[p].Heating;
+    batch->r_heat[i] = galaxies[p].r_heat;
+}
+
+
+/* Copies back the properties that can be modified by the stripping and cooling */
+static void update_galaxies_from_batch(const struct galaxy_batch *batch, struct GALAXY *galaxies)
+{
+    for(int32_t i = 0; i < batch->n; i++) {
+        const int p = batch->index[i];
+
+        galaxies[p].ColdGas = batch->ColdGas[i];
+        galaxies[p].HotGas = batch->HotGas[i];
+        galaxies[p].BlackHoleMass = batch->BlackHoleMass[i];
+        galaxies[p].MetalsColdGas = batch->MetalsColdGas[i];
+        galaxies[p].MetalsHotGas = batch->MetalsHotGas[i];
+
+        galaxies[p].Cooling = batch->Cooling[i];
+        galaxies[p].Heating = batch->Heating[i];
+        galaxies[p].r_heat = batch->r_heat[i];
+    }
+}
+
 int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals, struct halo_data *halos,
                     struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
-                    struct params *run_params)
+                    struct sage_arena *arena, struct params *run_params)
 {
     struct GALAXY *galaxies = *ptr_to_galaxies;
     struct GALAXY *halogal = *ptr_to_halogal;
@@ -321,15 +504,39 @@ int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals
      */
 
     const int halo_snapnum = halos[halonr].SnapNum;
-    const double Zcurr = run_params->ZZ[halo_snapnum];
     const double halo_age = run_params->Age[halo_snapnum];
-    const double infallingGas = infall_recipe(centralgal, ngal, Zcurr, galaxies, run_params);
+    const double infallingGas = infall_recipe(centralgal, ngal, halo_snapnum, galaxies, run_params);
+
+    /* The satellites only ever modify the central galaxy (and not each other). Therefore, the stripping and
+       cooling for all the satellites can be computed in one batch at the start of each substep and the
+       resulting stripped gas is then added to the central in the original order of the galaxies */
+    const struct arena_mark batch_mark = get_arena_mark(arena);
+    struct galaxy_batch sats, central;
+    alloc_galaxy_batch(&sats, ngal, arena);
+    alloc_galaxy_batch(&central, 1, arena);
 
     // We integrate things forward by using a number of intervals equal to STEPS
     for(int step = 0; step < STEPS; step++) {
 
-        // Loop over all galaxies in the halo
+        sats.n = 0;
         for(int p = 0; p < ngal; p++) {
+            // Don't treat galaxies that have already merged
+            if(p == centralgal || galaxies[p].mergeType > 0) {
+                continue;
+            }
+
+            const double deltaT = run_params->Age[galaxies[p].SnapNum] - halo_age;
+            add_galaxy_to_batch(&sats, p, deltaT / STEPS, galaxies);
+        }
+
+        strip_from_satellites(&sats, halo_snapnum, run_params);
+
+        // Determine the cooling gas given the halo properties
+        cool_gas_in_galaxies(&sats, run_params);
+        update_galaxies_from_batch(&sats, galaxies);
+
+        // Loop over all galaxies in the halo
+        for(int p = 0, isat = 0; p < ngal; p++) {
             // Don't treat galaxies that have already merged
             if(galaxies[p].mergeType > 0) {
                 continue;
@@ -349,16 +556,20 @@ int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals
                 if(run_params->ReIncorporationFactor > 0.0) {
                     reincorporate_gas(centralgal, deltaT / STEPS, galaxies, run_params);
                 }
+
+                central.n = 0;
+                add_galaxy_to_batch(&central, centralgal, deltaT / STEPS, galaxies);
+                cool_gas_in_galaxies(&central, run_params);
+                update_galaxies_from_batch(&central, galaxies);
             } else {
-                if(galaxies[p].Type == 1 && galaxies[p].HotGas > 0.0) {
-                    strip_from_satellite(centralgal, p, Zcurr, galaxies, run_params);
-                }
+                XRETURN(sats.index[isat] == p, EXIT_FAILURE,
+                        "Error: Expected satellite number %d to be galaxy = %d but found galaxy = %d instead\n",
+                        isat, p, sats.index[isat]);
+                galaxies[centralgal].HotGas += sats.strippedGas[isat];
+                galaxies[centralgal].MetalsHotGas += sats.strippedGasMetals[isat];
+                isat++;
             }
 
-            // Determine the cooling gas given the halo properties
-            double coolingGas = cooling_recipe(p, deltaT / STEPS, galaxies, run_params);
-            cool_gas_onto_galaxy(p, coolingGas, galaxies);
-
             // stars form and then explode!
             starformation_and_feedback(p, centralgal, time, deltaT / STEPS, halonr, step, galaxies, run_params);
         }
@@ -406,6 +617,9 @@ int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals
         }
     } // Go on to the next STEPS substep
 
+    // the batches are not needed any more -> release the scratch space
+    rewind_arena(arena, &batch_mark);
+
 
     // Extra miscellaneous stuff before finishing this halo
     galaxies[centralgal].TotalSatelliteBaryons = 0.0;
@@ -430,6 +644,38 @@ int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals
     }
 
 
+    // Merged galaxies won't be kept, so the mergeIntoID of every merged galaxy has to be offset by the number
+    // of preceding merged galaxies that merged into a galaxy with a smaller mergeIntoID. The mergeIntoID values
+    // are all within [*numgals, *numgals + ngal) -> count with a binary indexed (Fenwick) tree over those values
+    {
+        const struct arena_mark offset_mark = get_arena_mark(arena);
+        int32_t *nmerged_below = arena_malloc(arena, (ngal + 1) * sizeof(nmerged_below[0]));
+        memset(nmerged_below, 0, (ngal + 1) * sizeof(nmerged_below[0]));
+
+        for(int p = 0; p < ngal; p++) {
+            if(galaxies[p].mergeType == 0) {
+                continue;
+            }
+
+            const int key = galaxies[p].mergeIntoID - *numgals;
+            XRETURN(key >= 0 && key < ngal, EXIT_FAILURE,
+                    "Error: For galaxy = %d expected mergeIntoID = %d to be within [%d, %d)\n",
+                    p, galaxies[p].mergeIntoID, *numgals, *numgals + ngal);
+
+            int offset = 0;
+            for(int k = key; k > 0; k -= (k & -k)) {
+                offset += nmerged_below[k];
+            }
+            for(int k = key + 1; k <= ngal; k += (k & -k)) {
+                nmerged_below[k]++;
+            }
+
+            galaxies[p].mergeIntoID -= offset;  // these galaxies won't be kept so offset mergeIntoID
+        }
+
+        rewind_arena(arena, &offset_mark);
+    }
+
     // Attach final galaxy list to halo
     for(int p = 0, currenthalo = -1; p < ngal; p++) {
         if(galaxies[p].HaloNr != currenthalo) {
@@ -438,45 +684,23 @@ int evolve_galaxies(const int halonr, const int ngal, int *numgals, int *maxgals
             haloaux[currenthalo].NGalaxies = 0;
         }
 
-        // Merged galaxies won't be output. So go back through its history and find it
-        // in the previous timestep. Then copy the current merger info there.
-        int offset = 0;
-        int i = p-1;
-        while(i >= 0) {
-            if(galaxies[i].mergeType > 0) {
-                if(galaxies[p].mergeIntoID > galaxies[i].mergeIntoID) {
-                    offset++;  // these galaxies won't be kept so offset mergeIntoID below
-                }
-            }
-
-            i--;
-        }
-
-        i = -1;
+        // Merged galaxies won't be output. So find the galaxy in the previous timestep
+        // (where it was copied from) and copy the current merger info there.
         if(galaxies[p].mergeType > 0) {
-            i = haloaux[currenthalo].FirstGalaxy - 1;
-            while(i >= 0) {
-                if(halogal[i].GalaxyNr == galaxies[p].GalaxyNr) {
-                    break;
-                }
-
-                i--;
-            }
-
-            XRETURN(i >= 0, EXIT_FAILURE, "Error: This should not happen - i=%d should be >=0", i);
+            const int i = galaxies[p].HaloGalIndex;
+            XRETURN(i >= 0 && i < haloaux[currenthalo].FirstGalaxy && halogal[i].GalaxyNr == galaxies[p].GalaxyNr,
+                    EXIT_FAILURE, "Error: This should not happen - i=%d should be >=0 and contain GalaxyNr = %d\n",
+                    i, galaxies[p].GalaxyNr);
 
             halogal[i].mergeType = galaxies[p].mergeType;
-            halogal[i].mergeIntoID = galaxies[p].mergeIntoID - offset;
+            halogal[i].mergeIntoID = galaxies[p].mergeIntoID;
             halogal[i].mergeIntoSnapNum = halos[currenthalo].SnapNum;
         }
 
         if(galaxies[p].mergeType == 0) {
             /* realloc if needed */
             if(*numgals == (*maxgals - 1)) {
-                *maxgals += 10000;
-
-                *ptr_to_galaxies = myrealloc(*ptr_to_galaxies, *maxgals * sizeof(struct GALAXY));
-                *ptr_to_halogal  = myrealloc(*ptr_to_halogal, *maxgals * sizeof(struct GALAXY));
+                grow_galaxy_arrays(maxgals, ptr_to_galaxies, ptr_to_halogal, arena);
                 galaxies = *ptr_to_galaxies;
                 halogal = *ptr_to_halogal;
             }
@@ -5,11 +5,23 @@ extern "C" {
 #endif
 
 #include "core_allvars.h"
+#include "core_mymalloc.h"
+
+    /* State of one halo during the (depth-first) traversal in construct_galaxies. Every halo is
+       pushed at most once per forest, so a stack of nhalos frames (allocated once per forest) always suffices */
+    struct construct_frame
+    {
+        int halonr;
+        int stage;/* one of the CONSTRUCT_* stages in core_build_model.c */
+        int prog;/* next progenitor to visit */
+        int fofhalo;/* FOF halo whose progenitors are being visited */
+    };
 
     /* functions in core_build_model.c */
     extern int construct_galaxies(const int halonr, int *numgals, int *galaxycounter, int *maxgals, struct halo_data *halos,
                                   struct halo_aux_data *haloaux, struct GALAXY **ptr_to_galaxies, struct GALAXY **ptr_to_halogal,
-                                  struct params *run_params);
+                                  struct construct_frame *stack, const int maxstack,
+                                  struct sage_arena *arena, struct params *run_params);
 
 #ifdef __cplusplus
 }
@@ -24,7 +24,7 @@ static char *name[] = {
 
 
 // Metallicies with repect to solar. Will be converted to absolut metallicities by adding log10(Z_sun), Zsun=0.02
-static double metallicities[8] = {
+static const double solar_metallicities[8] = {
 	-5.0,   // actually primordial -> -infinity
 	-3.0,
 	-2.0,
@@ -36,18 +36,36 @@ static double metallicities[8] = {
 };
 
 double get_rate(int tab, double logTemp);
+static void init_cooling_rate_slopes(void);
+static inline int get_temperature_index(double *logTemp);
+static inline int get_metallicity_bin(double *logZ);
+static inline double interpolate_cooling_rate(const int tab, const int index, const double dlogT, const double logZ);
 
-#define NUM_METALS_TABLE        sizeof(metallicities)/sizeof(metallicities[0])
+#define NUM_METALS_TABLE        sizeof(solar_metallicities)/sizeof(solar_metallicities[0])
+#define LAST_METAL_BIN          (int) (NUM_METALS_TABLE - 2)
+
+/* number of galaxies that get_metaldependent_cooling_rates() processes per pass */
+#define COOLING_RATES_CHUNK     64
+
+/* The absolute metallicities of the tables. Set (not shifted) from solar_metallicities
+   so that every library context that re-reads the cooling functions sees the same tables */
+static double metallicities[NUM_METALS_TABLE];
 
 static double CoolRate[NUM_METALS_TABLE][TABSIZE];
 
+/* The slope (in log-space) between consecutive temperatures of each table, i.e.,
+   (CoolRate[tab][index + 1] - CoolRate[tab][index])/dlogT. This is exactly the
+   product evaluated by the interpolation in get_rate() and hence the rates are
+   unchanged */
+static double CoolRateSlope[NUM_METALS_TABLE][LAST_TAB_INDEX];
+
 void read_cooling_functions(void)
 {
     char buf[MAX_STRING_LEN];
 
     const double log10_zerop02 = log10(0.02);
     for(size_t i = 0; i < NUM_METALS_TABLE; i++) {
-        metallicities[i] += log10_zerop02;     // add solar metallicity
+        metallicities[i] = solar_metallicities[i] + log10_zerop02;     // add solar metallicity
     }
 
     for(size_t i = 0; i < NUM_METALS_TABLE; i++) {
@@ -75,54 +93,128 @@ void read_cooling_functions(void)
         fclose(fd);
     }
 
+    init_cooling_rate_slopes();
 }
 
 
-double get_rate(int tab, double logTemp)
+static void init_cooling_rate_slopes(void)
 {
-    const double dlogT = 0.05;
-    const double inv_dlogT = 1.0/dlogT;
-
-    if(logTemp < 4.0) {
-        logTemp = 4.0;
+    const double inv_dlogT = 1.0/0.05;
+    for(size_t i = 0; i < NUM_METALS_TABLE; i++) {
+        for(int n = 0; n < LAST_TAB_INDEX; n++) {
+            CoolRateSlope[i][n] = (CoolRate[i][n + 1] - CoolRate[i][n]) * inv_dlogT;
+        }
     }
+}
 
-    int index = (int) ((logTemp - 4.0) * inv_dlogT);
-    if(index >= LAST_TAB_INDEX) {
-        /*MS: because index+1 is also accessed, therefore index can be at most LAST_TAB_INDEX */
-        index = LAST_TAB_INDEX - 1;
-    }
 
-    const double logTindex = 4.0 + 0.05 * index;
+/* Clamps logTemp to the table and returns the index of the temperature node below it */
+static inline int get_temperature_index(double *logTemp)
+{
+    const double inv_dlogT = 1.0/0.05;
 
-    const double rate1 = CoolRate[tab][index];
-    const double rate2 = CoolRate[tab][index + 1];
+    if(*logTemp < 4.0) {
+        *logTemp = 4.0;
+    }
 
-    const double rate = rate1 + (rate2 - rate1) * inv_dlogT * (logTemp - logTindex);
+    const int index = (int) ((*logTemp - 4.0) * inv_dlogT);
 
-    return rate;
+    /*MS: because index+1 is also accessed, therefore index can be at most LAST_TAB_INDEX */
+    return index >= LAST_TAB_INDEX ? LAST_TAB_INDEX - 1:index;
 }
 
-double get_metaldependent_cooling_rate(const double logTemp, double logZ)  // pass: log10(temperatue/Kelvin), log10(metallicity)
+
+/* Clamps logZ to the tables and returns the table i such that metallicities[i] < logZ <= metallicities[i + 1]
+   (the same table as a search from the lowest metallicity). Above [Z/H] = -2, the tables are spaced by
+   0.5 dex and the table is computed directly; the final comparisons only guard against round-off */
+static inline int get_metallicity_bin(double *logZ)
 {
-    if(logZ < metallicities[0])
-        logZ = metallicities[0];
+    if(*logZ < metallicities[0]) {
+        *logZ = metallicities[0];
+    }
+    if(*logZ > metallicities[LAST_METAL_BIN + 1]) {
+        *logZ = metallicities[LAST_METAL_BIN + 1];
+    }
 
-    if(logZ > metallicities[7])
-        logZ = metallicities[7];
+    if(*logZ <= metallicities[2]) {
+        return *logZ <= metallicities[1] ? 0:1;
+    }
 
-    int i = 0;
-    while(logZ > metallicities[i + 1]) {
+    int i = 2 + (int) ((*logZ - metallicities[2]) * 2.0);
+    if(i > LAST_METAL_BIN) {
+        i = LAST_METAL_BIN;
+    }
+    if(*logZ <= metallicities[i]) {
+        i--;
+    } else if(i < LAST_METAL_BIN && *logZ > metallicities[i + 1]) {
         i++;
     }
 
+    return i;
+}
+
+
+/* The log10 of the cooling rate, interpolated in temperature within the tables 'tab' and 'tab + 1' and then
+   between their two metallicities. dlogT is the offset of log10(temperature) from the node 'index' */
+static inline double interpolate_cooling_rate(const int tab, const int index, const double dlogT, const double logZ)
+{
+    const double rate1 = CoolRate[tab][index] + CoolRateSlope[tab][index] * dlogT;
+    const double rate2 = CoolRate[tab + 1][index] + CoolRateSlope[tab + 1][index] * dlogT;
+
+    return rate1 + (rate2 - rate1) / (metallicities[tab + 1] - metallicities[tab]) * (logZ - metallicities[tab]);
+}
+
+
+double get_rate(int tab, double logTemp)
+{
+    const int index = get_temperature_index(&logTemp);
+    const double logTindex = 4.0 + 0.05 * index;
+
+    const double rate = CoolRate[tab][index] + CoolRateSlope[tab][index] * (logTemp - logTindex);
+
+    return rate;
+}
+
+double get_metaldependent_cooling_rate(double logTemp, double logZ)  // pass: log10(temperatue/Kelvin), log10(metallicity)
+{
+    const int index = get_temperature_index(&logTemp);
+    const int i = get_metallicity_bin(&logZ);
+
     // look up at i and i+1
-    const double rate1 = get_rate(i, logTemp);
-    const double rate2 = get_rate(i + 1, logTemp);
-    const double rate = rate1 + (rate2 - rate1) / (metallicities[i + 1] - metallicities[i]) * (logZ - metallicities[i]);
+    const double rate = interpolate_cooling_rate(i, index, logTemp - (4.0 + 0.05 * index), logZ);
 
     return pow(10.0, rate);
 }
 
 
+/* Evaluates get_metaldependent_cooling_rate() for n galaxies at once. The table indices for a chunk of galaxies
+   are found first, so that the interpolation and the exponentiation run as separate loops without any searches
+   (the rates are identical to the ones from the single-galaxy function) */
+void get_metaldependent_cooling_rates(const int32_t n, const double *logTemp, const double *logZ, double *rates)
+{
+    int tindex[COOLING_RATES_CHUNK], zbin[COOLING_RATES_CHUNK];
+    double dlogT[COOLING_RATES_CHUNK], clamped_logZ[COOLING_RATES_CHUNK];
+
+    for(int32_t start = 0; start < n; start += COOLING_RATES_CHUNK) {
+        const int32_t nchunk = n - start < COOLING_RATES_CHUNK ? n - start:COOLING_RATES_CHUNK;
+
+        for(int32_t k = 0; k < nchunk; k++) {
+            double logT = logTemp[start + k];
+            tindex[k] = get_temperature_index(&logT);
+            dlogT[k] = logT - (4.0 + 0.05 * tindex[k]);
+        }
+
+        for(int32_t k = 0; k < nchunk; k++) {
+            clamped_logZ[k] = logZ[start + k];
+            zbin[k] = get_metallicity_bin(&clamped_logZ[k]);
+        }
 
+        for(int32_t k = 0; k < nchunk; k++) {
+            rates[start + k] = interpolate_cooling_rate(zbin[k], tindex[k], dlogT[k], clamped_logZ[k]);
+        }
+
+        for(int32_t k = 0; k < nchunk; k++) {
+            rates[start + k] = pow(10.0, rates[start + k]);
+        }
+    }
+}
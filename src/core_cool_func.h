@@ -1,12 +1,15 @@
 #pragma once
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
     /* functions in core_cool_func.c */
     extern void read_cooling_functions(void);
-    extern double get_metaldependent_cooling_rate(const double logTemp, double logZ);
+    extern double get_metaldependent_cooling_rate(double logTemp, double logZ);
+    extern void get_metaldependent_cooling_rates(const int32_t n, const double *logTemp, const double *logZ, double *rates);
 
 #ifdef __cplusplus
 }
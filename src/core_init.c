@@ -16,6 +16,9 @@
 #include "core_mymalloc.h"
 #include "core_cool_func.h"
 
+#include "model_misc.h"
+#include "model_infall.h"
+
 
 /* These functions do not need to be exposed externally */
 double integrand_time_to_present(const double a, void *param);
@@ -45,8 +48,11 @@ void init(struct params *run_params)
         run_params->Age[i] = time_to_present(run_params->ZZ[i], run_params);
     }
 
-    run_params->a0 = 1.0 / (1.0 + run_params->Reionization_z0);
-    run_params->ar = 1.0 / (1.0 + run_params->Reionization_zr);
+    for(int i = 0; i < run_params->Snaplistlen; i++) {
+        run_params->VirialRadiusFac[i] = get_virial_radius_factor(run_params->ZZ[i], run_params);
+    }
+
+    init_recipe_quantities(run_params);
 
     read_cooling_functions();
 #ifdef VERBOSE
@@ -58,6 +64,22 @@ void init(struct params *run_params)
 
 
 
+/* Computes everything that depends on the recipe parameters. Since the recipe parameters
+   can change between repeated runs, this is called at the start of every run */
+void init_recipe_quantities(struct params *run_params)
+{
+    run_params->EnergySNcode = run_params->EnergySN / run_params->UnitEnergy_in_cgs * run_params->Hubble_h;
+    run_params->EtaSNcode = run_params->EtaSN * (run_params->UnitMass_in_g / SOLAR_MASS) / run_params->Hubble_h;
+
+    run_params->a0 = 1.0 / (1.0 + run_params->Reionization_z0);
+    run_params->ar = 1.0 / (1.0 + run_params->Reionization_zr);
+
+    for(int i = 0; i < run_params->Snaplistlen; i++) {
+        run_params->ReionizationMass[i] = get_reionization_mass_scale(run_params->ZZ[i], run_params);
+    }
+}
+
+
 void set_units(struct params *run_params)
 {
 
@@ -69,9 +91,6 @@ void set_units(struct params *run_params)
     run_params->UnitCoolingRate_in_cgs = run_params->UnitPressure_in_cgs / run_params->UnitTime_in_s;
     run_params->UnitEnergy_in_cgs = run_params->UnitMass_in_g * SQR(run_params->UnitLength_in_cm) / SQR(run_params->UnitTime_in_s);
 
-    run_params->EnergySNcode = run_params->EnergySN / run_params->UnitEnergy_in_cgs * run_params->Hubble_h;
-    run_params->EtaSNcode = run_params->EtaSN * (run_params->UnitMass_in_g / SOLAR_MASS) / run_params->Hubble_h;
-
     // convert some physical input parameters to internal units
     run_params->Hubble = HUBBLE * run_params->UnitTime_in_s;
 
@@ -6,6 +6,7 @@ extern "C" {
 
     /* functions in core_init.c */
     extern void init(struct params *run_params);
+    extern void init_recipe_quantities(struct params *run_params);
 
 #ifdef __cplusplus
 }
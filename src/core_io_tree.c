@@ -12,6 +12,7 @@
 #include "core_mymalloc.h"
 #include "core_io_tree.h"
 
+#include "io/forest_utils.h"
 #include "io/read_tree_lhalo_binary.h"
 #include "io/read_tree_consistentrees_ascii.h"
 
@@ -37,6 +38,16 @@ int setup_forests_io(struct params *run_params, struct forest_info *forests_info
     run_params->ForestNr_Mulfac = -1;
     forests_info->frac_volume_processed = -1.0;
 
+    /* Replace the guessed cost of each forest with the one fitted to the timings from a previous run
+       (before the forests are distributed over the tasks) */
+    if(run_params->ForestTimingsFromRun[0] != '\0') {
+        status = fit_forest_cost_exponent(run_params->ForestTimingsFromRun, ThisTask, &(run_params->Exponent_Forest_Dist_Scheme));
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+        run_params->ForestDistributionScheme = generic_power_in_nhalos;
+    }
+
     switch (TreeType)
         {
 #ifdef HDF5
@@ -142,14 +153,114 @@ void cleanup_forests_io(enum Valid_TreeTypes TreeType, struct forest_info *fores
     }
 
     // Finally, things that are common across forest types.
+    cleanup_resident_forests(forests_info);
     free(forests_info->FileNr);
     free(forests_info->original_treenr);
 
     return;
 }
 
+/* Keeps the forests loaded during the first of a series of repeated runs in memory (up to 'max_mb' MB,
+   or all of them when 'max_mb' is -1). Must be called after setup_forests_io */
+int setup_resident_forests(const double max_mb, struct forest_info *forests_info)
+{
+    const int64_t nforests = forests_info->nforests_this_task;
+    struct resident_forests *resident = calloc(1, sizeof(*resident));
+    CHECK_POINTER_AND_RETURN_ON_NULL(resident, "Failed to allocate %zu bytes for the resident forests", sizeof(*resident));
+
+    resident->nforests = nforests;
+    resident->max_nbytes = max_mb < 0 ? SIZE_MAX:(size_t) (max_mb * 1024.0 * 1024.0);
+    if(nforests > 0) {
+        resident->halos = calloc(nforests, sizeof(resident->halos[0]));
+        resident->nhalos = calloc(nforests, sizeof(resident->nhalos[0]));
+        if(resident->halos == NULL || resident->nhalos == NULL) {
+            fprintf(stderr,"Error: Failed to allocate %"PRId64" elements for the resident forests\n", nforests);
+            free(resident->halos);
+            free(resident->nhalos);
+            free(resident);
+            return MALLOC_FAILURE;
+        }
+    }
+    forests_info->resident = resident;
+
+    return EXIT_SUCCESS;
+}
+
+
+void cleanup_resident_forests(struct forest_info *forests_info)
+{
+    struct resident_forests *resident = forests_info->resident;
+    if(resident == NULL) {
+        return;
+    }
+
+#ifdef VERBOSE
+    int64_t nresident = 0;
+    for(int64_t i=0;i<resident->nforests;i++) {
+        nresident += resident->halos[i] != NULL;
+    }
+    fprintf(stderr,"Kept %"PRId64" (out of %"PRId64") forests in memory, using %.2f MB\n",
+            nresident, resident->nforests, resident->nbytes/(1024.0*1024.0));
+#endif
+
+    for(int64_t i=0;i<resident->nforests;i++) {
+        free(resident->halos[i]);
+    }
+    free(resident->halos);
+    free(resident->nhalos);
+    free(resident);
+    forests_info->resident = NULL;
+}
+
+
+/* Keeps a copy of a freshly loaded forest, if it fits within the memory budget. The copy is
+   allocated outside of mymalloc since it lives until the end of all the runs */
+static void make_forest_resident(const int64_t forestnr, const int64_t nhalos, const struct halo_data *halos,
+                                 struct resident_forests *resident)
+{
+    if(forestnr < 0 || forestnr >= resident->nforests || resident->halos[forestnr] != NULL) {
+        return;
+    }
+
+    const size_t nbytes = nhalos * sizeof(halos[0]);
+    int fits;
+#ifdef OPENMP
+#pragma omp critical (sage_resident_forests)
+#endif
+    {
+        fits = nbytes <= resident->max_nbytes - resident->nbytes;
+        if(fits) {
+            resident->nbytes += nbytes;
+        }
+    }
+    if( ! fits) {
+        return;
+    }
+
+    struct halo_data *copy = malloc(nbytes);
+    if(copy == NULL) {
+        /* not an error -> the forest will simply be read again in the next run */
+#ifdef OPENMP
+#pragma omp critical (sage_resident_forests)
+#endif
+        {
+            resident->nbytes -= nbytes;
+        }
+        return;
+    }
+    memcpy(copy, halos, nbytes);
+    resident->nhalos[forestnr] = nhalos;
+    resident->halos[forestnr] = copy;
+}
+
+
 int64_t load_forest(struct params *run_params, const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
 {
+    struct resident_forests *resident = forests_info->resident;
+    if(resident != NULL && forestnr >= 0 && forestnr < resident->nforests && resident->halos[forestnr] != NULL) {
+        *halos = resident->halos[forestnr];
+        return resident->nhalos[forestnr];
+    }
 
     int64_t nhalos;
     const enum Valid_TreeTypes TreeType = run_params->TreeType;
@@ -190,5 +301,33 @@ int64_t load_forest(struct params *run_params, const int64_t forestnr, struct ha
         return -EXIT_FAILURE;
     }
 
+    if(resident != NULL && nhalos > 0) {
+        make_forest_resident(forestnr, nhalos, *halos, resident);
+    }
+
     return nhalos;
 }
+
+
+/* Releases the halos returned by load_forest */
+void unload_forest(struct params *run_params, const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
+{
+    /* A resident forest is only released at the end of all the runs */
+    const struct resident_forests *resident = forests_info->resident;
+    if(resident != NULL && forestnr >= 0 && forestnr < resident->nforests && *halos == resident->halos[forestnr]) {
+        *halos = NULL;
+        return;
+    }
+
+    switch (run_params->TreeType) {
+
+    case lhalo_binary:
+        unload_forest_lht_binary(forestnr, halos, forests_info);
+        break;
+
+    default:
+        myfree(*halos);
+        *halos = NULL;
+        break;
+    }
+}
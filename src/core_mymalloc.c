@@ -14,11 +14,48 @@ static size_t SizeTable[MAXBLOCKS];
 static size_t TotMem = 0, HighMarkMem = 0, OldPrintedHighMark = 0;
 
 /* file-local function */
+static void *mymalloc_serial(size_t n);
+static void *myrealloc_serial(void *p, size_t n);
+static void myfree_serial(void *p);
 long find_block(const void *p);
 size_t get_aligned_memsize(size_t n);
 void set_and_print_highwater_mark(void);
 
+/* The allocation table is shared by all threads (when compiled with OpenMP),
+   so every update to the table is serialised via a named critical section */
 void *mymalloc(size_t n)
+{
+    void *p;
+#ifdef OPENMP
+#pragma omp critical (sage_mymalloc)
+#endif
+    p = mymalloc_serial(n);
+
+    return p;
+}
+
+void *myrealloc(void *p, size_t n)
+{
+    void *newp;
+#ifdef OPENMP
+#pragma omp critical (sage_mymalloc)
+#endif
+    newp = myrealloc_serial(p, n);
+
+    return newp;
+}
+
+void myfree(void *p)
+{
+    if(p == NULL) return;
+
+#ifdef OPENMP
+#pragma omp critical (sage_mymalloc)
+#endif
+    myfree_serial(p);
+}
+
+static void *mymalloc_serial(size_t n)
 {
     n = get_aligned_memsize(n);
 
@@ -69,7 +106,7 @@ long find_block(const void *p)
 }
 
 
-void *myrealloc(void *p, size_t n)
+static void *myrealloc_serial(void *p, size_t n)
 {
     n = get_aligned_memsize(n);
 
@@ -97,10 +134,8 @@ void *myrealloc(void *p, size_t n)
 }
 
 
-void myfree(void *p)
+static void myfree_serial(void *p)
 {
-    if(p == NULL) return;
-
     XASSERT(Nblocks > 0, -1,
             "Error: While trying to free the pointer at address = %p, "
             "expected Nblocks = %ld to be larger than 0", p, Nblocks);
@@ -167,3 +202,216 @@ void set_and_print_highwater_mark(void)
     }
     return;
 }
+
+
+/*
+  Arena allocator for the per-forest working memory
+
+  The chunks are obtained directly via malloc (i.e., they do not take up entries
+  in the mymalloc table, so the number of arenas is not limited by MAXBLOCKS) but
+  are still accounted for in the global high-water mark. The individual allocations
+  are only a pointer bump
+  within the current chunk. Each allocation is preceded by a small header that
+  stores the allocation size, so that the most recent allocation can be grown in
+  place and any other allocation can be (copy) re-allocated. An arena is only ever
+  used by one thread at a time and does not need any locking.
+*/
+#define ARENA_ALIGNMENT        (16)
+#define ARENA_HEADER_SIZE      (ARENA_ALIGNMENT)
+#define ARENA_MIN_CHUNK_SIZE   (4 * 1024 * 1024)
+
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;/* number of usable bytes in data[] */
+    size_t used;/* number of bytes already handed out from data[] */
+    size_t padding;/* keeps data[] aligned to ARENA_ALIGNMENT */
+    char data[];
+};
+
+/* Accounts for memory that is allocated outside of the mymalloc table */
+static void update_untabled_memory(const size_t nbytes, const int allocated)
+{
+#ifdef OPENMP
+#pragma omp critical (sage_mymalloc)
+#endif
+    {
+        if(allocated) {
+            TotMem += nbytes;
+            set_and_print_highwater_mark();
+        } else {
+            TotMem -= nbytes;
+        }
+    }
+}
+
+static inline size_t get_arena_aligned_size(const size_t n)
+{
+    return n == 0 ? ARENA_ALIGNMENT : ((n + ARENA_ALIGNMENT - 1)/ARENA_ALIGNMENT) * ARENA_ALIGNMENT;
+}
+
+static void add_arena_chunk(struct sage_arena *arena, const size_t min_size)
+{
+    /* Geometric growth -> doubles the capacity of the arena every time a new chunk is required */
+    size_t chunk_size = arena->capacity > ARENA_MIN_CHUNK_SIZE ? arena->capacity:ARENA_MIN_CHUNK_SIZE;
+    if(chunk_size < min_size) chunk_size = min_size;
+
+    const size_t nbytes = sizeof(struct arena_chunk) + chunk_size;
+    struct arena_chunk *chunk = malloc(nbytes);
+    if(chunk == NULL) {
+        fprintf(stderr, "Failed to allocate memory for %g MB for an arena chunk\n", nbytes / (1024.0 * 1024.0));
+        ABORT(MALLOC_FAILURE);
+    }
+    update_untabled_memory(nbytes, 1);
+
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->capacity += chunk_size;
+}
+
+static void free_arena_chunks(struct sage_arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    while(chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        update_untabled_memory(sizeof(*chunk) + chunk->size, 0);
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->capacity = 0;
+}
+
+void init_arena(struct sage_arena *arena)
+{
+    memset(arena, 0, sizeof(*arena));
+}
+
+void *arena_malloc(struct sage_arena *arena, size_t n)
+{
+    n = get_arena_aligned_size(n);
+    const size_t nbytes = n + ARENA_HEADER_SIZE;
+
+    struct arena_chunk *chunk = arena->chunks;
+    if(chunk == NULL || (chunk->size - chunk->used) < nbytes) {
+        add_arena_chunk(arena, nbytes);
+        chunk = arena->chunks;
+    }
+
+    char *block = chunk->data + chunk->used;
+    *((size_t *) block) = n;
+    chunk->used += nbytes;
+
+    arena->last_alloc = block + ARENA_HEADER_SIZE;
+    arena->curr_bytes += nbytes;
+    if(arena->curr_bytes > arena->peak_bytes) {
+        arena->peak_bytes = arena->curr_bytes;
+    }
+
+    return arena->last_alloc;
+}
+
+void *arena_realloc(struct sage_arena *arena, void *p, size_t n)
+{
+    if(p == NULL) {
+        return arena_malloc(arena, n);
+    }
+
+    n = get_arena_aligned_size(n);
+    size_t *oldsize = (size_t *) ((char *) p - ARENA_HEADER_SIZE);
+    if(n <= *oldsize) {
+        return p;
+    }
+
+    /* The most recent allocation can be grown in place if there is space left in the chunk */
+    struct arena_chunk *chunk = arena->chunks;
+    const size_t extra = n - *oldsize;
+    if(p == arena->last_alloc && (chunk->size - chunk->used) >= extra) {
+        chunk->used += extra;
+        *oldsize = n;
+        arena->curr_bytes += extra;
+        if(arena->curr_bytes > arena->peak_bytes) {
+            arena->peak_bytes = arena->curr_bytes;
+        }
+        return p;
+    }
+
+    /* Otherwise copy into a new block. The old block is only reclaimed when the arena is reset */
+    void *newp = arena_malloc(arena, n);
+    memcpy(newp, p, *oldsize);
+    return newp;
+}
+
+struct arena_mark get_arena_mark(const struct sage_arena *arena)
+{
+    struct arena_mark mark;
+    mark.chunk = arena->chunks;
+    mark.last_alloc = arena->last_alloc;
+    mark.used = arena->chunks != NULL ? arena->chunks->used:0;
+    mark.curr_bytes = arena->curr_bytes;
+    return mark;
+}
+
+void rewind_arena(struct sage_arena *arena, const struct arena_mark *mark)
+{
+    if(arena->chunks == NULL) {
+        return;
+    }
+
+    if(arena->chunks == mark->chunk) {
+        arena->chunks->used = mark->used;
+        arena->last_alloc = mark->last_alloc;
+    } else {
+        /* A new chunk was added after the mark -> the new chunk only contains allocations made
+           after the mark. The unused tail of the previous chunk is reclaimed at the next reset */
+        arena->chunks->used = 0;
+        arena->last_alloc = NULL;
+    }
+    arena->curr_bytes = mark->curr_bytes;
+}
+
+void reset_arena(struct sage_arena *arena)
+{
+    /* If the previous forest required multiple chunks, then replace them with
+       a single chunk that is large enough to hold all of the previous forest */
+    if(arena->chunks != NULL && arena->chunks->next != NULL) {
+        const size_t capacity = arena->capacity;
+        free_arena_chunks(arena);
+        add_arena_chunk(arena, capacity);
+    }
+
+    if(arena->chunks != NULL) {
+        arena->chunks->used = 0;
+    }
+    arena->last_alloc = NULL;
+    arena->curr_bytes = 0;
+    arena->nresets++;
+}
+
+void free_arena(struct sage_arena *arena)
+{
+    free_arena_chunks(arena);
+    arena->last_alloc = NULL;
+    arena->curr_bytes = 0;
+}
+
+void print_arena_usage(const struct sage_arena *arena, const char *name)
+{
+#ifdef VERBOSE
+    size_t highmark;
+#ifdef OPENMP
+#pragma omp critical (sage_mymalloc)
+#endif
+    highmark = HighMarkMem;
+
+    fprintf(stderr, "\nArena `%s`: peak usage = %g MB with capacity = %g MB over %"PRId64" forests. "
+            "Overall high mark = %g MB\n", name, arena->peak_bytes / (1024.0 * 1024.0),
+            arena->capacity / (1024.0 * 1024.0), arena->nresets, highmark / (1024.0 * 1024.0));
+#else
+    (void) arena;
+    (void) name;
+#endif
+    return;
+}
@@ -4,6 +4,33 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
+    /* A bump (arena) allocator that holds all of the per-forest working memory.
+       Allocations are never freed individually; instead, the entire arena is reset
+       once the forest has been saved and the memory is reused for the next forest */
+    struct arena_chunk;
+    struct sage_arena
+    {
+        struct arena_chunk *chunks;/* linked list of chunks, the first chunk is the one being allocated from */
+        void *last_alloc;/* most recent allocation -> can be grown (or released) in place */
+        size_t curr_bytes;/* bytes currently handed out (including abandoned blocks after a realloc) */
+        size_t peak_bytes;/* largest value of curr_bytes since init */
+        size_t capacity;/* total bytes in all chunks */
+        int64_t nresets;/* number of times the arena has been reset (i.e., number of forests processed) */
+    };
+
+    /* Position within an arena -> every allocation made after the mark can be released at once
+       with rewind_arena (used for the short-lived scratch space within a forest) */
+    struct arena_mark
+    {
+        struct arena_chunk *chunk;
+        void *last_alloc;
+        size_t used;
+        size_t curr_bytes;
+    };
+
     /* functions in core_mymalloc.c */
     extern void *mymalloc(size_t n);
     extern void *mycalloc(const size_t count, const size_t size);
@@ -13,6 +40,15 @@ extern "C" {
     extern void print_allocated(void);
 #endif
 
+    extern void init_arena(struct sage_arena *arena);
+    extern void *arena_malloc(struct sage_arena *arena, size_t n);
+    extern void *arena_realloc(struct sage_arena *arena, void *p, size_t n);
+    extern struct arena_mark get_arena_mark(const struct sage_arena *arena);
+    extern void rewind_arena(struct sage_arena *arena, const struct arena_mark *mark);
+    extern void reset_arena(struct sage_arena *arena);
+    extern void free_arena(struct sage_arena *arena);
+    extern void print_arena_usage(const struct sage_arena *arena, const char *name);
+
 #ifdef __cplusplus
 }
 #endif
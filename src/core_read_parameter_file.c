@@ -3,9 +3,11 @@
 #include <string.h>
 #include <math.h>
 #include <ctype.h> /* for isblank()*/
+#include <stddef.h> /* for offsetof() */
 
 #include "core_allvars.h"
 #include "core_mymalloc.h"
+#include "io/save_gals_binary.h"
 
 enum datatypes {
     DOUBLE = 1,
@@ -31,11 +33,46 @@ int compare_ints_descending (const void* p1, const void* p2)
     }
  }
 
+/* Reads the parameters either from the file 'fname' (when 'keys' is NULL) or from the 'nparams' key-value
+   pairs. In the latter case, 'fname' is only used to describe the source of the parameters in the error messages */
+static int parse_parameters(const char *fname, const int nparams, const char * const *keys, const char * const *values,
+                            struct params *run_params);
+static int next_parameter_line(FILE *fd, const int nparams, const char * const *keys, const char * const *values,
+                               int *iparam, char *buffer);
+static int parse_output_snapshots(const char *snap_list, struct params *run_params);
+
 int read_parameter_file(const char *fname, struct params *run_params)
+{
+    return parse_parameters(fname, 0, NULL, NULL, run_params);
+}
+
+int read_parameter_keyvalues(const int nparams, const char * const *keys, const char * const *values, struct params *run_params)
+{
+    XRETURN(nparams >= 0 && (nparams == 0 || (keys != NULL && values != NULL)), EXIT_FAILURE,
+            "Error: Could not validate the key-value parameters. nparams = %d (must be >= 0) keys = %p values = %p\n",
+            nparams, keys, values);
+    for(int i=0;i<nparams;i++) {
+        XRETURN(keys[i] != NULL && values[i] != NULL, EXIT_FAILURE,
+                "Error: Parameter number %d (out of %d) has a NULL key (%p) or value (%p)\n", i, nparams, keys[i], values[i]);
+    }
+
+    return parse_parameters("<key-value parameters>", nparams, keys, values, run_params);
+}
+
+/* An invalid parameter is reported to the caller (rather than aborting), so that sage can also be used as a library
+   without killing the host process. Assumes 'used_tag' has been allocated */
+#define PARAMETER_ERROR(status) {               \
+        myfree(used_tag);                       \
+        return status;                          \
+    }
+
+static int parse_parameters(const char *fname, const int nparams, const char * const *keys, const char * const *values,
+                            struct params *run_params)
 {
     int errorFlag = 0;
     int *used_tag = 0;
     char my_treetype[MAX_STRING_LEN], my_outputformat[MAX_STRING_LEN], my_forest_dist_scheme[MAX_STRING_LEN];
+    char my_output_fields[MAX_STRING_LEN];
     /*  recipe parameters  */
     int NParam = 0;
     char ParamTag[MAXTAGS][MAXTAGLEN + 1];
@@ -233,19 +270,96 @@ int read_parameter_file(const char *fname, struct params *run_params)
     ParamAddr[NParam] = &(run_params->Exponent_Forest_Dist_Scheme);
     ParamID[NParam++] = DOUBLE;
 
+    /* Optional parameters (with default values) -> these must be listed after all the required parameters */
+    const int NRequiredParam = NParam;
+
+    run_params->DynamicForestScheduling = 0;/* default: every task processes a fixed range of forests */
+    strncpy(ParamTag[NParam], "DynamicForestScheduling", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->DynamicForestScheduling);
+    ParamID[NParam++] = INT;
+
+    run_params->ForestCacheDir[0] = '\0';/* default: do not cache the (post-processed) forests */
+    strncpy(ParamTag[NParam], "ForestCacheDir", MAXTAGLEN);
+    ParamAddr[NParam] = run_params->ForestCacheDir;
+    ParamID[NParam++] = STRING;
+
+    run_params->WriteForestTimings = 0;/* default: do not write the time taken by each forest */
+    strncpy(ParamTag[NParam], "WriteForestTimings", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->WriteForestTimings);
+    ParamID[NParam++] = INT;
+
+    run_params->ForestTimingsFromRun[0] = '\0';/* default: use the cost model from 'ForestDistributionScheme' as is */
+    strncpy(ParamTag[NParam], "ForestTimingsFromRun", MAXTAGLEN);
+    ParamAddr[NParam] = run_params->ForestTimingsFromRun;
+    ParamID[NParam++] = STRING;
+
+    run_params->CheckpointInterval = 0.0;/* default: never write a checkpoint */
+    strncpy(ParamTag[NParam], "CheckpointInterval", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->CheckpointInterval);
+    ParamID[NParam++] = DOUBLE;
+
+    run_params->RestartFromCheckpoint = 0;/* default: always start from the first forest */
+    strncpy(ParamTag[NParam], "RestartFromCheckpoint", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->RestartFromCheckpoint);
+    ParamID[NParam++] = INT;
+
+#ifdef USE_SAGE_IN_MCMC_MODE
+    run_params->ResidentForestsMB = -1.0;/* default in MCMC mode: keep all the forests in memory between runs */
+#else
+    run_params->ResidentForestsMB = 0.0;/* default: re-read the forests for every run */
+#endif
+    strncpy(ParamTag[NParam], "ResidentForestsMB", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->ResidentForestsMB);
+    ParamID[NParam++] = DOUBLE;
+
+    my_output_fields[0] = '\0';/* default: write all the fields */
+    strncpy(ParamTag[NParam], "OutputFields", MAXTAGLEN);
+    ParamAddr[NParam] = my_output_fields;
+    ParamID[NParam++] = STRING;
+
+    /* Filters and chunking for the datasets in the 'sage_hdf5' output */
+    run_params->HDF5DeflateLevel = 0;/* default: no compression */
+    strncpy(ParamTag[NParam], "HDF5DeflateLevel", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->HDF5DeflateLevel);
+    ParamID[NParam++] = INT;
+
+    run_params->HDF5Shuffle = 1;/* default: shuffle the bytes before compression (only used when compressing) */
+    strncpy(ParamTag[NParam], "HDF5Shuffle", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->HDF5Shuffle);
+    ParamID[NParam++] = INT;
+
+    run_params->HDF5Fletcher32 = 0;/* default: no checksums */
+    strncpy(ParamTag[NParam], "HDF5Fletcher32", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->HDF5Fletcher32);
+    ParamID[NParam++] = INT;
+
+    run_params->HDF5ChunkSize = 8192;/* default: number of galaxies per chunk */
+    strncpy(ParamTag[NParam], "HDF5ChunkSize", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->HDF5ChunkSize);
+    ParamID[NParam++] = INT;
+
+    run_params->HDF5SingleFile = 0;/* default: one file per task, linked together by the master file */
+    strncpy(ParamTag[NParam], "HDF5SingleFile", MAXTAGLEN);
+    ParamAddr[NParam] = &(run_params->HDF5SingleFile);
+    ParamID[NParam++] = INT;
+
     used_tag = mymalloc(sizeof(int) * NParam);
     for(int i=0; i<NParam; i++) {
         used_tag[i]=1;
     }
 
-    FILE *fd = fopen(fname, "r");
-    if (fd == NULL) {
-        fprintf(stderr,"Parameter file '%s' not found.\n", fname);
-        return FILE_NOT_FOUND;
+    FILE *fd = NULL;
+    if(keys == NULL) {
+        fd = fopen(fname, "r");
+        if (fd == NULL) {
+            fprintf(stderr,"Parameter file '%s' not found.\n", fname);
+            PARAMETER_ERROR(FILE_NOT_FOUND);
+        }
     }
 
     char buffer[MAX_STRING_LEN];
-    while(fgets(&(buffer[0]), MAX_STRING_LEN, fd) != NULL) {
+    int iparam = 0;
+    while(next_parameter_line(fd, nparams, keys, values, &iparam, buffer)) {
         char buf1[MAX_STRING_LEN], buf2[MAX_STRING_LEN];
         char fmt[MAX_STRING_LEN];
         snprintf(fmt, MAX_STRING_LEN, "%%%ds %%%ds[^\n]", MAX_STRING_LEN-1, MAX_STRING_LEN-1);
@@ -310,7 +424,9 @@ int read_parameter_file(const char *fname, struct params *run_params)
             errorFlag = 1;
         }
     }
-    fclose(fd);
+    if(fd != NULL) {
+        fclose(fd);
+    }
 
     const size_t outlen = strlen(run_params->OutputDir);
     if(outlen > 0) {
@@ -319,7 +435,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
     }
 
 
-    for(int i = 0; i < NParam; i++) {
+    for(int i = 0; i < NRequiredParam; i++) {
         if(used_tag[i]) {
             fprintf(stderr, "Error. I miss a value for tag '%s' in parameter file '%s'.\n", ParamTag[i], fname);
             errorFlag = 1;
@@ -327,7 +443,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
     }
 
     if(errorFlag) {
-        ABORT(1);
+        PARAMETER_ERROR(1);
     }
 #ifdef VERBOSE
     fprintf(stdout, "\n");
@@ -335,13 +451,13 @@ int read_parameter_file(const char *fname, struct params *run_params)
 
     if( ! (run_params->LastSnapshotNr+1 > 0 && run_params->LastSnapshotNr+1 < ABSOLUTEMAXSNAPS) ) {
         fprintf(stderr,"LastSnapshotNr = %d should be in [0, %d) \n", run_params->LastSnapshotNr, ABSOLUTEMAXSNAPS);
-        ABORT(1);
+        PARAMETER_ERROR(1);
     }
     run_params->SimMaxSnaps = run_params->LastSnapshotNr + 1;
 
     if(!(run_params->NumSnapOutputs == -1 || (run_params->NumSnapOutputs > 0 && run_params->NumSnapOutputs <= ABSOLUTEMAXSNAPS))) {
         fprintf(stderr,"NumOutputs must be -1 or between 1 and %i\n", ABSOLUTEMAXSNAPS);
-        ABORT(1);
+        PARAMETER_ERROR(1);
     }
 
     // read in the output snapshot list
@@ -355,6 +471,19 @@ int read_parameter_file(const char *fname, struct params *run_params)
             fprintf(stdout, "all %d snapshots selected for output\n", run_params->NumSnapOutputs);
         }
 #endif
+    } else if(keys != NULL) {
+        /* the output snapshots are the value of the "->" key (in the same format as in the parameter file) */
+        const char *snap_list = NULL;
+        for(int i=0;i<nparams;i++) {
+            if(strcmp(keys[i], "->") == 0) {
+                snap_list = values[i];
+            }
+        }
+        if(snap_list == NULL || parse_output_snapshots(snap_list, run_params) != EXIT_SUCCESS) {
+            fprintf(stderr,"Error: Could not properly parse output snapshots. Please supply the %d output snapshots "
+                    "as the value of the key '->'\n", run_params->NumSnapOutputs);
+            PARAMETER_ERROR(2);
+        }
     } else {
 #ifdef VERBOSE
         if(ThisTask == 0) {
@@ -364,6 +493,10 @@ int read_parameter_file(const char *fname, struct params *run_params)
 
         // reopen the parameter file
         fd = fopen(fname, "r");
+        if(fd == NULL) {
+            fprintf(stderr,"Error: Could not re-open the parameter file '%s' to read the output snapshots\n", fname);
+            PARAMETER_ERROR(FILE_NOT_FOUND);
+        }
 
         int done = 0;
         while(!feof(fd) && !done) {
@@ -390,7 +523,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
         fclose(fd);
         if(! done ) {
             fprintf(stderr,"Error: Could not properly parse output snapshots\n");
-            ABORT(2);
+            PARAMETER_ERROR(2);
         }
 #ifdef VERBOSE
         fprintf(stdout, "\n");
@@ -403,7 +536,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
                         "should be larger than   FirstFile.\nProbably a typo in the parameter-file. "
                         "Please change to appropriate values...exiting\n",
                         run_params->FirstFile, run_params->LastFile);
-        ABORT(EXIT_FAILURE);
+        PARAMETER_ERROR(EXIT_FAILURE);
     }
 
     /* sort the output snapshot numbers in descending order (in case the user didn't do that already) MS: 24th Oct, 2023 */
@@ -422,7 +555,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
     }
     if(num_dup_snaps != 0) {
         fprintf(stderr,"Error: Found %d duplicate snapshots - please remove them from the parameter file and then re-run sage\n\n", num_dup_snaps);
-        ABORT(EXIT_FAILURE);
+        PARAMETER_ERROR(EXIT_FAILURE);
     }
 
     /* because in the default case of 'lhalo-binary', nothing
@@ -438,7 +571,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
 #ifndef HDF5
         fprintf(stderr, "You have specified to use a HDF5 file but have not compiled with the HDF5 option enabled.\n");
         fprintf(stderr, "Please check your file type and compiler options.\n");
-        ABORT(EXIT_FAILURE);
+        PARAMETER_ERROR(EXIT_FAILURE);
 #endif
         // strncmp returns 0 if the two strings are equal.
         // only relevant options are HDF5 or binary files. Consistent-trees is *always* ascii (with different filename extensions)
@@ -460,7 +593,7 @@ int read_parameter_file(const char *fname, struct params *run_params)
             for(int i=0;i<num_enum_types;i++) {                         \
                 fprintf(stderr, #paramname " = '%s'\n", enum_names[i]); \
             }                                                           \
-            ABORT(EXIT_FAILURE);                                        \
+            PARAMETER_ERROR(EXIT_FAILURE);                                        \
         }                                                               \
  }
 
@@ -479,14 +612,14 @@ int read_parameter_file(const char *fname, struct params *run_params)
     if(strncmp(my_outputformat, "sage_hdf5", MAX_STRING_LEN-1) == 0) {
         fprintf(stderr, "You have specified to use HDF5 output format but have not compiled with the HDF5 option enabled.\n");
         fprintf(stderr, "Please check your file type and compiler options.\n");
-        ABORT(EXIT_FAILURE);
+        PARAMETER_ERROR(EXIT_FAILURE);
     }
 #endif
 
-    const char format_names[][MAXTAGLEN] = {"sage_binary", "sage_hdf5", "lhalo_binary_output"};
-    const enum Valid_OutputFormats format_enums[] = {sage_binary, sage_hdf5, lhalo_binary_output};
+    const char format_names[][MAXTAGLEN] = {"sage_binary", "sage_hdf5", "lhalo_binary_output", "sage_memory"};
+    const enum Valid_OutputFormats format_enums[] = {sage_binary, sage_hdf5, lhalo_binary_output, sage_memory};
     const int nvalid_format_types  = sizeof(format_names)/(MAXTAGLEN*sizeof(char));
-    XRETURN(nvalid_format_types == 3, EXIT_FAILURE, "nvalid_format_types = %d should have been 3\n", nvalid_format_types);
+    XRETURN(nvalid_format_types == 4, EXIT_FAILURE, "nvalid_format_types = %d should have been 4\n", nvalid_format_types);
     CHECK_VALID_ENUM_IN_PARAM_FILE(OutputFormat, nvalid_format_types, format_names, format_enums, my_outputformat);
 
     /* Check that the way forests are distributed over (MPI) tasks is valid */
@@ -507,12 +640,196 @@ int read_parameter_file(const char *fname, struct params *run_params)
         fprintf(stderr,"Error: You have requested a power-law exponent but the exponent = %e must be greater than 0\n",
                 run_params->Exponent_Forest_Dist_Scheme);
         fprintf(stderr,"Please change the value for the parameter 'ExponentForestDistributionScheme' in the parameter file (%s)\n", fname);
-        ABORT(EXIT_FAILURE);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+
+    if(run_params->WriteForestTimings != 0 && run_params->WriteForestTimings != 1) {
+        fprintf(stderr,"Error: WriteForestTimings = %d must be either 0 (no timings) or 1 (write the time taken by each forest)\n",
+                run_params->WriteForestTimings);
+        fprintf(stderr,"Please change the value for the parameter 'WriteForestTimings' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->DynamicForestScheduling != 0 && run_params->DynamicForestScheduling != 1) {
+        fprintf(stderr,"Error: DynamicForestScheduling = %d must be either 0 (fixed range of forests per task) or 1 (dynamic scheduling)\n",
+                run_params->DynamicForestScheduling);
+        fprintf(stderr,"Please change the value for the parameter 'DynamicForestScheduling' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->DynamicForestScheduling && run_params->OutputFormat != sage_hdf5) {
+        fprintf(stderr,"Error: DynamicForestScheduling is only supported for the 'sage_hdf5' output format\n");
+        fprintf(stderr,"Please change the value for the parameter 'DynamicForestScheduling' or 'OutputFormat' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+
+    if(run_params->CheckpointInterval < 0) {
+        fprintf(stderr,"Error: CheckpointInterval = %e (seconds between checkpoints) must be either 0 (no checkpoints) or positive\n",
+                run_params->CheckpointInterval);
+        fprintf(stderr,"Please change the value for the parameter 'CheckpointInterval' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->RestartFromCheckpoint != 0 && run_params->RestartFromCheckpoint != 1) {
+        fprintf(stderr,"Error: RestartFromCheckpoint = %d must be either 0 (start from scratch) or 1 (continue from the checkpoint)\n",
+                run_params->RestartFromCheckpoint);
+        fprintf(stderr,"Please change the value for the parameter 'RestartFromCheckpoint' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if((run_params->CheckpointInterval > 0 || run_params->RestartFromCheckpoint) && run_params->OutputFormat == sage_memory) {
+        fprintf(stderr,"Error: Checkpoints are not supported for the 'sage_memory' output format (nothing is written to disk)\n");
+        fprintf(stderr,"Please change the value for the parameter 'CheckpointInterval', 'RestartFromCheckpoint' or "
+                "'OutputFormat' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if((run_params->CheckpointInterval > 0 || run_params->RestartFromCheckpoint) && run_params->DynamicForestScheduling) {
+        fprintf(stderr,"Error: Checkpoints are not supported with DynamicForestScheduling (the forests on each task are only known at runtime)\n");
+        fprintf(stderr,"Please change the value for the parameter 'CheckpointInterval', 'RestartFromCheckpoint' or "
+                "'DynamicForestScheduling' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+
+    if(parse_output_fields(my_output_fields, &(run_params->OutputFieldsMask)) != EXIT_SUCCESS) {
+        fprintf(stderr,"Error: Could not parse OutputFields = '%s' (a comma separated list of the fields to write)\n",
+                my_output_fields);
+        fprintf(stderr,"Please change the value for the parameter 'OutputFields' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+
+    if(run_params->ResidentForestsMB < 0 && run_params->ResidentForestsMB != -1) {
+        fprintf(stderr,"Error: ResidentForestsMB = %e must be either -1 (keep all forests in memory), 0 (re-read the forests "
+                "for every run) or positive (the memory budget in MB)\n", run_params->ResidentForestsMB);
+        fprintf(stderr,"Please change the value for the parameter 'ResidentForestsMB' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->ResidentForestsMB != 0 && run_params->DynamicForestScheduling) {
+        fprintf(stderr,"Error: ResidentForestsMB = %e is not supported with DynamicForestScheduling (the forests on each task "
+                "change between runs)\n", run_params->ResidentForestsMB);
+        fprintf(stderr,"Please change the value for the parameter 'ResidentForestsMB' or 'DynamicForestScheduling' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+
+    /* Check the options for the hdf5 output (these are ignored for the other output formats) */
+    if(run_params->HDF5DeflateLevel < 0 || run_params->HDF5DeflateLevel > 9) {
+        fprintf(stderr,"Error: HDF5DeflateLevel = %d must be between 0 (no compression) and 9 (maximum compression)\n",
+                run_params->HDF5DeflateLevel);
+        fprintf(stderr,"Please change the value for the parameter 'HDF5DeflateLevel' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->HDF5ChunkSize <= 0) {
+        fprintf(stderr,"Error: HDF5ChunkSize = %d (number of galaxies per chunk in the hdf5 output) must be at least 1\n",
+                run_params->HDF5ChunkSize);
+        fprintf(stderr,"Please change the value for the parameter 'HDF5ChunkSize' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
+    }
+    if(run_params->HDF5SingleFile != 0 && run_params->HDF5SingleFile != 1) {
+        fprintf(stderr,"Error: HDF5SingleFile = %d must be either 0 (one file per task) or 1 (a single file for all tasks)\n",
+                run_params->HDF5SingleFile);
+        fprintf(stderr,"Please change the value for the parameter 'HDF5SingleFile' in the parameter file (%s)\n", fname);
+        PARAMETER_ERROR(EXIT_FAILURE);
     }
 
     myfree(used_tag);
     return EXIT_SUCCESS;
 }
+#undef PARAMETER_ERROR
+
+
+/* Copies the next "tag value" line into 'buffer' (at least MAX_STRING_LEN bytes) and returns 0 once there are no more lines */
+static int next_parameter_line(FILE *fd, const int nparams, const char * const *keys, const char * const *values,
+                               int *iparam, char *buffer)
+{
+    if(keys == NULL) {
+        return fgets(buffer, MAX_STRING_LEN, fd) != NULL;
+    }
+
+    if(*iparam >= nparams) {
+        return 0;
+    }
+    snprintf(buffer, MAX_STRING_LEN, "%s %s", keys[*iparam], values[*iparam]);
+    (*iparam)++;
+    return 1;
+}
+
+
+static int parse_output_snapshots(const char *snap_list, struct params *run_params)
+{
+    const char *pos = snap_list;
+    for(int i=0; i<run_params->NumSnapOutputs; i++) {
+        int nchars = 0;
+        if(sscanf(pos, "%d%n", &(run_params->ListOutputSnaps[i]), &nchars) != 1) {
+            fprintf(stderr,"Error: Found only %d (out of NumOutputs = %d) output snapshots in '%s'\n",
+                    i, run_params->NumSnapOutputs, snap_list);
+            return EXIT_FAILURE;
+        }
+        pos += nchars;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* The recipe parameters are the only ones that may be changed once sage has been initialised (i.e., between
+   repeated runs on the same forests). Everything that depends on them is re-computed at the start of every run */
+#define RECIPE_PARAM(name, type) {#name, offsetof(struct params, name), type}
+static const struct recipe_param {
+    const char *tag;
+    size_t offset;
+    enum datatypes type;
+} recipe_params[] = {
+    RECIPE_PARAM(SFprescription, INT),
+    RECIPE_PARAM(AGNrecipeOn, INT),
+    RECIPE_PARAM(SupernovaRecipeOn, INT),
+    RECIPE_PARAM(ReionizationOn, INT),
+    RECIPE_PARAM(DiskInstabilityOn, INT),
+    RECIPE_PARAM(SfrEfficiency, DOUBLE),
+    RECIPE_PARAM(FeedbackReheatingEpsilon, DOUBLE),
+    RECIPE_PARAM(FeedbackEjectionEfficiency, DOUBLE),
+    RECIPE_PARAM(ReIncorporationFactor, DOUBLE),
+    RECIPE_PARAM(RadioModeEfficiency, DOUBLE),
+    RECIPE_PARAM(QuasarModeEfficiency, DOUBLE),
+    RECIPE_PARAM(BlackHoleGrowthRate, DOUBLE),
+    RECIPE_PARAM(ThreshMajorMerger, DOUBLE),
+    RECIPE_PARAM(ThresholdSatDisruption, DOUBLE),
+    RECIPE_PARAM(Yield, DOUBLE),
+    RECIPE_PARAM(RecycleFraction, DOUBLE),
+    RECIPE_PARAM(FracZleaveDisk, DOUBLE),
+    RECIPE_PARAM(BaryonFrac, DOUBLE),
+    RECIPE_PARAM(Reionization_z0, DOUBLE),
+    RECIPE_PARAM(Reionization_zr, DOUBLE),
+    RECIPE_PARAM(EnergySN, DOUBLE),
+    RECIPE_PARAM(EtaSN, DOUBLE),
+};
+#undef RECIPE_PARAM
+
+int set_recipe_parameter(const char *key, const char *value, struct params *run_params)
+{
+    XRETURN(key != NULL && value != NULL && run_params != NULL, EXIT_FAILURE,
+            "Error: Could not validate input parameters. key = %p value = %p run_params = %p\n", key, value, run_params);
+
+    const int nrecipe_params = sizeof(recipe_params)/sizeof(recipe_params[0]);
+    for(int i=0;i<nrecipe_params;i++) {
+        if(strcasecmp(key, recipe_params[i].tag) != 0) continue;
+
+        char *endptr = NULL;
+        void *addr = (char *) run_params + recipe_params[i].offset;
+        if(recipe_params[i].type == INT) {
+            const long ival = strtol(value, &endptr, 10);
+            XRETURN(endptr != value && *endptr == '\0' && ival >= INT32_MIN && ival <= INT32_MAX, EXIT_FAILURE,
+                    "Error: Could not parse the value '%s' for the (integer) recipe parameter '%s'\n", value, key);
+            *((int32_t *) addr) = (int32_t) ival;
+        } else {
+            const double dval = strtod(value, &endptr);
+            XRETURN(endptr != value && *endptr == '\0', EXIT_FAILURE,
+                    "Error: Could not parse the value '%s' for the (floating-point) recipe parameter '%s'\n", value, key);
+            *((double *) addr) = dval;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    fprintf(stderr,"Error: '%s' is not a recipe parameter. Only the following parameters can be changed between runs:\n", key);
+    for(int i=0;i<nrecipe_params;i++) {
+        fprintf(stderr,"    %s\n", recipe_params[i].tag);
+    }
+    return EXIT_FAILURE;
+}
 
 
 #undef MAXTAGS
@@ -6,6 +6,8 @@ extern "C" {
 
     /* functions in core_read_parameter_file.c */
     extern int read_parameter_file(const char *fname, struct params *run_params);
+    extern int read_parameter_keyvalues(const int nparams, const char * const *keys, const char * const *values, struct params *run_params);
+    extern int set_recipe_parameter(const char *key, const char *value, struct params *run_params);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "core_allvars.h"
 #include "core_save.h"
@@ -14,12 +15,29 @@
 #include "core_mymalloc.h"
 
 #include "io/save_gals_binary.h"
+#include "io/save_gals_memory.h"
 
 #ifdef HDF5
 #include "io/save_gals_hdf5.h"
 #endif
 
+/* The checkpoint file '<OutputDir>/<FileNameGalaxies>_checkpoint_<ThisTask>.bin' contains this header, followed
+   by tot_ngals[NumSnapOutputs] and then forest_ngals[snap][0 ... nforests_saved-1] for every output snapshot */
+#define CHECKPOINT_MAGIC  0x54504b4345474153ULL /* 'SAGECKPT' */
+struct checkpoint_header {
+    uint64_t magic;
+    int32_t ThisTask;
+    int32_t NTasks;
+    int32_t OutputFormat;
+    int32_t NumSnapOutputs;
+    int64_t nforests_this_task;
+    int64_t nforests_saved;
+    int64_t single_file_nrounds;/* only with HDF5SingleFile: the checkpoint was written after this round of writes into the single file */
+};
+
 // Local Proto-Types //
+static void get_checkpoint_filename(char *fname, const size_t maxlen, const struct params *run_params);
+static int32_t read_checkpoint(const struct forest_info *forest_info, struct save_info *save_info, const struct params *run_params);
 int32_t generate_galaxy_indices(const struct halo_data *halos, const struct halo_aux_data *haloaux,
                                 struct GALAXY *halogal, const int64_t numgals,
                                 const int64_t treenr, const int32_t filenr,
@@ -40,6 +58,16 @@ int32_t initialize_galaxy_files(const int rank, const struct forest_info *forest
         return INVALID_OPTION_IN_PARAMS;
     }
 
+    // Restore the number of forests (and galaxies) saved before the checkpoint. The output files
+    // are then re-opened (rather than created) and the galaxies after the checkpoint are discarded.
+    if(run_params->RestartFromCheckpoint) {
+        status = read_checkpoint(forest_info, save_info, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+    gettimeofday(&(save_info->last_checkpoint), NULL);
+
     switch(run_params->OutputFormat) {
 
     case(sage_binary):
@@ -52,6 +80,10 @@ int32_t initialize_galaxy_files(const int rank, const struct forest_info *forest
       break;
 #endif
 
+    case(sage_memory):
+      status = initialize_memory_galaxy_catalogue(save_info, run_params);
+      break;
+
     default:
       fprintf(stderr, "Error: Unknown OutputFormat in `initialize_galaxy_files()`.\n");
       status = INVALID_OPTION_IN_PARAMS;
@@ -84,9 +116,17 @@ int32_t save_galaxies(const int64_t task_forestnr, const int numgals, struct hal
         return MALLOC_FAILURE;
     }
 
+    // Track the output snapshot (index within ListOutputSnaps) of each galaxy. Note: this
+    // has numgals elements and can not be stored in haloaux (which only has nhalos elements)
+    int32_t *OutputGalSnapIdx = mymalloc(numgals * sizeof(*(OutputGalSnapIdx)));
+    if(OutputGalSnapIdx == NULL) {
+        fprintf(stderr,"Error: Could not allocate memory for %d int elements in array `OutputGalSnapIdx`\n", numgals);
+        return MALLOC_FAILURE;
+    }
+
     for(int32_t gal_idx = 0; gal_idx < numgals; gal_idx++) {
         OutputGalOrder[gal_idx] = -1;
-        haloaux[gal_idx].output_snap_n = -1;
+        OutputGalSnapIdx[gal_idx] = -1;
     }
 
     // First update mergeIntoID to point to the correct galaxy in the output.
@@ -95,7 +135,7 @@ int32_t save_galaxies(const int64_t task_forestnr, const int numgals, struct hal
             if(halogal[gal_idx].SnapNum == run_params->ListOutputSnaps[snap_idx]) {
                 OutputGalOrder[gal_idx] = OutputGalCount[snap_idx];
                 OutputGalCount[snap_idx]++;
-                haloaux[gal_idx].output_snap_n = snap_idx;
+                OutputGalSnapIdx[gal_idx] = snap_idx;
             }
         }
     }
@@ -137,32 +177,106 @@ int32_t save_galaxies(const int64_t task_forestnr, const int numgals, struct hal
         return EXIT_FAILURE;
     }
 
+    // The forests are saved in the order that they appear in the output, hence ``nforests_saved`` is the
+    // index of this forest within the output. This is the same as ``task_forestnr`` unless the forests
+    // are scheduled dynamically.
+    const int64_t tree_idx = save_info->nforests_saved;
+
     // All of the tracking arrays set up, time to perform the actual writing.
     switch(run_params->OutputFormat) {
 
     case(sage_binary):
         status = save_binary_galaxies(task_forestnr, numgals, OutputGalCount, forest_info,
-                                      halos, haloaux, halogal, save_info, run_params);
+                                      halos, OutputGalSnapIdx, halogal, save_info, run_params);
         break;
 
 #ifdef HDF5
     case(sage_hdf5):
-        status = save_hdf5_galaxies(task_forestnr, numgals, forest_info, halos, haloaux, halogal, save_info, run_params);
+        status = save_hdf5_galaxies(task_forestnr, tree_idx, numgals, forest_info, halos, OutputGalSnapIdx, halogal, save_info, run_params);
         break;
 #endif
 
+    case(sage_memory):
+        status = save_memory_galaxies(task_forestnr, tree_idx, numgals, forest_info, halos, OutputGalSnapIdx, halogal, save_info, run_params);
+        break;
+
     default:
         fprintf(stderr, "Uknown OutputFormat in `save_galaxies()`.\n");
         status = INVALID_OPTION_IN_PARAMS;
 
     }
 
+    myfree(OutputGalSnapIdx);
     myfree(OutputGalOrder);
 
+    if(status == EXIT_SUCCESS) {
+        if(save_info->forestnr_per_tree != NULL) {
+            save_info->forestnr_per_tree[tree_idx] = forest_info->start_forestnum_this_task + task_forestnr;
+        }
+        save_info->nforests_saved++;
+    }
+
     return status;
 }
 
 
+// Writes a checkpoint if at least `CheckpointInterval` seconds have passed since the previous one (or since
+// the output files were opened). All the galaxies saved so far are flushed to the output files and then the
+// number of forests saved is recorded, so that a run interrupted later on can continue from the next forest.
+// With `HDF5SingleFile`, this must be called after every forest: the galaxies are written into the single file
+// by all the tasks together and all the tasks then write their checkpoint at the same time.
+int32_t checkpoint_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info, const struct params *run_params)
+{
+    int checkpoint_due = 0;
+    if(run_params->CheckpointInterval > 0) {
+        struct timeval tnow;
+        gettimeofday(&tnow, NULL);
+        checkpoint_due = get_elapsed_seconds(save_info->last_checkpoint, tnow) >= run_params->CheckpointInterval;
+    }
+
+#ifdef HDF5
+    if(run_params->OutputFormat == sage_hdf5 && run_params->HDF5SingleFile) {
+        return sync_hdf5_single_file(forest_info, save_info, checkpoint_due, run_params);
+    }
+#endif
+
+    if(checkpoint_due == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    int32_t status = EXIT_FAILURE;
+
+    switch(run_params->OutputFormat) {
+
+    case(sage_binary):
+        status = flush_binary_galaxy_files(save_info, run_params);
+        break;
+
+#ifdef HDF5
+    case(sage_hdf5):
+        status = flush_hdf5_galaxy_files(save_info, run_params);
+        break;
+#endif
+
+    default:
+        fprintf(stderr, "Error: Unknown OutputFormat in `checkpoint_galaxy_files()`.\n");
+        status = INVALID_OPTION_IN_PARAMS;
+        break;
+    }
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    status = write_checkpoint(forest_info, save_info, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    gettimeofday(&(save_info->last_checkpoint), NULL);
+    return EXIT_SUCCESS;
+}
+
+
 // Write any remaining attributes or header information, close all the open files and free all the
 // relevant dataspaces.
 int32_t finalize_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info, const struct params *run_params)
@@ -182,17 +296,127 @@ int32_t finalize_galaxy_files(const struct forest_info *forest_info, struct save
         break;
 #endif
 
+    case(sage_memory):
+        /* the galaxies stay in memory until the next run */
+        status = EXIT_SUCCESS;
+        break;
+
     default:
         fprintf(stderr, "Error: Unknown OutputFormat in `finalize_galaxy_files()`.\n");
         status = INVALID_OPTION_IN_PARAMS;
         break;
     }
 
+    // The output files are complete -> the checkpoint is no longer needed
+    if(status == EXIT_SUCCESS && (run_params->CheckpointInterval > 0 || run_params->RestartFromCheckpoint)) {
+        char fname[3*MAX_STRING_LEN];
+        get_checkpoint_filename(fname, sizeof(fname), run_params);
+        if(unlink(fname) != 0 && errno != ENOENT) {
+            fprintf(stderr,"Warning: Could not remove the checkpoint file '%s'\n", fname);
+            perror(NULL);
+        }
+    }
+
     return status;
 }
 
+// Writes the checkpoint to a temporary file that then replaces the previous checkpoint. Hence, there is always a
+// complete checkpoint on disk, even if the run is interrupted while the checkpoint is being written.
+int32_t write_checkpoint(const struct forest_info *forest_info, const struct save_info *save_info, const struct params *run_params)
+{
+    char fname[3*MAX_STRING_LEN], tmp_fname[3*MAX_STRING_LEN + 4];
+    get_checkpoint_filename(fname, sizeof(fname), run_params);
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+
+    FILE *fp = fopen(tmp_fname, "w");
+    XRETURN(fp != NULL, FILE_NOT_FOUND, "Error: Could not open the file '%s' to write the checkpoint\n", tmp_fname);
+
+    struct checkpoint_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CHECKPOINT_MAGIC;
+    hdr.ThisTask = run_params->ThisTask;
+    hdr.NTasks = run_params->NTasks;
+    hdr.OutputFormat = (int32_t) run_params->OutputFormat;
+    hdr.NumSnapOutputs = run_params->NumSnapOutputs;
+    hdr.nforests_this_task = forest_info->nforests_this_task;
+    hdr.nforests_saved = save_info->nforests_saved;
+    hdr.single_file_nrounds = save_info->single_file_nrounds;
+
+    int status = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    status = status && fwrite(save_info->tot_ngals, sizeof(save_info->tot_ngals[0]), run_params->NumSnapOutputs, fp) == (size_t) run_params->NumSnapOutputs;
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs && status; snap_idx++) {
+        status = fwrite(save_info->forest_ngals[snap_idx], sizeof(save_info->forest_ngals[snap_idx][0]), hdr.nforests_saved, fp) == (size_t) hdr.nforests_saved;
+    }
+    status = status && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    status = (fclose(fp) == 0) && status;
+    XRETURN(status, FILE_WRITE_ERROR, "Error: Could not write the checkpoint to the file '%s'\n", tmp_fname);
+
+    XRETURN(rename(tmp_fname, fname) == 0, FILE_WRITE_ERROR,
+            "Error: Could not rename the checkpoint file '%s' to '%s'\n", tmp_fname, fname);
+
+    return EXIT_SUCCESS;
+}
+
 // Local Functions //
 
+void get_checkpoint_filename(char *fname, const size_t maxlen, const struct params *run_params)
+{
+    snprintf(fname, maxlen, "%s/%s_checkpoint_%d.bin", run_params->OutputDir, run_params->FileNameGalaxies, run_params->ThisTask);
+}
+
+// Reads the checkpoint written by a previous run of this task. Without a checkpoint, the run starts from the
+// first forest. Otherwise `nforests_saved`, `tot_ngals`, `forest_ngals` (and `single_file_nrounds`) are set to their
+// values at the checkpoint.
+int32_t read_checkpoint(const struct forest_info *forest_info, struct save_info *save_info, const struct params *run_params)
+{
+    char fname[3*MAX_STRING_LEN];
+    get_checkpoint_filename(fname, sizeof(fname), run_params);
+    FILE *fp = fopen(fname, "r");
+    if(fp == NULL) {
+        fprintf(stderr,"ThisTask = %d: No checkpoint found (expected in '%s') -> starting from the first forest\n",
+                run_params->ThisTask, fname);
+        return EXIT_SUCCESS;
+    }
+
+    struct checkpoint_header hdr;
+    XRETURN(fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == CHECKPOINT_MAGIC, FILE_READ_ERROR,
+            "Error: The checkpoint file '%s' is not a valid checkpoint\n", fname);
+    XRETURN(hdr.ThisTask == run_params->ThisTask && hdr.NTasks == run_params->NTasks && hdr.OutputFormat == (int32_t) run_params->OutputFormat &&
+            hdr.NumSnapOutputs == run_params->NumSnapOutputs && hdr.nforests_this_task == forest_info->nforests_this_task,
+            EXIT_FAILURE, "Error: The checkpoint file '%s' was written by a different run. Checkpoint (current run) values are:\n"
+            "ThisTask = %d (%d) NTasks = %d (%d) OutputFormat = %d (%d) NumSnapOutputs = %d (%d) nforests_this_task = %"PRId64" (%"PRId64")\n"
+            "The run must be restarted with the same parameters and the same number of tasks\n", fname,
+            hdr.ThisTask, run_params->ThisTask, hdr.NTasks, run_params->NTasks, hdr.OutputFormat, (int32_t) run_params->OutputFormat,
+            hdr.NumSnapOutputs, run_params->NumSnapOutputs, hdr.nforests_this_task, forest_info->nforests_this_task);
+    XRETURN(hdr.nforests_saved >= 0 && hdr.nforests_saved <= hdr.nforests_this_task, FILE_READ_ERROR,
+            "Error: The checkpoint file '%s' contains an invalid number of saved forests = %"PRId64" (must be in [0, %"PRId64"])\n",
+            fname, hdr.nforests_saved, hdr.nforests_this_task);
+
+    int status = fread(save_info->tot_ngals, sizeof(save_info->tot_ngals[0]), run_params->NumSnapOutputs, fp) == (size_t) run_params->NumSnapOutputs;
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs && status; snap_idx++) {
+        status = fread(save_info->forest_ngals[snap_idx], sizeof(save_info->forest_ngals[snap_idx][0]), hdr.nforests_saved, fp) == (size_t) hdr.nforests_saved;
+    }
+    fclose(fp);
+    XRETURN(status, FILE_READ_ERROR, "Error: Could not read the number of galaxies from the checkpoint file '%s'\n", fname);
+
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        int64_t ngals = 0;
+        for(int64_t i=0;i<hdr.nforests_saved;i++) {
+            ngals += save_info->forest_ngals[snap_idx][i];
+        }
+        XRETURN(ngals == save_info->tot_ngals[snap_idx], FILE_READ_ERROR,
+                "Error: The checkpoint file '%s' is inconsistent. At snapshot index = %d, the galaxies per forest sum to %"PRId64" "
+                "but the total number of galaxies is %"PRId64"\n", fname, snap_idx, ngals, save_info->tot_ngals[snap_idx]);
+    }
+
+    save_info->nforests_saved = hdr.nforests_saved;
+    save_info->single_file_nrounds = hdr.single_file_nrounds;
+    fprintf(stderr,"ThisTask = %d: Restarting from the checkpoint in '%s' after %"PRId64" (out of %"PRId64") forests\n",
+            run_params->ThisTask, fname, hdr.nforests_saved, hdr.nforests_this_task);
+
+    return EXIT_SUCCESS;
+}
+
 // Generate a unique GalaxyIndex for each galaxy based on the file number, the file-local
 // tree number and the tree-local galaxy number.  NOTE: Both the file number and the tree number are
 // based on the **original simulation files**.  These may be different from the ``forestnr``
@@ -15,6 +15,12 @@ extern "C" {
                                  struct halo_aux_data *haloaux, struct GALAXY *halogal, struct save_info *save_info,
                                  const struct params *run_params);
 
+    extern int32_t checkpoint_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info,
+                                           const struct params *run_params);
+
+    extern int32_t write_checkpoint(const struct forest_info *forest_info, const struct save_info *save_info,
+                                    const struct params *run_params);
+
     extern int32_t finalize_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info,
                                          const struct params *run_params);
 
@@ -82,6 +82,11 @@ int my_snprintf(char *buffer, int len, const char *format, ...)
   (code can be easily extended to include `weeks' as a system of time unit. left to the reader)
 */
 
+double get_elapsed_seconds(struct timeval t0, struct timeval t1)
+{
+  return (t1.tv_sec - t0.tv_sec) + 1e-6 * (t1.tv_usec - t0.tv_usec);
+}
+
 char *get_time_string(struct timeval t0, struct timeval t1)
 {
   const size_t MAXLINESIZE = 1024;
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "async_writer.h"
+#include "../core_allvars.h"
+#include "../macros.h"
+
+/* Only compiled in with USE-ASYNC-WRITE (requires linking with -pthread) */
+#ifdef USE_ASYNC_WRITE
+
+static void *async_writer_thread(void *arg)
+{
+    struct async_writer *aw = (struct async_writer *) arg;
+
+    pthread_mutex_lock(&aw->lock);
+    while(1) {
+        while(aw->num_queued == 0 && aw->stop == 0) {
+            pthread_cond_wait(&aw->cond, &aw->lock);
+        }
+        if(aw->num_queued == 0) {
+            /* stop was requested and there is nothing left to write */
+            break;
+        }
+
+        const struct async_write_job job = aw->jobs[aw->first_job];
+        aw->first_job = (aw->first_job + 1) % aw->max_jobs;
+        aw->num_queued--;
+        aw->writing = 1;
+        pthread_cond_broadcast(&aw->cond);/* a slot in the queue is now free */
+        pthread_mutex_unlock(&aw->lock);
+
+        const int status = job.write_func(job.arg);
+
+        pthread_mutex_lock(&aw->lock);
+        if(status != EXIT_SUCCESS && aw->status == EXIT_SUCCESS) {
+            aw->status = status;
+        }
+        *(job.in_flight) = 0;
+        aw->writing = 0;
+        pthread_cond_broadcast(&aw->cond);
+    }
+    pthread_mutex_unlock(&aw->lock);
+
+    return NULL;
+}
+
+
+int start_async_writer(struct async_writer *aw, const int32_t max_jobs)
+{
+    XRETURN(aw != NULL && max_jobs > 0, EXIT_FAILURE,
+            "Error: Could not validate input parameters. async writer address = %p max_jobs = %d (must be > 0)\n",
+            aw, max_jobs);
+
+    memset(aw, 0, sizeof(*aw));
+    aw->jobs = malloc(max_jobs * sizeof(aw->jobs[0]));
+    XRETURN(aw->jobs != NULL, MALLOC_FAILURE, "Error: Could not allocate memory for %d async write jobs (each of size %zu bytes)\n",
+            max_jobs, sizeof(aw->jobs[0]));
+    aw->max_jobs = max_jobs;
+    aw->status = EXIT_SUCCESS;
+
+    int status = pthread_mutex_init(&aw->lock, NULL);
+    XRETURN(status == 0, EXIT_FAILURE, "Error: Could not initialise the mutex for the async writer (error code = %d)\n", status);
+    status = pthread_cond_init(&aw->cond, NULL);
+    XRETURN(status == 0, EXIT_FAILURE, "Error: Could not initialise the condition variable for the async writer (error code = %d)\n", status);
+    status = pthread_create(&aw->thread, NULL, async_writer_thread, aw);
+    XRETURN(status == 0, EXIT_FAILURE, "Error: Could not create the async writer thread (error code = %d)\n", status);
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Queues up 'write_func(arg)' and marks '*in_flight' as set until the write completes. Blocks
+   while the queue is full. Returns the error from any previously failed write */
+int submit_async_write(struct async_writer *aw, int (*write_func)(void *), void *arg, int *in_flight)
+{
+    pthread_mutex_lock(&aw->lock);
+    while(aw->num_queued == aw->max_jobs && aw->status == EXIT_SUCCESS) {
+        pthread_cond_wait(&aw->cond, &aw->lock);
+    }
+    const int status = aw->status;
+    if(status == EXIT_SUCCESS) {
+        const int32_t slot = (aw->first_job + aw->num_queued) % aw->max_jobs;
+        aw->jobs[slot].write_func = write_func;
+        aw->jobs[slot].arg = arg;
+        aw->jobs[slot].in_flight = in_flight;
+        *in_flight = 1;
+        aw->num_queued++;
+        pthread_cond_broadcast(&aw->cond);
+    }
+    pthread_mutex_unlock(&aw->lock);
+
+    if(status != EXIT_SUCCESS) {
+        fprintf(stderr,"Error: A previous asynchronous write failed with status = %d\n", status);
+    }
+    return status;
+}
+
+
+/* Blocks until the write associated with 'in_flight' has completed */
+int wait_for_async_write(struct async_writer *aw, const int *in_flight)
+{
+    pthread_mutex_lock(&aw->lock);
+    while(*in_flight) {
+        pthread_cond_wait(&aw->cond, &aw->lock);
+    }
+    const int status = aw->status;
+    pthread_mutex_unlock(&aw->lock);
+
+    return status;
+}
+
+
+/* Blocks until every submitted write has completed */
+int drain_async_writer(struct async_writer *aw)
+{
+    pthread_mutex_lock(&aw->lock);
+    while(aw->num_queued > 0 || aw->writing) {
+        pthread_cond_wait(&aw->cond, &aw->lock);
+    }
+    const int status = aw->status;
+    pthread_mutex_unlock(&aw->lock);
+
+    return status;
+}
+
+
+/* Finishes all pending writes, joins the writer thread and releases the resources */
+int stop_async_writer(struct async_writer *aw)
+{
+    pthread_mutex_lock(&aw->lock);
+    aw->stop = 1;
+    pthread_cond_broadcast(&aw->cond);
+    pthread_mutex_unlock(&aw->lock);
+
+    int status = pthread_join(aw->thread, NULL);
+    XRETURN(status == 0, EXIT_FAILURE, "Error: Could not join the async writer thread (error code = %d)\n", status);
+
+    status = aw->status;
+    pthread_cond_destroy(&aw->cond);
+    pthread_mutex_destroy(&aw->lock);
+    free(aw->jobs);
+    aw->jobs = NULL;
+    aw->max_jobs = 0;
+
+    if(status != EXIT_SUCCESS) {
+        fprintf(stderr,"Error: At least one asynchronous write failed (status = %d)\n", status);
+    }
+    return status;
+}
+
+#endif /* USE_ASYNC_WRITE */
@@ -0,0 +1,42 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* A single pending write. 'write_func' is called (with 'arg') on the writer thread and
+   '*in_flight' is reset to 0 once the write has completed */
+struct async_write_job {
+    int (*write_func)(void *arg);
+    void *arg;
+    int *in_flight;
+};
+
+/* One dedicated I/O thread that drains a bounded FIFO queue of write jobs. All fields
+   (including the 'in_flight' flags of the submitted jobs) are protected by 'lock' */
+struct async_writer {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    struct async_write_job *jobs;/* circular queue with 'max_jobs' slots */
+    int32_t max_jobs;
+    int32_t first_job;
+    int32_t num_queued;
+    int32_t writing;/* set while the writer thread is executing a job */
+    int32_t stop;
+    int status;/* first error returned by any of the jobs (EXIT_SUCCESS otherwise) */
+};
+
+    extern int start_async_writer(struct async_writer *aw, const int32_t max_jobs);
+    extern int submit_async_write(struct async_writer *aw, int (*write_func)(void *), void *arg, int *in_flight);
+    extern int wait_for_async_write(struct async_writer *aw, const int *in_flight);
+    extern int drain_async_writer(struct async_writer *aw);
+    extern int stop_async_writer(struct async_writer *aw);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h> //for memcpy
+#include <inttypes.h>
 
 /*
 The initial version of this code was generated using ChatGPT as a fun exercise. The instructions
@@ -54,6 +55,50 @@ out the instructions. -MS 27th Jul, 2023
 #include "buffered_io.h"
 #include "../core_utils.h" //for mypwrite
 
+#ifdef USE_ASYNC_WRITE
+#include "async_writer.h"
+
+static int write_buffered_io_job(void *arg)
+{
+    const struct buffered_io_write_job *job = (const struct buffered_io_write_job *) arg;
+    const ssize_t bytes_written = mypwrite(job->file_descriptor, job->buffer, job->num_bytes, job->offset);
+    if(bytes_written != (ssize_t) job->num_bytes) {
+        fprintf(stderr,"Error: In function %s> Expected to write %zu bytes at offset %"PRId64" but wrote %zd bytes instead\n",
+                __FUNCTION__, job->num_bytes, (int64_t) job->offset, bytes_written);
+        return -1;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Hands the current buffer over to the writer thread and switches to the other buffer (once that
+   buffer has been written out) */
+static int submit_current_buffer(struct buffered_io *buf_io)
+{
+    if(buf_io->bytes_stored == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    const int curr = buf_io->curr_buffer;
+    struct buffered_io_write_job *job = &buf_io->jobs[curr];
+    job->file_descriptor = buf_io->file_descriptor;
+    job->buffer = buf_io->buffers[curr];
+    job->num_bytes = buf_io->bytes_stored;
+    job->offset = buf_io->current_offset;
+    int status = submit_async_write(buf_io->async_writer, write_buffered_io_job, job, &buf_io->in_flight[curr]);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+    buf_io->current_offset += buf_io->bytes_stored;
+    buf_io->bytes_stored = 0;
+
+    buf_io->curr_buffer = 1 - curr;
+    status = wait_for_async_write(buf_io->async_writer, &buf_io->in_flight[buf_io->curr_buffer]);
+    buf_io->buffer = buf_io->buffers[buf_io->curr_buffer];
+
+    return status;
+}
+#endif
+
 
 int setup_buffered_io(struct buffered_io *buf_io, const size_t buffer_size, int output_fd, const off_t start_offset) 
 {
@@ -77,9 +122,41 @@ int setup_buffered_io(struct buffered_io *buf_io, const size_t buffer_size, int
     buf_io->bytes_stored = 0;
     buf_io->file_descriptor = output_fd;
     buf_io->current_offset = start_offset;
+    buf_io->async_writer = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+#ifdef USE_ASYNC_WRITE
+/* Same as 'setup_buffered_io' but allocates two buffers of 'buffer_size' bytes each. Full buffers
+   are written out by 'async_writer' (which must already be running) while the other buffer is filled */
+int setup_async_buffered_io(struct buffered_io *buf_io, const size_t buffer_size, int output_fd, const off_t start_offset,
+                            struct async_writer *async_writer)
+{
+    if(async_writer == NULL) {
+        fprintf(stderr,"Error: In %s> The async writer must not be NULL\n", __FUNCTION__);
+        return -1;
+    }
+
+    int status = setup_buffered_io(buf_io, buffer_size, output_fd, start_offset);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    buf_io->buffers[0] = buf_io->buffer;
+    buf_io->buffers[1] = malloc(buffer_size);
+    if (buf_io->buffers[1] == NULL) {
+        fprintf(stderr,"Error: In %s> Could not allocate memory of size %zu bytes for the second buffer\n", __FUNCTION__, buffer_size);
+        return -1;
+    }
+    buf_io->in_flight[0] = 0;
+    buf_io->in_flight[1] = 0;
+    buf_io->curr_buffer = 0;
+    buf_io->async_writer = async_writer;
 
     return EXIT_SUCCESS;
 }
+#endif
 
 int write_buffered_io(struct buffered_io *buf_io, const void *src, size_t num_bytes_to_write)
 {
@@ -90,6 +167,30 @@ int write_buffered_io(struct buffered_io *buf_io, const void *src, size_t num_by
         return -1;
     }
 
+#ifdef USE_ASYNC_WRITE
+    if(buf_io->async_writer != NULL) {
+        // The source may be released as soon as we return -> every byte is copied into a
+        // buffer, and every full buffer is passed on to the writer thread
+        const char *src_bytes = (const char *) src;
+        while(num_bytes_to_write > 0) {
+            const size_t bytes_free = buf_io->bytes_allocated - buf_io->bytes_stored;
+            const size_t nbytes = num_bytes_to_write < bytes_free ? num_bytes_to_write : bytes_free;
+            memcpy((char *) buf_io->buffer + buf_io->bytes_stored, src_bytes, nbytes);
+            buf_io->bytes_stored += nbytes;
+            src_bytes += nbytes;
+            num_bytes_to_write -= nbytes;
+
+            if(buf_io->bytes_stored == buf_io->bytes_allocated) {
+                const int status = submit_current_buffer(buf_io);
+                if(status != EXIT_SUCCESS) {
+                    return status;
+                }
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+#endif
+
     // Check if the buffer has enough space to hold new data
     if ((buf_io->bytes_stored + num_bytes_to_write) < buf_io->bytes_allocated) {
         // Copy data to the buffer
@@ -140,6 +241,40 @@ int write_buffered_io(struct buffered_io *buf_io, const void *src, size_t num_by
     return EXIT_SUCCESS;
 }
 
+/* Writes out any data stored in the buffer (and waits until all pending asynchronous writes have completed)
+   but keeps the buffer for further writes. Afterwards, the file contains every byte passed to 'write_buffered_io' */
+int flush_buffered_io(struct buffered_io *buf_io)
+{
+    if(buf_io == NULL) {
+        fprintf(stderr,"Error: In %s> Could not validate input parameters. buffer pointer address = %p", __FUNCTION__, buf_io);
+        return -1;
+    }
+
+#ifdef USE_ASYNC_WRITE
+    if(buf_io->async_writer != NULL) {
+        int status = submit_current_buffer(buf_io);
+        if(status == EXIT_SUCCESS) {
+            status = wait_for_async_write(buf_io->async_writer, &buf_io->in_flight[1 - buf_io->curr_buffer]);
+        }
+        if(status != EXIT_SUCCESS) {
+            fprintf(stderr,"Error: In %s> Could not flush the (asynchronous) buffered io\n", __FUNCTION__);
+        }
+        return status;
+    }
+#endif
+
+    const ssize_t bytes_written = mypwrite(buf_io->file_descriptor, buf_io->buffer, buf_io->bytes_stored, buf_io->current_offset);
+    if(bytes_written != (ssize_t) buf_io->bytes_stored) {
+        fprintf(stderr,"Error: In %s> Expected to write %zu bytes at offset %"PRId64" but wrote %zd bytes instead\n",
+                __FUNCTION__, buf_io->bytes_stored, (int64_t) buf_io->current_offset, bytes_written);
+        return -1;
+    }
+    buf_io->current_offset += bytes_written;
+    buf_io->bytes_stored = 0;
+
+    return EXIT_SUCCESS;
+}
+
 int cleanup_buffered_io(struct buffered_io *buf_io) 
 {
     if(buf_io == NULL) {
@@ -147,6 +282,29 @@ int cleanup_buffered_io(struct buffered_io *buf_io)
         return -1;
     }
 
+#ifdef USE_ASYNC_WRITE
+    if(buf_io->async_writer != NULL) {
+        // Hand over the partially filled buffer and wait for both buffers to be written out
+        int status = submit_current_buffer(buf_io);
+        if(status == EXIT_SUCCESS) {
+            status = wait_for_async_write(buf_io->async_writer, &buf_io->in_flight[1 - buf_io->curr_buffer]);
+        }
+        if(status != EXIT_SUCCESS) {
+            fprintf(stderr,"Error: In %s> Could not finalise the file in (asynchronous) buffered io\n", __FUNCTION__);
+            return status;
+        }
+
+        free(buf_io->buffers[0]);
+        free(buf_io->buffers[1]);
+        buf_io->buffers[0] = buf_io->buffers[1] = NULL;
+        buf_io->buffer = NULL;
+        buf_io->async_writer = NULL;
+        buf_io->bytes_allocated = 0;
+        buf_io->bytes_stored = 0;
+        return EXIT_SUCCESS;
+    }
+#endif
+
     // Write out any remaining data in the buffer
     ssize_t bytes_written = mypwrite(buf_io->file_descriptor, buf_io->buffer, buf_io->bytes_stored, buf_io->current_offset);
     if (bytes_written < 0) {
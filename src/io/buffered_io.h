@@ -4,16 +4,38 @@
 extern "C" {
 #endif
 
+struct async_writer;
+
+struct buffered_io_write_job{
+    int file_descriptor;
+    const void *buffer;
+    size_t num_bytes;
+    off_t offset;
+};
+
 struct buffered_io{
     size_t bytes_allocated;
     size_t bytes_stored;
     int file_descriptor;
     off_t current_offset;
     void *buffer;
+
+    /* Only used when the full buffers are written out by an async writer thread (NULL otherwise).
+       'buffer' is then one of the two 'buffers' and is filled while the other one is being written */
+    struct async_writer *async_writer;
+    void *buffers[2];
+    int in_flight[2];
+    int curr_buffer;
+    struct buffered_io_write_job jobs[2];
 };
 
     extern int setup_buffered_io(struct buffered_io *buf_io, const size_t buffer_size, int output_fd, const off_t start_offset);
+#ifdef USE_ASYNC_WRITE
+    extern int setup_async_buffered_io(struct buffered_io *buf_io, const size_t buffer_size, int output_fd, const off_t start_offset,
+                                       struct async_writer *async_writer);
+#endif
     extern int write_buffered_io(struct buffered_io *buf_io, const void *src, size_t num_bytes_to_write);
+    extern int flush_buffered_io(struct buffered_io *buf_io);
     extern int cleanup_buffered_io(struct buffered_io *buf_io);
 
 #ifdef __cplusplus
@@ -4,6 +4,12 @@
 #include <math.h>
 
 #include "forest_utils.h"
+#include "../core_mymalloc.h"
+
+/* The (dynamic) forest scheduler splits the forests into this many chunks per task. Every chunk
+   is setup separately (see setup_forest_scheduler), so more chunks improve the load-balance at the
+   cost of reading the tree headers more often */
+#define NUM_FOREST_CHUNKS_PER_TASK 16
 
 static inline double compute_forest_cost_from_nhalos(const enum Valid_Forest_Distribution_Schemes forest_weighting, const int64_t nhalos, const double exponent);
 
@@ -153,7 +159,12 @@ int distribute_weighted_forests_over_ntasks(const int64_t totnforests, const int
         cost_so_far += cost_this_forest;
         nhalos_so_far += nhalos_per_forest[i];
         nhalos_curr_task += nhalos_per_forest[i];
-        if (cost_so_far < curr_cost_target) continue;
+
+        /* Every task needs at least one forest -> the current task must stop here once there
+           are only as many forests left as there are tasks left (e.g., after a few expensive forests) */
+        const int64_t nforests_left = totnforests - (i + 1);
+        const int64_t ntasks_left = NTasks - (currtask + 1);
+        if (cost_so_far < curr_cost_target && nforests_left > ntasks_left) continue;
 
         /* If we have reached here that means processing this forest
            will exceed the target cost. Therefore, we need to mark
@@ -211,6 +222,162 @@ int distribute_weighted_forests_over_ntasks(const int64_t totnforests, const int
 
 
 
+/* Fits the cost of a forest as A * pow(nhalos, exponent) (i.e., the 'generic_power_in_nhalos' scheme) to the
+   timings written by a previous run with 'WriteForestTimings'. Reads all the files '<timings_base>_forest_timings_<N>.txt'
+   (N = 0, 1, ...) and fits a straight line to log(seconds) vs log(nhalos) with least squares */
+int fit_forest_cost_exponent(const char *timings_base, const int ThisTask, double *exponent)
+{
+    double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0, sum_yy = 0.0;
+    int64_t npoints = 0;
+    int nfiles = 0;
+    char fname[3*MAX_STRING_LEN];
+    char line[MAX_STRING_LEN];
+
+    while(1) {
+        snprintf(fname, sizeof(fname), "%s_forest_timings_%d.txt", timings_base, nfiles);
+        FILE *fp = fopen(fname, "r");
+        if(fp == NULL) break;
+        nfiles++;
+
+        while(fgets(line, sizeof(line), fp) != NULL) {
+            if(line[0] == '#') continue;
+            int32_t filenr;
+            int64_t treenr, nhalos;
+            double seconds;
+            if(sscanf(line, "%"SCNd32" %"SCNd64" %"SCNd64" %lf", &filenr, &treenr, &nhalos, &seconds) != 4) {
+                fprintf(stderr,"Error: Could not parse the line '%s' in the forest timings file '%s'\n", line, fname);
+                fclose(fp);
+                return EXIT_FAILURE;
+            }
+            /* Forests that are too fast to be timed do not constrain the fit */
+            if(nhalos <= 0 || seconds <= 0.0) continue;
+
+            const double x = log((double) nhalos), y = log(seconds);
+            sum_x += x;
+            sum_y += y;
+            sum_xx += x*x;
+            sum_xy += x*y;
+            sum_yy += y*y;
+            npoints++;
+        }
+        fclose(fp);
+    }
+
+    XRETURN(nfiles > 0, FILE_NOT_FOUND, "Error: Could not find any forest timings files. The first file should be '%s_forest_timings_0.txt'\n",
+            timings_base);
+
+    const double var_x = sum_xx - sum_x*sum_x/npoints;
+    XRETURN(npoints >= 2 && var_x > 0.0, EXIT_FAILURE,
+            "Error: Need timings for forests with at least two different sizes to fit the forest cost. Found %"PRId64" usable timings in %d files\n",
+            npoints, nfiles);
+
+    const double slope = (sum_xy - sum_x*sum_y/npoints)/var_x;
+    const double intercept = (sum_y - slope*sum_x)/npoints;
+    const double rms = sqrt(fmax(0.0, (sum_yy - 2.0*intercept*sum_y - 2.0*slope*sum_xy + npoints*intercept*intercept
+                                       + 2.0*intercept*slope*sum_x + slope*slope*sum_xx)/npoints));
+
+    /* The cost must not decrease with the size of the forest */
+    *exponent = slope > 0.0 ? slope:0.0;
+    if(ThisTask == 0) {
+        fprintf(stderr,"[LOG]: Fitted the forest cost as %g * pow(nhalos, %g) seconds using %"PRId64" forests from %d timings files "
+                       "(rms scatter = %g dex)\n", exp(intercept), *exponent, npoints, nfiles, rms/log(10.0));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Sets up the chunks for dynamic scheduling. The chunks are the ranges of forests that the forests
+   would be distributed into (with the usual 'ForestDistributionScheme') if there were 'nchunks' tasks,
+   i.e., every chunk is a contiguous range of forests and the chunks have roughly equal cost. The
+   forests in a chunk are only setup (with setup_forests_io) by the task that processes the chunk.
+   Must be called by all tasks */
+int setup_forest_scheduler(struct forest_scheduler *fs, const int64_t totnforests, const int NTasks, const int ThisTask)
+{
+    if(ThisTask > NTasks || ThisTask < 0 || NTasks < 1) {
+        fprintf(stderr,"Error: ThisTask = %d and NTasks = %d must satisfy i) ThisTask < NTasks, ii) ThisTask > 0 and iii) NTasks >= 1\n",
+                ThisTask, NTasks);
+        return EXIT_FAILURE;
+    }
+
+    if(totnforests < 0) {
+        fprintf(stderr,"Error: On ThisTask = %d: total number of forests = %"PRId64" must be >= 0\n", ThisTask, totnforests);
+        return EXIT_FAILURE;
+    }
+
+    /* Every chunk must contain at least one forest */
+    const int64_t max_nchunks = (int64_t) NTasks * NUM_FOREST_CHUNKS_PER_TASK;
+    fs->nchunks = totnforests < max_nchunks ? totnforests:max_nchunks;
+    fs->ThisTask = ThisTask;
+
+#ifdef MPI
+    const MPI_Aint counter_size = ThisTask == 0 ? sizeof(*(fs->counter)):0;
+    int status = MPI_Win_allocate(counter_size, sizeof(*(fs->counter)), MPI_INFO_NULL, MPI_COMM_WORLD, &(fs->counter), &(fs->counter_win));
+    XRETURN(status == MPI_SUCCESS, EXIT_FAILURE, "Error: Could not create the MPI window for the forest scheduler (error code = %d)\n", status);
+    if(ThisTask == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, fs->counter_win);
+        *(fs->counter) = 0;
+        MPI_Win_unlock(0, fs->counter_win);
+    }
+    /* No task may request a chunk before the counter has been initialised */
+    MPI_Barrier(MPI_COMM_WORLD);
+#else
+    fs->counter = 0;
+#endif
+
+    if(ThisTask == 0) {
+        fprintf(stderr,"[LOG]: Dynamically scheduling %"PRId64" forests in %"PRId64" chunks over %d tasks\n",
+                totnforests, fs->nchunks, NTasks);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Claims the next unprocessed chunk for this task. Returns the chunk index, or -1 once all the
+   chunks have been handed out */
+int64_t get_next_forest_chunk(struct forest_scheduler *fs)
+{
+    int64_t chunk;
+#ifdef MPI
+    const int64_t one = 1;
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, fs->counter_win);
+    MPI_Fetch_and_op(&one, &chunk, MPI_INT64_T, 0, 0, MPI_SUM, fs->counter_win);
+    MPI_Win_unlock(0, fs->counter_win);
+#else
+    chunk = fs->counter++;
+#endif
+
+    return chunk < fs->nchunks ? chunk:-1;
+}
+
+
+/* The counter lives in the memory of task 0. Unless the MPI library progresses one-sided operations
+   asynchronously (e.g., MPICH with MPICH_ASYNC_PROGRESS=1, or hardware atomics), a request from another
+   task only completes once task 0 calls into MPI. Hence task 0 should call this between forests */
+void poll_forest_scheduler(const struct forest_scheduler *fs)
+{
+#ifdef MPI
+    if(fs->ThisTask == 0) {
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+    }
+#else
+    (void) fs;
+#endif
+}
+
+
+/* Must be called by all tasks (once they have finished processing) */
+void cleanup_forest_scheduler(struct forest_scheduler *fs)
+{
+#ifdef MPI
+    MPI_Win_free(&(fs->counter_win));
+#endif
+    fs->nchunks = 0;
+}
+
+
 int find_start_and_end_filenum(const int64_t start_forestnum, const int64_t end_forestnum,
                                const int64_t *totnforests_per_file, const int64_t totnforests,
                                const int firstfile, const int lastfile,
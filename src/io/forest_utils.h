@@ -8,6 +8,24 @@ extern "C" {
 
 #include "../core_allvars.h"
 
+#ifdef MPI
+#include <mpi.h>
+#endif
+
+/* Hands out chunks (i.e., contiguous ranges) of forests to tasks on request. The chunks are
+   identical on all tasks; only the index of the next chunk to be processed is shared between
+   the tasks (via an MPI one-sided atomic counter on task 0) */
+struct forest_scheduler {
+    int64_t nchunks;
+    int ThisTask;
+#ifdef MPI
+    MPI_Win counter_win;/* holds the index of the next chunk (on task 0) */
+    int64_t *counter;
+#else
+    int64_t counter;
+#endif
+};
+
     extern int distribute_forests_over_ntasks(const int64_t totnforests, const int NTasks, const int ThisTask,
                                               int64_t *nforests_thistask, int64_t *start_forestnum_thistask);
 
@@ -15,6 +33,13 @@ extern "C" {
                                                        const enum Valid_Forest_Distribution_Schemes forest_weighting, const double power_law_index,
                                                        const int NTasks, const int ThisTask, int64_t *nforests_thistask, int64_t *start_forestnum_thistask);
         
+    extern int fit_forest_cost_exponent(const char *timings_base, const int ThisTask, double *exponent);
+
+    extern int setup_forest_scheduler(struct forest_scheduler *fs, const int64_t totnforests, const int NTasks, const int ThisTask);
+    extern int64_t get_next_forest_chunk(struct forest_scheduler *fs);
+    extern void poll_forest_scheduler(const struct forest_scheduler *fs);
+    extern void cleanup_forest_scheduler(struct forest_scheduler *fs);
+
     extern int find_start_and_end_filenum(const int64_t start_forestnum, const int64_t end_forestnum,
                                           const int64_t *totnforests_per_file, const int64_t totnforests,
                                           const int firstfile, const int lastfile,
@@ -161,6 +161,58 @@ herr_t read_dataset(hid_t fd, const char *dataset_name, hid_t dataset_id, void *
 }
 
 
+/* Reads 'count' rows (starting at row 'offset') of the already opened dataset 'h5_dset' straight into the member
+   located at 'field_offset' within 'count' consecutive structs of size 'struct_size' bytes (starting at 'dst').
+   Each row contains 'ncomponents' elements, i.e., the dataset must either be 1-D (ncomponents == 1) or have
+   shape (N, ncomponents). The memory dataspace views the struct array as a strided array of 'mem_dtype' elements,
+   so HDF5 scatters (and if required, converts the datatype of) every value into the correct struct member */
+herr_t read_partial_dataset_into_structs(hid_t h5_dset, const char *dataset_name, const hsize_t offset, const hsize_t count,
+                                         const int ncomponents, const hid_t mem_dtype,
+                                         void *dst, const size_t struct_size, const size_t field_offset)
+{
+    const size_t field_size = H5Tget_size(mem_dtype);
+    const int is_aligned = field_size > 0 && (struct_size % field_size) == 0 && (field_offset % field_size) == 0;
+    XRETURN(is_aligned, -1,
+            "Error: Can not read dataset '%s' directly into the struct (size = %zu bytes). The field is "
+            "at offset = %zu bytes and each element has size = %zu bytes\n",
+            dataset_name, struct_size, field_offset, field_size);
+
+    hid_t h5_fspace = H5Dget_space(h5_dset);
+    XRETURN(h5_fspace >= 0, -1, "Error: Could not reserve filespace for dataset = '%s'\n", dataset_name);
+    hsize_t dims[2] = {0, 1};
+    const int ndims = H5Sget_simple_extent_ndims(h5_fspace);
+    XRETURN(ndims == 1 || ndims == 2, -1, "Error: Expected dataset = '%s' to be a 1-D or 2-D array. Instead found ndims = %d\n",
+            dataset_name, ndims);
+    XRETURN(H5Sget_simple_extent_dims(h5_fspace, dims, NULL) == ndims, -1,
+            "Error: Could not get the shape of the dataset '%s'. ndims = %d\n", dataset_name, ndims);
+    XRETURN(dims[1] == (hsize_t) ncomponents && offset + count <= dims[0], -1,
+            "Error: Can not read %llu rows (with %d element(s) each) starting at row = %llu from dataset = '%s' "
+            "with shape (%llu, %llu)\n", (unsigned long long) count, ncomponents, (unsigned long long) offset,
+            dataset_name, (unsigned long long) dims[0], (unsigned long long) dims[1]);
+
+    const hsize_t file_start[2] = {offset, 0}, file_count[2] = {count, (hsize_t) ncomponents};
+    herr_t status = H5Sselect_hyperslab(h5_fspace, H5S_SELECT_SET, file_start, NULL, file_count, NULL);
+    XRETURN(status >= 0, -1, "Error: Failed to select the file hyperslab for dataset = '%s'\n", dataset_name);
+
+    const hsize_t mem_dims = count * (struct_size / field_size);
+    hid_t h5_memspace = H5Screate_simple(1, &mem_dims, NULL);
+    XRETURN(h5_memspace >= 0, -1, "Error: Failed to create memory space for dataset = '%s'\n", dataset_name);
+    const hsize_t mem_start = field_offset / field_size, mem_stride = struct_size / field_size;
+    const hsize_t mem_block = (hsize_t) ncomponents;
+    status = H5Sselect_hyperslab(h5_memspace, H5S_SELECT_SET, &mem_start, &mem_stride, &count, &mem_block);
+    XRETURN(status >= 0, -1, "Error: Failed to select the memory hyperslab for dataset = '%s'\n", dataset_name);
+
+    status = H5Dread(h5_dset, mem_dtype, h5_memspace, h5_fspace, H5P_DEFAULT, dst);
+    XRETURN(status >= 0, -1, "Error: Failed to read dataset = '%s' (offset = %llu, count = %llu)\n",
+            dataset_name, (unsigned long long) offset, (unsigned long long) count);
+
+    XRETURN(H5Sclose(h5_memspace) >= 0, -1, "Error: Failed to close the dataspace for = '%s'\n", dataset_name);
+    XRETURN(H5Sclose(h5_fspace) >= 0, -1, "Error: Failed to close the filespace for = '%s'\n", dataset_name);
+
+    return (herr_t) EXIT_SUCCESS;
+}
+
+
 int32_t fill_hdf5_metadata_names(struct HDF5_METADATA_NAMES *metadata_names, enum Valid_TreeTypes my_TreeType)
 {
     switch (my_TreeType) {
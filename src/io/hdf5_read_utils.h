@@ -10,6 +10,9 @@ extern "C" {
     extern herr_t read_attribute(hid_t fd, const char *group_name, const char *attr_name, void *attribute, const size_t dst_size);
     extern herr_t read_dataset_shape(hid_t fd, const char *dataset_name, int *ndims, hsize_t **dims);
     extern herr_t read_dataset(hid_t fd, const char *dataset_name, hid_t dataset_id, void *buffer, const size_t dst_size, const int check_size);
+    extern herr_t read_partial_dataset_into_structs(hid_t h5_dset, const char *dataset_name, const hsize_t offset, const hsize_t count,
+                                                    const int ncomponents, const hid_t mem_dtype,
+                                                    void *dst, const size_t struct_size, const size_t field_offset);
     extern int32_t fill_hdf5_metadata_names(struct HDF5_METADATA_NAMES *metadata_names, enum Valid_TreeTypes my_TreeType);
 
 
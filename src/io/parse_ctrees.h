@@ -30,6 +30,9 @@
 /* max. number of expected characters in one single-line */
 #define PARSE_CTREES_MAXBUFSIZE      1240
 
+/* number of bytes read (with one pread) at a time from a tree file -> the lines are parsed directly within this buffer */
+#define PARSE_CTREES_READBUFSIZE     (64*1024)
+
 #if PARSE_CTREES_MAX_COLNAME_LEN < 64
 #error Some of the Consistent-Trees column names are long. Please increase PARSE_CTREES_MAX_COLNAME_LEN to be at least 64
 #endif
@@ -320,6 +323,120 @@ static inline int parse_header_ctrees(char (*column_names)[PARSE_CTREES_MAX_COLN
     return EXIT_SUCCESS;
 }
 
+/* The ctrees columns are separated by (one or more) spaces or commas */
+static inline int is_ctrees_delimiter(const char c)
+{
+    return c == ' ' || c == ',';
+}
+
+/* Parses an integer in place (same as strtoll for base-10 values). The parsing stops at the first non-digit */
+static inline int64_t parse_ctrees_int(const char *p)
+{
+    int negative = 0;
+    if(*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+    uint64_t value = 0;
+    while(*p >= '0' && *p <= '9') {
+        value = value * 10 + (uint64_t) (*p - '0');
+        p++;
+    }
+    return negative ? -((int64_t) value):(int64_t) value;
+}
+
+/* Splits a decimal floating-point value (e.g., `-1.2345e+06`) into an integer mantissa and a
+   power of ten. Returns 0 if the value has too many digits or is not a plain decimal number
+   (e.g., `nan` or `inf`) -> the caller should then fall back to strtod/strtof */
+static inline int split_ctrees_float(const char *p, int *negative, uint64_t *mantissa, int *exp10)
+{
+    *negative = 0;
+    if(*p == '-' || *p == '+') {
+        *negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t m = 0;
+    int ndigits = 0, nsignificant = 0, e = 0;
+    while(*p >= '0' && *p <= '9') {
+        if(m > 0 || *p != '0') {
+            if(nsignificant == 19) return 0;
+            m = m * 10 + (uint64_t) (*p - '0');
+            nsignificant++;
+        }
+        ndigits++;
+        p++;
+    }
+    if(*p == '.') {
+        p++;
+        while(*p >= '0' && *p <= '9') {
+            if(m > 0 || *p != '0') {
+                if(nsignificant == 19) return 0;
+                m = m * 10 + (uint64_t) (*p - '0');
+                nsignificant++;
+            }
+            e--;
+            ndigits++;
+            p++;
+        }
+    }
+    if(ndigits == 0) return 0;
+
+    if(*p == 'e' || *p == 'E') {
+        p++;
+        int negative_exp = 0;
+        if(*p == '-' || *p == '+') {
+            negative_exp = (*p == '-');
+            p++;
+        }
+        if(!(*p >= '0' && *p <= '9')) return 0;
+        int explicit_exp = 0;
+        while(*p >= '0' && *p <= '9') {
+            if(explicit_exp < 10000) explicit_exp = explicit_exp * 10 + (*p - '0');
+            p++;
+        }
+        e += negative_exp ? -explicit_exp:explicit_exp;
+    }
+
+    /* the entire token must have been consumed */
+    if(!(*p == '\0' || is_ctrees_delimiter(*p))) return 0;
+
+    *mantissa = m;
+    *exp10 = e;
+    return 1;
+}
+
+/* Both the mantissa and the power of ten are exactly representable -> a single multiplication
+   (or division) gives the correctly rounded result, i.e., identical to strtod/strtof */
+static inline double parse_ctrees_double(const char *p)
+{
+    static const double exact_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                                 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    int negative, exp10;
+    uint64_t mantissa;
+    if(split_ctrees_float(p, &negative, &mantissa, &exp10) && mantissa <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+        double value = (double) mantissa;
+        value = exp10 < 0 ? value / exact_powers_of_ten[-exp10]:value * exact_powers_of_ten[exp10];
+        return negative ? -value:value;
+    }
+    return strtod(p, NULL);
+}
+
+static inline float parse_ctrees_float(const char *p)
+{
+    static const float exact_powers_of_ten[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    int negative, exp10;
+    uint64_t mantissa;
+    if(split_ctrees_float(p, &negative, &mantissa, &exp10) && mantissa <= (UINT64_C(1) << 24) && exp10 >= -10 && exp10 <= 10) {
+        float value = (float) mantissa;
+        value = exp10 < 0 ? value / exact_powers_of_ten[-exp10]:value * exact_powers_of_ten[exp10];
+        return negative ? -value:value;
+    }
+    return strtof(p, NULL);
+}
+
+
+/* Parses the (nul-terminated) line in place -> only the requested columns are converted */
 static inline int parse_line_ctrees(const char *linebuf, const struct ctrees_column_to_ptr *column_info, struct base_ptr_info *base_ptr_info)
 {
     if(base_ptr_info->nallocated == base_ptr_info->N) {
@@ -338,10 +455,8 @@ static inline int parse_line_ctrees(const char *linebuf, const struct ctrees_col
     }
 
     int icol = -1;
-    char *tofree, *string;
-    /* fprintf(stderr,"in %s>linebuf = `%s`\n\n", __FUNCTION__, linebuf); */
-    tofree = string = strdup(linebuf);
-    char *token = NULL;
+    const char *token = NULL;
+    const char *string = linebuf;
     for(int i=0;i<column_info->ncols;i++) {
         const int wanted_col = column_info->column_number[i];
         const int64_t base_ptr_idx = column_info->base_ptr_idx[i];
@@ -370,45 +485,39 @@ static inline int parse_line_ctrees(const char *linebuf, const struct ctrees_col
         /* this is the type for the destination (hence called 'field_types' rather than 'column_types') */
         const enum parse_numeric_types wanted_type = column_info->field_types[i];
 
-        /* there might be duplicate column numbers in matched_columns
-           then the following while loop should immediately exit (without
-           executing any lines within)
-           and we will re-use the previous parsed value of token */
+        /* skip over the columns that are not required. There might be duplicate column
+           numbers in matched_columns, then the following while loop will immediately exit
+           and we will re-use the previous value of token */
         while(icol < wanted_col || token == NULL) {
-            token = strsep(&string, " ,");
-            if(token != NULL && ((token[0] == '\0') || (token[0] == ' '))) {
-                continue;
+            while(is_ctrees_delimiter(*string)) string++;
+            if(*string == '\0') {
+                token = NULL;
+                break;
             }
+            token = string;
+            while(*string != '\0' && ! is_ctrees_delimiter(*string)) string++;
             icol++;
         }
-        PARSE_CTREES_XASSERT(token != NULL && token[0] != '\0' && icol == wanted_col, EXIT_FAILURE,
-                             "Error: token=`%s` should have valid non-zero numeric value at this stage.\n"
-                             "And the parsed col = %d should be equal to the requested column = %d\n",
-                             token, icol, wanted_col);
+        PARSE_CTREES_XASSERT(token != NULL && icol == wanted_col, EXIT_FAILURE,
+                             "Error: Could not find a valid numeric value in the line `%s`.\n"
+                             "The parsed col = %d should be equal to the requested column = %d\n",
+                             linebuf, icol, wanted_col);
 
         switch(wanted_type) {
         case F32:{
-            float tmp = strtof(token, NULL);
-            /* fprintf(stderr,"[float] := %f (col #%d)\n", tmp, wanted_col); */
-            *((float *) dest) = tmp;
+            *((float *) dest) = parse_ctrees_float(token);
             break;
         }
         case F64:{
-            double tmp = strtod(token, NULL);
-            /* fprintf(stderr,"[double] := %lf (col #%d)\n", tmp, wanted_col); */
-            *((double *) dest) = tmp;
+            *((double *) dest) = parse_ctrees_double(token);
             break;
         }
         case I32:{
-            int32_t tmp = (int32_t) strtol(token, NULL, 10);
-            /* fprintf(stderr,"[int32_t] := %"PRId32" (col #%d)\n", tmp, wanted_col); */
-            *((int32_t *) dest) = tmp;
+            *((int32_t *) dest) = (int32_t) parse_ctrees_int(token);
             break;
         }
         case I64:{
-            int64_t tmp = (int64_t) strtoll(token, NULL, 10);
-            /* fprintf(stderr,"[int64_t] := %"PRId64" (col #%d)\n", tmp, wanted_col); */
-            *((int64_t *) dest) = tmp;
+            *((int64_t *) dest) = parse_ctrees_int(token);
             break;
         }
         default:
@@ -417,10 +526,8 @@ static inline int parse_line_ctrees(const char *linebuf, const struct ctrees_col
             return EXIT_FAILURE;
         }
     }
-    free(tofree);
 
     base_ptr_info->N++;
-    /* fprintf(stderr,"parsed one line: base->N = %"PRId64" nallocated = %"PRId64" linebuf = `%s'\n", base_ptr_info->N, base_ptr_info->nallocated, linebuf); */
 
     return EXIT_SUCCESS;
 }
@@ -439,84 +546,77 @@ static inline int read_single_tree_ctrees(int fd, off_t offset, const struct ctr
         return EXIT_FAILURE;
     }
 
-    char read_buffer[PARSE_CTREES_MAXBUFSIZE];
-    const size_t to_read_bytes = PARSE_CTREES_MAXBUFSIZE - 1;
-    read_buffer[PARSE_CTREES_MAXBUFSIZE - 1] = '\0';
+    char *read_buffer = malloc(PARSE_CTREES_READBUFSIZE);
+    PARSE_CTREES_XASSERT(read_buffer != NULL, EXIT_FAILURE,
+                         "Error: Could not allocate memory for the read buffer (%d bytes)\n", PARSE_CTREES_READBUFSIZE);
+    const size_t to_read_bytes = PARSE_CTREES_READBUFSIZE - 1;
+    int status = EXIT_SUCCESS;
     int done_reading_tree = 0;
     /* two things can happen while reading -> EOF or I reach the next tree */
-    while(done_reading_tree == 0) {
-        /* int first = 1; */
+    while(done_reading_tree == 0 && status == EXIT_SUCCESS) {
         ssize_t nbytes_read = pread(fd, read_buffer, to_read_bytes, offset);
         if(nbytes_read == 0) {
             done_reading_tree = 1;/* we have reached end of file */
         } else if(nbytes_read < 0) {
             fprintf(stderr,"Error: trying to read %zu bytes from file failed. Encountered negative bytes read \n", to_read_bytes);
             perror(NULL);
-            return EXIT_FAILURE;
+            status = EXIT_FAILURE;
         } else {
-            const off_t start_offset = offset;
+            read_buffer[nbytes_read] = '\0';
             if(read_buffer[0] == '#') {
                 done_reading_tree = 1;
                 break;
             }
-            /* if(first == 1) { */
-            /*     fprintf(stderr,"read the first chunk\n`%s`\n\n",read_buffer); */
-            /*     first=0; */
-            /* } */
             if(nbytes_read < (ssize_t) to_read_bytes) {
                 done_reading_tree = 1;/* we have reached end of file but this read buffer needs to be processed*/
             }
 
-            /* some bytes were read -> now let's parse one line at a time */
-            char *start = &(read_buffer[0]);
+            /* some bytes were read -> now parse each (complete) line directly within the read buffer */
+            char *start = read_buffer;
             const char *end = read_buffer + nbytes_read;
-            char *this = start;
-            while(this < end) {
-                if(*this == '\n') {
-                    *this = '\0';
-
-                    if( ! ( this >= start && (this - start) < PARSE_CTREES_MAXBUFSIZE)) {
-                        fprintf(stderr, "Error: Expected this = %p to be >= start = %p "
-                                "and (this - start) = %td to be less than PARSE_CTREES_MAXBUFSIZE = %d\n",
-                                this, start, this - start, PARSE_CTREES_MAXBUFSIZE);
-                        return EXIT_FAILURE;
-                    }
-
-                    char linebuf[PARSE_CTREES_MAXBUFSIZE];
-                    memmove(linebuf, start, this - start + 1);
+            while(start < end) {
+                char *this = memchr(start, '\n', end - start);
+                if(this == NULL) {
+                    break;/* incomplete line -> will be read again (from the start) with the next pread */
+                }
+                *this = '\0';
 
-                    offset += (this - start + 1);
-                    start = this + 1;/* might point beyond valid memory but should not get de-referenced */
+                if((this - start) >= PARSE_CTREES_MAXBUFSIZE) {
+                    fprintf(stderr, "Error: Expected each line to contain less than PARSE_CTREES_MAXBUFSIZE = %d characters. "
+                            "Found a line with %td characters instead\n", PARSE_CTREES_MAXBUFSIZE, this - start);
+                    status = EXIT_FAILURE;
+                    break;
+                }
 
-                    /* fprintf(stderr,"calling parse_line with `%s`\n\n", linebuf); */
-                    int status = parse_line_ctrees(linebuf, column_info, base_ptr_info);
-                    if(status != EXIT_SUCCESS) {
-                        return status;
-                    }
-                    /* fprintf(stderr,"parsed one line. bytes processed = %"PRId64" nbytes_read = %zd this = %p strlen(linebuf) = %zu\n", */
-                    /*         offset - start_offset, nbytes_read, this, strlen(linebuf)); */
+                status = parse_line_ctrees(start, column_info, base_ptr_info);
+                if(status != EXIT_SUCCESS) {
+                    break;
                 }
-                this++;
-                if(this < end && *this == '#') {
-                    /* fprintf(stderr,"encountered '#'...stopping parsing\n"); */
+                offset += (this - start + 1);
+                start = this + 1;
+
+                if(start < end && *start == '#') {
                     /* we have encountered the beginning of a new tree (new line and begins with '#tree ')*/
                     done_reading_tree = 1;
-                    this = (char *) end;/* casting, otherwise compiler complains */
                     break;
                 }
             }
-            PARSE_CTREES_XASSERT(offset - start_offset <= nbytes_read, EXIT_FAILURE,
-                                 "Error: bytes processed = %"PRId64" should be at most num bytes read = %zd\n",
-                                 offset - start_offset, nbytes_read);
+
+            if(status == EXIT_SUCCESS && done_reading_tree == 0 && start == read_buffer) {
+                fprintf(stderr,"Error: Could not find a complete line within %zd bytes read\n", nbytes_read);
+                status = EXIT_FAILURE;
+            }
         }
     }
 
-    return EXIT_SUCCESS;
+    free(read_buffer);
+    return status;
 }
 
 /* these macros are for internal use only
    and can therefor be undefined */
 #undef PARSE_CTREES_MAXBUFSIZE
+#undef PARSE_CTREES_READBUFSIZE
 #undef PARSE_CTREES_XASSERT
 #undef LAST_NUMBERED_COLUMN_IN_CTREES
 
@@ -3,8 +3,11 @@
 #include <math.h>
 #include <string.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "read_tree_consistentrees_ascii.h"
 #include "../core_allvars.h"
@@ -18,6 +21,49 @@
 void convert_ctrees_conventions_to_lht(struct halo_data *halos, struct additional_info *info, const int64_t nhalos,
                                        const int32_t snap_offset, const double part_mass, const int64_t forest_offset);
 
+/* The (optional) forest cache stores the post-processed forests (i.e., after 'fix_flybys', 'fix_upid' and
+   'assign_mergertree_indices') as packed 'struct halo_data'. The cache file layout is:
+
+   struct ctrees_cache_header
+   struct ctrees_cache_source[nsources] -> size and checksum of each input file (forests.list, locations.dat and the tree files)
+   forests -> the halos for each forest, in the order the forests were loaded
+   int64_t nhalos_per_forest[nforests]
+   off_t offset_per_forest[nforests]  -> starts at 'index_offset'
+
+   The magic is written last, i.e., an incomplete cache file will never have a valid header.
+*/
+#define CTREES_CACHE_MAGIC "SAGECTC1" /* bump the trailing version whenever the layout of the cache file changes */
+
+enum ctrees_cache_states {
+    ctrees_cache_none = 0, /* no caching requested (or the cache could not be created) */
+    ctrees_cache_reading = 1, /* forests are read from a valid cache file */
+    ctrees_cache_writing = 2, /* forests are parsed from the ascii files and written to a new cache file */
+    ctrees_cache_failed = 3 /* something went wrong while writing the new cache file -> will be deleted */
+};
+
+struct ctrees_cache_header {
+    char magic[8];
+    int64_t sizeof_halo_data;
+    int64_t totnforests;
+    int64_t nforests;/* number of forests on this task */
+    int32_t ThisTask;
+    int32_t NTasks;
+    int32_t nsources;
+    int32_t unused;/* unused, but present for alignment */
+    double PartMass;/* used to compute the number of particles per halo */
+    int64_t index_offset;
+};
+
+struct ctrees_cache_source {
+    int64_t nbytes;
+    uint64_t checksum;
+};
+
+static int read_from_cache_file(const int fd, void *ptr, const size_t nbytes, off_t offset);
+static int setup_forest_cache_ctrees(struct forest_info *forests_info, const int ThisTask, const int NTasks, const struct params *run_params);
+static int write_forest_to_cache_ctrees(const int64_t forestnr, const struct halo_data *halos, const int64_t nhalos, struct ctrees_info *ctr);
+static void cleanup_forest_cache_ctrees(struct ctrees_info *ctr);
+
 void get_forests_filename_ctr_ascii(char *filename, const size_t len, const struct params *run_params)
 {
     /* this prints the first filename (tree_0_0_0.dat) */
@@ -79,6 +125,8 @@ int setup_forests_io_ctrees(struct forest_info *forests_info, const int ThisTask
             totnforests, INT_MAX);
 
     struct ctrees_info *ctr = &(forests_info->ctr);
+    ctr->cache_state = ctrees_cache_none;
+    ctr->cache_fd = -1;
 
     forests_info->totnforests = totnforests;
     const int64_t nforests_per_cpu = (int64_t) (totnforests/NTasks);
@@ -98,6 +146,7 @@ int setup_forests_io_ctrees(struct forest_info *forests_info, const int ThisTask
 
      */
     start_forestnum += ThisTask <= rem_nforests ? ThisTask:rem_nforests; /* assumes that "0<= ThisTask < NTasks" */
+    forests_info->start_forestnum_this_task = start_forestnum;
     const int64_t end_forestnum = start_forestnum + nforests_this_task; /* not inclusive, i.e., do not process foresnr == end_forestnum */
 
     int64_t ntrees_this_task = 0;
@@ -319,6 +368,13 @@ int setup_forests_io_ctrees(struct forest_info *forests_info, const int ThisTask
     run_params->FileNr_Mulfac = 0;
     run_params->ForestNr_Mulfac = 1000000000LL;/*MS: The ID needs to fit in 64 bits -> ID must be <  2^64 ~ 1e19.*/
 
+    if(run_params->ForestCacheDir[0] != '\0') {
+        status = setup_forest_cache_ctrees(forests_info, ThisTask, NTasks, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -328,6 +384,21 @@ int64_t load_forest_ctrees(const int32_t forestnr, struct halo_data **halos, str
     const int64_t ntrees = ctr->ntrees_per_forest[forestnr];
     const int64_t start_treenum = ctr->start_treenum_per_forest[forestnr];
 
+    if(ctr->cache_state == ctrees_cache_reading) {
+        const int64_t nhalos = ctr->cache_nhalos_per_forest[forestnr];
+        *halos = mymalloc(nhalos * sizeof(struct halo_data));
+        XRETURN( *halos != NULL, -MALLOC_FAILURE, "Error: Could not allocate memory to store halos\n"
+                 "nhalos = %"PRId64". Total number of bytes = %"PRIu64"\n",
+                 nhalos, nhalos*sizeof(struct halo_data));
+        int status = read_from_cache_file(ctr->cache_fd, *halos, nhalos * sizeof(struct halo_data), ctr->cache_offsets[forestnr]);
+        if(status != EXIT_SUCCESS) {
+            fprintf(stderr,"Error: Could not read forestnr = %d (nhalos = %"PRId64") from the forest cache '%s'\n",
+                    forestnr, nhalos, ctr->cache_filename);
+            return -FILE_READ_ERROR;
+        }
+        return nhalos;
+    }
+
     const int64_t default_nhalos_per_tree = 1000;/* allocate for a 100k halos per tree by default */
     int64_t nhalos_allocated = default_nhalos_per_tree * ntrees;
 
@@ -420,6 +491,11 @@ int64_t load_forest_ctrees(const int32_t forestnr, struct halo_data **halos, str
     /* Now we can free the additional_info struct */
     myfree(info);
 
+    if(ctr->cache_state == ctrees_cache_writing) {
+        /* Failure to write to the cache is not fatal -> the (incomplete) cache file will simply be deleted */
+        write_forest_to_cache_ctrees(forestnr, forest_halos, totnhalos, ctr);
+    }
+
     return totnhalos;
 }
 
@@ -465,6 +541,7 @@ void convert_ctrees_conventions_to_lht(struct halo_data *halos, struct additiona
 void cleanup_forests_io_ctrees(struct forest_info *forests_info)
 {
     struct ctrees_info *ctr = &(forests_info->ctr);
+    cleanup_forest_cache_ctrees(ctr);
     myfree(ctr->ntrees_per_forest);
     myfree(ctr->start_treenum_per_forest);
     myfree(ctr->tree_offsets);
@@ -475,3 +552,311 @@ void cleanup_forests_io_ctrees(struct forest_info *forests_info)
     }
     myfree(ctr->open_fds);
 }
+
+
+/* Unlike 'mypread', does not abort on failure (e.g., for a truncated cache file) */
+static int read_from_cache_file(const int fd, void *ptr, const size_t nbytes, off_t offset)
+{
+    char *buf = (char *) ptr;
+    size_t nleft = nbytes;
+    while(nleft > 0) {
+        const ssize_t nread = pread(fd, buf, nleft, offset);
+        if(nread <= 0) {
+            return FILE_READ_ERROR;
+        }
+        buf += nread;
+        offset += nread;
+        nleft -= nread;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* A fast (non-cryptographic) checksum of the entire file -> detects any changes to the input files */
+static int checksum_file(const int fd, struct ctrees_cache_source *source)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        perror(NULL);
+        return FILE_READ_ERROR;
+    }
+    source->nbytes = (int64_t) st.st_size;
+
+    const size_t bufsize = 4*1024*1024;
+    uint64_t *buf = malloc(bufsize);
+    CHECK_POINTER_AND_RETURN_ON_NULL(buf, "Failed to allocate %zu bytes for the buffer to compute the checksum", bufsize);
+
+    uint64_t hash = UINT64_C(14695981039346656037);
+    const uint64_t prime = UINT64_C(1099511628211);
+    off_t offset = 0;
+    while(offset < st.st_size) {
+        const ssize_t nread = pread(fd, buf, bufsize, offset);
+        if(nread <= 0) {
+            fprintf(stderr,"Error: Could not read from the file at offset = %"PRId64" while computing the checksum\n", (int64_t) offset);
+            perror(NULL);
+            free(buf);
+            return FILE_READ_ERROR;
+        }
+        const size_t nwords = nread/sizeof(buf[0]);
+        for(size_t i=0;i<nwords;i++) {
+            hash = (hash ^ buf[i]) * prime;
+            hash ^= hash >> 29;
+        }
+        const unsigned char *tail = (const unsigned char *) (buf + nwords);
+        for(size_t i=nwords*sizeof(buf[0]);i<(size_t) nread;i++) {
+            hash = (hash ^ *tail++) * prime;
+        }
+        offset += nread;
+    }
+    free(buf);
+    source->checksum = hash;
+
+    return EXIT_SUCCESS;
+}
+
+/* Computes the sizes and checksums of all the input files that determine the forests on this task */
+static int get_forest_cache_sources_ctrees(const struct ctrees_info *ctr, const struct params *run_params,
+                                           int32_t *nsources, struct ctrees_cache_source **sources)
+{
+    /* Only the tree files that contain (at least) one tree on this task are included */
+    int8_t *file_used = calloc(ctr->numfiles, sizeof(file_used[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(file_used, "Failed to allocate %d elements of size %zu for file_used", ctr->numfiles, sizeof(file_used[0]));
+    int64_t ntrees_this_task = 0;
+    for(int64_t i=0;i<ctr->nforests;i++) {
+        ntrees_this_task += ctr->ntrees_per_forest[i];
+    }
+    for(int64_t i=0;i<ntrees_this_task;i++) {
+        for(int j=0;j<ctr->numfiles;j++) {
+            if(ctr->tree_fd[i] == ctr->open_fds[j]) {
+                file_used[j] = 1;
+                break;
+            }
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    *sources = calloc(ctr->numfiles + 2, sizeof(**sources));
+    if(*sources == NULL) {
+        fprintf(stderr,"Error: Failed to allocate %d elements of size %zu for the cache sources\n",
+                ctr->numfiles + 2, sizeof(**sources));
+        status = MALLOC_FAILURE;
+        goto fail;
+    }
+
+    const char *fixed_files[] = {"forests.list", "locations.dat"};
+    int32_t n = 0;
+    for(int i=0;i<2;i++) {
+        char filename[2*MAX_STRING_LEN];
+        snprintf(filename, sizeof(filename), "%s/%s", run_params->SimulationDir, fixed_files[i]);
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0) {
+            fprintf(stderr,"Error: Could not open file `%s` to compute the checksum\n", filename);
+            status = FILE_NOT_FOUND;
+            goto fail;
+        }
+        status = checksum_file(fd, &((*sources)[n]));
+        close(fd);
+        if(status != EXIT_SUCCESS) {
+            goto fail;
+        }
+        n++;
+    }
+
+    for(int j=0;j<ctr->numfiles;j++) {
+        if(file_used[j] == 0) continue;
+        status = checksum_file(ctr->open_fds[j], &((*sources)[n]));
+        if(status != EXIT_SUCCESS) {
+            goto fail;
+        }
+        n++;
+    }
+    free(file_used);
+    *nsources = n;
+
+    return EXIT_SUCCESS;
+
+fail:
+    free(file_used);
+    free(*sources);
+    *sources = NULL;
+    return status;
+}
+
+/* Checks whether the existing cache file (if any) matches the current input files and run */
+static int read_forest_cache_index_ctrees(struct ctrees_info *ctr, const struct ctrees_cache_header *wanted,
+                                          const struct ctrees_cache_source *sources)
+{
+    int fd = open(ctr->cache_filename, O_RDONLY);
+    if(fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct ctrees_cache_header header;
+    struct ctrees_cache_source *cached_sources = NULL;
+    int status = read_from_cache_file(fd, &header, sizeof(header), 0);
+    if(status != EXIT_SUCCESS || memcmp(header.magic, wanted->magic, sizeof(header.magic)) != 0 ||
+       header.sizeof_halo_data != wanted->sizeof_halo_data || header.totnforests != wanted->totnforests ||
+       header.nforests != wanted->nforests || header.ThisTask != wanted->ThisTask || header.NTasks != wanted->NTasks ||
+       header.nsources != wanted->nsources || header.PartMass != wanted->PartMass) {
+        goto invalid;
+    }
+
+    cached_sources = malloc(header.nsources * sizeof(cached_sources[0]));
+    if(cached_sources == NULL ||
+       read_from_cache_file(fd, cached_sources, header.nsources * sizeof(cached_sources[0]), sizeof(header)) != EXIT_SUCCESS ||
+       memcmp(cached_sources, sources, header.nsources * sizeof(cached_sources[0])) != 0) {
+        goto invalid;
+    }
+    free(cached_sources);
+    cached_sources = NULL;
+
+    const size_t nhalos_nbytes = ctr->nforests * sizeof(ctr->cache_nhalos_per_forest[0]);
+    if(read_from_cache_file(fd, ctr->cache_nhalos_per_forest, nhalos_nbytes, header.index_offset) != EXIT_SUCCESS ||
+       read_from_cache_file(fd, ctr->cache_offsets, ctr->nforests * sizeof(ctr->cache_offsets[0]),
+                            header.index_offset + nhalos_nbytes) != EXIT_SUCCESS) {
+        goto invalid;
+    }
+
+    ctr->cache_fd = fd;
+    return EXIT_SUCCESS;
+
+ invalid:
+    free(cached_sources);
+    close(fd);
+    return EXIT_FAILURE;
+}
+
+static int setup_forest_cache_ctrees(struct forest_info *forests_info, const int ThisTask, const int NTasks, const struct params *run_params)
+{
+    struct ctrees_info *ctr = &(forests_info->ctr);
+    snprintf(ctr->cache_filename, sizeof(ctr->cache_filename), "%s/%s_ctrees_cache_%d_of_%d.bin",
+             run_params->ForestCacheDir, run_params->TreeName, ThisTask, NTasks);
+
+    struct ctrees_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CTREES_CACHE_MAGIC, sizeof(header.magic));
+    header.sizeof_halo_data = sizeof(struct halo_data);
+    header.totnforests = forests_info->totnforests;
+    header.nforests = ctr->nforests;
+    header.ThisTask = ThisTask;
+    header.NTasks = NTasks;
+    header.PartMass = run_params->PartMass;
+
+    struct ctrees_cache_source *sources = NULL;
+    int status = get_forest_cache_sources_ctrees(ctr, run_params, &(header.nsources), &sources);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    ctr->cache_nhalos_per_forest = mymalloc(ctr->nforests * sizeof(ctr->cache_nhalos_per_forest[0]));
+    ctr->cache_offsets = mymalloc(ctr->nforests * sizeof(ctr->cache_offsets[0]));
+    if(ctr->cache_nhalos_per_forest == NULL || ctr->cache_offsets == NULL) {
+        fprintf(stderr,"Error: Could not allocate memory to store the number of halos and the offset per cached forest\n");
+        free(sources);
+        return MALLOC_FAILURE;
+    }
+
+    if(read_forest_cache_index_ctrees(ctr, &header, sources) == EXIT_SUCCESS) {
+        ctr->cache_state = ctrees_cache_reading;
+        free(sources);
+        if(ThisTask == 0) {
+            fprintf(stdout, "Reading the Consistent-Trees forests from the cache '%s'\n", ctr->cache_filename);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    /* No valid cache -> write a new one (to a temporary file that is only renamed once all the forests have been written) */
+    snprintf(ctr->cache_tmp_filename, sizeof(ctr->cache_tmp_filename), "%s.tmp.%d", ctr->cache_filename, (int) getpid());
+    ctr->cache_fd = open(ctr->cache_tmp_filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(ctr->cache_fd < 0) {
+        fprintf(stderr,"Warning: Could not create the forest cache file '%s' (%s). Continuing without the cache\n",
+                ctr->cache_tmp_filename, strerror(errno));
+        free(sources);
+        myfree(ctr->cache_offsets);
+        myfree(ctr->cache_nhalos_per_forest);
+        return EXIT_SUCCESS;
+    }
+
+    /* The magic is only written once all the forests (and the index) have been written */
+    memset(header.magic, 0, sizeof(header.magic));
+    const off_t sources_offset = sizeof(header);
+    const size_t sources_nbytes = header.nsources * sizeof(sources[0]);
+    const int write_ok = mypwrite(ctr->cache_fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+        && mypwrite(ctr->cache_fd, sources, sources_nbytes, sources_offset) == (ssize_t) sources_nbytes;
+    free(sources);
+    ctr->cache_state = write_ok ? ctrees_cache_writing:ctrees_cache_failed;
+    ctr->cache_nbytes = sources_offset + sources_nbytes;
+    ctr->cache_nforests_written = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static int write_forest_to_cache_ctrees(const int64_t forestnr, const struct halo_data *halos, const int64_t nhalos, struct ctrees_info *ctr)
+{
+    const off_t nbytes = nhalos * sizeof(halos[0]);
+    off_t offset;
+#ifdef OPENMP
+#pragma omp atomic capture
+#endif
+    {
+        offset = ctr->cache_nbytes;
+        ctr->cache_nbytes += nbytes;
+    }
+
+    ctr->cache_nhalos_per_forest[forestnr] = nhalos;
+    ctr->cache_offsets[forestnr] = offset;
+
+    if(nbytes > 0 && mypwrite(ctr->cache_fd, halos, nbytes, offset) != (ssize_t) nbytes) {
+        fprintf(stderr,"Warning: Could not write forestnr = %"PRId64" to the forest cache '%s' (%s). The cache will not be created\n",
+                forestnr, ctr->cache_tmp_filename, strerror(errno));
+#ifdef OPENMP
+#pragma omp atomic write
+#endif
+        ctr->cache_state = ctrees_cache_failed;
+        return FILE_WRITE_ERROR;
+    }
+
+#ifdef OPENMP
+#pragma omp atomic update
+#endif
+    ctr->cache_nforests_written++;
+
+    return EXIT_SUCCESS;
+}
+
+static void cleanup_forest_cache_ctrees(struct ctrees_info *ctr)
+{
+    if(ctr->cache_fd < 0) {
+        return;
+    }
+
+    if(ctr->cache_state == ctrees_cache_writing) {
+        int complete = ctr->cache_nforests_written == ctr->nforests;
+        if(complete) {
+            /* All the forests have been written -> write the index, then the index offset and finally the magic */
+            const int64_t index_offset = ctr->cache_nbytes;
+            const size_t nhalos_nbytes = ctr->nforests * sizeof(ctr->cache_nhalos_per_forest[0]);
+            const size_t offsets_nbytes = ctr->nforests * sizeof(ctr->cache_offsets[0]);
+            complete = mypwrite(ctr->cache_fd, ctr->cache_nhalos_per_forest, nhalos_nbytes, index_offset) == (ssize_t) nhalos_nbytes
+                && mypwrite(ctr->cache_fd, ctr->cache_offsets, offsets_nbytes, index_offset + nhalos_nbytes) == (ssize_t) offsets_nbytes
+                && mypwrite(ctr->cache_fd, &index_offset, sizeof(index_offset),
+                            offsetof(struct ctrees_cache_header, index_offset)) == (ssize_t) sizeof(index_offset)
+                && fsync(ctr->cache_fd) == 0
+                && mypwrite(ctr->cache_fd, CTREES_CACHE_MAGIC, sizeof(((struct ctrees_cache_header *) 0)->magic),
+                            offsetof(struct ctrees_cache_header, magic)) == (ssize_t) sizeof(((struct ctrees_cache_header *) 0)->magic)
+                && rename(ctr->cache_tmp_filename, ctr->cache_filename) == 0;
+            if(complete == 0) {
+                fprintf(stderr,"Warning: Could not finalise the forest cache '%s' (%s)\n", ctr->cache_filename, strerror(errno));
+            }
+        }
+        if(complete == 0) {
+            unlink(ctr->cache_tmp_filename);
+        }
+    } else if(ctr->cache_state == ctrees_cache_failed) {
+        unlink(ctr->cache_tmp_filename);
+    }
+
+    close(ctr->cache_fd);
+    ctr->cache_fd = -1;
+    myfree(ctr->cache_nhalos_per_forest);
+    myfree(ctr->cache_offsets);
+}
@@ -204,6 +204,7 @@ int setup_forests_io_ctrees_hdf5(struct forest_info *forests_info, const int Thi
     ctr_h5->nforests = nforests_this_task;
     //ctr_h5->start_forestnum = start_forestnum;
     forests_info->nforests_this_task = nforests_this_task;/* Note: Number of forests to process on this task is also stored at the container struct*/
+    forests_info->start_forestnum_this_task = start_forestnum;
 
     int64_t *num_forests_to_process_per_file = mycalloc(totnfiles, sizeof(num_forests_to_process_per_file[0]));
     int64_t *start_forestnum_to_process_per_file = mymalloc(totnfiles * sizeof(start_forestnum_to_process_per_file[0]));
@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <hdf5.h>
 
 #include "read_tree_gadget4_hdf5.h"
@@ -13,8 +14,26 @@
 #include "../core_mymalloc.h"
 #include "forest_utils.h"
 
+/* Limit on the number of halos in a batch of consecutive forests that are read in together
+   (a forest with more halos than this limit is read in on its own) */
+#define GADGET4_MAX_NHALOS_PER_BATCH    (1 << 18)
+
+enum gadget4_field_type {
+    g4_int_field = 0,
+    g4_float_field = 1,
+    g4_llong_field = 2,
+};
+
+struct gadget4_field {
+    const char *name;/* dataset name within the 'TreeHalos' group */
+    size_t offset;/* offset of the destination member within 'struct halo_data' */
+    int ncomponents;/* number of elements per halo */
+    enum gadget4_field_type type;/* type of the destination member */
+};
+
 
 /* Local Proto-Types */
+static int setup_forest_batches_gadget4_hdf5(struct gadget4_info *g4);
 static void get_forests_filename_gadget4_hdf5(char *filename, const size_t len, const int filenr, const struct params *run_params);
 
 int load_tree_table_gadget4_hdf5(const int firstfile, const int lastfile, const int64_t *totnforests_per_file, 
@@ -174,6 +193,7 @@ int setup_forests_io_gadget4_hdf5(struct forest_info *forests_info,
     fprintf(stderr,"Thistask = %d start_forestnum = %"PRId64" end_forestnum = %"PRId64"\n", ThisTask, start_forestnum, end_forestnum);
 #endif
     forests_info->nforests_this_task = nforests_this_task;
+    forests_info->start_forestnum_this_task = start_forestnum;
     g4->nforests = nforests_this_task;
     int64_t nhalos_this_task = 0;
     for(int64_t i=start_forestnum;i<=end_forestnum;i++) {
@@ -536,6 +556,11 @@ int setup_forests_io_gadget4_hdf5(struct forest_info *forests_info,
     run_params->FileNr_Mulfac = 1000000000000000LL;
     run_params->ForestNr_Mulfac = 1000000000LL;
 
+    status = setup_forest_batches_gadget4_hdf5(g4);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
     fprintf(stderr,"[On ThisTask = %d] start_forestnum = %"PRId64" end_forestnum = %"PRId64" start_filenum = %d end_filenum = %d "
                     "file_nhalo_offset_for_start_forestnum = %"PRId64" end_halonum = %"PRId64"\n", 
                     ThisTask, start_forestnum, end_forestnum, start_filenum, end_filenum, 
@@ -547,36 +572,185 @@ int setup_forests_io_gadget4_hdf5(struct forest_info *forests_info,
 }
 
 
-#define READ_TREE_PROPERTY(fd, offset, sage_name, dataset_name, count, C_dtype) { \
-        const long long ndim = 1;                                                  \
-        READ_PARTIAL_DATASET(fd, "TreeHalos", dataset_name, ndim, offset, count, buffer);\
-        C_dtype *macro_x = (C_dtype *) buffer;                          \
-        for (hsize_t halo_idx = 0; halo_idx < count[0]; halo_idx++){       \
-            local_halos[halo_idx].sage_name = *macro_x;                 \
-            macro_x++;                                                  \
-        }                                                               \
-    }
-
-#define READ_TREE_PROPERTY_MULTIPLEDIM(fd, offset, sage_name, dataset_name, ndim, count, C_dtype) { \
-        const long long dims = 2;                                                  \
-        READ_PARTIAL_DATASET(fd, "TreeHalos", dataset_name, dims, offset, count, buffer);\
-        C_dtype *macro_x = (C_dtype *) buffer;                          \
-        for (hsize_t halo_idx = 0; halo_idx < count[0]; halo_idx++){       \
-            for (int dim = 0; dim < NDIM; dim++) {                      \
-                local_halos[halo_idx].sage_name[dim] = *macro_x;        \
-                macro_x++;                                              \
-            }                                                           \
-        }                                                               \
+/* Fields read from the 'TreeHalos' group, with the destination member within 'struct halo_data'. HDF5 converts
+   from the on-disk datatype, so the Gadget4 'MyFloat' and 'MyIDType' can be either 4 or 8 bytes */
+static const struct gadget4_field gadget4_fields[] = {
+    /* Merger Tree Pointers */
+    {"TreeDescendant", offsetof(struct halo_data, Descendant), 1, g4_int_field},
+    {"TreeFirstProgenitor", offsetof(struct halo_data, FirstProgenitor), 1, g4_int_field},
+    {"TreeNextProgenitor", offsetof(struct halo_data, NextProgenitor), 1, g4_int_field},
+    {"TreeFirstHaloInFOFgroup", offsetof(struct halo_data, FirstHaloInFOFgroup), 1, g4_int_field},
+    {"TreeNextHaloInFOFgroup", offsetof(struct halo_data, NextHaloInFOFgroup), 1, g4_int_field},
+
+    /* Halo Properties */
+    {"SubhaloLen", offsetof(struct halo_data, Len), 1, g4_int_field},
+    {"Group_M_Crit200", offsetof(struct halo_data, Mvir), 1, g4_float_field},//MS: 16/9/2019 sage uses Mvir but assumes that contains M200c
+    {"SubhaloPos", offsetof(struct halo_data, Pos), NDIM, g4_float_field},//needs to be converted from kpc/h -> Mpc/h
+    {"SubhaloVel", offsetof(struct halo_data, Vel), NDIM, g4_float_field},//km/s
+    {"SubhaloVelDisp", offsetof(struct halo_data, VelDisp), 1, g4_float_field},//km/s
+    {"SubhaloVmax", offsetof(struct halo_data, Vmax), 1, g4_float_field},//km/s
+    {"SubhaloSpin", offsetof(struct halo_data, Spin), NDIM, g4_float_field},//(kpc/h)(km/s) -> convert to (Mpc)*(km/s). Does it need sqrt(3)?
+    {"SubhaloIDMostbound", offsetof(struct halo_data, MostBoundID), 1, g4_llong_field},
+
+    /* File Position Info */
+    {"SnapNum", offsetof(struct halo_data, SnapNum), 1, g4_int_field},
+    {"SubhaloNr", offsetof(struct halo_data, SubhaloIndex), 1, g4_int_field},//MS: Unsure if this is the right field mapping (another option is SubhaloNumber)
+};
+#define NUM_GADGET4_FIELDS   ((int) (sizeof(gadget4_fields)/sizeof(gadget4_fields[0])))
+
+struct gadget4_forest_batch {
+    int64_t nbatches;
+    int64_t *start_forestnr;/* batch 'ibatch' contains the (task-local) forests [start_forestnr[ibatch], start_forestnr[ibatch + 1]),
+                               shape (nbatches + 1, ) */
+    int64_t *halo_offset_in_batch;/* where the halos for each forest begin within the halos of its batch, shape (nforests, ) */
+    int64_t curr_batch;/* the batch currently contained in 'halos' (-1 when none has been read yet) */
+    int64_t curr_first_forestnr;/* first forest of the current batch that is contained in 'halos' */
+    int64_t prev_forestnr;/* forest that was loaded last (-2 when none has been loaded yet) */
+    struct halo_data *halos;/* halos for (the remaining) forests in the current batch. Only used for batches with more than
+                               one forest; a batch with a single forest is read directly into that forest's halos */
+    hid_t *h5_dsets;/* the 'TreeHalos' datasets, opened on first use and kept open until cleanup, shape (numfiles, NUM_GADGET4_FIELDS) */
+};
+
+
+static hid_t get_mem_dtype_gadget4_field(const enum gadget4_field_type type)
+{
+    switch(type) {
+    case g4_int_field:
+        return H5T_NATIVE_INT;
+    case g4_float_field:
+        return H5T_NATIVE_FLOAT;
+    case g4_llong_field:
+        return H5T_NATIVE_LLONG;
+    default:
+        fprintf(stderr,"Error: Unknown field type = %d in %s\n", (int) type, __FUNCTION__);
+        return -1;
     }
+}
 
+/* Splits the forests on this task into batches of consecutive forests, with each batch containing (at most)
+   GADGET4_MAX_NHALOS_PER_BATCH halos -- unless the batch consists of a single forest */
+static int setup_forest_batches_gadget4_hdf5(struct gadget4_info *g4)
+{
+    struct gadget4_forest_batch *batch = mycalloc(1, sizeof(*batch));
+    CHECK_POINTER_AND_RETURN_ON_NULL(batch, "Failed to allocate %zu bytes for the gadget4 forest batch\n", sizeof(*batch));
+    g4->batch = batch;
+    batch->curr_batch = -1;
+    batch->curr_first_forestnr = -1;
+    batch->prev_forestnr = -2;
+
+    batch->h5_dsets = mymalloc(g4->numfiles * NUM_GADGET4_FIELDS * sizeof(batch->h5_dsets[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(batch->h5_dsets, "Failed to allocate %d elements of size %zu for the open gadget4 datasets\n",
+                                     g4->numfiles * NUM_GADGET4_FIELDS, sizeof(batch->h5_dsets[0]));
+    for(int i=0;i<g4->numfiles * NUM_GADGET4_FIELDS;i++) {
+        batch->h5_dsets[i] = -1;
+    }
 
+    batch->start_forestnr = mymalloc((g4->nforests + 1) * sizeof(batch->start_forestnr[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(batch->start_forestnr, "Failed to allocate %"PRId64" elements of size %zu for the batch start forests\n",
+                                     g4->nforests + 1, sizeof(batch->start_forestnr[0]));
+    batch->halo_offset_in_batch = mymalloc(g4->nforests * sizeof(batch->halo_offset_in_batch[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(batch->halo_offset_in_batch, "Failed to allocate %"PRId64" elements of size %zu for the halo offsets within batch\n",
+                                     g4->nforests, sizeof(batch->halo_offset_in_batch[0]));
 
-int64_t load_forest_gadget4_hdf5(const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
+    int64_t nbatches = 0, nhalos_this_batch = 0, max_nhalos_multi_forest_batch = 0;
+    for(int64_t iforest=0;iforest<g4->nforests;iforest++) {
+        if(iforest == 0 || nhalos_this_batch + g4->nhalos_per_forest[iforest] > GADGET4_MAX_NHALOS_PER_BATCH) {
+            batch->start_forestnr[nbatches] = iforest;
+            nbatches++;
+            nhalos_this_batch = 0;
+        }
+        batch->halo_offset_in_batch[iforest] = nhalos_this_batch;
+        nhalos_this_batch += g4->nhalos_per_forest[iforest];
+        if(iforest > batch->start_forestnr[nbatches - 1] && nhalos_this_batch > max_nhalos_multi_forest_batch) {
+            max_nhalos_multi_forest_batch = nhalos_this_batch;
+        }
+    }
+    batch->start_forestnr[nbatches] = g4->nforests;
+    batch->nbatches = nbatches;
+
+    if(max_nhalos_multi_forest_batch > 0) {
+        batch->halos = mymalloc(max_nhalos_multi_forest_batch * sizeof(batch->halos[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(batch->halos, "Failed to allocate %"PRId64" halos (each of size %zu) for the gadget4 forest batch\n",
+                                         max_nhalos_multi_forest_batch, sizeof(batch->halos[0]));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Reads 'count' consecutive halos, starting at (file-local) halo number 'offset' within the file 'fd_index' */
+static int read_halos_from_file_gadget4_hdf5(struct gadget4_info *g4, const int32_t fd_index, const hsize_t offset,
+                                             const hsize_t count, struct halo_data *dst)
+{
+    XRETURN(fd_index >= 0 && fd_index < g4->numfiles, -1, "Error: Index for HDF5 file pointer = %d should be between [0, %d)\n",
+            fd_index, g4->numfiles);
+    if(count == 0) return EXIT_SUCCESS;
+
+    const hid_t fd = g4->open_h5_fds[fd_index];
+    /* CHECK: HDF5 file pointer is valid */
+    XRETURN( fd > 0, -INVALID_FILE_POINTER, "Error: File pointer is NULL (i.e., you need to open the file before reading).\n"
+            "This error should already have been caught before reaching this line\n");
+
+    for(int ifield=0;ifield<NUM_GADGET4_FIELDS;ifield++) {
+        const struct gadget4_field *field = &gadget4_fields[ifield];
+        hid_t *h5_dset = &(g4->batch->h5_dsets[fd_index * NUM_GADGET4_FIELDS + ifield]);
+        if(*h5_dset < 0) {
+            char dataset_name[MAX_STRING_LEN];
+            snprintf(dataset_name, MAX_STRING_LEN - 1, "TreeHalos/%s", field->name);
+            *h5_dset = H5Dopen2(fd, dataset_name, H5P_DEFAULT);
+            XRETURN(*h5_dset >= 0, -HDF5_ERROR, "Error: Could not open dataset = '%s' (file index = %d)\n", dataset_name, fd_index);
+        }
+        herr_t status = read_partial_dataset_into_structs(*h5_dset, field->name, offset, count, field->ncomponents,
+                                                          get_mem_dtype_gadget4_field(field->type),
+                                                          dst, sizeof(struct halo_data), field->offset);
+        XRETURN(status >= 0, -HDF5_ERROR, "Error: Failed to read %llu halos starting at halo = %llu for dataset = '%s' (file index = %d)\n",
+                (unsigned long long) count, (unsigned long long) offset, field->name, fd_index);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Reads all the halos for the forests [start_forestnr, end_forestnr). Consecutive forests are stored contiguously,
+   with a forest potentially continuing at the beginning of the next file -> one hyperslab per field per file */
+static int read_forests_gadget4_hdf5(struct gadget4_info *g4, const int64_t start_forestnr, const int64_t end_forestnr,
+                                     struct halo_data *dst)
 {
+    int32_t fd_index = g4->start_h5_fd_index[start_forestnr];
+    hsize_t offset = g4->offset_in_nhalos_first_file_for_forests[start_forestnr];
+    hsize_t count = 0;
+    for(int64_t iforest=start_forestnr;iforest<end_forestnr;iforest++) {
+        for(int32_t ifile=0;ifile<g4->num_files_per_forest[iforest];ifile++) {
+            const int32_t this_fd_index = g4->start_h5_fd_index[iforest] + ifile;
+            const hsize_t this_offset = ifile == 0 ? (hsize_t) g4->offset_in_nhalos_first_file_for_forests[iforest]:0;
+            if(this_fd_index != fd_index) {
+                int status = read_halos_from_file_gadget4_hdf5(g4, fd_index, offset, count, dst);
+                if(status != EXIT_SUCCESS) {
+                    return status;
+                }
+                dst += count;
+                fd_index = this_fd_index;
+                offset = this_offset;
+                count = 0;
+            }
+            XRETURN(this_offset == offset + count, -1,
+                    "Error: The halos for forestnr = %"PRId64" begin at halo = %llu within file index = %d but the halos for the "
+                    "previous forest end at halo = %llu\n", iforest, (unsigned long long) this_offset, this_fd_index,
+                    (unsigned long long) (offset + count));
+            count += g4->nhalos_per_file_per_forest[iforest][ifile];
+        }
+    }
 
-    /* Since the Gadget4 mergertree allows trees to be split across multiple files, we need to loop over the files */
-    const struct gadget4_info *g4 = &(forests_info->gadget4);
-    // const int64_t treenum_in_file = forests_info->original_treenr[forestnr];
+    return read_halos_from_file_gadget4_hdf5(g4, fd_index, offset, count, dst);
+}
+
+
+int64_t load_forest_gadget4_hdf5(const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
+{
+    /* Since the Gadget4 mergertree allows trees to be split across multiple files, the halos for an entire batch of
+       forests are read in together (one hyperslab per field per file) and then copied out for each forest */
+    struct gadget4_info *g4 = &(forests_info->gadget4);
+    struct gadget4_forest_batch *batch = g4->batch;
+    XRETURN(forestnr >= 0 && forestnr < g4->nforests, -1, "Error: forestnr = %"PRId64" should be between [0, %"PRId64")\n",
+            forestnr, g4->nforests);
     const int64_t nhalos = g4->nhalos_per_forest[forestnr];
 
     /* allocate the entire memory space required to store the halos*/
@@ -584,82 +758,52 @@ int64_t load_forest_gadget4_hdf5(const int64_t forestnr, struct halo_data **halo
     XRETURN(*halos != NULL, -MALLOC_FAILURE,
             "Error: Could not allocate memory for %"PRId64" halos. Size requested = %"PRIu64" bytes\n",
             nhalos, nhalos * sizeof(struct halo_data));
-
     struct halo_data *local_halos = *halos;
 
-    // char dataset_name[MAX_STRING_LEN];
-    void *buffer; // Buffer to hold the read HDF5 data.
-    buffer = malloc(nhalos * NDIM * sizeof(double)); // The largest data-type will be double.
-    XRETURN(buffer != NULL, -MALLOC_FAILURE,
-            "Error: Could not allocate memory for %"PRId64" halos in the HDF5 buffer. Size requested = %"PRIu64" bytes\n",
-            nhalos, nhalos * NDIM * sizeof(double));
-
-    const int32_t numfiles_this_forest = g4->num_files_per_forest[forestnr];
-    for(int32_t ifile=0; ifile<numfiles_this_forest;ifile++) {
-        const int32_t fd_index = g4->start_h5_fd_index[forestnr] + ifile;
-        XRETURN(fd_index < g4->numfiles, -1, "Error: Index for HDF5 file pointer = %d should be between [0, %d)\n",
-                fd_index, g4->numfiles);
-        const hid_t fd = g4->open_h5_fds[fd_index];
-        /* CHECK: HDF5 file pointer is valid */
-        XRETURN( fd > 0, -INVALID_FILE_POINTER, "Error: File pointer is NULL (i.e., you need to open the file before reading).\n"
-                "This error should already have been caught before reaching this line\n");
-
-
-        hsize_t nhalo_offset[1] = {0};
-        if(ifile == 0) {
-            nhalo_offset[0] = g4->offset_in_nhalos_first_file_for_forests[forestnr];
+    /* Locate the batch containing this forest (the batches are sorted by forestnr) */
+    int64_t lo = 0, hi = batch->nbatches - 1;
+    while(lo < hi) {
+        const int64_t mid = lo + (hi - lo + 1)/2;
+        if(batch->start_forestnr[mid] <= forestnr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
-        // fprintf(stderr,"forestnr = %"PRId64" ifile = %d fd_index = %d (numfiles_this_task=%d) nhalos = %"PRId64" offset = %lld\n",
-        //        forestnr, ifile, fd_index, g4->numfiles, nhalos, nhalo_offset[0]);
-
-        const hsize_t numhalos_this_file[1] = {g4->nhalos_per_file_per_forest[forestnr][ifile]};
-        // fprintf(stderr,"forestnr = %"PRId64" fd = %ld (numfiles = %d) treenum = %"PRId64" nhalos = %"PRId64" nhalos_this_file = %llu\n", 
-        //                forestnr, (long) fd, numfiles_this_forest, treenum_in_file, nhalos, numhalos_this_file[0]);
-
-        /* Merger Tree Pointers */
-        READ_TREE_PROPERTY(fd, nhalo_offset, Descendant, "TreeDescendant", numhalos_this_file, int);
-        READ_TREE_PROPERTY(fd, nhalo_offset, FirstProgenitor, "TreeFirstProgenitor", numhalos_this_file, int);
-        READ_TREE_PROPERTY(fd, nhalo_offset, NextProgenitor, "TreeNextProgenitor", numhalos_this_file, int);
-        READ_TREE_PROPERTY(fd, nhalo_offset, FirstHaloInFOFgroup, "TreeFirstHaloInFOFgroup", numhalos_this_file, int);
-        READ_TREE_PROPERTY(fd, nhalo_offset, NextHaloInFOFgroup, "TreeNextHaloInFOFgroup", numhalos_this_file, int);
-
-        /* Halo Properties */
-        const hsize_t multi_dim_offset[] = {nhalo_offset[0], 0};
-        const hsize_t multi_dim_count[] = {numhalos_this_file[0], 3};
-        READ_TREE_PROPERTY(fd, nhalo_offset, Len, "SubhaloLen", numhalos_this_file, int);
-        // READ_TREE_PROPERTY(fd, nhalo_offset, M_Mean200, Group_M_Mean200, numhalos_this_file, float);//MS: units 10^10 Msun/h for all Illustris mass fields
-        // READ_TREE_PROPERTY(fd, nhalo_offset, M_Mean200, "SubhaloMass", numhalos_this_file, float);//MS: units 10^10 Msun/h for all Illustris mass fields
-        READ_TREE_PROPERTY(fd, nhalo_offset, Mvir, "Group_M_Crit200", numhalos_this_file, float);//MS: 16/9/2019 sage uses Mvir but assumes that contains M200c
-        // READ_TREE_PROPERTY(fd, nhalo_offset, M_TopHat, Group_M_TopHat200, numhalos_this_file, float);
-        READ_TREE_PROPERTY_MULTIPLEDIM(fd, multi_dim_offset, Pos, "SubhaloPos", 3, multi_dim_count, float);//needs to be converted from kpc/h -> Mpc/h
-        READ_TREE_PROPERTY_MULTIPLEDIM(fd, multi_dim_offset, Vel, "SubhaloVel", 3, multi_dim_count, float);//km/s
-        READ_TREE_PROPERTY(fd, nhalo_offset, VelDisp, "SubhaloVelDisp", numhalos_this_file, float);//km/s
-        READ_TREE_PROPERTY(fd, nhalo_offset, Vmax, "SubhaloVmax", numhalos_this_file, float);//km/s
-        READ_TREE_PROPERTY_MULTIPLEDIM(fd, multi_dim_offset, Spin, "SubhaloSpin", 3, multi_dim_count, float);//(kpc/h)(km/s) -> convert to (Mpc)*(km/s). Does it need sqrt(3)?
-        READ_TREE_PROPERTY(fd, nhalo_offset, MostBoundID, "SubhaloIDMostbound", numhalos_this_file, unsigned int);
-
-        /* File Position Info */
-        READ_TREE_PROPERTY(fd, nhalo_offset, SnapNum, "SnapNum", numhalos_this_file, int);
-        // READ_TREE_PROPERTY(fd, nhalo_offset, FileNr, FileNr, numhalos_this_file, int);
-        READ_TREE_PROPERTY(fd, nhalo_offset, SubhaloIndex, "SubhaloNr", numhalos_this_file, int);//MS: Unsure if this is the right field mapping (another option is SubhaloNumber)
-        //READ_TREE_PROPERTY(fd, nhalo_offset, SubHalfMass, SubHalfMass, numhalos_this_file, float);//MS: Unsure what this field captures -> thankfully unused within sage
-
-        local_halos += numhalos_this_file[0];
-
-    #ifdef DEBUG_HDF5_READER
-        for (int32_t i = 0; i < 20; ++i) {
-            printf("halo %d: Descendant %d FirstProg %d x %.4f y %.4f z %.4f\n", i, local_halos[i].Descendant, local_halos[i].FirstProgenitor, local_halos[i].Pos[0], local_halos[i].Pos[1], local_halos[i].Pos[2]);
+    }
+    const int64_t ibatch = lo;
+    const int64_t start_forestnr = batch->start_forestnr[ibatch], end_forestnr = batch->start_forestnr[ibatch + 1];
+
+    /* The rest of the batch is only read in when the forests are being loaded in order (i.e., this forest
+       follows the previously loaded one or starts the batch). Any other forest that is not already in
+       'halos' is read on its own -> an out-of-order load never re-reads an entire batch */
+    const int in_order = forestnr == start_forestnr || forestnr == batch->prev_forestnr + 1;
+    batch->prev_forestnr = forestnr;
+
+    const struct halo_data *src = NULL;
+    if(end_forestnr - start_forestnr > 1 && batch->curr_batch == ibatch && forestnr >= batch->curr_first_forestnr) {
+        src = &(batch->halos[batch->halo_offset_in_batch[forestnr] - batch->halo_offset_in_batch[batch->curr_first_forestnr]]);
+    } else if(end_forestnr - start_forestnr > 1 && in_order) {
+        int status = read_forests_gadget4_hdf5(g4, forestnr, end_forestnr, batch->halos);
+        if(status != EXIT_SUCCESS) {
+            batch->curr_batch = -1;
+            return -1;
+        }
+        batch->curr_batch = ibatch;
+        batch->curr_first_forestnr = forestnr;
+        src = batch->halos;
+    } else {
+        int status = read_forests_gadget4_hdf5(g4, forestnr, forestnr + 1, local_halos);
+        if(status != EXIT_SUCCESS) {
+            return -1;
         }
-        ABORT(0);
-    #endif
     }
-    local_halos -= nhalos;
-
-    free(buffer);
 
     /* Since the Gadget4 mergertree is by far the most complicated among all the supported formats,
-        we have this extra validation step within the load routine. MS 29/07/2023 */
+        we validate the tree pointers for every halo as the halos are copied out of the batch. MS 29/07/2023 */
     for(int64_t i=0;i<nhalos;i++) {
+        if(src != NULL) {
+            local_halos[i] = src[i];
+        }
         XRETURN(local_halos[i].FirstProgenitor == -1 || (local_halos[i].FirstProgenitor >= 0 && local_halos[i].FirstProgenitor < nhalos), -1, 
         "Error: forestnr = %"PRId64" (with nhalos = %"PRId64") for i=%"PRId64" firstprog = %d\n", forestnr, nhalos, i, local_halos[i].FirstProgenitor);
         XRETURN(local_halos[i].Descendant == -1 || (local_halos[i].Descendant >= 0 && local_halos[i].Descendant < nhalos), -1, 
@@ -673,25 +817,28 @@ int64_t load_forest_gadget4_hdf5(const int64_t forestnr, struct halo_data **halo
         forestnr, nhalos, i, local_halos[i].FirstHaloInFOFgroup);
         XRETURN(local_halos[i].NextHaloInFOFgroup == -1 || (local_halos[i].NextHaloInFOFgroup >= 0 && local_halos[i].NextHaloInFOFgroup < nhalos), -1, 
         "Error: forestnr = %"PRId64" (with nhalos = %"PRId64") for i=%"PRId64" firstprog = %d\n", forestnr, nhalos, i, local_halos[i].NextHaloInFOFgroup);
-
-        // for(int k=0;k<3;k++) {
-        //     XRETURN(local_halos[i].Pos[k] >= 0 && local_halos[i].Pos[k] <= forests_info->BoxSize, -1, 
-        //     "Error: forestnr = %"PRId64" (with nhalos = %"PRId64" offset = %"PRId64") for i=%"PRId64" pos[%d] = %g original_treenr = %"PRId64" filenr = %d\n", 
-        //     forestnr, nhalos, g4->offset_in_nhalos_first_file_for_forests[forestnr], 
-        //     i, k, local_halos[i].Pos[k], forests_info->original_treenr[forestnr], forests_info->FileNr[forestnr]);
-        // }
     }
 
     return nhalos;
 }
 
-#undef READ_TREE_PROPERTY
-#undef READ_TREE_PROPERTY_MULTIPLEDIM
-
 
 void cleanup_forests_io_gadget4_hdf5(struct forest_info *forests_info)
 {
     struct gadget4_info *g4 = &(forests_info->gadget4);
+    struct gadget4_forest_batch *batch = g4->batch;
+    if(batch != NULL) {
+        for(int i=0;i<g4->numfiles * NUM_GADGET4_FIELDS;i++) {
+            if(batch->h5_dsets[i] >= 0) H5Dclose(batch->h5_dsets[i]);
+        }
+        myfree(batch->h5_dsets);
+        myfree(batch->start_forestnr);
+        myfree(batch->halo_offset_in_batch);
+        if(batch->halos != NULL) myfree(batch->halos);
+        myfree(batch);
+        g4->batch = NULL;
+    }
+
     for(int32_t i=0;i<g4->numfiles;i++) {
         /* could use 'H5close' instead to make sure any open datasets are also
            closed; but that would hide potential bugs in code.
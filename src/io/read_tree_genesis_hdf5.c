@@ -38,6 +38,28 @@ enum GalaxyProperty
 };
 
 static char galaxy_property_names[num_galaxy_props][MAX_STRING_LEN];
+
+/* Limits on the size of a batch of forests that are read in together */
+#define GENESIS_MAX_NFORESTS_PER_BATCH      (4096)
+#define GENESIS_MAX_NHALOS_PER_BATCH        (1 << 18)
+
+/* Halo properties for a batch of consecutive forests (all within the same file). Each property is read in with a
+   single hyperslab per snapshot that covers every forest in the batch, and the individual forests are then
+   scattered out of these arrays. The (task-local) forestnr's are [start_forestnr, start_forestnr + nforests) */
+struct genesis_forest_batch
+{
+    int64_t start_forestnr;
+    int64_t nforests;
+    int64_t nhalos;/* total number of halos in the batch (across all snapshots) */
+    int64_t *nhalos_per_forest;/* shape (nforests, ) */
+    int64_t *nhalos_per_forest_per_snap;/* shape (nforests, maxsnaps) */
+    int64_t *forest_offset_per_snap;/* shape (nforests, maxsnaps) -- where each forest begins within the batch at every snapshot */
+    int64_t *file_offset_per_snap;/* shape (maxsnaps, ) -- index of the first halo in the batch within the snapshot group */
+    int64_t *nhalos_per_snap;/* shape (maxsnaps, ) -- number of halos in the batch at every snapshot */
+    int64_t *slab_start_per_snap;/* shape (maxsnaps, ) -- where each snapshot begins within the 'props' arrays */
+    void *props[num_galaxy_props];/* shape (nhalos, ) each -- int64_t for the integer properties, double otherwise */
+};
+
 static int fix_flybys_genesis(struct halo_data *halos, const int64_t nhalos_last_snap, const int64_t forestnr);
 static void get_forest_metadata_filename(const char *forestfilename, const size_t stringlen, char *metadata_filename);
 
@@ -160,13 +182,6 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
             metadata_fname, maxforestsize);
     gen->maxforestsize = maxforestsize;
 
-    gen->halo_offset_per_snap = mycalloc(gen->maxsnaps, sizeof(gen->halo_offset_per_snap[0]));/* Stores the halo index offset (i.e., marks the end of
-                                                                                               the halos from the previous forest)
-                                                                                               to read from at every snapshot */
-    XRETURN(gen->halo_offset_per_snap != NULL, MALLOC_FAILURE,
-            "Error: Could not allocate memory to hold halo offsets at every snapshot (%d items of size %zu bytes)\n",
-            gen->maxsnaps, sizeof(gen->halo_offset_per_snap[0]));
-
     int64_t *totnforests_per_file = mycalloc(totnfiles, sizeof(*totnforests_per_file));
     XRETURN(totnforests_per_file != NULL, MALLOC_FAILURE,
             "Error: Could not allocate memory to hold number of forests per file (%"PRId64" items of size %zu bytes)\n",
@@ -238,15 +253,15 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
     gen->nforests = nforests_this_task;
     gen->start_forestnum = start_forestnum;
     forests_info->nforests_this_task = nforests_this_task;/* Note: Number of forests to process on this task is also stored at the container struct*/
+    forests_info->start_forestnum_this_task = start_forestnum;
 
     gen->offset_for_global_forestnum = mycalloc(totnfiles, sizeof(gen->offset_for_global_forestnum[0]));
 
     int64_t *num_forests_to_process_per_file = mycalloc(totnfiles, sizeof(num_forests_to_process_per_file[0]));
     int64_t *start_forestnum_per_file = mycalloc(totnfiles, sizeof(start_forestnum_per_file[0]));
     int64_t *offset_for_global_forestnum = gen->offset_for_global_forestnum;
-    int64_t *halo_offset_per_snap = gen->halo_offset_per_snap;
     if(num_forests_to_process_per_file == NULL || start_forestnum_per_file == NULL ||
-       halo_offset_per_snap == NULL || offset_for_global_forestnum == NULL) {
+       offset_for_global_forestnum == NULL) {
         fprintf(stderr,"Error: Could not allocate memory to store the number of forests that need to be processed per file (on thistask=%d)\n", ThisTask);
         perror(NULL);
         return MALLOC_FAILURE;
@@ -256,22 +271,22 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
     // Now for each task, we know the starting forest number it needs to start reading from.
     // So let's determine what file and forest number within the file each task needs to start/end reading from.
     int start_filenum = -1, end_filenum = -1;
-    int64_t xx, yy;//dummy variables to throw away but needed to pass to find_start_and_end_filenum
     status = find_start_and_end_filenum(start_forestnum, end_forestnum,
                                         totnforests_per_file, totnforests,
                                         firstfile, lastfile,
                                         ThisTask, NTasks,
-                                        &xx, &yy,
+                                        num_forests_to_process_per_file, start_forestnum_per_file,
                                         &start_filenum, &end_filenum);
     if(status != EXIT_SUCCESS) {
         return status;
     }
-    int64_t nforests_so_far = 0;
+    int64_t nforests_so_far = 0, nforests_this_task_so_far = 0;
     /* This bit is different for Genesis trees and needs to separately accounted for. MS: 13th June 2023*/
     for(int filenr=firstfile;filenr<=lastfile;filenr++) {
-        offset_for_global_forestnum[filenr] = nforests_so_far;
-        if(filenr == start_filenum) {
-            offset_for_global_forestnum[filenr] += start_forestnum - nforests_so_far;
+        /* task-local forestnr + offset == global forestnum (for forests within this file) */
+        offset_for_global_forestnum[filenr] = nforests_so_far + start_forestnum_per_file[filenr] - nforests_this_task_so_far;
+        if(filenr >= start_filenum && filenr <= end_filenum) {
+            nforests_this_task_so_far += num_forests_to_process_per_file[filenr];
         }
         nforests_so_far += totnforests_per_file[filenr];
     }
@@ -279,8 +294,6 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
     gen->totnfiles = totnfiles;/* the number of files to be processed across all tasks */
     gen->numfiles = end_filenum - start_filenum + 1;/* Number of files to process on this task */
     gen->start_filenum = start_filenum;
-    gen->curr_filenum = -1;/* Curr_file_num has to be set to some negative value so that the
-                            'gen->halo_offset_per_snap' values are not reset for the first forest. */
 
     /* We need to track which file each forest is in for two reasons -- i) to actually read from the correct file and ii) to create unique IDs */
     forests_info->FileNr = calloc(nforests_this_task, sizeof(forests_info->FileNr[0]));
@@ -316,35 +329,9 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
         }
     }
 
-    /* Now fill out the halo offsets per snapshot for the first forest */
-    // MS: 24th May 2023 -> copied over to hdf5_read_utils.h as `READ_PARTIAL_DATASET` macro
-
-
-    {
-        /* Intentionally written in new scope (separate '{')
-
-           For the first forest on this task, we need to start at some arbitrary index within the snapshot group.
-           This index is simply the sum of the number of halos at that snapshot located within all preceeding
-           forests (these preceeding forests are processed on other tasks). In this section, we simply assign the cumulative
-           sum as the 'offset' to start reading from for the first forest.
-        */
-        char fname[5*MAX_STRING_LEN];
-        snprintf(fname, sizeof(fname), "%s.%d", filename, start_filenum);
-        hid_t h5_fd = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
-        if(h5_fd < 0) {
-            fprintf(stderr,"Error: On ThisTask = %d can't open the first file to process. filename is '%s'\n", run_params->ThisTask, fname);
-            return FILE_NOT_FOUND;
-        }
-
-        const hsize_t start_forestnum_in_file = forests_info->original_treenr[0];
-        const hsize_t read_ndim = 2;
-        const hsize_t read_offset[2] = {start_forestnum_in_file, 0};
-        const hsize_t read_count[2] = {1, gen->maxsnaps};
-        READ_PARTIAL_DATASET(h5_fd, "ForestInfoInFile", "ForestOffsetsAllSnaps", read_ndim, read_offset, read_count, gen->halo_offset_per_snap);
-
-        XRETURN(H5Fclose(h5_fd) >= 0, HDF5_ERROR,
-                "Error: On ThisTask = %d could not close file descriptor for filename = '%s'\n", ThisTask, fname);
-    }
+    gen->batch = mycalloc(1, sizeof(*(gen->batch)));
+    CHECK_POINTER_AND_RETURN_ON_NULL(gen->batch, "Failed to allocate %zu bytes for the genesis batch struct", sizeof(*(gen->batch)));
+    gen->batch->start_forestnr = -1;
 
     /* Now malloc the relevant arrays in forests_info->gen */
     gen->h5_fds = mycalloc(gen->totnfiles, sizeof(gen->h5_fds[0]));/* Allocates enough space to store all '(lastfile + 1)' hdf5 file descriptors
@@ -549,55 +536,232 @@ int setup_forests_io_genesis_hdf5(struct forest_info *forests_info, const int Th
  */
 
 
-int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info, struct params *run_params)
+/* The integer-valued properties are read in as int64_t, and all the remaining properties as double */
+static inline int is_integer_galaxy_property(const enum GalaxyProperty prop)
 {
-    struct genesis_info *gen = &(forests_info->gen);
-    int processing_first_forest = 0;
-    if(gen->curr_filenum < 0) {
-        processing_first_forest = 1;
-        gen->curr_filenum = gen->start_filenum;
-        const int64_t forestnum_across_all_files = forestnr + gen->offset_for_global_forestnum[gen->start_filenum];
-        if(forestnum_across_all_files != gen->start_forestnum) {
-            fprintf(stderr,"Error: On ThisTask = %d looks like we are processing the first forest, with forestnr = %"PRId64" "
-                    "But forestnum_across_all_files = %"PRId64" is not equal to start_forestnum = %"PRId64"\n",
-                    run_params->ThisTask, forestnr, forestnum_across_all_files, gen->start_forestnum);
-            return -1;
-        }
-    }
+    return (prop == head_enum || prop == tail_enum || prop == hosthaloid_enum || prop == len_enum || prop == mostboundid_enum) ? 1:0;
+}
 
-    const int filenum_for_forest = forests_info->FileNr[forestnr];
+static int read_genesis_property_slab(hid_t snap_group, const int isnap, const enum GalaxyProperty prop,
+                                      const hsize_t offset, const hsize_t count, void *buffer)
+{
+    const char *dataset_name = galaxy_property_names[prop];
+    hid_t h5_dset = H5Dopen2(snap_group, dataset_name, H5P_DEFAULT);
+    XRETURN(h5_dset >= 0, -HDF5_ERROR,
+            "Error encountered when trying to open up dataset %s at snapshot = %d\n",
+            dataset_name, isnap);
+    hid_t h5_fspace = H5Dget_space(h5_dset);
+    XRETURN(h5_fspace >= 0, -HDF5_ERROR,
+            "Error encountered when trying to reserve filespace for dataset %s at snapshot = %d\n",
+            dataset_name, isnap);
+    herr_t status = H5Sselect_hyperslab(h5_fspace, H5S_SELECT_SET, &offset, NULL, &count, NULL);
+    XRETURN(status >= 0, -HDF5_ERROR,
+            "Error: Failed to select hyperslab for dataset = %s at snapshot = %d.\n"
+            "The hyperslab started at %llu and contained %llu elements\n",
+            dataset_name, isnap, (unsigned long long) offset, (unsigned long long) count);
+    hid_t h5_memspace = H5Screate_simple(1, &count, NULL);
+    XRETURN(h5_memspace >= 0, -HDF5_ERROR,
+            "Error: Failed to create memory space for dataset = %s at snapshot = %d (count = %llu)\n",
+            dataset_name, isnap, (unsigned long long) count);
+    const hid_t h5_memtype = is_integer_galaxy_property(prop) ? H5T_NATIVE_INT64:H5T_NATIVE_DOUBLE;
+    status = H5Dread(h5_dset, h5_memtype, h5_memspace, h5_fspace, H5P_DEFAULT, buffer);
+    XRETURN(status >= 0, FILE_READ_ERROR,
+            "Error: Failed to read array for dataset = %s at snapshot = %d.\n"
+            "The hyperslab started at %llu and contained %llu elements\n",
+            dataset_name, isnap, (unsigned long long) offset, (unsigned long long) count);
+    XRETURN(H5Sclose(h5_memspace) >= 0, -HDF5_ERROR,
+            "Error: Failed to close the dataspace for = %s at snapshot = %d\n", dataset_name, isnap);
+    XRETURN(H5Sclose(h5_fspace) >= 0, -HDF5_ERROR,
+            "Error: Failed to close the filespace for = %s at snapshot = %d\n", dataset_name, isnap);
+    XRETURN(H5Dclose(h5_dset) >= 0, -HDF5_ERROR,
+            "Error: Could not close dataset = '%s' at snapshot = %d\n", dataset_name, isnap);
+
+    return EXIT_SUCCESS;
+}
 
-    /* Do the forest offsets have to be reset? Only reset if this is not the first forest
-       The offsets for the first forest have been populated at the forest_setup stage  */
-    if(processing_first_forest == 0 && gen->curr_filenum != filenum_for_forest) {
-        /* This forest is in a new file (but this forest isn't the first forest being processed by this task)*/
-        for(int isnap=0;isnap<gen->maxsnaps;isnap++) {
-            gen->halo_offset_per_snap[isnap] = 0;
-        }
-        gen->curr_filenum = filenum_for_forest;
-    }
-    const int filenum = gen->curr_filenum;
 
-    if (gen->h5_fds[filenum] < 0) {
-        fprintf(stderr, "The HDF5 file '%d' (corresponding to '%d'th file on ThisTask) should still be opened when reading the halos in the forest.\n",
-                filenum_for_forest, filenum);
+static void free_forest_batch_genesis_hdf5(struct genesis_forest_batch *batch)
+{
+    if(batch->nforests == 0) return;
+
+    myfree(batch->props[0]);
+    myfree(batch->slab_start_per_snap);
+    myfree(batch->nhalos_per_snap);
+    myfree(batch->file_offset_per_snap);
+    myfree(batch->forest_offset_per_snap);
+    myfree(batch->nhalos_per_forest_per_snap);
+    myfree(batch->nhalos_per_forest);
+
+    batch->start_forestnr = -1;
+    batch->nforests = 0;
+    batch->nhalos = 0;
+}
+
+
+/* Reads in all the halos for a batch of consecutive forests (within the same file), starting at 'forestnr'.
+   The halos belonging to the batch at any one snapshot are contiguous in the file, so each property is
+   read with a single hyperslab per snapshot regardless of the number of forests in the batch */
+static int fill_forest_batch_genesis_hdf5(const int64_t forestnr, struct forest_info *forests_info, struct params *run_params)
+{
+    struct genesis_info *gen = &(forests_info->gen);
+    struct genesis_forest_batch *batch = gen->batch;
+    const int32_t maxsnaps = gen->maxsnaps;
+    const int filenum = forests_info->FileNr[forestnr];
+
+    const hid_t h5_fd = gen->h5_fds[filenum];
+    if (h5_fd < 0) {
+        fprintf(stderr, "The HDF5 file '%d' should still be opened when reading the halos in the forest.\n", filenum);
         fprintf(stderr, "For forest %"PRId64" we encountered error\n", forestnr);
-        H5Eprint(gen->h5_fds[filenum], stderr);
+        H5Eprint(h5_fd, stderr);
         ABORT(NULL_POINTER_FOUND);
     }
 
-    const int64_t forestnum_across_all_files = forestnr + gen->offset_for_global_forestnum[filenum];
+    free_forest_batch_genesis_hdf5(batch);
 
-    int64_t nhalos;
-    const hsize_t h5_single_item = 1;
+    /* A batch never straddles a file boundary */
+    int64_t max_nforests = 0;
+    while(max_nforests < GENESIS_MAX_NFORESTS_PER_BATCH && forestnr + max_nforests < gen->nforests &&
+          forests_info->FileNr[forestnr + max_nforests] == filenum) {
+        max_nforests++;
+    }
+
+    int64_t *nhalos_per_forest = mymalloc(max_nforests * sizeof(*nhalos_per_forest));
+    XRETURN(nhalos_per_forest != NULL, MALLOC_FAILURE,
+            "Error: Could not allocate memory to store the number of halos for %"PRId64" forests\n", max_nforests);
+
+    /* Read the number of halos in the forests -> starting at offset 'forestnum_across_all_files'  */
+    const int64_t forestnum_across_all_files = forestnr + gen->offset_for_global_forestnum[filenum];
     const hsize_t h5_global_forestnum = (hsize_t) forestnum_across_all_files;
-    /* Read the number of halos in this forest -> starting at offset 'forestnum_across_all_files'  */
+    const hsize_t h5_max_nforests = (hsize_t) max_nforests;
     const hsize_t ndim = 1;
-    READ_PARTIAL_DATASET(gen->meta_fd, "ForestInfo", "ForestSizes", ndim, &h5_global_forestnum, &h5_single_item, &nhalos);
+    READ_PARTIAL_DATASET(gen->meta_fd, "ForestInfo", "ForestSizes", ndim, &h5_global_forestnum, &h5_max_nforests, nhalos_per_forest);
+
+    /* Add forests until the batch is full (the first forest is always included, however large) */
+    int64_t nforests = 1, nhalos = nhalos_per_forest[0];
+    while(nforests < max_nforests && nhalos + nhalos_per_forest[nforests] <= GENESIS_MAX_NHALOS_PER_BATCH) {
+        nhalos += nhalos_per_forest[nforests];
+        nforests++;
+    }
+
+    batch->nhalos_per_forest = nhalos_per_forest;
+    batch->nhalos_per_forest_per_snap = mymalloc(nforests * maxsnaps * sizeof(batch->nhalos_per_forest_per_snap[0]));
+    batch->forest_offset_per_snap = mymalloc(nforests * maxsnaps * sizeof(batch->forest_offset_per_snap[0]));
+    batch->file_offset_per_snap = mymalloc(maxsnaps * sizeof(batch->file_offset_per_snap[0]));
+    batch->nhalos_per_snap = mycalloc(maxsnaps, sizeof(batch->nhalos_per_snap[0]));
+    batch->slab_start_per_snap = mymalloc(maxsnaps * sizeof(batch->slab_start_per_snap[0]));
+    /* Every property is stored as an 8-byte value (either int64_t or double) */
+    char *props = mymalloc(num_galaxy_props * nhalos * sizeof(double));
+    if(batch->nhalos_per_forest_per_snap == NULL || batch->forest_offset_per_snap == NULL || batch->file_offset_per_snap == NULL ||
+       batch->nhalos_per_snap == NULL || batch->slab_start_per_snap == NULL || props == NULL) {
+        fprintf(stderr,"Error: Could not allocate memory to read in a batch of %"PRId64" forests containing %"PRId64" halos\n",
+                nforests, nhalos);
+        return MALLOC_FAILURE;
+    }
+    for(int iprop=0;iprop<num_galaxy_props;iprop++) {
+        batch->props[iprop] = props + iprop * nhalos * sizeof(double);
+    }
+    batch->start_forestnr = forestnr;
+    batch->nforests = nforests;
+    batch->nhalos = nhalos;
+
+    const hsize_t forestnum_in_file = forests_info->original_treenr[forestnr];
+    const hsize_t read_ndims = 2;
+    const hsize_t read_offset[2] = {forestnum_in_file, 0};
+    const hsize_t read_count[2] = {(hsize_t) nforests, (hsize_t) maxsnaps};
+    READ_PARTIAL_DATASET(h5_fd, "ForestInfoInFile", "ForestSizesAllSnaps", read_ndims, read_offset, read_count, batch->nhalos_per_forest_per_snap);
+
+    /* The (file-level) halo offsets at every snapshot are only needed for the first forest in the batch, the
+       remaining forests in the batch follow on contiguously. Reading the offsets directly (rather than
+       accumulating the sizes of all the preceeding forests) means that any forest can be loaded at any time */
+    const hsize_t first_forest_count[2] = {1, (hsize_t) maxsnaps};
+    READ_PARTIAL_DATASET(h5_fd, "ForestInfoInFile", "ForestOffsetsAllSnaps", read_ndims, read_offset, first_forest_count, batch->file_offset_per_snap);
+
+    /* Within the batch, the halos from consecutive forests follow each other at every snapshot */
+    for(int64_t iforest=0;iforest<nforests;iforest++) {
+        const int64_t *nhalos_per_snap = &(batch->nhalos_per_forest_per_snap[iforest * maxsnaps]);
+        int64_t *forest_offsets = &(batch->forest_offset_per_snap[iforest * maxsnaps]);
+        int64_t nhalos_this_forest = 0;
+        for(int isnap=0;isnap<maxsnaps;isnap++) {
+            forest_offsets[isnap] = batch->nhalos_per_snap[isnap];
+            batch->nhalos_per_snap[isnap] += nhalos_per_snap[isnap];
+            nhalos_this_forest += nhalos_per_snap[isnap];
+        }
+
+        /* Check that the number of halos to read in agrees with that derived with the per snapshot one */
+        if(nhalos_this_forest != nhalos_per_forest[iforest]) {
+            fprintf(stderr,"Error: On ThisTask = %d while processing task-local-forestnr = %"PRId64" "
+                    " file-local-forestnr = %"PRId64" and global forestnum = %"PRId64" located in the file = %d\n",
+                    run_params->ThisTask, forestnr + iforest, forests_info->original_treenr[forestnr + iforest],
+                    forestnum_across_all_files + iforest, filenum);
+            fprintf(stderr,"Expected the 'nhalos_per_snap' array to sum up to 'nhalos' but that is not the case\n");
+            fprintf(stderr,"Sum(nhalos_per_snap) = %"PRId64" nhalos = %"PRId64"\n", nhalos_this_forest, nhalos_per_forest[iforest]);
+            fprintf(stderr,"Now printing out individual values of the nhalos_per_snap\n");
+            for(int isnap=maxsnaps-1;isnap>=0;isnap--) {
+                fprintf(stderr,"nhalos_per_snap[%03d] = %09"PRId64"\n", isnap, nhalos_per_snap[isnap]);
+            }
+            fprintf(stderr,"Now printing out the offset need per file\n");
+            for(int i=0;i<gen->totnfiles;i++) {
+                fprintf(stderr,"gen->offset_for_global_forestnum[%04d] = %09"PRId64"\n", i, gen->offset_for_global_forestnum[i]);
+            }
+
+            ABORT(INVALID_VALUE_READ_FROM_FILE);
+        }
+    }
+
+    int64_t slab_start = 0;
+    for(int isnap=maxsnaps-1;isnap>=0;isnap--) {
+        batch->slab_start_per_snap[isnap] = slab_start;
+        slab_start += batch->nhalos_per_snap[isnap];
+    }
+
+    const int start_snap = gen->min_snapnum;
+    const int end_snap = gen->min_snapnum + maxsnaps - 1;//maxsnaps already includes a +1,
+    for(int isnap=end_snap;isnap>=start_snap;isnap--) {
+        const hsize_t nhalos_snap = batch->nhalos_per_snap[isnap];
+        if(nhalos_snap == 0) continue;
+
+        char snap_group_name[MAX_STRING_LEN];
+        snprintf(snap_group_name, MAX_STRING_LEN-1, "Snap_%03d", isnap);
+        hid_t h5_grp = H5Gopen(h5_fd, snap_group_name, H5P_DEFAULT);
+        XRETURN(h5_grp >= 0, -HDF5_ERROR, "Error: Could not open group = `%s` corresponding to snapshot = %d\n",
+                snap_group_name, isnap);
+
+        const hsize_t snap_offset = batch->file_offset_per_snap[isnap];
+        for(int iprop=0;iprop<num_galaxy_props;iprop++) {
+            char *dst = ((char *) batch->props[iprop]) + batch->slab_start_per_snap[isnap] * sizeof(double);
+            int status = read_genesis_property_slab(h5_grp, isnap, iprop, snap_offset, nhalos_snap, dst);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+        }
+
+        XRETURN(H5Gclose(h5_grp) >= 0, -HDF5_ERROR, "Error: Could not close snapshot group = '%s'\n", snap_group_name);
+    }
+
+    return EXIT_SUCCESS;
+}
 
-    int64_t *nhalos_per_snap = mymalloc(gen->maxsnaps * sizeof(*nhalos_per_snap));
-    XRETURN(nhalos_per_snap != NULL, MALLOC_FAILURE,
-            "Error: Could not allocate memory to store the number of halos per snapshot (forestnr = %"PRId64")\n",
+
+int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info, struct params *run_params)
+{
+    struct genesis_info *gen = &(forests_info->gen);
+    struct genesis_forest_batch *batch = gen->batch;
+    if(forestnr < batch->start_forestnr || forestnr >= batch->start_forestnr + batch->nforests) {
+        int status = fill_forest_batch_genesis_hdf5(forestnr, forests_info, run_params);
+        if(status != EXIT_SUCCESS) {
+            return -1;
+        }
+    }
+
+    const int filenum_for_forest = forests_info->FileNr[forestnr];
+    const int64_t iforest = forestnr - batch->start_forestnr;
+    const int64_t nhalos = batch->nhalos_per_forest[iforest];
+    const int64_t *nhalos_per_snap = &(batch->nhalos_per_forest_per_snap[iforest * gen->maxsnaps]);
+    const int64_t *batch_offsets = &(batch->forest_offset_per_snap[iforest * gen->maxsnaps]);
+
+    int64_t *forest_offsets = mymalloc(gen->maxsnaps * sizeof(*forest_offsets));
+    XRETURN(forest_offsets != NULL, MALLOC_FAILURE,
+            "Error: Could not allocate memory for the storing the halo offsets within the file at each snapshot (forestnr = %"PRId64")\n",
             forestnr);
 
     int32_t *forest_local_offsets = mymalloc(gen->maxsnaps * sizeof(*forest_local_offsets));
@@ -610,13 +774,6 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
 
     int32_t forest_start_snap = end_snap;
     int32_t forest_end_snap = start_snap;
-    hid_t h5_fd = gen->h5_fds[filenum];
-    const hsize_t forestnum_in_file = forests_info->original_treenr[forestnr];
-    const hsize_t read_ndims = 2;
-    const hsize_t read_offset[2] = {forestnum_in_file, 0};
-    const hsize_t read_count[2] = {1, gen->maxsnaps};
-    READ_PARTIAL_DATASET(h5_fd, "ForestInfoInFile", "ForestSizesAllSnaps", read_ndims, read_offset, read_count, nhalos_per_snap);
-//#undef READ_GENESIS_PARTIAL_FORESTINFO
 
     /* Now that we have the data */
     int64_t offset=0;
@@ -637,30 +794,10 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
             forest_end_snap = (isnap > forest_end_snap) ? isnap:forest_end_snap;
         }
         forest_local_offsets[isnap] = offset;
-        /* fprintf(stderr,"forest_local_offsets[%03d] = %d\n", isnap, forest_local_offsets[isnap]); */
+        forest_offsets[isnap] = batch->file_offset_per_snap[isnap] + batch_offsets[isnap];
         offset += nhalos_per_snap[isnap];
     }
 
-
-    /* Check that the number of halos to read in agrees with that derived with the per snapshot one */
-    if(offset != nhalos) {
-        fprintf(stderr,"Error: On ThisTask = %d while processing task-local-forestnr = %"PRId64" "
-                " file-local-forestnr = %"PRId64" and global forestnum = %"PRId64" located in the file = %d\n",
-                run_params->ThisTask, forestnr, forests_info->original_treenr[forestnr], forestnum_across_all_files, filenum);
-        fprintf(stderr,"Expected the 'nhalos_per_snap' array to sum up to 'nhalos' but that is not the case\n");
-        fprintf(stderr,"Sum(nhalos_per_snap) = %"PRId64" nhalos = %"PRId64"\n", offset, nhalos);
-        fprintf(stderr,"Now printing out individual values of the nhalos_per_snap\n");
-        for(int isnap=end_snap;isnap>=start_snap;isnap--) {
-            fprintf(stderr,"nhalos_per_snap[%03d] = %09"PRId64"\n", isnap, nhalos_per_snap[isnap]);
-        }
-        fprintf(stderr,"Now printing out the offset need per file\n");
-        for(int i=0;i<gen->totnfiles;i++) {
-            fprintf(stderr,"gen->offset_for_global_forestnum[%04d] = %09"PRId64"\n", i, gen->offset_for_global_forestnum[i]);
-        }
-
-        ABORT(INVALID_VALUE_READ_FROM_FILE);
-    }
-
     *halos = mymalloc(sizeof(struct halo_data) * nhalos);//the malloc failure check is done within mymalloc
     struct halo_data *local_halos = *halos;
     for(int64_t i=0;i<nhalos;i++) {
@@ -672,82 +809,8 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
         local_halos[i].Descendant = -1;
     }
 
-    // The max. size of the data to be read in would be "nhalos" * NDIM (== 3 for pos/vel) * sizeof(double)
-    char *buffer = mymalloc(nhalos * NDIM * sizeof(double));
-    if (buffer == NULL) {
-        fprintf(stderr, "Could not allocate memory for the HDF5 multiple dimension buffer.\n");
-        ABORT(MALLOC_FAILURE);
-    }
-
-#define READ_PARTIAL_1D_ARRAY(snap_group, isnap, dataset_enum, offset, count, buffer) { \
-        hid_t h5_dset = H5Dopen2(snap_group, galaxy_property_names[dataset_enum], H5P_DEFAULT); \
-        XRETURN(h5_dset >= 0, -HDF5_ERROR,                              \
-                "Error encountered when trying to open up dataset %s at snapshot = %d\n", \
-                galaxy_property_names[dataset_enum], isnap);            \
-        hid_t h5_fspace = H5Dget_space(h5_dset);                        \
-        XRETURN(h5_fspace >= 0, -HDF5_ERROR,                            \
-                "Error encountered when trying to reserve filespace for dataset %s at snapshot = %d\n", \
-                galaxy_property_names[dataset_enum], isnap);            \
-        herr_t macro_status = H5Sselect_hyperslab(h5_fspace, H5S_SELECT_SET, offset, NULL, count, NULL); \
-        XRETURN(macro_status >= 0, -HDF5_ERROR,                         \
-                "Error: Failed to select hyperslab for dataset = %s.\n" \
-                "The dimensions of the dataset was %d.\n",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        hid_t h5_memspace = H5Screate_simple(1, count, NULL);           \
-        XRETURN(h5_memspace >= 0, -HDF5_ERROR,                          \
-                "Error: Failed to select hyperslab for dataset = %s.\n" \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        const hid_t h5_dtype = H5Dget_type(h5_dset);                    \
-        XRETURN(h5_dtype >= 0, -HDF5_ERROR,                             \
-                "Error: Failed to get datatype for dataset = %s.\n"     \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        macro_status = H5Dread(h5_dset, h5_dtype, h5_memspace, h5_fspace, H5P_DEFAULT, buffer); \
-        XRETURN(macro_status >= 0, FILE_READ_ERROR,                     \
-                "Error: Failed to read array for dataset = %s.\n"       \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        XRETURN(H5Dclose(h5_dset) >= 0, -HDF5_ERROR,                    \
-                "Error: Could not close dataset = '%s'.\n"              \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        XRETURN(H5Tclose(h5_dtype) >= 0, -HDF5_ERROR,                   \
-                "Error: Failed to close the datatype for = %s.\n"       \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        XRETURN(H5Sclose(h5_fspace) >= 0, -HDF5_ERROR,                  \
-                "Error: Failed to close the filespace for = %s.\n"      \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-        XRETURN(H5Sclose(h5_memspace) >= 0, -HDF5_ERROR,                \
-                "Error: Failed to close the dataspace for = %s.\n"      \
-                "The dimensions of the dataset was %d\n.",              \
-                galaxy_property_names[dataset_enum], (int32_t) *count); \
-    }
-
-#define ASSIGN_BUFFER_TO_SAGE(numhalos, buffer_dtype, sage_name, sage_dtype) { \
-    buffer_dtype *buf = (buffer_dtype *) buffer;                    \
-    for(hsize_t i=0;i<numhalos[0];i++) {                            \
-        local_halos[i].sage_name = (sage_dtype) buf[i];             \
-    }                                                               \
-}
-
-#define ASSIGN_BUFFER_TO_NDIM_SAGE(numhalos, ndim, buffer_dtype, sage_name, sage_dtype) { \
-    XRETURN(ndim == 3, -1, "Error: The code is written assuming number of dimensions is 3. Found ndim = %d\n", (int) ndim); \
-    buffer_dtype *buf0 = ((buffer_dtype *) buffer) + 0*numhalos[0]; \
-    buffer_dtype *buf1 = ((buffer_dtype *) buffer) + 1*numhalos[0]; \
-    buffer_dtype *buf2 = ((buffer_dtype *) buffer) + 2*numhalos[0]; \
-    for(hsize_t i=0;i<numhalos[0];i++) {                            \
-        local_halos[i].sage_name[0] = (sage_dtype) buf0[i];         \
-        local_halos[i].sage_name[1] = (sage_dtype) buf1[i];         \
-        local_halos[i].sage_name[2] = (sage_dtype) buf2[i];         \
-    }                                                               \
-}
-
-
-#define ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_buffer, buffer_dtype, sage_name, snapnum, is_mergertree_index, minus_one_means_itself) { \
-    for(hsize_t i=0;i<nhalos_buffer[0];i++) {                   \
+#define ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_buffer, buffer, sage_name, snapnum, is_mergertree_index, minus_one_means_itself) { \
+    for(hsize_t i=0;i<nhalos_buffer;i++) {                   \
         const int64_t macro_haloid = ((int64_t *) buffer)[i];   \
         if(macro_haloid == -1 && minus_one_means_itself) {      \
             const int64_t macro_forest_local_index = forest_local_offsets[snapnum] + i; \
@@ -807,91 +870,56 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
     }                                                           \
 }
 
-    int64_t *forest_offsets = gen->halo_offset_per_snap;
+#define GENESIS_BATCH_PROPERTY(dataset_enum, dtype)   (((dtype *) batch->props[dataset_enum]) + slab_offset)
+
     for(int isnap=forest_end_snap;isnap>=forest_start_snap;isnap--) {
-        hsize_t snap_offset[1], nhalos_snap[1];
-        snap_offset[0] = (hsize_t) forest_offsets[isnap];
-        nhalos_snap[0] = nhalos_per_snap[isnap];
-        if(nhalos_snap[0] == 0) continue;
+        const hsize_t nhalos_snap = nhalos_per_snap[isnap];
+        if(nhalos_snap == 0) continue;
 
-        /* fprintf(stderr,"forestnr = %"PRId64" reading nhalos = %llu at or snapshot = %d\n", forestnr, nhalos_snap[0], isnap); */
-
-        char snap_group_name[MAX_STRING_LEN];
-        snprintf(snap_group_name, MAX_STRING_LEN-1, "Snap_%03d", isnap);
-        hid_t h5_grp = H5Gopen(h5_fd, snap_group_name, H5P_DEFAULT);
-        XRETURN(h5_grp >= 0, -HDF5_ERROR, "Error: Could not open group = `%s` corresponding to snapshot = %d\n",
-                snap_group_name, isnap);
+        /* Where the halos of this forest at this snapshot begin within the (already read-in) batch */
+        const int64_t slab_offset = batch->slab_start_per_snap[isnap] + batch_offsets[isnap];
 
         /* Merger Tree Pointers */
         //Descendant, FirstProgenitor, NextProgenitor, FirstHaloInFOFgroup, NextHaloInFOFgroup
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, head_enum, snap_offset, nhalos_snap, buffer);
         /* Can not directly assign since 'Head' contains Descendant haloid which is too large to be contained
            within 32 bits. I will need a separate assignment to break up haloid into a local index + snapshot,
            and then use the forest-local offset for each snapshot */
-
         const int is_mergertree_idx = 1, is_hosthaloid = 1;
-        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, int64_t, Descendant, isnap, is_mergertree_idx, ~is_hosthaloid);
+        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, GENESIS_BATCH_PROPERTY(head_enum, int64_t), Descendant, isnap, is_mergertree_idx, ~is_hosthaloid);
 
         //Same with 'Tail' -> 'FirstProgenitor'
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, tail_enum, snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, int64_t, FirstProgenitor, isnap, is_mergertree_idx, ~is_hosthaloid);
+        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, GENESIS_BATCH_PROPERTY(tail_enum, int64_t), FirstProgenitor, isnap, is_mergertree_idx, ~is_hosthaloid);
 
         //And same with 'hostHaloID' -> FirstHaloinFOFGroup.
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, hosthaloid_enum, snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, int64_t, FirstHaloInFOFgroup, isnap, ~is_mergertree_idx, is_hosthaloid);
-
+        ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE(nhalos_snap, GENESIS_BATCH_PROPERTY(hosthaloid_enum, int64_t), FirstHaloInFOFgroup, isnap, ~is_mergertree_idx, is_hosthaloid);
 
         /* MS 3rd June, 2019: The LHaloTree convention (which sage uses) is that Mvir contains M200c. While this is DEEPLY confusing,
            I am using C 'unions' to reduce the confusion slightly. What will happen here is that 'Mass_200crit' will get
            assigned to the 'M200c' field within the halo struct; but that 'M200c' will also be accessible via 'Mvir'.
         */
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, m200c_enum, snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_TO_SAGE(nhalos_snap, double, M200c, float);//M200c is an alias for Mvir
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, vmax_enum, snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_TO_SAGE(nhalos_snap, double, Vmax, float);
-
-        /* Read in the positions for the halo centre*/
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, xc_enum, snap_offset, nhalos_snap, buffer);
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, yc_enum, snap_offset, nhalos_snap, buffer + nhalos_snap[0]*sizeof(double));
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, zc_enum, snap_offset, nhalos_snap, buffer + 2*nhalos_snap[0]*sizeof(double));
-        /* Assign to the Pos array within sage*/
-        ASSIGN_BUFFER_TO_NDIM_SAGE(nhalos_snap, NDIM, double, Pos, float);/* Be careful that the last argument is only used
-                                                                             at the assignment stage (i.e., for type conversion)
-                                                                             Otherwise, the memory areas would be accessed incorrectly
-                                                                             and we would get corrupted results -- MS 27/11/2019 */
-
-        /* Read in the halo velocities */
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, vxc_enum, snap_offset, nhalos_snap, buffer);
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, vyc_enum, snap_offset, nhalos_snap, buffer + nhalos_snap[0]*sizeof(double));
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, vzc_enum, snap_offset, nhalos_snap, buffer + 2*nhalos_snap[0]*sizeof(double));
-        /* Assign to the appropriate vel array within sage*/
-        ASSIGN_BUFFER_TO_NDIM_SAGE(nhalos_snap, NDIM, double, Vel, float);
-
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, len_enum,  snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_TO_SAGE(nhalos_snap, int64_t, Len, int32_t);
-
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, mostboundid_enum,  snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_TO_SAGE(nhalos_snap, int64_t, MostBoundID, long long);
-
-        /* Read in the angular momentum */
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, lx_enum, snap_offset, nhalos_snap, buffer);
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, ly_enum, snap_offset, nhalos_snap, buffer + nhalos_snap[0]*sizeof(double));
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, lz_enum, snap_offset, nhalos_snap, buffer + 2*nhalos_snap[0]*sizeof(double));
-        /* Assign to the appropriate vel array within sage*/
-        ASSIGN_BUFFER_TO_NDIM_SAGE(nhalos_snap, NDIM, double, Spin, float);
-
-        /* READ_PARTIAL_1D_ARRAY(h5_grp, isnap, m200b_enum, snap_offset, nhalos_snap, buffer); */
-        /* ASSIGN_BUFFER_TO_SAGE(nhalos_snap, double, M_Mean200, float); */
-
-        READ_PARTIAL_1D_ARRAY(h5_grp, isnap, veldisp_enum, snap_offset, nhalos_snap, buffer);
-        ASSIGN_BUFFER_TO_SAGE(nhalos_snap, double, VelDisp, float);
-
-        XRETURN(H5Gclose(h5_grp) >= 0, -HDF5_ERROR, "Error: Could not close snapshot group = '%s'\n", snap_group_name);
-        /* Done with all the reading for this snapshot */
+        const double *m200c = GENESIS_BATCH_PROPERTY(m200c_enum, double);
+        const double *vmax = GENESIS_BATCH_PROPERTY(vmax_enum, double);
+        const double *pos[NDIM] = {GENESIS_BATCH_PROPERTY(xc_enum, double), GENESIS_BATCH_PROPERTY(yc_enum, double), GENESIS_BATCH_PROPERTY(zc_enum, double)};
+        const double *vel[NDIM] = {GENESIS_BATCH_PROPERTY(vxc_enum, double), GENESIS_BATCH_PROPERTY(vyc_enum, double), GENESIS_BATCH_PROPERTY(vzc_enum, double)};
+        const double *spin[NDIM] = {GENESIS_BATCH_PROPERTY(lx_enum, double), GENESIS_BATCH_PROPERTY(ly_enum, double), GENESIS_BATCH_PROPERTY(lz_enum, double)};
+        const double *veldisp = GENESIS_BATCH_PROPERTY(veldisp_enum, double);
+        const int64_t *len = GENESIS_BATCH_PROPERTY(len_enum, int64_t);
+        const int64_t *mostboundid = GENESIS_BATCH_PROPERTY(mostboundid_enum, int64_t);
 
         const double scale_factor = run_params->scale_factors[isnap];
         const double hubble_h = run_params->Hubble_h;
-        for(hsize_t i=0;i<nhalos_snap[0];i++) {
+        for(hsize_t i=0;i<nhalos_snap;i++) {
+            local_halos[i].M200c = (float) m200c[i];//M200c is an alias for Mvir
+            local_halos[i].Vmax = (float) vmax[i];
+            for(int j=0;j<NDIM;j++) {
+                local_halos[i].Pos[j] = (float) pos[j][i];
+                local_halos[i].Vel[j] = (float) vel[j][i];
+                local_halos[i].Spin[j] = (float) spin[j][i];
+            }
+            local_halos[i].Len = (int32_t) len[i];
+            local_halos[i].MostBoundID = (long long) mostboundid[i];
+            local_halos[i].VelDisp = (float) veldisp[i];
+
             /* Fill up the remaining properties that are not within the GENESIS dataset */
             local_halos[i].SnapNum = isnap;
             local_halos[i].FileNr = filenum_for_forest;
@@ -900,12 +928,6 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
 
             /* Change the conventions across the entire forest to match the SAGE conventions */
             /* convert the masses into 1d10 Msun/h units */
-            /* if(local_halos[i].M200c < 0) { */
-            /*     fprintf(stderr,"Error: halo # %llu (snapshot local index) at snapshot %d within forestnr = %"PRId64" has negative mass = %e\n", */
-            /*             i, isnap, forestnum_across_all_files, local_halos[i].M200c); */
-            /*     fprintf(stderr,"halo contains %d particles\n", local_halos[i].Len); */
-            /* } */
-
             if(local_halos[i].M200c > 0) {
                 local_halos[i].M200c *= hubble_h;// M200c is an alias for Mvir
             }
@@ -917,11 +939,14 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
         }
 
         //Done reading all halos belonging to this forest at this snapshot
-        local_halos += nhalos_snap[0];
+        local_halos += nhalos_snap;
     }
+#undef GENESIS_BATCH_PROPERTY
+#undef ASSIGN_BUFFER_WITH_MERGERTREE_IDX_TO_SAGE
+
     //Done reading all halos belonging to this forest (across all snapshots)
     local_halos -= nhalos;//rewind the local_halos to the first halo in this forest
-    myfree(buffer);
+    myfree(forest_offsets);
 
     //Populate the NextProg, NexthaloinFofgroup indices. FirstHaloinFOFGroup, Descendant, FirstProgenitor should already be set correctly
 
@@ -1006,34 +1031,20 @@ int64_t load_forest_genesis_hdf5(int64_t forestnr, struct halo_data **halos, str
 
     myfree(forest_local_offsets);
 
-    /* We have loaded in this forest -> now update the offsets so that we can
-       correctly read in the next forest from this file. If the next forest
-       is in a new file, then there is a condition at the top of this function that
-       will reset all the halo_offset values to 0 -- MS 21/11/2019  */
-    for(int isnap=end_snap;isnap>=start_snap;isnap--) {
-        gen->halo_offset_per_snap[isnap] += nhalos_per_snap[isnap];
-    }
-    gen->curr_filenum = filenum_for_forest;
-
-    myfree(nhalos_per_snap);
-
     return nhalos;
 }
 
-#undef READ_PARTIAL_1D_ARRAY
-#undef ASSIGN_BUFFER_TO_SAGE
-#undef ASSIGN_BUFFER_TO_NDIM_SAGE
-
 void cleanup_forests_io_genesis_hdf5(struct forest_info *forests_info)
 {
     struct genesis_info *gen = &(forests_info->gen);
 
-    for(int i=0;i<gen->numfiles;i++) {
+    for(int i=gen->start_filenum;i<gen->start_filenum+gen->numfiles;i++) {
         H5Fclose(gen->h5_fds[i]);
     }
     H5Fclose(gen->meta_fd);
 
-    myfree(gen->halo_offset_per_snap);
+    free_forest_batch_genesis_hdf5(gen->batch);
+    myfree(gen->batch);
     myfree(gen->h5_fds);
     myfree(gen->offset_for_global_forestnum);
 }
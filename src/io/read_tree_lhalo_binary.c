@@ -5,6 +5,12 @@
 #include <unistd.h>
 #include <limits.h>
 
+#ifdef USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#endif
+
 #include "read_tree_lhalo_binary.h"
 #include "../core_mymalloc.h"
 #include "../core_utils.h"
@@ -15,6 +21,13 @@ static void get_forests_filename_lht_binary(char *filename, const size_t len, co
 static int load_tree_table_lht_binary(const int firstfile, const int lastfile, const int64_t *totnforests_per_file,
                                       const struct params *run_params, const int ThisTask,
                                       int64_t *nhalos_per_forest);
+#ifdef USE_MMAP
+/* Number of upcoming forests that the kernel is asked to read ahead (with madvise) when a forest is loaded */
+#define LHT_BINARY_NFORESTS_READ_AHEAD    4
+
+static int32_t get_file_index_lht_binary(const int fd, const struct lhalotree_info *lht);
+static void read_ahead_forests_lht_binary(const int64_t first_forestnr, const struct lhalotree_info *lht);
+#endif
 
 void get_forests_filename_lht_binary(char *filename, const size_t len, const int filenr, const struct params *run_params)
 {
@@ -90,6 +103,7 @@ int setup_forests_io_lht_binary(struct forest_info *forests_info,
     // Now that we know the number of trees being processed by each task, let's set up and malloc the structs.
     struct lhalotree_info *lht = &(forests_info->lht);
     forests_info->nforests_this_task = nforests_this_task;
+    forests_info->start_forestnum_this_task = start_forestnum;
 
     forests_info->FileNr = malloc(nforests_this_task * sizeof(*(forests_info->FileNr)));
     CHECK_POINTER_AND_RETURN_ON_NULL(forests_info->FileNr,
@@ -130,6 +144,8 @@ int setup_forests_io_lht_binary(struct forest_info *forests_info,
 
     lht->numfiles = end_filenum - start_filenum + 1;
     lht->open_fds = mymalloc(lht->numfiles * sizeof(lht->open_fds[0]));
+    lht->mmap_addr = mymalloc(lht->numfiles * sizeof(lht->mmap_addr[0]));
+    lht->mmap_size = mymalloc(lht->numfiles * sizeof(lht->mmap_size[0]));
 
     int64_t *forestnhalos = lht->nhalos_per_forest;
     int64_t nforests_so_far = 0;
@@ -155,6 +171,22 @@ int setup_forests_io_lht_binary(struct forest_info *forests_info,
         XRETURN(fd > 0, FILE_NOT_FOUND,
                 "Error: can't open file `%s'\n", filename);
         lht->open_fds[file_index] = fd;/* keep the file open, will be closed at the cleanup stage */
+        lht->mmap_addr[file_index] = NULL;
+        lht->mmap_size[file_index] = 0;
+#ifdef USE_MMAP
+        /* Map the entire file. The halos of each forest are then used directly from the page cache. The mapping is
+           private and writable -> any (accidental) modification of the halos is never written back to the file */
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if(addr != MAP_FAILED) {
+                lht->mmap_addr[file_index] = addr;
+                lht->mmap_size[file_index] = (size_t) st.st_size;
+            } else {
+                fprintf(stderr,"Warning: Could not memory-map file `%s'. Will read the forests with pread instead\n", filename);
+            }
+        }
+#endif
 
         const int64_t nforests_to_process_this_file = num_forests_to_process_per_file[filenr];
         const size_t nbytes = totnforests_per_file[filenr] * sizeof(int32_t);
@@ -231,18 +263,14 @@ int setup_forests_io_lht_binary(struct forest_info *forests_info,
 
 int64_t load_forest_lht_binary(const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
 {
-    const int64_t nhalos = (int64_t) forests_info->lht.nhalos_per_forest[forestnr];/* the array itself contains int32_t, since the LHT format*/
-    struct halo_data *local_halos = mymalloc(sizeof(struct halo_data) * nhalos);
-    XRETURN(local_halos != NULL, -MALLOC_FAILURE,
-            "Error: Could not allocate memory for %"PRId64" halos in forestnr = %"PRId64"\n",
-            nhalos, forestnr);
-
     if(forestnr >= forests_info->lht.nforests) {
         fprintf(stderr,"Error: Attempting to access forest = %"PRId64" but memory is allocated for only %"PRId64"\n"
                 "Perhaps, the starting forest offset was not accounted for?\n", forestnr, forests_info->lht.nforests);
         return -INVALID_MEMORY_ACCESS_REQUESTED;
     }
 
+    const int64_t nhalos = (int64_t) forests_info->lht.nhalos_per_forest[forestnr];/* the array itself contains int32_t, since the LHT format*/
+
     int fd = forests_info->lht.fd[forestnr];
 
     /* must have a valid file pointer  */
@@ -257,8 +285,43 @@ int64_t load_forest_lht_binary(const int64_t forestnr, struct halo_data **halos,
         return -FILE_READ_ERROR;/* negative offset would lead to file read error */
     }
 
+    const size_t nbytes = sizeof(struct halo_data) * nhalos;
+
+#ifdef USE_MMAP
+    const int32_t file_index = get_file_index_lht_binary(fd, &(forests_info->lht));
+    if(file_index >= 0 && forests_info->lht.mmap_addr[file_index] != NULL) {
+        XRETURN((size_t) offset + nbytes <= forests_info->lht.mmap_size[file_index], -FILE_READ_ERROR,
+                "Error: forestnr = %"PRId64" with %"PRId64" halos starting at offset = %"PRId64" bytes extends beyond the end "
+                "of the file (size = %zu bytes)\n", forestnr, nhalos, (int64_t) offset, forests_info->lht.mmap_size[file_index]);
+
+        read_ahead_forests_lht_binary(forestnr + 1, &(forests_info->lht));
+
+        struct halo_data *mapped_halos = (struct halo_data *) ((char *) forests_info->lht.mmap_addr[file_index] + offset);
+
+        /* The halos start after the (32-bit) nhalos per forest -> can only use
+           the halos in-place when they are correctly aligned, otherwise make a copy */
+        if(((uintptr_t) mapped_halos % _Alignof(struct halo_data)) == 0) {
+            *halos = mapped_halos;
+        } else {
+            struct halo_data *local_halos = mymalloc(nbytes);
+            XRETURN(local_halos != NULL, -MALLOC_FAILURE,
+                    "Error: Could not allocate memory for %"PRId64" halos in forestnr = %"PRId64"\n",
+                    nhalos, forestnr);
+            memcpy(local_halos, mapped_halos, nbytes);
+            *halos = local_halos;
+        }
+
+        return nhalos;
+    }
+#endif
+
+    struct halo_data *local_halos = mymalloc(nbytes);
+    XRETURN(local_halos != NULL, -MALLOC_FAILURE,
+            "Error: Could not allocate memory for %"PRId64" halos in forestnr = %"PRId64"\n",
+            nhalos, forestnr);
+
     /* file descriptor can be pointing anywhere, does not get modified by this pread */
-    mypread(fd, local_halos, sizeof(struct halo_data) * nhalos, offset);
+    mypread(fd, local_halos, nbytes, offset);
 
     *halos = local_halos;
 
@@ -266,6 +329,36 @@ int64_t load_forest_lht_binary(const int64_t forestnr, struct halo_data **halos,
 }
 
 
+/* The halos returned by load_forest_lht_binary might point directly into a memory-mapped file */
+void unload_forest_lht_binary(const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
+{
+    if(*halos == NULL) {
+        return;
+    }
+
+#ifdef USE_MMAP
+    const struct lhalotree_info *lht = &(forests_info->lht);
+    if(forestnr >= 0 && forestnr < lht->nforests) {
+        const int32_t file_index = get_file_index_lht_binary(lht->fd[forestnr], lht);
+        if(file_index >= 0 && lht->mmap_addr[file_index] != NULL) {
+            const char *start = lht->mmap_addr[file_index];
+            const char *p = (const char *) *halos;
+            if(p >= start && p < start + lht->mmap_size[file_index]) {
+                *halos = NULL;
+                return;
+            }
+        }
+    }
+#else
+    (void) forestnr;
+    (void) forests_info;
+#endif
+
+    myfree(*halos);
+    *halos = NULL;
+}
+
+
 void cleanup_forests_io_lht_binary(struct forest_info *forests_info)
 {
     struct lhalotree_info *lht = &(forests_info->lht);
@@ -274,11 +367,55 @@ void cleanup_forests_io_lht_binary(struct forest_info *forests_info)
     myfree(lht->fd);
 
     for(int32_t i=0;i<lht->numfiles;i++) {
+#ifdef USE_MMAP
+        if(lht->mmap_addr[i] != NULL) {
+            munmap(lht->mmap_addr[i], lht->mmap_size[i]);
+        }
+#endif
         close(lht->open_fds[i]);
     }
+    myfree(lht->mmap_size);
+    myfree(lht->mmap_addr);
     myfree(lht->open_fds);
 }
 
+#ifdef USE_MMAP
+static int32_t get_file_index_lht_binary(const int fd, const struct lhalotree_info *lht)
+{
+    for(int32_t i=0;i<lht->numfiles;i++) {
+        if(lht->open_fds[i] == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Asks the kernel to start reading the next few forests into the page cache, so that
+   the I/O overlaps with the processing of the current forest */
+static void read_ahead_forests_lht_binary(const int64_t first_forestnr, const struct lhalotree_info *lht)
+{
+    const size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    for(int64_t forestnr=first_forestnr; forestnr < first_forestnr + LHT_BINARY_NFORESTS_READ_AHEAD && forestnr < lht->nforests; forestnr++) {
+        const int32_t file_index = get_file_index_lht_binary(lht->fd[forestnr], lht);
+        if(file_index < 0 || lht->mmap_addr[file_index] == NULL) {
+            continue;
+        }
+
+        const size_t start = (size_t) lht->bytes_offset_for_forest[forestnr];
+        size_t end = start + sizeof(struct halo_data) * lht->nhalos_per_forest[forestnr];
+        if(end > lht->mmap_size[file_index]) {
+            end = lht->mmap_size[file_index];
+        }
+
+        /* madvise requires a page-aligned address */
+        const size_t aligned_start = (start / pagesize) * pagesize;
+        if(end > aligned_start) {
+            madvise((char *) lht->mmap_addr[file_index] + aligned_start, end - aligned_start, MADV_WILLNEED);
+        }
+    }
+}
+#endif
+
 int load_tree_table_lht_binary(const int firstfile, const int lastfile, const int64_t *totnforests_per_file,
                                  const struct params *run_params, const int ThisTask,
                                  int64_t *nhalos_per_forest)
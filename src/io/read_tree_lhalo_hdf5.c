@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stddef.h>
 
 
 #include "read_tree_lhalo_hdf5.h"
@@ -178,6 +179,7 @@ int setup_forests_io_lht_hdf5(struct forest_info *forests_info,
 
     struct lhalotree_info *lht = &(forests_info->lht);
     forests_info->nforests_this_task = nforests_this_task;
+    forests_info->start_forestnum_this_task = start_forestnum;
     lht->nforests = nforests_this_task;
 
     forests_info->FileNr = malloc(nforests_this_task * sizeof(*(forests_info->FileNr)));
@@ -268,45 +270,53 @@ int setup_forests_io_lht_hdf5(struct forest_info *forests_info,
 }
 
 
-/* MS: 17/9/2019 Assumes a properly allocated variable, with size at least 'nhalos*8' called 'buffer'
-   Also assumes a properly allocated variable, 'local_halos' of size 'nhalos' */
-#define READ_TREE_PROPERTY(fd, treenr, sage_name, hdf5_name, C_dtype) { \
-        snprintf(dataset_name, MAX_STRING_LEN - 1, "Tree%"PRId64"/%s", treenr, #hdf5_name); \
-        const int check_size = 1;                                       \
-        int macro_status = read_dataset(fd, dataset_name, -1, buffer, sizeof(C_dtype), check_size); \
-        if (macro_status != EXIT_SUCCESS) {                                   \
+/* Reads the dataset 'dataset_name' (within the already opened group for the tree) straight into the field
+   located at 'field_offset' within each of the 'nhalos' halo structs -> no intermediate buffer or copy loop is required */
+static int read_tree_property_into_halos(hid_t tree_group, const char *dataset_name, const size_t field_offset,
+                                         const hid_t mem_dtype, const int ncomponents, const int64_t nhalos,
+                                         struct halo_data *halos)
+{
+    hid_t h5_dset = H5Dopen2(tree_group, dataset_name, H5P_DEFAULT);
+    XRETURN(h5_dset >= 0, -HDF5_ERROR, "Error: Could not open dataset = '%s'\n", dataset_name);
+    hid_t h5_fspace = H5Dget_space(h5_dset);
+    XRETURN(h5_fspace >= 0, -HDF5_ERROR, "Error: Could not reserve filespace for dataset = '%s'\n", dataset_name);
+    const hssize_t npoints = H5Sget_simple_extent_npoints(h5_fspace);
+    XRETURN(npoints == nhalos * ncomponents, -1,
+            "Error: Expected dataset = '%s' to contain %"PRId64" elements (nhalos = %"PRId64" with %d element(s) per halo) "
+            "but found %lld elements instead\n",
+            dataset_name, nhalos * ncomponents, nhalos, ncomponents, (long long) npoints);
+    XRETURN(H5Sclose(h5_fspace) >= 0, -HDF5_ERROR, "Error: Failed to close the filespace for = '%s'\n", dataset_name);
+
+    herr_t status = read_partial_dataset_into_structs(h5_dset, dataset_name, 0, (hsize_t) nhalos, ncomponents, mem_dtype,
+                                                      halos, sizeof(struct halo_data), field_offset);
+    XRETURN(status >= 0, FILE_READ_ERROR, "Error: Failed to read dataset = '%s' (nhalos = %"PRId64")\n", dataset_name, nhalos);
+    XRETURN(H5Dclose(h5_dset) >= 0, -HDF5_ERROR, "Error: Could not close dataset = '%s'\n", dataset_name);
+
+    return EXIT_SUCCESS;
+}
+
+/* MS: 17/9/2019 Assumes an open group called 'tree_group' and a properly allocated variable, 'local_halos' of size 'nhalos' */
+#define READ_TREE_PROPERTY(sage_name, hdf5_name, h5_mem_dtype) {        \
+        const int macro_status = read_tree_property_into_halos(tree_group, #hdf5_name, offsetof(struct halo_data, sage_name), \
+                                                               h5_mem_dtype, 1, nhalos, local_halos); \
+        if (macro_status != EXIT_SUCCESS) {                             \
             return -1;                                                  \
         }                                                               \
-        C_dtype *macro_x = (C_dtype *) buffer;                          \
-        for (int halo_idx = 0; halo_idx < nhalos; ++halo_idx) {         \
-            local_halos[halo_idx].sage_name = *macro_x;                 \
-            macro_x++;                                                  \
-        }                                                               \
     }
 
-/* MS: 17/9/2019 Assumes a properly allocated variable, with size at least 'nhalos*NDIM*8' called 'buffer'
-   Also assumes a properly allocated variable, 'local_halos' of size 'nhalos' */
-#define READ_TREE_PROPERTY_MULTIPLEDIM(fd, treenr, sage_name, hdf5_name, C_dtype) { \
-        snprintf(dataset_name, MAX_STRING_LEN - 1, "Tree%"PRId64"/%s", treenr, #hdf5_name); \
-        const int check_size = 1;                                       \
-        const int macro_status = read_dataset(fd, dataset_name, -1, buffer, sizeof(C_dtype), check_size); \
+/* Same as above, but for fields with NDIM values per halo (the dataset has shape (nhalos, NDIM)) */
+#define READ_TREE_PROPERTY_MULTIPLEDIM(sage_name, hdf5_name, h5_mem_dtype) { \
+        const int macro_status = read_tree_property_into_halos(tree_group, #hdf5_name, offsetof(struct halo_data, sage_name), \
+                                                               h5_mem_dtype, NDIM, nhalos, local_halos); \
         if (macro_status != EXIT_SUCCESS) {                             \
             return -1;                                                  \
         }                                                               \
-        C_dtype *macro_x = (C_dtype *) buffer;                          \
-        for (int halo_idx = 0; halo_idx < nhalos; ++halo_idx) {         \
-            for (int dim = 0; dim < NDIM; ++dim) {                      \
-                local_halos[halo_idx].sage_name[dim] = *macro_x;        \
-                macro_x++;                                              \
-            }                                                           \
-        }                                                               \
     }
 
 
 int64_t load_forest_lht_hdf5(const int64_t forestnr, struct halo_data **halos, struct forest_info *forests_info)
 {
     char dataset_name[MAX_STRING_LEN];
-    void *buffer; // Buffer to hold the read HDF5 data.
 
     /* const int64_t nhalos = (int64_t) forests_info->lht.nhalos_per_forest[forestnr];/\* the array itself contains int32_t, since the LHT format*\/ */
     hid_t fd = forests_info->lht.h5_fd[forestnr];
@@ -343,40 +353,40 @@ int64_t load_forest_lht_hdf5(const int64_t forestnr, struct halo_data **halos, s
     *halos = mymalloc(sizeof(struct halo_data) * nhalos);
     struct halo_data *local_halos = *halos;
 
-    buffer = malloc(nhalos * NDIM * sizeof(double)); // The largest data-type will be double.
-    XRETURN(buffer != NULL, -MALLOC_FAILURE,
-            "Error: Could not allocate memory for %"PRId64" halos in the HDF5 buffer. Size requested = %"PRIu64" bytes\n",
-            nhalos, nhalos * NDIM * sizeof(double));
+    /* All the fields for this forest live within the same group -> open the group once */
+    snprintf(dataset_name, MAX_STRING_LEN - 1, "Tree%"PRId64, treenum_in_file);
+    hid_t tree_group = H5Gopen(fd, dataset_name, H5P_DEFAULT);
+    XRETURN(tree_group >= 0, -HDF5_ERROR, "Error: Could not open group = '%s'\n", dataset_name);
 
     // We now need to read in all the halo fields for this forest.
-    // To do so, we read the field into a buffer and then properly slot the field into the Halo struct.
+    // Each field is read directly into the Halo struct (HDF5 converts the on-disk datatype, if required)
 
     /* Merger Tree Pointers */
-    READ_TREE_PROPERTY(fd, treenum_in_file, Descendant, Descendant, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, FirstProgenitor, FirstProgenitor, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, NextProgenitor, NextProgenitor, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, FirstHaloInFOFgroup, FirstHaloInFOFGroup, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, NextHaloInFOFgroup, NextHaloInFOFGroup, int);
+    READ_TREE_PROPERTY(Descendant, Descendant, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(FirstProgenitor, FirstProgenitor, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(NextProgenitor, NextProgenitor, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(FirstHaloInFOFgroup, FirstHaloInFOFGroup, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(NextHaloInFOFgroup, NextHaloInFOFGroup, H5T_NATIVE_INT);
 
     /* Halo Properties */
-    READ_TREE_PROPERTY(fd, treenum_in_file, Len, SubhaloLen, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, M_Mean200, Group_M_Mean200, float);//MS: units 10^10 Msun/h for all Illustris mass fields
-    READ_TREE_PROPERTY(fd, treenum_in_file, Mvir, Group_M_Crit200, float);//MS: 16/9/2019 sage uses Mvir but assumes that contains M200c
-    READ_TREE_PROPERTY(fd, treenum_in_file, M_TopHat, Group_M_TopHat200, float);
-    READ_TREE_PROPERTY_MULTIPLEDIM(fd, treenum_in_file, Pos, SubhaloPos, float);//needs to be converted from kpc/h -> Mpc/h
-    READ_TREE_PROPERTY_MULTIPLEDIM(fd, treenum_in_file, Vel, SubhaloVel, float);//km/s
-    READ_TREE_PROPERTY(fd, treenum_in_file, VelDisp, SubhaloVelDisp, float);//km/s
-    READ_TREE_PROPERTY(fd, treenum_in_file, Vmax,  SubhaloVMax, float);//km/s
-    READ_TREE_PROPERTY_MULTIPLEDIM(fd, treenum_in_file, Spin, SubhaloSpin, float);//(kpc/h)(km/s) -> convert to (Mpc)*(km/s). Does it need sqrt(3)?
-    READ_TREE_PROPERTY(fd, treenum_in_file, MostBoundID, SubhaloIDMostBound, unsigned long long);
+    READ_TREE_PROPERTY(Len, SubhaloLen, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(M_Mean200, Group_M_Mean200, H5T_NATIVE_FLOAT);//MS: units 10^10 Msun/h for all Illustris mass fields
+    READ_TREE_PROPERTY(Mvir, Group_M_Crit200, H5T_NATIVE_FLOAT);//MS: 16/9/2019 sage uses Mvir but assumes that contains M200c
+    READ_TREE_PROPERTY(M_TopHat, Group_M_TopHat200, H5T_NATIVE_FLOAT);
+    READ_TREE_PROPERTY_MULTIPLEDIM(Pos, SubhaloPos, H5T_NATIVE_FLOAT);//needs to be converted from kpc/h -> Mpc/h
+    READ_TREE_PROPERTY_MULTIPLEDIM(Vel, SubhaloVel, H5T_NATIVE_FLOAT);//km/s
+    READ_TREE_PROPERTY(VelDisp, SubhaloVelDisp, H5T_NATIVE_FLOAT);//km/s
+    READ_TREE_PROPERTY(Vmax,  SubhaloVMax, H5T_NATIVE_FLOAT);//km/s
+    READ_TREE_PROPERTY_MULTIPLEDIM(Spin, SubhaloSpin, H5T_NATIVE_FLOAT);//(kpc/h)(km/s) -> convert to (Mpc)*(km/s). Does it need sqrt(3)?
+    READ_TREE_PROPERTY(MostBoundID, SubhaloIDMostBound, H5T_NATIVE_LLONG);
 
     /* File Position Info */
-    READ_TREE_PROPERTY(fd, treenum_in_file, SnapNum, SnapNum, int);
-    READ_TREE_PROPERTY(fd, treenum_in_file, FileNr, FileNr, int);
-    //READ_TREE_PROPERTY(fd, treenum_in_file, SubhaloIndex, SubhaloGrNr, int);//MS: Unsure if this is the right field mapping (another option is SubhaloNumber)
-    //READ_TREE_PROPERTY(fd, treenum_in_file, SubHalfMass, SubHalfMass, float);//MS: Unsure what this field captures -> thankfully unused within sage
+    READ_TREE_PROPERTY(SnapNum, SnapNum, H5T_NATIVE_INT);
+    READ_TREE_PROPERTY(FileNr, FileNr, H5T_NATIVE_INT);
+    //READ_TREE_PROPERTY(SubhaloIndex, SubhaloGrNr, H5T_NATIVE_INT);//MS: Unsure if this is the right field mapping (another option is SubhaloNumber)
+    //READ_TREE_PROPERTY(SubHalfMass, SubHalfMass, H5T_NATIVE_FLOAT);//MS: Unsure what this field captures -> thankfully unused within sage
 
-    free(buffer);
+    XRETURN(H5Gclose(tree_group) >= 0, -HDF5_ERROR, "Error: Could not close group for tree number = %"PRId64"\n", treenum_in_file);
 
     //MS: 16/9/2019 -- these are the fields present in the Illustris-lhalo-hdf5 file for TNG100-3-Dark
     /* 'Descendant', 'FileNr', 'FirstHaloInFOFGroup', 'FirstProgenitor', 'Group_M_Crit200', 'Group_M_Mean200', 'Group_M_TopHat200', 'NextHaloInFOFGroup', 'NextProgenitor', 'SnapNum', 'SubhaloGrNr', 'SubhaloHalfmassRad', 'SubhaloHalfmassRadType', 'SubhaloIDMostBound', 'SubhaloLen', 'SubhaloLenType', 'SubhaloMassInRadType', 'SubhaloMassType', 'SubhaloNumber', 'SubhaloOffsetType', 'SubhaloPos', 'SubhaloSpin', 'SubhaloVMax', 'SubhaloVel', 'SubhaloVelDisp' */
@@ -3,24 +3,125 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <math.h>
 #include <limits.h>
+#include <stddef.h>
 
 #include "save_gals_binary.h"
 #include "../core_mymalloc.h"
 #include "../core_utils.h"
 #include "../model_misc.h"
+#include "../macros.h"
 
-#ifdef USE_BUFFERED_WRITE
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
 #include "buffered_io.h"
 static struct buffered_io *all_buffers = NULL;
 #endif
 
+#ifdef USE_ASYNC_WRITE
+#include "async_writer.h"
+#endif
+
+/* Every output field is one of these (numpy-compatible) types */
+#define DTYPE_INT32   "i4"
+#define DTYPE_INT64   "i8"
+#define DTYPE_FLOAT32 "f4"
+
+/* The output fields in the order of the 'sage_hdf5' datasets (used by the 'sage_memory' output, the
+   'OutputFields' selection and the packed binary records) */
+#define OUTPUT_FIELD(name, member, dtype) {name, offsetof(struct GALAXY_OUTPUT, member), dtype, \
+                                           sizeof(((struct GALAXY_OUTPUT *) 0)->member)}
+static const struct galaxy_output_field output_fields[] = {
+#ifdef USE_SAGE_IN_MCMC_MODE
+    OUTPUT_FIELD("SnapNum", SnapNum, DTYPE_INT32),
+    OUTPUT_FIELD("StellarMass", StellarMass, DTYPE_FLOAT32),
+#else
+    OUTPUT_FIELD("SnapNum", SnapNum, DTYPE_INT32),
+    OUTPUT_FIELD("Type", Type, DTYPE_INT32),
+    OUTPUT_FIELD("GalaxyIndex", GalaxyIndex, DTYPE_INT64),
+    OUTPUT_FIELD("CentralGalaxyIndex", CentralGalaxyIndex, DTYPE_INT64),
+    OUTPUT_FIELD("SAGEHaloIndex", SAGEHaloIndex, DTYPE_INT32),
+    OUTPUT_FIELD("SAGETreeIndex", SAGETreeIndex, DTYPE_INT32),
+    OUTPUT_FIELD("SimulationHaloIndex", SimulationHaloIndex, DTYPE_INT64),
+    OUTPUT_FIELD("mergeType", mergeType, DTYPE_INT32),
+    OUTPUT_FIELD("mergeIntoID", mergeIntoID, DTYPE_INT32),
+    OUTPUT_FIELD("mergeIntoSnapNum", mergeIntoSnapNum, DTYPE_INT32),
+    OUTPUT_FIELD("dT", dT, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Posx", Pos[0], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Posy", Pos[1], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Posz", Pos[2], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Velx", Vel[0], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Vely", Vel[1], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Velz", Vel[2], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Spinx", Spin[0], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Spiny", Spin[1], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Spinz", Spin[2], DTYPE_FLOAT32),
+    OUTPUT_FIELD("Len", Len, DTYPE_INT32),
+    OUTPUT_FIELD("Mvir", Mvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("CentralMvir", CentralMvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Rvir", Rvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Vvir", Vvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Vmax", Vmax, DTYPE_FLOAT32),
+    OUTPUT_FIELD("VelDisp", VelDisp, DTYPE_FLOAT32),
+    OUTPUT_FIELD("ColdGas", ColdGas, DTYPE_FLOAT32),
+    OUTPUT_FIELD("StellarMass", StellarMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("BulgeMass", BulgeMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("HotGas", HotGas, DTYPE_FLOAT32),
+    OUTPUT_FIELD("EjectedMass", EjectedMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("BlackHoleMass", BlackHoleMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("IntraClusterStars", ICS, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsColdGas", MetalsColdGas, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsStellarMass", MetalsStellarMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsBulgeMass", MetalsBulgeMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsHotGas", MetalsHotGas, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsEjectedMass", MetalsEjectedMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("MetalsIntraClusterStars", MetalsICS, DTYPE_FLOAT32),
+    OUTPUT_FIELD("SfrDisk", SfrDisk, DTYPE_FLOAT32),
+    OUTPUT_FIELD("SfrBulge", SfrBulge, DTYPE_FLOAT32),
+    OUTPUT_FIELD("SfrDiskZ", SfrDiskZ, DTYPE_FLOAT32),
+    OUTPUT_FIELD("SfrBulgeZ", SfrBulgeZ, DTYPE_FLOAT32),
+    OUTPUT_FIELD("DiskRadius", DiskScaleRadius, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Cooling", Cooling, DTYPE_FLOAT32),
+    OUTPUT_FIELD("Heating", Heating, DTYPE_FLOAT32),
+    OUTPUT_FIELD("QuasarModeBHaccretionMass", QuasarModeBHaccretionMass, DTYPE_FLOAT32),
+    OUTPUT_FIELD("TimeOfLastMajorMerger", TimeOfLastMajorMerger, DTYPE_FLOAT32),
+    OUTPUT_FIELD("TimeOfLastMinorMerger", TimeOfLastMinorMerger, DTYPE_FLOAT32),
+    OUTPUT_FIELD("OutflowRate", OutflowRate, DTYPE_FLOAT32),
+    OUTPUT_FIELD("infallMvir", infallMvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("infallVvir", infallVvir, DTYPE_FLOAT32),
+    OUTPUT_FIELD("infallVmax", infallVmax, DTYPE_FLOAT32),
+#endif
+};
+#undef OUTPUT_FIELD
+
+#define NUM_GALAXY_OUTPUT_FIELDS ((int32_t) (sizeof(output_fields)/sizeof(output_fields[0])))
+BUILD_BUG_OR_ZERO(NUM_GALAXY_OUTPUT_FIELDS <= 64, output_fields_must_fit_into_the_64_bit_mask);
+
+/* With 'OutputFields' selecting only some of the fields, every galaxy is written as a packed record that
+   contains the selected fields (in the order of 'output_fields', without any padding). The file then
+   contains a description of the records between the number of galaxies per tree and the galaxies:
+   struct packed_output_header followed by 'num_fields' instances of struct packed_output_field */
+#define PACKED_OUTPUT_MAGIC  0x53444c4645474153ULL /* 'SAGEFLDS' */
+#define PACKED_OUTPUT_NAME_LEN  32
+struct packed_output_header {
+    uint64_t magic;
+    int32_t num_fields;
+    int32_t record_size;/* in bytes */
+};
+struct packed_output_field {
+    char name[PACKED_OUTPUT_NAME_LEN];
+    char dtype[8];
+};
 
 // Local Proto-Types //
+static int is_packed_output(const uint64_t mask);
+static size_t get_output_record_size(const uint64_t mask);
+static off_t get_packed_header_size(const uint64_t mask);
+static int32_t write_packed_header(const int fd, const off_t offset, const uint64_t mask);
+static void pack_galaxy_output(const struct GALAXY_OUTPUT *o, const uint64_t mask, char *record);
+static void get_selected_output_members(const uint64_t mask, char *selected);
 
-static int32_t prepare_galaxy_for_output(struct GALAXY *g, struct GALAXY_OUTPUT *o, struct halo_data *halos,
-                                         const int32_t original_treenr, const struct params *run_params);
 
 // Externally Visible Functions //
 
@@ -29,7 +130,12 @@ int32_t initialize_binary_galaxy_files(const int filenr, const struct forest_inf
 {
 
     const int32_t ntrees = forest_info->nforests_this_task;
-    const off_t halo_data_start_offset = (ntrees + 2) * sizeof(int32_t);
+    const off_t halo_data_start_offset = (ntrees + 2) * sizeof(int32_t) + get_packed_header_size(run_params->OutputFieldsMask);
+    const size_t record_size = get_output_record_size(run_params->OutputFieldsMask);
+
+    // When restarting from a checkpoint, the galaxies written up to the checkpoint are kept (and anything
+    // written after the checkpoint is discarded). Otherwise `tot_ngals` is 0 and the files are created afresh.
+    const int restart = save_info->nforests_saved > 0;
 
     // We open up files for each output. We'll store the file IDs of each of these file.
     save_info->save_fd = mymalloc(run_params->NumSnapOutputs * sizeof(int32_t));
@@ -42,25 +148,52 @@ int32_t initialize_binary_galaxy_files(const int filenr, const struct forest_inf
                  run_params->ZZ[run_params->ListOutputSnaps[n]], filenr);
 
         /* the last argument sets permissions as "rw-r--r--" (read/write owner, read group, read other)*/
-        save_info->save_fd[n] = open(buffer,  O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+        save_info->save_fd[n] = open(buffer, restart ? O_WRONLY:O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
         CHECK_STATUS_AND_RETURN_ON_FAIL(save_info->save_fd[n], FILE_NOT_FOUND,
                                         "Can't open file %s for initialization.\n", buffer);
 
-        // write out placeholders for the header data.
-        const off_t status = lseek(save_info->save_fd[n], halo_data_start_offset, SEEK_SET);
+        const off_t galaxy_data_end_offset = halo_data_start_offset + save_info->tot_ngals[n] * record_size;
+        if(restart) {
+            struct stat st;
+            XRETURN(fstat(save_info->save_fd[n], &st) == 0 && (save_info->tot_ngals[n] == 0 || st.st_size >= galaxy_data_end_offset), FILE_READ_ERROR,
+                    "Error: The output file '%s' does not contain the %"PRId64" galaxies written before the checkpoint\n",
+                    buffer, save_info->tot_ngals[n]);
+            XRETURN(ftruncate(save_info->save_fd[n], galaxy_data_end_offset) == 0, FILE_WRITE_ERROR,
+                    "Error: Could not discard the galaxies written after the checkpoint in the output file '%s'\n", buffer);
+        }
+
+        // write out placeholders for the header data (and skip the galaxies from before the checkpoint).
+        const off_t status = lseek(save_info->save_fd[n], galaxy_data_end_offset, SEEK_SET);
         CHECK_STATUS_AND_RETURN_ON_FAIL(status, FILE_WRITE_ERROR,
                                         "Error: Failed to write out %d elements for header information for file %d.\n"
                                         "Attempted to write %"PRId64" bytes\n", ntrees + 2, n, halo_data_start_offset);
     }
 
-#ifdef USE_BUFFERED_WRITE
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
+#ifdef USE_ASYNC_WRITE
+    // Two buffers per snapshot -> halve the size to keep the same memory footprint. There is never more than
+    // one buffer per snapshot waiting to be written, so the queue can never be full
+    const size_t buffer_size = 4 * 1024 * 1024; //4 MB
+    save_info->async_writer = malloc(sizeof(*(save_info->async_writer)));
+    XRETURN(save_info->async_writer != NULL, MALLOC_FAILURE, "Error: Could not allocate memory for the async writer\n");
+    int aw_status = start_async_writer(save_info->async_writer, run_params->NumSnapOutputs);
+    if(aw_status != EXIT_SUCCESS) {
+        return aw_status;
+    }
+#else
     const size_t buffer_size = 8 * 1024 * 1024; //8 MB
+#endif
     all_buffers = malloc(sizeof(*all_buffers)*run_params->NumSnapOutputs);
     XRETURN(all_buffers != NULL, -1, "Error: Could not allocate %d elements of size %zu bytes for buffered io\n", 
                                                       run_params->NumSnapOutputs, sizeof(*all_buffers));
     for(int n = 0; n < run_params->NumSnapOutputs; n++) {
         int fd = save_info->save_fd[n];
-        int status = setup_buffered_io(&all_buffers[n], buffer_size, fd, halo_data_start_offset);
+        const off_t start_offset = halo_data_start_offset + save_info->tot_ngals[n] * record_size;
+#ifdef USE_ASYNC_WRITE
+        int status = setup_async_buffered_io(&all_buffers[n], buffer_size, fd, start_offset, save_info->async_writer);
+#else
+        int status = setup_buffered_io(&all_buffers[n], buffer_size, fd, start_offset);
+#endif
         if(status != EXIT_SUCCESS) {
             fprintf(stderr,"Error: Could not setup buffered io\n");
             return -1;
@@ -73,7 +206,7 @@ int32_t initialize_binary_galaxy_files(const int filenr, const struct forest_inf
 
 
 int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals, const int32_t *OutputGalCount,
-                             struct forest_info *forest_info, struct halo_data *halos, struct halo_aux_data *haloaux,
+                             struct forest_info *forest_info, struct halo_data *halos, const int32_t *OutputGalSnapIdx,
                              struct GALAXY *halogal, struct save_info *save_info, const struct params *run_params)
 {
 
@@ -100,8 +233,15 @@ int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
 
     // We store all the galaxies to be written for this tree in a single memory block.  Later we
     // will then perform a single write for each snapshot, pointing to the correct position in
-    // the block.
-    struct GALAXY_OUTPUT *all_outputgals  = mymalloc(num_output_gals * sizeof(all_outputgals[0]));
+    // the block. With 'OutputFields', the block contains the packed records instead of GALAXY_OUTPUT structs.
+    const uint64_t mask = run_params->OutputFieldsMask;
+    const int packed = is_packed_output(mask);
+    const size_t record_size = get_output_record_size(mask);
+    char selected[sizeof(struct GALAXY_OUTPUT)];
+    if(packed) {
+        get_selected_output_members(mask, selected);
+    }
+    char *all_outputgals = mymalloc(num_output_gals * record_size);
     if(all_outputgals == NULL) {
         fprintf(stderr,"Error: Could not allocate enough memory to hold all %d output galaxies\n",num_output_gals);
         return MALLOC_FAILURE;
@@ -109,18 +249,23 @@ int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
 
     // Prepare all the galaxies for output.
     for(int32_t gal_idx = 0; gal_idx < num_gals; gal_idx++) {
-        if(haloaux[gal_idx].output_snap_n < 0) {
+        if(OutputGalSnapIdx[gal_idx] < 0) {
             continue;
         }
-        int32_t snap_idx = haloaux[gal_idx].output_snap_n;
+        int32_t snap_idx = OutputGalSnapIdx[gal_idx];
 
         // Here we move the offset pointer depending upon the number of galaxies processed up to this point.
-        struct GALAXY_OUTPUT *galaxy_output = all_outputgals + cumul_output_ngal[snap_idx] + num_gals_processed[snap_idx];
+        char *record = all_outputgals + (cumul_output_ngal[snap_idx] + num_gals_processed[snap_idx]) * record_size;
+        struct GALAXY_OUTPUT packed_galaxy;
+        struct GALAXY_OUTPUT *galaxy_output = packed ? &packed_galaxy:(struct GALAXY_OUTPUT *) record;
         status = prepare_galaxy_for_output(&halogal[gal_idx],  galaxy_output, halos,
-                                           forest_info->original_treenr[task_treenr], run_params);
+                                           forest_info->original_treenr[task_treenr], packed ? selected:NULL, run_params);
         if(status != EXIT_SUCCESS) {
           return status;
         }
+        if(packed) {
+            pack_galaxy_output(galaxy_output, mask, record);
+        }
 
         // Update the running totals.
         save_info->tot_ngals[snap_idx]++;
@@ -132,12 +277,12 @@ int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
     for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
 
         // Shift the offset pointer depending upon how many galaxies have been written out.
-        struct GALAXY_OUTPUT *galaxy_output = all_outputgals + cumul_output_ngal[snap_idx];
+        char *galaxy_output = all_outputgals + cumul_output_ngal[snap_idx] * record_size;
 
         // Then write out the chunk of galaxies for this redshift output.
-        const size_t numbytes = sizeof(struct GALAXY_OUTPUT)*OutputGalCount[snap_idx];
+        const size_t numbytes = record_size*OutputGalCount[snap_idx];
 
-#ifdef USE_BUFFERED_WRITE
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
         status = write_buffered_io(&all_buffers[snap_idx], galaxy_output, numbytes);
         if(status < 0) {
             fprintf(stderr,"Error: Could not write (buffered). snapshot number = %d number of bytes = %zu\n", snap_idx, numbytes);
@@ -149,7 +294,7 @@ int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
             fprintf(stderr, "Error: Failed to write out the galaxy struct for galaxies within file %d. "
                             "Meant to write out %d elements with a total of %zu bytes (%zu bytes for each element). "
                             "However, I wrote out a total of %zd bytes.\n",
-                            snap_idx, OutputGalCount[snap_idx], numbytes, sizeof(struct GALAXY_OUTPUT),
+                            snap_idx, OutputGalCount[snap_idx], numbytes, record_size,
                             nwritten);
             return FILE_WRITE_ERROR;
         }
@@ -162,6 +307,24 @@ int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
     return EXIT_SUCCESS;
 }
 
+// Make sure that all the galaxies saved so far are on disk (i.e., the files are consistent with `tot_ngals`).
+int32_t flush_binary_galaxy_files(struct save_info *save_info, const struct params *run_params)
+{
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
+        int status = flush_buffered_io(&all_buffers[snap_idx]);
+        if(status != EXIT_SUCCESS) {
+            fprintf(stderr,"Error: Could not flush the output file for snapshot = %d\n", snap_idx);
+            return status;
+        }
+#endif
+        XRETURN(fsync(save_info->save_fd[snap_idx]) == 0, FILE_WRITE_ERROR,
+                "Error: Could not synchronise the output file for snapshot = %d to disk\n", snap_idx);
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int32_t finalize_binary_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info, const struct params *run_params)
 {
 
@@ -171,7 +334,7 @@ int32_t finalize_binary_galaxy_files(const struct forest_info *forest_info, stru
         CHECK_STATUS_AND_RETURN_ON_FAIL(save_info->save_fd[snap_idx], EXIT_FAILURE,
                                         "Error trying to write to output number %d.\nThe file handle is %d.\n",
                                         snap_idx, save_info->save_fd[snap_idx]);
-#ifdef USE_BUFFERED_WRITE
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
         int status = cleanup_buffered_io(&all_buffers[snap_idx]);
         if(status != EXIT_SUCCESS) {
             fprintf(stderr,"Error: Could not finalise the output file for snapshot = %d\n", snap_idx);
@@ -208,6 +371,15 @@ int32_t finalize_binary_galaxy_files(const struct forest_info *forest_info, stru
             return FILE_WRITE_ERROR;
         }
 
+        if(is_packed_output(run_params->OutputFieldsMask)) {
+            const int32_t header_status = write_packed_header(save_info->save_fd[snap_idx], (ntrees + 2) * sizeof(int32_t),
+                                                              run_params->OutputFieldsMask);
+            if(header_status != EXIT_SUCCESS) {
+                fprintf(stderr,"Error: Could not write the description of the output fields for the header of file %d\n", snap_idx);
+                return header_status;
+            }
+        }
+
         // Close the file and clear handle after everything has been written.
         close(save_info->save_fd[snap_idx]);
         save_info->save_fd[snap_idx] = -1;
@@ -215,122 +387,277 @@ int32_t finalize_binary_galaxy_files(const struct forest_info *forest_info, stru
 
     myfree(save_info->save_fd);
 
-#ifdef USE_BUFFERED_WRITE
+#if defined(USE_BUFFERED_WRITE) || defined(USE_ASYNC_WRITE)
     free(all_buffers);
 #endif
+#ifdef USE_ASYNC_WRITE
+    const int aw_status = stop_async_writer(save_info->async_writer);
+    free(save_info->async_writer);
+    save_info->async_writer = NULL;
+    if(aw_status != EXIT_SUCCESS) {
+        return aw_status;
+    }
+#endif
 
     return EXIT_SUCCESS;
 }
 
-// Local Functions //
+// Only the members of the output galaxy that are selected (i.e., with a non-zero byte at the offset of the
+// member in 'selected') are computed. All the members are computed when 'selected' is NULL.
+/* Assumes 'o' and 'selected' are set appropriately before invoking the macro */
+#define SET_GALAXY_OUTPUT_MEMBER(member, value) {                       \
+        if(selected == NULL || selected[offsetof(struct GALAXY_OUTPUT, member)]) { \
+            o->member = value;                                          \
+        }                                                               \
+    }
+#define IS_GALAXY_OUTPUT_MEMBER_SELECTED(member)  (selected == NULL || selected[offsetof(struct GALAXY_OUTPUT, member)])
 
+// Converts a galaxy into the output format (also used for the 'sage_memory' output). With 'selected'
+// (see get_selected_output_members), the output fields that are not written are not even computed.
 int32_t prepare_galaxy_for_output(struct GALAXY *g, struct GALAXY_OUTPUT *o, struct halo_data *halos,
-                                  const int32_t original_treenr, const struct params *run_params)
+                                  const int32_t original_treenr, const char *selected, const struct params *run_params)
 {
     if(g == NULL || o == NULL) {
         fprintf(stderr,"Error: Either the input galaxy (address = %p) or the output galaxy (address = %p) is NULL\n", g, o);
         return -1;
     }
 
-    o->SnapNum = g->SnapNum;
+    SET_GALAXY_OUTPUT_MEMBER(SnapNum, g->SnapNum);
     if(g->Type < SHRT_MIN || g->Type > SHRT_MAX) {
         fprintf(stderr,"Error: Galaxy type = %d can not be represented in 2 bytes\n", g->Type);
         fprintf(stderr,"Converting galaxy type while saving from integer to short will result in data corruption");
         return EXIT_FAILURE;
     }
-    o->Type = g->Type;
+    SET_GALAXY_OUTPUT_MEMBER(Type, g->Type);
+
+    SET_GALAXY_OUTPUT_MEMBER(GalaxyIndex, g->GalaxyIndex);
+    SET_GALAXY_OUTPUT_MEMBER(CentralGalaxyIndex, g->CentralGalaxyIndex);
+
+    SET_GALAXY_OUTPUT_MEMBER(SAGEHaloIndex, g->HaloNr);/* if the original input halonr is required, then use haloaux[halonr].orig_index: MS 29/6/2018 */
+    SET_GALAXY_OUTPUT_MEMBER(SAGETreeIndex, original_treenr);
+    SET_GALAXY_OUTPUT_MEMBER(SimulationHaloIndex, llabs(halos[g->HaloNr].MostBoundID));
+
+    SET_GALAXY_OUTPUT_MEMBER(mergeType, g->mergeType);
+    SET_GALAXY_OUTPUT_MEMBER(mergeIntoID, g->mergeIntoID);
+    SET_GALAXY_OUTPUT_MEMBER(mergeIntoSnapNum, g->mergeIntoSnapNum);
+    SET_GALAXY_OUTPUT_MEMBER(dT, g->dT * run_params->UnitTime_in_s / SEC_PER_MEGAYEAR);
+
+    SET_GALAXY_OUTPUT_MEMBER(Pos[0], g->Pos[0]);
+    SET_GALAXY_OUTPUT_MEMBER(Pos[1], g->Pos[1]);
+    SET_GALAXY_OUTPUT_MEMBER(Pos[2], g->Pos[2]);
+    SET_GALAXY_OUTPUT_MEMBER(Vel[0], g->Vel[0]);
+    SET_GALAXY_OUTPUT_MEMBER(Vel[1], g->Vel[1]);
+    SET_GALAXY_OUTPUT_MEMBER(Vel[2], g->Vel[2]);
+    SET_GALAXY_OUTPUT_MEMBER(Spin[0], halos[g->HaloNr].Spin[0]);
+    SET_GALAXY_OUTPUT_MEMBER(Spin[1], halos[g->HaloNr].Spin[1]);
+    SET_GALAXY_OUTPUT_MEMBER(Spin[2], halos[g->HaloNr].Spin[2]);
+
+    SET_GALAXY_OUTPUT_MEMBER(Len, g->Len);
+    SET_GALAXY_OUTPUT_MEMBER(Mvir, g->Mvir);
+    SET_GALAXY_OUTPUT_MEMBER(CentralMvir, get_virial_mass(halos[g->HaloNr].FirstHaloInFOFgroup, halos, run_params));
+    SET_GALAXY_OUTPUT_MEMBER(Rvir, get_virial_radius(g->HaloNr, halos, run_params));  // output the actual Rvir, not the maximum Rvir
+    SET_GALAXY_OUTPUT_MEMBER(Vvir, get_virial_velocity(g->HaloNr, halos, run_params));  // output the actual Vvir, not the maximum Vvir
+    SET_GALAXY_OUTPUT_MEMBER(Vmax, g->Vmax);
+    SET_GALAXY_OUTPUT_MEMBER(VelDisp, halos[g->HaloNr].VelDisp);
+
+    SET_GALAXY_OUTPUT_MEMBER(ColdGas, g->ColdGas);
+    SET_GALAXY_OUTPUT_MEMBER(StellarMass, g->StellarMass);
+    SET_GALAXY_OUTPUT_MEMBER(BulgeMass, g->BulgeMass);
+    SET_GALAXY_OUTPUT_MEMBER(HotGas, g->HotGas);
+    SET_GALAXY_OUTPUT_MEMBER(EjectedMass, g->EjectedMass);
+    SET_GALAXY_OUTPUT_MEMBER(BlackHoleMass, g->BlackHoleMass);
+    SET_GALAXY_OUTPUT_MEMBER(ICS, g->ICS);
+
+    SET_GALAXY_OUTPUT_MEMBER(MetalsColdGas, g->MetalsColdGas);
+    SET_GALAXY_OUTPUT_MEMBER(MetalsStellarMass, g->MetalsStellarMass);
+    SET_GALAXY_OUTPUT_MEMBER(MetalsBulgeMass, g->MetalsBulgeMass);
+    SET_GALAXY_OUTPUT_MEMBER(MetalsHotGas, g->MetalsHotGas);
+    SET_GALAXY_OUTPUT_MEMBER(MetalsEjectedMass, g->MetalsEjectedMass);
+    SET_GALAXY_OUTPUT_MEMBER(MetalsICS, g->MetalsICS);
+
+    if(IS_GALAXY_OUTPUT_MEMBER_SELECTED(SfrDisk) || IS_GALAXY_OUTPUT_MEMBER_SELECTED(SfrBulge) ||
+       IS_GALAXY_OUTPUT_MEMBER_SELECTED(SfrDiskZ) || IS_GALAXY_OUTPUT_MEMBER_SELECTED(SfrBulgeZ)) {
+        o->SfrDisk = 0.0;
+        o->SfrBulge = 0.0;
+        o->SfrDiskZ = 0.0;
+        o->SfrBulgeZ = 0.0;
+
+        // NOTE: in Msun/yr
+        for(int step = 0; step < STEPS; step++) {
+            o->SfrDisk += g->SfrDisk[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
+            o->SfrBulge += g->SfrBulge[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
+
+            if(g->SfrDiskColdGas[step] > 0.0) {
+                o->SfrDiskZ += g->SfrDiskColdGasMetals[step] / g->SfrDiskColdGas[step] / STEPS;
+            }
+
+            if(g->SfrBulgeColdGas[step] > 0.0) {
+                o->SfrBulgeZ += g->SfrBulgeColdGasMetals[step] / g->SfrBulgeColdGas[step] / STEPS;
+            }
+        }
+    }
 
-    o->GalaxyIndex = g->GalaxyIndex;
-    o->CentralGalaxyIndex = g->CentralGalaxyIndex;
+    SET_GALAXY_OUTPUT_MEMBER(DiskScaleRadius, g->DiskScaleRadius);
 
-    o->SAGEHaloIndex = g->HaloNr;/* if the original input halonr is required, then use haloaux[halonr].orig_index: MS 29/6/2018 */
-    o->SAGETreeIndex = original_treenr;
-    o->SimulationHaloIndex = llabs(halos[g->HaloNr].MostBoundID);
+    SET_GALAXY_OUTPUT_MEMBER(Cooling, g->Cooling > 0.0 ? log10(g->Cooling * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s):0.0);
+    SET_GALAXY_OUTPUT_MEMBER(Heating, g->Heating > 0.0 ? log10(g->Heating * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s):0.0);
 
-    o->mergeType = g->mergeType;
-    o->mergeIntoID = g->mergeIntoID;
-    o->mergeIntoSnapNum = g->mergeIntoSnapNum;
-    o->dT = g->dT * run_params->UnitTime_in_s / SEC_PER_MEGAYEAR;
+    SET_GALAXY_OUTPUT_MEMBER(QuasarModeBHaccretionMass, g->QuasarModeBHaccretionMass);
 
-    for(int j = 0; j < 3; j++) {
-        o->Pos[j] = g->Pos[j];
-        o->Vel[j] = g->Vel[j];
-        o->Spin[j] = halos[g->HaloNr].Spin[j];
-    }
+    SET_GALAXY_OUTPUT_MEMBER(TimeOfLastMajorMerger, g->TimeOfLastMajorMerger * run_params->UnitTime_in_Megayears);
+    SET_GALAXY_OUTPUT_MEMBER(TimeOfLastMinorMerger, g->TimeOfLastMinorMerger * run_params->UnitTime_in_Megayears);
+
+    SET_GALAXY_OUTPUT_MEMBER(OutflowRate, g->OutflowRate * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
+
+    //infall properties
+    SET_GALAXY_OUTPUT_MEMBER(infallMvir, g->Type != 0 ? g->infallMvir:0.0);
+    SET_GALAXY_OUTPUT_MEMBER(infallVvir, g->Type != 0 ? g->infallVvir:0.0);
+    SET_GALAXY_OUTPUT_MEMBER(infallVmax, g->Type != 0 ? g->infallVmax:0.0);
+
+    return EXIT_SUCCESS;
+}
+
+#undef SET_GALAXY_OUTPUT_MEMBER
+#undef IS_GALAXY_OUTPUT_MEMBER_SELECTED
 
-    o->Len = g->Len;
-    o->Mvir = g->Mvir;
-    o->CentralMvir = get_virial_mass(halos[g->HaloNr].FirstHaloInFOFgroup, halos, run_params);
-    o->Rvir = get_virial_radius(g->HaloNr, halos, run_params);  // output the actual Rvir, not the maximum Rvir
-    o->Vvir = get_virial_velocity(g->HaloNr, halos, run_params);  // output the actual Vvir, not the maximum Vvir
-    o->Vmax = g->Vmax;
-    o->VelDisp = halos[g->HaloNr].VelDisp;
-
-    o->ColdGas = g->ColdGas;
-    o->StellarMass = g->StellarMass;
-    o->BulgeMass = g->BulgeMass;
-    o->HotGas = g->HotGas;
-    o->EjectedMass = g->EjectedMass;
-    o->BlackHoleMass = g->BlackHoleMass;
-    o->ICS = g->ICS;
-
-    o->MetalsColdGas = g->MetalsColdGas;
-    o->MetalsStellarMass = g->MetalsStellarMass;
-    o->MetalsBulgeMass = g->MetalsBulgeMass;
-    o->MetalsHotGas = g->MetalsHotGas;
-    o->MetalsEjectedMass = g->MetalsEjectedMass;
-    o->MetalsICS = g->MetalsICS;
-
-    o->SfrDisk = 0.0;
-    o->SfrBulge = 0.0;
-    o->SfrDiskZ = 0.0;
-    o->SfrBulgeZ = 0.0;
-
-    // NOTE: in Msun/yr
-    for(int step = 0; step < STEPS; step++) {
-        o->SfrDisk += g->SfrDisk[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
-        o->SfrBulge += g->SfrBulge[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
-
-        if(g->SfrDiskColdGas[step] > 0.0) {
-            o->SfrDiskZ += g->SfrDiskColdGasMetals[step] / g->SfrDiskColdGas[step] / STEPS;
+
+int32_t get_num_galaxy_output_fields(void)
+{
+    return NUM_GALAXY_OUTPUT_FIELDS;
+}
+
+
+const struct galaxy_output_field *get_galaxy_output_field(const int32_t field_idx)
+{
+    return &output_fields[field_idx];
+}
+
+
+// Converts the (comma and/or space separated) list of field names in 'field_list' into the bitmask
+// of the selected output fields. An empty list selects all the fields.
+int32_t parse_output_fields(const char *field_list, uint64_t *mask)
+{
+    char buffer[MAX_STRING_LEN];
+    snprintf(buffer, MAX_STRING_LEN, "%s", field_list);
+
+    *mask = 0;
+    char *string = buffer, *token;
+    while((token = strsep(&string, " ,\t")) != NULL) {
+        if(token[0] == '\0') {
+            continue;
         }
 
-        if(g->SfrBulgeColdGas[step] > 0.0) {
-            o->SfrBulgeZ += g->SfrBulgeColdGasMetals[step] / g->SfrBulgeColdGas[step] / STEPS;
+        int32_t field_idx;
+        for(field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+            if(strcasecmp(token, output_fields[field_idx].name) == 0) {
+                break;
+            }
+        }
+        if(field_idx == NUM_GALAXY_OUTPUT_FIELDS) {
+            fprintf(stderr,"Error: '%s' is not an output field. Please choose from --\n", token);
+            for(field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+                fprintf(stderr,"%s%s", output_fields[field_idx].name, field_idx == NUM_GALAXY_OUTPUT_FIELDS - 1 ? "\n":", ");
+            }
+            return INVALID_OPTION_IN_PARAMS;
         }
+        *mask |= 1ULL << field_idx;
     }
 
-    o->DiskScaleRadius = g->DiskScaleRadius;
+    if(*mask == 0) {
+        *mask = NUM_GALAXY_OUTPUT_FIELDS == 64 ? ~0ULL:(1ULL << NUM_GALAXY_OUTPUT_FIELDS) - 1;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Local Functions //
 
-    if (g->Cooling > 0.0) {
-        o->Cooling = log10(g->Cooling * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s);
-    } else {
-        o->Cooling = 0.0;
+// The galaxies are only written as packed records when some of the fields are not selected
+// (i.e., the default output is unchanged)
+static int is_packed_output(const uint64_t mask)
+{
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx) == 0) {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    if (g->Heating > 0.0) {
-        o->Heating = log10(g->Heating * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s);
-    } else {
-        o->Heating = 0.0;
+static size_t get_output_record_size(const uint64_t mask)
+{
+    if(is_packed_output(mask) == 0) {
+        return sizeof(struct GALAXY_OUTPUT);
     }
 
-    o->QuasarModeBHaccretionMass = g->QuasarModeBHaccretionMass;
+    size_t record_size = 0;
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx)) {
+            record_size += output_fields[field_idx].size;
+        }
+    }
+    return record_size;
+}
 
-    o->TimeOfLastMajorMerger = g->TimeOfLastMajorMerger * run_params->UnitTime_in_Megayears;
-    o->TimeOfLastMinorMerger = g->TimeOfLastMinorMerger * run_params->UnitTime_in_Megayears;
+static off_t get_packed_header_size(const uint64_t mask)
+{
+    if(is_packed_output(mask) == 0) {
+        return 0;
+    }
 
-    o->OutflowRate = g->OutflowRate * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS;
+    int32_t num_fields = 0;
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        num_fields += IS_OUTPUT_FIELD_SELECTED(mask, field_idx) ? 1:0;
+    }
+    return sizeof(struct packed_output_header) + num_fields * sizeof(struct packed_output_field);
+}
 
-    //infall properties
-    if(g->Type != 0) {
-        o->infallMvir = g->infallMvir;
-        o->infallVvir = g->infallVvir;
-        o->infallVmax = g->infallVmax;
-    } else {
-        o->infallMvir = 0.0;
-        o->infallVvir = 0.0;
-        o->infallVmax = 0.0;
+static int32_t write_packed_header(const int fd, const off_t offset, const uint64_t mask)
+{
+    const off_t header_size = get_packed_header_size(mask);
+    char *buffer = mycalloc(1, header_size);
+    CHECK_POINTER_AND_RETURN_ON_NULL(buffer, "Failed to allocate %"PRId64" bytes for the description of the output fields",
+                                     (int64_t) header_size);
+
+    struct packed_output_header *header = (struct packed_output_header *) buffer;
+    struct packed_output_field *fields = (struct packed_output_field *) (buffer + sizeof(*header));
+    header->magic = PACKED_OUTPUT_MAGIC;
+    header->record_size = (int32_t) get_output_record_size(mask);
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx)) {
+            snprintf(fields[header->num_fields].name, PACKED_OUTPUT_NAME_LEN, "%s", output_fields[field_idx].name);
+            snprintf(fields[header->num_fields].dtype, sizeof(fields[0].dtype), "%s", output_fields[field_idx].dtype);
+            header->num_fields++;
+        }
     }
 
+    const ssize_t nwritten = mypwrite(fd, buffer, header_size, offset);
+    myfree(buffer);
+    XRETURN(nwritten == (ssize_t) header_size, FILE_WRITE_ERROR,
+            "Error: Wrote %zd bytes instead of %"PRId64" bytes for the description of the output fields\n",
+            nwritten, (int64_t) header_size);
+
     return EXIT_SUCCESS;
 }
+
+static void pack_galaxy_output(const struct GALAXY_OUTPUT *o, const uint64_t mask, char *record)
+{
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx)) {
+            memcpy(record, (const char *) o + output_fields[field_idx].offset, output_fields[field_idx].size);
+            record += output_fields[field_idx].size;
+        }
+    }
+}
+
+// Marks the bytes of the selected output fields within struct GALAXY_OUTPUT (i.e., 'selected' must
+// contain sizeof(struct GALAXY_OUTPUT) bytes) -> only those fields are computed by prepare_galaxy_for_output
+static void get_selected_output_members(const uint64_t mask, char *selected)
+{
+    memset(selected, 0, sizeof(struct GALAXY_OUTPUT));
+    for(int32_t field_idx = 0; field_idx < NUM_GALAXY_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx)) {
+            memset(selected + output_fields[field_idx].offset, 1, output_fields[field_idx].size);
+        }
+    }
+}
@@ -80,6 +80,18 @@ extern "C" {
       float infallVmax;
     };
 
+    /* One field of the galaxy output (i.e., one member of GALAXY_OUTPUT). The names are identical to the
+       dataset names in the 'sage_hdf5' output and the dtypes are numpy-compatible ("i4", "i8" or "f4") */
+    struct galaxy_output_field {
+        const char *name;
+        size_t offset;/* within struct GALAXY_OUTPUT */
+        const char *dtype;
+        size_t size;
+    };
+
+/* 'OutputFields' is stored as a bitmask over the output fields -> bit 'field_idx' is set when that field is written */
+#define IS_OUTPUT_FIELD_SELECTED(mask, field_idx)   (((mask) >> (field_idx)) & 1ULL)
+
     /* Proto-Types */
     extern int32_t initialize_binary_galaxy_files(const int filenr, const struct forest_info *forest_info,
                                                   struct save_info *save_info,
@@ -87,9 +99,18 @@ extern "C" {
 
     extern int32_t save_binary_galaxies(const int32_t task_treenr, const int32_t num_gals,
                                         const int32_t *OutputGalCount, struct forest_info *forest_info,
-                                        struct halo_data *halos, struct halo_aux_data *haloaux,
+                                        struct halo_data *halos, const int32_t *OutputGalSnapIdx,
                                         struct GALAXY *halogal, struct save_info *save_info, const struct params *run_params);
 
+    extern int32_t flush_binary_galaxy_files(struct save_info *save_info, const struct params *run_params);
+
+    extern int32_t prepare_galaxy_for_output(struct GALAXY *g, struct GALAXY_OUTPUT *o, struct halo_data *halos,
+                                             const int32_t original_treenr, const char *selected, const struct params *run_params);
+
+    extern int32_t get_num_galaxy_output_fields(void);
+    extern const struct galaxy_output_field *get_galaxy_output_field(const int32_t field_idx);
+    extern int32_t parse_output_fields(const char *field_list, uint64_t *mask);
+
     extern int32_t finalize_binary_galaxy_files(const struct forest_info *forest_info,
                                                 struct save_info *save_info,
                                                 const struct params *run_params);
@@ -7,11 +7,22 @@
 #include <math.h>
 
 #include "save_gals_hdf5.h"
+#include "save_gals_binary.h"
 #include "../core_mymalloc.h"
+#include "../core_save.h"
 #include "../core_utils.h"
 #include "../macros.h"
 #include "../model_misc.h"
 #include "../sage.h"
+#include "hdf5_read_utils.h"
+
+#ifdef MPI
+#include <mpi.h>
+#endif
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
 
 
 #ifdef USE_SAGE_IN_MCMC_MODE
@@ -33,11 +44,116 @@ static int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct sav
                                               const int64_t original_treenr,
                                               const struct params *run_params);
 
-static int32_t trigger_buffer_write(const int32_t snap_idx, const int32_t num_to_write, const int64_t num_already_written,
-                                    struct save_info *save_info, const struct params *run_params);
+static int32_t write_galaxy_buffer(const int32_t snap_idx, const int32_t num_to_write, struct save_info *save_info,
+                                   const struct params *run_params);
+
+static int32_t trigger_buffer_write(const int32_t snap_idx, const struct HDF5_GALAXY_OUTPUT *buffer, const int32_t num_to_write,
+                                    const int64_t num_already_written, const struct save_info *save_info,
+                                    const struct params *run_params);
 
 static int32_t write_header(hid_t file_id, const struct forest_info *forest_info, const struct params *run_params);
 
+static int32_t create_snapshot_group(hid_t file_id, const int32_t snap_idx, const hid_t prop, struct save_info *save_info,
+                                     const struct params *run_params);
+
+static int32_t reopen_snapshot_group(hid_t file_id, const int32_t snap_idx, const int64_t ngals, struct save_info *save_info,
+                                     const struct params *run_params);
+
+static int32_t create_extendible_dataset(hid_t file_id, const char *dataset_name, const hid_t h5_dtype, const hid_t prop);
+
+static int32_t shrink_dataset(hid_t file_id, const char *dataset_name, const int64_t new_size);
+
+static int32_t set_galaxy_dataset_properties(hid_t prop, const hsize_t chunk_size, const struct params *run_params);
+
+static int32_t allocate_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer, const int32_t buffer_size, const uint64_t mask);
+
+static void free_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer);
+
+static int32_t grow_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer, const int32_t new_size);
+
+static void free_hdf5_save_info(struct save_info *save_info, const struct params *run_params);
+
+static int32_t agree_on_status(const int32_t status);
+
+static int32_t setup_single_file(struct save_info *save_info, const struct params *run_params);
+
+static int32_t create_single_file(struct save_info *save_info, const struct params *run_params);
+
+static int32_t reopen_single_file(struct save_info *save_info, const struct params *run_params);
+
+static int32_t write_single_file_round(const struct forest_info *forest_info, struct save_info *save_info, const int checkpoint,
+                                       const struct params *run_params);
+
+static int32_t write_task_galaxies_into_single_file(hid_t file_id, const struct save_info *save_info, const int64_t *my_counts,
+                                                    const int64_t *offsets, const int64_t *new_sizes, const struct params *run_params);
+
+static int32_t extend_and_write_dataset(hid_t file_id, const char *dataset_name, const void *data, const hsize_t count,
+                                        const hsize_t dst_offset, const hsize_t new_size, const hid_t mem_dtype);
+
+static int32_t write_single_file_summary(const struct forest_info *forest_info, const struct save_info *save_info,
+                                         const struct params *run_params);
+
+static int32_t write_single_file_totals(const struct save_info *save_info, const int64_t *all_counts, const double frac_volume_processed,
+                                        const struct params *run_params);
+
+static void free_single_file(struct save_info *save_info);
+
+#ifdef MPI
+static void send_single_file_message(struct hdf5_single_file *single_file, const int64_t type, const int64_t round);
+
+static void receive_single_file_messages(struct save_info *save_info, const int wait);
+#endif
+
+#ifdef USE_ASYNC_WRITE
+#include "async_writer.h"
+
+// Everything required to write out one (full) galaxy buffer on the async writer thread. There
+// is at most one such write pending per output snapshot.
+struct hdf5_buffer_write_job {
+    int32_t snap_idx;
+    int32_t num_to_write;
+    int64_t num_already_written;
+    struct HDF5_GALAXY_OUTPUT buffer;
+    const struct save_info *save_info;
+    const struct params *run_params;
+};
+
+static int hdf5_buffer_write_job(void *arg);
+#endif
+
+// With `HDF5SingleFile`, all the tasks write into the single file together, in rounds. In every round, each task
+// writes all the galaxies (and trees) saved since the previous round, at the end of the datasets and in task
+// order. A task requests a round (by messaging all the other tasks) once one of its buffers is full or a checkpoint
+// is due, and the other tasks join that round after their current forest. Hence, the galaxies are ordered by round
+// and then by task, and 'TreeInfo/ForestNr' contains the forest number of each tree.
+#define SINGLE_FILE_MSG_TAG     (1)
+#define SINGLE_FILE_MSG_ROUND   (0)/* request a round (the message contains the number of the round) */
+#define SINGLE_FILE_MSG_DONE    (1)/* the task has saved all its forests (and does not send any more messages) */
+
+#ifdef MPI
+// A message to all the other tasks that has not necessarily been received yet.
+struct single_file_message {
+    int64_t content[2];/* message type and round */
+    MPI_Request *requests;/* one per task (MPI_REQUEST_NULL for this task) */
+    struct single_file_message *next;
+};
+#endif
+
+struct hdf5_single_file {
+    char fname[3*MAX_STRING_LEN];
+    int64_t *ngals;/* number of galaxies in the file at each output snapshot (identical on all tasks) */
+    int64_t ntrees;/* number of trees in the file (identical on all tasks) */
+    int64_t nforests_written;/* number of forests on this task that are in the file */
+    int32_t *buffer_capacity;/* the buffers are only written in between forests -> they grow when a forest does not fit */
+    int64_t *counts;/* [NTasks][NumSnapOutputs + 2] work space for the counts exchanged in every round */
+#ifdef MPI
+    MPI_Comm comm;/* the messages (and the exchange of the counts in every round) use a separate communicator */
+    int32_t round_requested;/* another task (or this one) has requested the next round */
+    int32_t ntasks_done;
+    struct single_file_message *sent;
+#endif
+};
+
 
 
 // HDF5 is a self-describing data format.  Each dataset will contain a number of attributes to
@@ -148,18 +264,34 @@ static int32_t write_header(hid_t file_id, const struct forest_info *forest_info
 
 // Unlike the binary output where we generate an array of output struct instances, the HDF5 workflow has
 // a single output struct (for each snapshot) where the **properties** of the struct are arrays.
-// This macro callocs (i.e., allocates and zeros) space for these inner arrays.
-#define MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, field_name) {        \
-        save_info->buffer_output_gals[snap_idx].field_name = malloc(save_info->buffer_size * sizeof(*(save_info->buffer_output_gals[snap_idx].field_name))); \
-        if(save_info->buffer_output_gals[snap_idx].field_name == NULL) { \
-            fprintf(stderr, "Could not allocate %d elements for the " #field_name" GALAXY_OUTPUT " \
-                    "field for output snapshot " #snap_idx"\n", save_info->buffer_size); \
-            return MALLOC_FAILURE;                                      \
+// This macro allocates space for these inner arrays. Only the output fields selected with 'OutputFields'
+// are allocated (the others remain NULL and are neither filled nor written).
+/* Assumes 'field_idx' is set appropriately before invoking the macro */
+#define MALLOC_GALAXY_OUTPUT_INNER_ARRAY(field_name) {        \
+        if(IS_OUTPUT_FIELD_SELECTED(mask, field_idx)) {                 \
+            buffer->field_name = malloc(buffer_size * sizeof(*(buffer->field_name))); \
+            if(buffer->field_name == NULL) {                            \
+                fprintf(stderr, "Could not allocate %d elements for the " #field_name" GALAXY_OUTPUT " \
+                        "field\n", buffer_size);                        \
+                return MALLOC_FAILURE;                                  \
+            }                                                           \
         }                                                               \
+        field_idx++;                                                    \
+    }
+
+#define FREE_GALAXY_OUTPUT_INNER_ARRAY(field_name) {     \
+        free(buffer->field_name);  \
     }
 
-#define FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, field_name) {     \
-        free(save_info->buffer_output_gals[snap_idx].field_name);  \
+/* Only the arrays that were allocated are grown */
+#define REALLOC_GALAXY_OUTPUT_INNER_ARRAY(field_name) if(buffer->field_name != NULL) { \
+        void *new_array = realloc(buffer->field_name, new_size * sizeof(*(buffer->field_name))); \
+        if(new_array == NULL) {                                         \
+            fprintf(stderr, "Could not re-allocate %d elements for the " #field_name" GALAXY_OUTPUT " \
+                    "field\n", new_size);                               \
+            return MALLOC_FAILURE;                                      \
+        }                                                               \
+        buffer->field_name = new_array;                                 \
     }
 
 // Externally Visible Functions //
@@ -167,6 +299,9 @@ static int32_t write_header(hid_t file_id, const struct forest_info *forest_info
 // Creates the HDF5 file, groups and the datasets.  The heirachy for the HDF5 file is
 // File->Group->Datasets.  For example, File->"Snap_43"->"StellarMass"->**Data**.
 // The handles for all of these are stored in `save_info` so we can write later.
+// With `HDF5SingleFile`, there is no per-task file: Task 0 creates the single file instead and the
+// galaxies are written into it by all the tasks together (see `sync_hdf5_single_file()`). All the
+// tasks must then call this function.
 int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_info, const struct params *run_params)
 {
     char buffer[3*MAX_STRING_LEN];
@@ -175,11 +310,28 @@ int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_in
     // Use 3*MAX_STRING_LEN because OutputDir and FileNameGalaxies can be MAX_STRING_LEN.  Add a bit more buffer for the filenr and '.hdf5'.
     snprintf(buffer, 3*MAX_STRING_LEN-1, "%s/%s_%d.hdf5", run_params->OutputDir, run_params->FileNameGalaxies, filenr);
 
-    hid_t file_id = H5Fcreate(buffer, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-    CHECK_STATUS_AND_RETURN_ON_FAIL(file_id, FILE_NOT_FOUND,
-                                    "Can't open file %s for initialization.\n", buffer);
+    // When restarting from a checkpoint, the file written by the previous run is re-used.
+    const int restart = save_info->nforests_saved > 0;
+    hid_t file_id = -1;
+    if(run_params->HDF5SingleFile == 0) {
+        file_id = restart ? H5Fopen(buffer, H5F_ACC_RDWR, H5P_DEFAULT):H5Fcreate(buffer, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(file_id, FILE_NOT_FOUND,
+                                        "Can't open file %s for initialization.\n", buffer);
+    }
     save_info->file_id = file_id;
 
+    // The previous run may have been interrupted while finalizing the file -> remove anything written then.
+    if(restart && file_id >= 0) {
+        const char *finalize_groups[] = {"TreeInfo", "Header"};
+        for(size_t i = 0; i < sizeof(finalize_groups)/sizeof(finalize_groups[0]); i++) {
+            if(H5Lexists(file_id, finalize_groups[i], H5P_DEFAULT) > 0) {
+                herr_t status = H5Ldelete(file_id, finalize_groups[i], H5P_DEFAULT);
+                CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                                "Failed to remove the (incomplete) %s group from file %s.\n", finalize_groups[i], buffer);
+            }
+        }
+    }
+
     // Generate the names, description and HDF5 data types for each of the output fields.
     char field_names[NUM_OUTPUT_FIELDS][MAX_STRING_LEN];
     char field_descriptions[NUM_OUTPUT_FIELDS][MAX_STRING_LEN];
@@ -188,27 +340,45 @@ int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_in
 
     generate_field_metadata(field_names, field_descriptions, field_units, field_dtypes);
 
-    save_info->num_output_fields = NUM_OUTPUT_FIELDS;
-    save_info->name_output_fields = malloc(NUM_OUTPUT_FIELDS * sizeof(save_info->name_output_fields[0]));
+    // Only the fields selected with 'OutputFields' are written. The selection refers to the binary output
+    // fields, which must be in the same order as the datasets.
+    const uint64_t mask = run_params->OutputFieldsMask;
+    XRETURN(get_num_galaxy_output_fields() == NUM_OUTPUT_FIELDS, EXIT_FAILURE,
+            "Error: There are %d binary output fields but %d hdf5 output fields\n", get_num_galaxy_output_fields(), NUM_OUTPUT_FIELDS);
+    int32_t num_fields = 0;
+    for(int32_t i = 0; i < NUM_OUTPUT_FIELDS; i++) {
+        XRETURN(strcmp(field_names[i], get_galaxy_output_field(i)->name) == 0, EXIT_FAILURE,
+                "Error: The hdf5 output field number %d is '%s' but the binary output field is '%s'\n",
+                i, field_names[i], get_galaxy_output_field(i)->name);
+        num_fields += IS_OUTPUT_FIELD_SELECTED(mask, i) ? 1:0;
+    }
+
+    save_info->num_output_fields = num_fields;
+    save_info->name_output_fields = malloc(num_fields * sizeof(save_info->name_output_fields[0]));
     CHECK_POINTER_AND_RETURN_ON_NULL(save_info->name_output_fields,
                                      "Failed to allocate %d elements of size %zu for save_info->name_output_fields",
-                                     NUM_OUTPUT_FIELDS,
+                                     num_fields,
                                      sizeof(char *));
-
-    for(int i=0;i<NUM_OUTPUT_FIELDS;i++) {
-        save_info->name_output_fields[i] = malloc(MAX_STRING_LEN * sizeof(save_info->name_output_fields[i][0]));
-        CHECK_POINTER_AND_RETURN_ON_NULL(save_info->name_output_fields[i],
-                                         "Failed to allocate %d elements of size %zu for save_info->name_output_fields[%d]",
-                                         NUM_OUTPUT_FIELDS,
-                                         sizeof(char), i);
-        memcpy(save_info->name_output_fields[i], field_names[i], MAX_STRING_LEN);
-    }
-    save_info->field_dtypes = malloc(NUM_OUTPUT_FIELDS * sizeof(save_info->field_dtypes[0]));
+    save_info->field_dtypes = malloc(num_fields * sizeof(save_info->field_dtypes[0]));
     CHECK_POINTER_AND_RETURN_ON_NULL(save_info->field_dtypes,
                                      "Failed to allocate %d elements of size %zu for save_info->field_dtypes",
-                                     NUM_OUTPUT_FIELDS,
+                                     num_fields,
                                      sizeof(save_info->field_dtypes[0]));
 
+    for(int32_t i = 0, j = 0; i < NUM_OUTPUT_FIELDS; i++) {
+        if(IS_OUTPUT_FIELD_SELECTED(mask, i) == 0) {
+            continue;
+        }
+        save_info->name_output_fields[j] = malloc(MAX_STRING_LEN * sizeof(save_info->name_output_fields[j][0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(save_info->name_output_fields[j],
+                                         "Failed to allocate %d elements of size %zu for save_info->name_output_fields[%d]",
+                                         MAX_STRING_LEN,
+                                         sizeof(char), j);
+        memcpy(save_info->name_output_fields[j], field_names[i], MAX_STRING_LEN);
+        save_info->field_dtypes[j] = field_dtypes[i];
+        j++;
+    }
+
     // We will have groups for each output snapshot, and then inside those groups, a dataset for
     // each field.
     save_info->group_ids = mymalloc(run_params->NumSnapOutputs * sizeof(save_info->group_ids[0]));
@@ -216,80 +386,27 @@ int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_in
                                      "Failed to allocate %d elements of size %zu for save_info->group_ids", run_params->NumSnapOutputs,
                                      sizeof(*(save_info->group_ids)));
 
-    // A couple of variables before we enter the loop.
-    // JS 17/03/19: I've attempted to put these directly into the function calls and things blew up.
-    /* Note from MS: That almost certainly means that there is a bug somewhere here (16/9/2019) */
-    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
-
-        hsize_t dims[1] = {0};
-        hsize_t maxdims[1] = {H5S_UNLIMITED};
-        hsize_t chunk_dims[1] = {NUM_GALS_PER_BUFFER};
-        char full_field_name[2*MAX_STRING_LEN];
-
-        // Create a snapshot group.
-        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "Snap_%d", run_params->ListOutputSnaps[snap_idx]);
-        hid_t group_id = H5Gcreate2(file_id, full_field_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-        CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
-                                        "Failed to create the %s group.\nThe file ID was %d\n", full_field_name,
-                                        (int32_t) file_id);
-        save_info->group_ids[snap_idx] = group_id;
-
-        const float redshift = run_params->ZZ[run_params->ListOutputSnaps[snap_idx]];
-        CREATE_SINGLE_ATTRIBUTE(group_id, "redshift", redshift, H5T_NATIVE_FLOAT);
-
-        for(int32_t field_idx = 0; field_idx < NUM_OUTPUT_FIELDS; field_idx++) {
-
-            // Then create each field inside.
-            snprintf(full_field_name, 2*MAX_STRING_LEN - 1,"Snap_%d/%s", run_params->ListOutputSnaps[snap_idx], field_names[field_idx]);
-
-            /* fprintf(stderr, "Creating field '%s' with description '%s' and unit '%s'\n",
-               field_names[field_idx], field_descriptions[field_idx], field_units[field_idx]); */
-
-            hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(prop, (int32_t) prop,
-                                            "Could not create the property list for output snapshot number %d.\n", snap_idx);
-
-            // Create a dataspace with 0 dimension.  We will extend the datasets before every write.
-            hid_t dataspace_id = H5Screate_simple(1, dims, maxdims);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(dataspace_id, (int32_t) dataspace_id,
-                                            "Could not create a dataspace for output snapshot number %d.\n"
-                                            "The requested initial size was %d with an unlimited maximum upper bound.",
-                                            snap_idx, (int32_t) dims[0]);
-
-            // To increase reading/writing speed, we chunk the HDF5 file. --JS
-            // MS: That is incorrect. We need a resizeable dataset, and that
-            //requires chunking
-            herr_t status = H5Pset_chunk(prop, 1, chunk_dims);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
-                                            "Could not set the HDF5 chunking for output snapshot number %d.  Chunk size was %d.\n",
-                                            snap_idx, (int32_t) chunk_dims[0]);
-
-            // Now create the dataset.
-            hid_t dataset_id = H5Dcreate2(file_id, full_field_name, field_dtypes[field_idx], dataspace_id, H5P_DEFAULT, prop, H5P_DEFAULT);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(dataset_id, (int32_t) dataset_id,
-                                            "Could not create the '%s' dataset.\n", full_field_name);
-
-            // Set metadata attributes for each dataset.
-            CREATE_STRING_ATTRIBUTE(dataset_id, "Description", field_descriptions[field_idx], MAX_STRING_LEN);
-            CREATE_STRING_ATTRIBUTE(dataset_id, "Units", field_units[field_idx], MAX_STRING_LEN);
-
-            status = H5Dclose(dataset_id);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
-                                            "Failed to close field number %d for output snapshot number %d\n"
-                                            "The dataset ID was %d\n", field_idx, snap_idx,
-                                            (int32_t) dataset_id);
-
-            status = H5Pclose(prop);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
-                                            "Failed to close the property list for output snapshot number %d.\n", snap_idx);
-
-            status = H5Sclose(dataspace_id);
-            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
-                                            "Failed to close the dataspace for output snapshot number %d.\n", snap_idx);
+    // The same dataset creation property list (chunking plus any requested filters) is used for every galaxy field.
+    hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(prop, (int32_t) prop,
+                                    "Could not create the dataset creation property list for the galaxy fields.\n");
+    int32_t prop_status = set_galaxy_dataset_properties(prop, run_params->HDF5ChunkSize, run_params);
+    if(prop_status != EXIT_SUCCESS) {
+        return prop_status;
+    }
 
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs && file_id >= 0; snap_idx++) {
+        const int32_t group_status = restart ? reopen_snapshot_group(file_id, snap_idx, save_info->tot_ngals[snap_idx], save_info, run_params):
+                                               create_snapshot_group(file_id, snap_idx, prop, save_info, run_params);
+        if(group_status != EXIT_SUCCESS) {
+            return group_status;
         }
     }
 
+    prop_status = H5Pclose(prop);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(prop_status, prop_status,
+                                    "Failed to close the dataset creation property list for the galaxy fields.\n");
+
     // Now for each snapshot, we process `buffer_count` galaxies into RAM for every snapshot before
     // writing a single chunk. Unlike the binary instance where we have a single GALAXY_OUTPUT
     // struct instance per galaxy, here HDF5_GALAXY_OUTPUT is a **struct of arrays**.
@@ -308,73 +425,56 @@ int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_in
 
     // Now we need to malloc all the arrays **inside** the GALAXY_OUTPUT struct.
     for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        const int32_t alloc_status = allocate_galaxy_output_buffer(&save_info->buffer_output_gals[snap_idx], save_info->buffer_size, mask);
+        if(alloc_status != EXIT_SUCCESS) {
+            return alloc_status;
+        }
+    }
+
+#ifdef USE_ASYNC_WRITE
+    // The full buffers are written out on a separate thread. This requires a thread-safe HDF5 library
+    // unless the main thread never touches HDF5 (i.e., the input trees are not in HDF5) while galaxies are saved.
+    save_info->async_writer = NULL;
+    hbool_t is_threadsafe = 0;
+    if(H5is_library_threadsafe(&is_threadsafe) < 0) {
+        is_threadsafe = 0;
+    }
+    const int input_uses_hdf5 = run_params->TreeType != lhalo_binary && run_params->TreeType != consistent_trees_ascii;
+    if(run_params->HDF5SingleFile == 0 && (is_threadsafe || input_uses_hdf5 == 0)) {
+        save_info->spare_output_gals = mymalloc(run_params->NumSnapOutputs * sizeof(save_info->spare_output_gals[0]));
+        save_info->buffer_write_jobs = mymalloc(run_params->NumSnapOutputs * sizeof(save_info->buffer_write_jobs[0]));
+        save_info->buffer_in_flight = mycalloc(run_params->NumSnapOutputs, sizeof(save_info->buffer_in_flight[0]));
+        save_info->async_writer = mymalloc(sizeof(*(save_info->async_writer)));
+        XRETURN(save_info->spare_output_gals != NULL && save_info->buffer_write_jobs != NULL &&
+                save_info->buffer_in_flight != NULL && save_info->async_writer != NULL, MALLOC_FAILURE,
+                "Error: Failed to allocate memory for the asynchronous writes of %d output snapshots\n", run_params->NumSnapOutputs);
+        for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+            const int32_t alloc_status = allocate_galaxy_output_buffer(&save_info->spare_output_gals[snap_idx], save_info->buffer_size, mask);
+            if(alloc_status != EXIT_SUCCESS) {
+                return alloc_status;
+            }
+        }
 
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SnapNum);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Type);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, GalaxyIndex);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, CentralGalaxyIndex);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SAGEHaloIndex);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SAGETreeIndex);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SimulationHaloIndex);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TaskForestNr);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeType);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeIntoID);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeIntoSnapNum);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, dT);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posx);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posy);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posz);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Velx);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vely);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Velz);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spinx);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spiny);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spinz);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Len);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Mvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, CentralMvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Rvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vmax);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, VelDisp);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, ColdGas);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, StellarMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, BulgeMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, HotGas);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, EjectedMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, BlackHoleMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, ICS);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsColdGas);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsStellarMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsBulgeMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsHotGas);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsEjectedMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsICS);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrDisk);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrBulge);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrDiskZ);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrBulgeZ);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, DiskScaleRadius);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Cooling);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Heating);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, QuasarModeBHaccretionMass);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TimeOfLastMajorMerger);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TimeOfLastMinorMerger);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, OutflowRate);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallMvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallVvir);
-        MALLOC_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallVmax);
+        // At most one buffer per snapshot is pending at any time -> submitting never blocks
+        const int aw_status = start_async_writer(save_info->async_writer, run_params->NumSnapOutputs);
+        if(aw_status != EXIT_SUCCESS) {
+            return aw_status;
+        }
+    }
+#endif
+
+    save_info->single_file = NULL;
+    if(run_params->HDF5SingleFile) {
+        return setup_single_file(save_info, run_params);
     }
 
     return EXIT_SUCCESS;
 }
 
-#undef MALLOC_GALAXY_OUTPUT_INNER_ARRAY
-
 // Add all the galaxies for this tree to the buffer.  If we hit the buffer limit, write all the
-// galaxies to file.
-int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int32_t num_gals, struct forest_info *forest_info,
-                           struct halo_data *halos, struct halo_aux_data *haloaux, struct GALAXY *halogal,
+// galaxies to file. ``tree_idx`` is the index of this tree within the output file.
+int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int64_t tree_idx, const int32_t num_gals, struct forest_info *forest_info,
+                           struct halo_data *halos, const int32_t *OutputGalSnapIdx, struct GALAXY *halogal,
                            struct save_info *save_info, const struct params *run_params)
 {
     int32_t status = EXIT_FAILURE;
@@ -382,13 +482,13 @@ int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int32_t num_gals,
     for(int32_t gal_idx = 0; gal_idx < num_gals; gal_idx++) {
 
         // Only processing galaxies at selected snapshots. This field was generated in `save_galaxies()`.
-        if(haloaux[gal_idx].output_snap_n < 0) {
+        if(OutputGalSnapIdx[gal_idx] < 0) {
             continue;
         }
 
         // Add galaxies to buffer.
-        int32_t snap_idx = haloaux[gal_idx].output_snap_n;
-        status = prepare_galaxy_for_hdf5_output(&halogal[gal_idx], save_info, snap_idx, halos, task_forestnr,
+        int32_t snap_idx = OutputGalSnapIdx[gal_idx];
+        status = prepare_galaxy_for_hdf5_output(&halogal[gal_idx], save_info, snap_idx, halos, tree_idx,
                                                 forest_info->original_treenr[task_forestnr], run_params);
         if(status != EXIT_SUCCESS) {
             return status;
@@ -397,26 +497,149 @@ int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int32_t num_gals,
 
         // We can't guarantee that this tree will contain enough galaxies to trigger a write.
         // Hence we need to increment this here.
-        save_info->forest_ngals[snap_idx][task_forestnr]++;
+        save_info->forest_ngals[snap_idx][tree_idx]++;
+
+        // Check to see if we need to write. With `HDF5SingleFile`, the galaxies are only written in between
+        // forests (see `sync_hdf5_single_file()`) -> the (full) buffer grows instead.
+        if(run_params->HDF5SingleFile) {
+            const int32_t buffer_capacity = save_info->single_file->buffer_capacity[snap_idx];
+            if(save_info->num_gals_in_buffer[snap_idx] == buffer_capacity) {
+                XRETURN(buffer_capacity <= INT32_MAX/2, MALLOC_FAILURE,
+                        "Error: ThisTask = %d has more than %d galaxies at output snapshot number %d waiting to be written "
+                        "into the single hdf5 file\n", run_params->ThisTask, buffer_capacity, snap_idx);
+                status = grow_galaxy_output_buffer(&save_info->buffer_output_gals[snap_idx], 2*buffer_capacity);
+                if(status != EXIT_SUCCESS) {
+                    return status;
+                }
+                save_info->single_file->buffer_capacity[snap_idx] = 2*buffer_capacity;
+            }
+        } else if(save_info->num_gals_in_buffer[snap_idx] == save_info->buffer_size) {
+            status = write_galaxy_buffer(snap_idx, save_info->buffer_size, save_info, run_params);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
 
-        // Check to see if we need to write.
-        if(save_info->num_gals_in_buffer[snap_idx] == save_info->buffer_size) {
-            status = trigger_buffer_write(snap_idx, save_info->buffer_size, save_info->tot_ngals[snap_idx], save_info, run_params);
+
+// Write out all the galaxies in the buffers (and wait for any pending asynchronous writes) so that the file
+// contains every galaxy saved so far, i.e., the datasets for each snapshot have exactly `tot_ngals` elements.
+int32_t flush_hdf5_galaxy_files(struct save_info *save_info, const struct params *run_params)
+{
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        const int32_t num_gals_to_write = save_info->num_gals_in_buffer[snap_idx];
+        if(num_gals_to_write > 0) {
+            const int32_t status = write_galaxy_buffer(snap_idx, num_gals_to_write, save_info, run_params);
             if(status != EXIT_SUCCESS) {
                 return status;
             }
         }
     }
 
+#ifdef USE_ASYNC_WRITE
+    if(save_info->async_writer != NULL) {
+        const int aw_status = drain_async_writer(save_info->async_writer);
+        if(aw_status != EXIT_SUCCESS) {
+            return aw_status;
+        }
+    }
+#endif
+
+    herr_t status = H5Fflush(save_info->file_id, H5F_SCOPE_LOCAL);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Failed to flush the HDF5 file.\nThe file ID was %d\n", (int32_t) save_info->file_id);
+
     return EXIT_SUCCESS;
 }
 
 
+// Only with `HDF5SingleFile`: must be called by every task after every forest. Writes all the galaxies in the
+// buffers into the single file (together with all the other tasks) if a buffer on any task is full or if any
+// task is due a checkpoint. All the tasks then write a checkpoint at the same time, since the single file can
+// only be restored to a state that is consistent across all the tasks.
+int32_t sync_hdf5_single_file(const struct forest_info *forest_info, struct save_info *save_info, const int checkpoint_due,
+                              const struct params *run_params)
+{
+    int need_round = checkpoint_due;
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        if(save_info->num_gals_in_buffer[snap_idx] >= save_info->buffer_size) {
+            need_round = 1;
+        }
+    }
+
+#ifdef MPI
+    struct hdf5_single_file *single_file = save_info->single_file;
+    receive_single_file_messages(save_info, 0);
+    if(need_round && single_file->round_requested == 0) {
+        send_single_file_message(single_file, SINGLE_FILE_MSG_ROUND, save_info->single_file_nrounds + 1);
+        single_file->round_requested = 1;
+    }
+    need_round = single_file->round_requested;
+#endif
+
+    if(need_round == 0) {
+        return EXIT_SUCCESS;
+    }
+    return write_single_file_round(forest_info, save_info, checkpoint_due, run_params);
+}
+
+
 // We may still have galaxies in the buffer.  Here we write them.  Then fill out the final
 // attributes that are required, close all the files and release all the datasets/groups/file.
+// With `HDF5SingleFile`, this task keeps on taking part in the rounds of writes into the single
+// file until all the tasks have saved all their forests. Then the remaining galaxies are written,
+// which requires all tasks to call this function.
 int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info,
                                    const struct params *run_params)
 {
+    if(run_params->HDF5SingleFile) {
+        int32_t status = EXIT_SUCCESS;
+#ifdef MPI
+        struct hdf5_single_file *single_file = save_info->single_file;
+        send_single_file_message(single_file, SINGLE_FILE_MSG_DONE, 0);
+        single_file->ntasks_done++;
+        // Every task sends its 'done' message last -> all the rounds have been requested once all tasks are done
+        while(status == EXIT_SUCCESS && (single_file->ntasks_done < run_params->NTasks || single_file->round_requested)) {
+            if(single_file->round_requested) {
+                status = write_single_file_round(forest_info, save_info, 0, run_params);
+            } else {
+                receive_single_file_messages(save_info, 1);
+            }
+        }
+#endif
+        if(status == EXIT_SUCCESS) {
+            status = write_single_file_round(forest_info, save_info, 0, run_params);
+        }
+        if(status == EXIT_SUCCESS) {
+            status = write_single_file_summary(forest_info, save_info, run_params);
+        }
+        free_single_file(save_info);
+        free_hdf5_save_info(save_info, run_params);
+        return status;
+    }
+
+#ifdef USE_ASYNC_WRITE
+    if(save_info->async_writer != NULL) {
+        // Complete all the pending writes and stop the writer thread. The galaxies still
+        // remaining in the buffers are then written out synchronously (below).
+        const int aw_status = stop_async_writer(save_info->async_writer);
+        myfree(save_info->async_writer);
+        save_info->async_writer = NULL;
+        if(aw_status != EXIT_SUCCESS) {
+            return aw_status;
+        }
+
+        for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+            free_galaxy_output_buffer(&save_info->spare_output_gals[snap_idx]);
+        }
+        myfree(save_info->spare_output_gals);
+        myfree(save_info->buffer_write_jobs);
+        myfree(save_info->buffer_in_flight);
+    }
+#endif
 
     hid_t group_id = H5Gcreate(save_info->file_id, "/TreeInfo", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
     CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
@@ -428,6 +651,13 @@ int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct
                                     "Failed to close the /TreeInfo group."
                                     "The group ID was %d.\n", (int32_t) group_id);
 
+    // With dynamic scheduling, the forests on this task are neither contiguous nor in forest order.
+    // Hence we store the forest number of each tree.
+    if(save_info->forestnr_per_tree != NULL) {
+        hsize_t dims[1] = {forest_info->nforests_this_task};
+        CREATE_AND_WRITE_1D_ARRAY(save_info->file_id, "/TreeInfo/ForestNr", dims, save_info->forestnr_per_tree, H5T_NATIVE_INT64);
+    }
+
     for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
 
         // Attributes can only be 64kb in size (strict rule enforced by the HDF5 group).
@@ -453,25 +683,12 @@ int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct
         int32_t num_gals_to_write = save_info->num_gals_in_buffer[snap_idx];
 
         if(num_gals_to_write > 0) {
-            h5_status = trigger_buffer_write(snap_idx, num_gals_to_write,
-                                             save_info->tot_ngals[snap_idx], save_info, run_params);
+            h5_status = write_galaxy_buffer(snap_idx, num_gals_to_write, save_info, run_params);
             if(h5_status != EXIT_SUCCESS) {
                 return h5_status;
             }
 
-            for(int32_t gal_idx = 0; gal_idx < num_gals_to_write; gal_idx++) {
-
-                // JS: We're going to be a bit sneaky here so we don't need to pass the tree number to this function.
-                /* MS: 17/9/2019 -- we have to do it the difficult way! */
-                int64_t tree = save_info->buffer_output_gals[snap_idx].TaskForestNr[gal_idx];
-                if(tree < 0 || tree >= forest_info->nforests_this_task) {
-                    fprintf(stderr,"\nError: at snap_idx = %d -> got tree = %"PRId64". num_gals_to_write = %d\n"
-                            "Expecting to get tree in the range [0, %"PRId64"), where the upper limit is the number of forests on THIS task\n",
-                            snap_idx, tree, num_gals_to_write, forest_info->nforests_this_task);
-                    return EXIT_FAILURE;
-                }
-                save_info->forest_ngals[snap_idx][tree]++;
-            }
+            // Note: These galaxies have already been counted in `forest_ngals` (in `save_hdf5_galaxies()`)
         }
 
         // Write attributes showing how many galaxies we wrote for this snapshot.
@@ -564,6 +781,14 @@ int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct
                                     "Failed to close the HDF5 file.\nThe file ID was %d\n",
                                     (int32_t) save_info->file_id);
 
+    free_hdf5_save_info(save_info, run_params);
+
+    return EXIT_SUCCESS;
+}
+
+// Frees the field names and types and the galaxy buffers.
+void free_hdf5_save_info(struct save_info *save_info, const struct params *run_params)
+{
     myfree(save_info->group_ids);
 
     for(int32_t i=0;i<save_info->num_output_fields;i++) {
@@ -576,71 +801,12 @@ int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct
     myfree(save_info->num_gals_in_buffer);
 
     for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
-
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SnapNum);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Type);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, GalaxyIndex);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, CentralGalaxyIndex);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SAGEHaloIndex);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SAGETreeIndex);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SimulationHaloIndex);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TaskForestNr);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeType);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeIntoID);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, mergeIntoSnapNum);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, dT);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posx);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posy);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Posz);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Velx);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vely);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Velz);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spinx);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spiny);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Spinz);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Len);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Mvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, CentralMvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Rvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Vmax);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, VelDisp);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, ColdGas);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, StellarMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, BulgeMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, HotGas);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, EjectedMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, BlackHoleMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, ICS);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsColdGas);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsStellarMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsBulgeMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsHotGas);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsEjectedMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, MetalsICS);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrDisk);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrBulge);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrDiskZ);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, SfrBulgeZ);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, DiskScaleRadius);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Cooling);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, Heating);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, QuasarModeBHaccretionMass);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TimeOfLastMajorMerger);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, TimeOfLastMinorMerger);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, OutflowRate);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallMvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallVvir);
-        FREE_GALAXY_OUTPUT_INNER_ARRAY(snap_idx, infallVmax);
+        free_galaxy_output_buffer(&save_info->buffer_output_gals[snap_idx]);
     }
 
     myfree(save_info->buffer_output_gals);
-
-    return EXIT_SUCCESS;
 }
 
-#undef FREE_GALAXY_OUTPUT_INNER_ARRAY
-
 
 int32_t create_hdf5_master_file(const struct params *run_params)
 {
@@ -732,6 +898,550 @@ int32_t create_hdf5_master_file(const struct params *run_params)
 
 // Local Functions //
 
+// Returns EXIT_SUCCESS only if `status` is EXIT_SUCCESS on all tasks (otherwise `status` on the tasks that failed,
+// and EXIT_FAILURE on the others). Must be called by all tasks.
+int32_t agree_on_status(const int32_t status)
+{
+#ifdef MPI
+    int failed = status != EXIT_SUCCESS, any_failed = 0;
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    if(any_failed && status == EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+#endif
+    return status;
+}
+
+// Sets up the state for writing the single file (see `struct hdf5_single_file`) and creates the file on Task 0.
+// When restarting from a checkpoint, the file written by the previous run is re-used instead. Must be called by
+// all tasks.
+int32_t setup_single_file(struct save_info *save_info, const struct params *run_params)
+{
+    const int32_t nsnaps = run_params->NumSnapOutputs;
+    int32_t status = EXIT_SUCCESS;
+
+    struct hdf5_single_file *single_file = mycalloc(1, sizeof(*single_file));
+    CHECK_POINTER_AND_RETURN_ON_NULL(single_file, "Failed to allocate %d elements of size %zu for save_info->single_file", 1,
+                                     sizeof(*single_file));
+    save_info->single_file = single_file;
+    snprintf(single_file->fname, 3*MAX_STRING_LEN - 1, "%s/%s.hdf5", run_params->OutputDir, run_params->FileNameGalaxies);
+#ifdef MPI
+    MPI_Comm_dup(MPI_COMM_WORLD, &(single_file->comm));
+#endif
+
+    single_file->ngals = mycalloc(nsnaps + 1, sizeof(single_file->ngals[0]));
+    single_file->buffer_capacity = mymalloc(nsnaps * sizeof(single_file->buffer_capacity[0]));
+    single_file->counts = mycalloc(run_params->NTasks * (nsnaps + 2), sizeof(single_file->counts[0]));
+    if(single_file->ngals == NULL || single_file->buffer_capacity == NULL || single_file->counts == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the galaxy counts of %d output snapshots on %d tasks\n",
+                nsnaps, run_params->NTasks);
+        status = MALLOC_FAILURE;
+    } else {
+        for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+            single_file->buffer_capacity[snap_idx] = save_info->buffer_size;
+        }
+    }
+
+#if defined(MPI) && defined(OPENMP)
+    // The forests are saved (and hence the galaxies written) from within the OpenMP threads.
+    int provided;
+    MPI_Query_thread(&provided);
+    if(provided < MPI_THREAD_SERIALIZED && omp_get_max_threads() > 1) {
+        fprintf(stderr, "Error: Writing the single hdf5 file with %d OpenMP threads requires an MPI library that supports "
+                "MPI_THREAD_SERIALIZED\n", omp_get_max_threads());
+        status = EXIT_FAILURE;
+    }
+#endif
+
+    // The single file is only consistent if all the tasks restart from the checkpoint written after the same round.
+    int64_t nrounds[2] = {-save_info->single_file_nrounds, save_info->single_file_nrounds};
+#ifdef MPI
+    MPI_Allreduce(MPI_IN_PLACE, nrounds, 2, MPI_INT64_T, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    if(-nrounds[0] != nrounds[1]) {
+        fprintf(stderr, "Error: The checkpoints of the tasks were written after different numbers of writes into the single hdf5 file "
+                "(between %"PRId64" and %"PRId64").\nThe run must be started from scratch (i.e., with RestartFromCheckpoint = 0)\n",
+                -nrounds[0], nrounds[1]);
+        status = EXIT_FAILURE;
+    }
+    status = agree_on_status(status);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    // The galaxies (and trees) of all the tasks that were written before the checkpoint.
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        single_file->ngals[snap_idx] = save_info->tot_ngals[snap_idx];
+    }
+    single_file->ngals[nsnaps] = save_info->nforests_saved;
+#ifdef MPI
+    MPI_Allreduce(MPI_IN_PLACE, single_file->ngals, nsnaps + 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    single_file->ntrees = single_file->ngals[nsnaps];
+    single_file->nforests_written = save_info->nforests_saved;
+
+    if(run_params->ThisTask == 0) {
+        status = save_info->single_file_nrounds > 0 ? reopen_single_file(save_info, run_params):create_single_file(save_info, run_params);
+    }
+
+    return agree_on_status(status);
+}
+
+// Creates the single file with all the (empty) galaxy and tree datasets. The datasets are extended in every round.
+int32_t create_single_file(struct save_info *save_info, const struct params *run_params)
+{
+    char full_field_name[2*MAX_STRING_LEN];
+
+    hid_t file_id = H5Fcreate(save_info->single_file->fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(file_id, FILE_NOT_FOUND, "Can't create the single output file %s.\n", save_info->single_file->fname);
+
+    hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(prop, (int32_t) prop,
+                                    "Could not create the dataset creation property list for the single file.\n");
+    const int32_t prop_status = set_galaxy_dataset_properties(prop, run_params->HDF5ChunkSize, run_params);
+    if(prop_status != EXIT_SUCCESS) {
+        return prop_status;
+    }
+
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        const int32_t group_status = create_snapshot_group(file_id, snap_idx, prop, save_info, run_params);
+        if(group_status != EXIT_SUCCESS) {
+            return group_status;
+        }
+        herr_t h5_status = H5Gclose(save_info->group_ids[snap_idx]);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                        "Failed to close the group for output snapshot number %d.\n", snap_idx);
+    }
+
+    // The number of galaxies per tree are stored in the same order as the galaxies, i.e., by round and then by task.
+    // Hence the forest number of each tree is also stored.
+    hid_t group_id = H5Gcreate2(file_id, "TreeInfo", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                    "Failed to create the TreeInfo group.\nThe file ID was %d\n", (int32_t) file_id);
+    CREATE_SINGLE_ATTRIBUTE(group_id, "FileNr_Mulfac", run_params->FileNr_Mulfac, H5T_NATIVE_LLONG);
+    CREATE_SINGLE_ATTRIBUTE(group_id, "ForestNr_Mulfac", run_params->ForestNr_Mulfac, H5T_NATIVE_LLONG);
+    herr_t h5_status = H5Gclose(group_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the TreeInfo group.\nThe group ID was %d.\n", (int32_t) group_id);
+
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d", run_params->ListOutputSnaps[snap_idx]);
+        group_id = H5Gcreate2(file_id, full_field_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                        "Failed to create the '%s' group.\nThe file ID was %d\n", full_field_name, (int32_t) file_id);
+        h5_status = H5Gclose(group_id);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                        "Failed to close '%s' group.\nThe group ID was %d.\n", full_field_name, (int32_t) group_id);
+
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d/NumGalsPerTreePerSnap", run_params->ListOutputSnaps[snap_idx]);
+        const int32_t dset_status = create_extendible_dataset(file_id, full_field_name, H5T_NATIVE_INT, prop);
+        if(dset_status != EXIT_SUCCESS) {
+            return dset_status;
+        }
+    }
+    const int32_t dset_status = create_extendible_dataset(file_id, "TreeInfo/ForestNr", H5T_NATIVE_INT64, prop);
+    if(dset_status != EXIT_SUCCESS) {
+        return dset_status;
+    }
+
+    h5_status = H5Pclose(prop);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the dataset creation property list for the single file.\n");
+    h5_status = H5Fclose(file_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the single output file %s.\n", save_info->single_file->fname);
+
+    return EXIT_SUCCESS;
+}
+
+// Restores the single file written by a previous run to its state at the checkpoint: anything written when the
+// file was finalized is removed and the datasets are shrunk to the galaxies (and trees) written before the checkpoint.
+int32_t reopen_single_file(struct save_info *save_info, const struct params *run_params)
+{
+    const struct hdf5_single_file *single_file = save_info->single_file;
+    char full_field_name[2*MAX_STRING_LEN];
+
+    hid_t file_id = H5Fopen(single_file->fname, H5F_ACC_RDWR, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(file_id, FILE_NOT_FOUND, "Can't open the single output file %s to restart from the checkpoint.\n",
+                                    single_file->fname);
+
+    for(int32_t snap_idx = -1; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        if(snap_idx < 0) {
+            snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/NumForestsPerTask");
+        } else {
+            snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d/NumGalsPerTask", run_params->ListOutputSnaps[snap_idx]);
+        }
+        if(H5Lexists(file_id, full_field_name, H5P_DEFAULT) > 0) {
+            herr_t status = H5Ldelete(file_id, full_field_name, H5P_DEFAULT);
+            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                            "Failed to remove '%s' from the single file %s.\n", full_field_name, single_file->fname);
+        }
+    }
+    if(H5Lexists(file_id, "Header", H5P_DEFAULT) > 0) {
+        herr_t status = H5Ldelete(file_id, "Header", H5P_DEFAULT);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Failed to remove the Header group from the single file %s.\n", single_file->fname);
+    }
+
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        int32_t status = reopen_snapshot_group(file_id, snap_idx, single_file->ngals[snap_idx], save_info, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+        herr_t h5_status = H5Gclose(save_info->group_ids[snap_idx]);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                        "Failed to close the group for output snapshot number %d.\n", snap_idx);
+
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d/NumGalsPerTreePerSnap", run_params->ListOutputSnaps[snap_idx]);
+        status = shrink_dataset(file_id, full_field_name, single_file->ntrees);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+    int32_t status = shrink_dataset(file_id, "TreeInfo/ForestNr", single_file->ntrees);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    herr_t h5_status = H5Fclose(file_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the single output file %s.\n", single_file->fname);
+
+    return EXIT_SUCCESS;
+}
+
+// One round of writes into the single file. Every task appends the galaxies in its buffers and the trees saved since
+// the previous round: the tasks exchange their counts, so that each task knows the offsets of its galaxies, and then
+// take turns to write (the serial HDF5 library can not write into the same file from several tasks at once). When
+// `checkpoint` is set on any task, all the tasks then write a checkpoint. Must be called by all tasks.
+int32_t write_single_file_round(const struct forest_info *forest_info, struct save_info *save_info, const int checkpoint,
+                                const struct params *run_params)
+{
+    struct hdf5_single_file *single_file = save_info->single_file;
+    const int32_t nsnaps = run_params->NumSnapOutputs;
+    const int32_t ncounts = nsnaps + 2;
+    int64_t *my_counts = single_file->counts + run_params->ThisTask * ncounts;
+
+    // The galaxies at each output snapshot, the trees and whether a checkpoint is due.
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        my_counts[snap_idx] = save_info->num_gals_in_buffer[snap_idx];
+    }
+    my_counts[nsnaps] = save_info->nforests_saved - single_file->nforests_written;
+    my_counts[nsnaps + 1] = checkpoint;
+#ifdef MPI
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, single_file->counts, ncounts, MPI_INT64_T, single_file->comm);
+    single_file->round_requested = 0;
+#endif
+
+    // The galaxies (and trees) of this round are appended in task order.
+    int64_t offsets[nsnaps + 1], new_sizes[nsnaps + 1];
+    int any_checkpoint = 0;
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        offsets[snap_idx] = new_sizes[snap_idx] = single_file->ngals[snap_idx];
+    }
+    offsets[nsnaps] = new_sizes[nsnaps] = single_file->ntrees;
+    for(int task = 0; task < run_params->NTasks; task++) {
+        const int64_t *task_counts = single_file->counts + task * ncounts;
+        for(int32_t i = 0; i <= nsnaps; i++) {
+            if(task < run_params->ThisTask) {
+                offsets[i] += task_counts[i];
+            }
+            new_sizes[i] += task_counts[i];
+        }
+        any_checkpoint |= task_counts[nsnaps + 1] != 0;
+    }
+
+    // Only the tasks with anything to write take a turn (and extend the datasets they write into).
+    int32_t status = EXIT_SUCCESS;
+    for(int task = 0; task < run_params->NTasks; task++) {
+        const int64_t *task_counts = single_file->counts + task * ncounts;
+        int64_t task_total = 0;
+        for(int32_t i = 0; i <= nsnaps; i++) {
+            task_total += task_counts[i];
+        }
+        if(task_total == 0) {
+            continue;
+        }
+
+        if(task == run_params->ThisTask) {
+            hid_t file_id = H5Fopen(single_file->fname, H5F_ACC_RDWR, H5P_DEFAULT);
+            if(file_id < 0) {
+                fprintf(stderr, "Error: Can't open the single output file %s for writing.\n", single_file->fname);
+                status = FILE_NOT_FOUND;
+            } else {
+                status = write_task_galaxies_into_single_file(file_id, save_info, my_counts, offsets, new_sizes, run_params);
+                if(H5Fclose(file_id) < 0) {
+                    fprintf(stderr, "Error: Failed to close the single output file %s.\n", single_file->fname);
+                    status = HDF5_ERROR;
+                }
+            }
+        }
+        // This is also the barrier before the next task writes.
+        status = agree_on_status(status);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+
+    // The buffers are empty again -> release any memory that was required for large forests.
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        single_file->ngals[snap_idx] = new_sizes[snap_idx];
+        save_info->tot_ngals[snap_idx] += my_counts[snap_idx];
+        save_info->num_gals_in_buffer[snap_idx] = 0;
+        if(single_file->buffer_capacity[snap_idx] > save_info->buffer_size) {
+            status = grow_galaxy_output_buffer(&save_info->buffer_output_gals[snap_idx], save_info->buffer_size);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+            single_file->buffer_capacity[snap_idx] = save_info->buffer_size;
+        }
+    }
+    single_file->ntrees = new_sizes[nsnaps];
+    single_file->nforests_written = save_info->nforests_saved;
+    save_info->single_file_nrounds++;
+
+    if(any_checkpoint) {
+        status = agree_on_status(write_checkpoint(forest_info, save_info, run_params));
+        gettimeofday(&(save_info->last_checkpoint), NULL);
+    }
+
+    return status;
+}
+
+// Opens the dataset `dataset_name` in the single file, extends it to `new_size` elements and writes `count` elements
+// from `data` at position `dst_offset`.
+int32_t extend_and_write_dataset(hid_t file_id, const char *dataset_name, const void *data, const hsize_t count,
+                                 const hsize_t dst_offset, const hsize_t new_size, const hid_t mem_dtype)
+{
+    hid_t dataset_id = H5Dopen2(file_id, dataset_name, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(dataset_id, (int32_t) dataset_id, "Could not open the dataset '%s' in the single file.\n", dataset_name);
+
+    const hsize_t new_dims[1] = {new_size};
+    herr_t status = H5Dset_extent(dataset_id, new_dims);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Could not extend the dataset '%s' in the single file to %"PRIu64" elements.\n",
+                                    dataset_name, (uint64_t) new_size);
+
+    if(count > 0) {
+        hid_t file_space = H5Dget_space(dataset_id);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(file_space, (int32_t) file_space,
+                                        "Could not get the dataspace for the dataset '%s' in the single file.\n", dataset_name);
+        const hsize_t start[1] = {dst_offset};
+        const hsize_t block[1] = {count};
+        status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, block, NULL);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not select the region to write into the dataset '%s' in the single file.\n", dataset_name);
+
+        hid_t mem_space = H5Screate_simple(1, block, NULL);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(mem_space, (int32_t) mem_space,
+                                        "Could not create the memory space to write the dataset '%s'.\n", dataset_name);
+
+        status = H5Dwrite(dataset_id, mem_dtype, mem_space, file_space, H5P_DEFAULT, data);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not write %"PRIu64" elements at offset %"PRIu64" into the dataset '%s' in the single file.\n",
+                                        (uint64_t) count, (uint64_t) dst_offset, dataset_name);
+
+        status = H5Sclose(mem_space);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not close the memory space to write the dataset '%s'.\n", dataset_name);
+        status = H5Sclose(file_space);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not close the dataspace for the dataset '%s' in the single file.\n", dataset_name);
+    }
+
+    status = H5Dclose(dataset_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status, "Could not close the dataset '%s' in the single file.\n", dataset_name);
+
+    return EXIT_SUCCESS;
+}
+
+// Adds the totals once all the galaxies have been written into the single file: the number of galaxies at each output
+// snapshot, the number of forests (and galaxies) per task and the header. Must be called by all tasks.
+int32_t write_single_file_summary(const struct forest_info *forest_info, const struct save_info *save_info,
+                                  const struct params *run_params)
+{
+    const int32_t nsnaps = run_params->NumSnapOutputs;
+    const int32_t ncounts = nsnaps + 2;
+    int64_t *all_counts = save_info->single_file->counts;
+    int64_t *my_counts = all_counts + run_params->ThisTask * ncounts;
+
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        my_counts[snap_idx] = save_info->tot_ngals[snap_idx];
+    }
+    my_counts[nsnaps] = save_info->nforests_saved;
+    my_counts[nsnaps + 1] = 0;
+
+    double frac_volume_processed = forest_info->frac_volume_processed;
+#ifdef MPI
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, all_counts, ncounts, MPI_INT64_T, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &frac_volume_processed, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+
+    int32_t status = EXIT_SUCCESS;
+    if(run_params->ThisTask == 0) {
+        status = write_single_file_totals(save_info, all_counts, frac_volume_processed, run_params);
+    }
+
+    return agree_on_status(status);
+}
+
+// Writes the totals into the single file (on Task 0). `all_counts` contains the number of galaxies at each output
+// snapshot, the number of forests and an unused entry, for every task.
+int32_t write_single_file_totals(const struct save_info *save_info, const int64_t *all_counts, const double frac_volume_processed,
+                                 const struct params *run_params)
+{
+    const struct hdf5_single_file *single_file = save_info->single_file;
+    const int32_t nsnaps = run_params->NumSnapOutputs;
+    const int32_t ncounts = nsnaps + 2;
+    char full_field_name[2*MAX_STRING_LEN];
+
+    hid_t file_id = H5Fopen(single_file->fname, H5F_ACC_RDWR, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(file_id, FILE_NOT_FOUND, "Can't open the single output file %s to finalize it.\n", single_file->fname);
+
+    long long *counts_per_task = mymalloc(run_params->NTasks * sizeof(counts_per_task[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(counts_per_task, "Failed to allocate %d elements of size %zu for counts_per_task",
+                                     run_params->NTasks, sizeof(counts_per_task[0]));
+    hsize_t dims[1] = {run_params->NTasks};
+    for(int task = 0; task < run_params->NTasks; task++) {
+        counts_per_task[task] = all_counts[task * ncounts + nsnaps];
+    }
+    CREATE_AND_WRITE_1D_ARRAY(file_id, "TreeInfo/NumForestsPerTask", dims, counts_per_task, H5T_NATIVE_LLONG);
+
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "Snap_%d", run_params->ListOutputSnaps[snap_idx]);
+        hid_t group_id = H5Gopen2(file_id, full_field_name, H5P_DEFAULT);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                        "Failed to open the %s group.\nThe file ID was %d\n", full_field_name, (int32_t) file_id);
+        const long long num_gals = single_file->ngals[snap_idx];
+        CREATE_SINGLE_ATTRIBUTE(group_id, "num_gals", num_gals, H5T_NATIVE_LLONG);
+        herr_t h5_status = H5Gclose(group_id);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                        "Failed to close the %s group.\nThe group ID was %d.\n", full_field_name, (int32_t) group_id);
+
+        for(int task = 0; task < run_params->NTasks; task++) {
+            counts_per_task[task] = all_counts[task * ncounts + snap_idx];
+        }
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d/NumGalsPerTask", run_params->ListOutputSnaps[snap_idx]);
+        CREATE_AND_WRITE_1D_ARRAY(file_id, full_field_name, dims, counts_per_task, H5T_NATIVE_LLONG);
+    }
+    myfree(counts_per_task);
+
+    // The header describes all the forests in the file.
+    hid_t group_id = H5Gcreate2(file_id, "Header", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                    "Failed to create the Header group.\nThe file ID was %d\n", (int32_t) file_id);
+
+    struct forest_info all_forests;
+    memset(&all_forests, 0, sizeof(all_forests));
+    all_forests.nforests_this_task = single_file->ntrees;
+    all_forests.frac_volume_processed = frac_volume_processed;
+    const int32_t status = write_header(file_id, &all_forests, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    herr_t h5_status = H5Gclose(group_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the Header group.\nThe group ID was %d.\n", (int32_t) group_id);
+    h5_status = H5Fclose(file_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                    "Failed to close the single output file %s.\n", single_file->fname);
+
+    return EXIT_SUCCESS;
+}
+
+// Releases the state for writing the single file (after waiting for all the messages to be received).
+void free_single_file(struct save_info *save_info)
+{
+    struct hdf5_single_file *single_file = save_info->single_file;
+    if(single_file == NULL) {
+        return;
+    }
+
+#ifdef MPI
+    int ntasks;
+    MPI_Comm_size(single_file->comm, &ntasks);
+    while(single_file->sent != NULL) {
+        struct single_file_message *msg = single_file->sent;
+        MPI_Waitall(ntasks, msg->requests, MPI_STATUSES_IGNORE);
+        single_file->sent = msg->next;
+        free(msg->requests);
+        free(msg);
+    }
+    MPI_Comm_free(&(single_file->comm));
+#endif
+
+    myfree(single_file->counts);
+    myfree(single_file->buffer_capacity);
+    myfree(single_file->ngals);
+    myfree(single_file);
+    save_info->single_file = NULL;
+}
+
+#ifdef MPI
+// Sends a message to all the other tasks (without waiting for it to be received). The messages that have been
+// received in the meantime are released.
+void send_single_file_message(struct hdf5_single_file *single_file, const int64_t type, const int64_t round)
+{
+    int ntasks, this_task;
+    MPI_Comm_size(single_file->comm, &ntasks);
+    MPI_Comm_rank(single_file->comm, &this_task);
+
+    struct single_file_message **prev = &(single_file->sent);
+    while(*prev != NULL) {
+        struct single_file_message *msg = *prev;
+        int done;
+        MPI_Testall(ntasks, msg->requests, &done, MPI_STATUSES_IGNORE);
+        if(done) {
+            *prev = msg->next;
+            free(msg->requests);
+            free(msg);
+        } else {
+            prev = &(msg->next);
+        }
+    }
+
+    struct single_file_message *msg = malloc(sizeof(*msg));
+    MPI_Request *requests = malloc(ntasks * sizeof(requests[0]));
+    if(msg == NULL || requests == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for a message to %d tasks about the single hdf5 file\n", ntasks);
+        ABORT(MALLOC_FAILURE);
+    }
+    msg->content[0] = type;
+    msg->content[1] = round;
+    msg->requests = requests;
+    for(int task = 0; task < ntasks; task++) {
+        requests[task] = MPI_REQUEST_NULL;
+        if(task != this_task) {
+            MPI_Isend(msg->content, 2, MPI_INT64_T, task, SINGLE_FILE_MSG_TAG, single_file->comm, &requests[task]);
+        }
+    }
+    msg->next = single_file->sent;
+    single_file->sent = msg;
+}
+
+// Receives all the messages from the other tasks that have arrived (and waits for at least one with `wait` set).
+// A request for a round that has already been written is ignored.
+void receive_single_file_messages(struct save_info *save_info, const int wait)
+{
+    struct hdf5_single_file *single_file = save_info->single_file;
+    int flag = wait;
+    if(flag == 0) {
+        MPI_Iprobe(MPI_ANY_SOURCE, SINGLE_FILE_MSG_TAG, single_file->comm, &flag, MPI_STATUS_IGNORE);
+    }
+    while(flag) {
+        int64_t content[2];
+        MPI_Recv(content, 2, MPI_INT64_T, MPI_ANY_SOURCE, SINGLE_FILE_MSG_TAG, single_file->comm, MPI_STATUS_IGNORE);
+        if(content[0] == SINGLE_FILE_MSG_DONE) {
+            single_file->ntasks_done++;
+        } else if(content[1] > save_info->single_file_nrounds) {
+            single_file->round_requested = 1;
+        }
+        MPI_Iprobe(MPI_ANY_SOURCE, SINGLE_FILE_MSG_TAG, single_file->comm, &flag, MPI_STATUS_IGNORE);
+    }
+}
+#endif
+
 // Give more transparent control over the names of the fields, their descriptions and what units we
 // use.  To allow easy comparison with  the binary output format (e.g., for testing purposes), we
 // use identical field names to the script that reads the binary data (e.g., 'tests/sagediff.py').
@@ -825,6 +1535,390 @@ int32_t generate_field_metadata(char (*field_names)[MAX_STRING_LEN], char (*fiel
     return EXIT_SUCCESS;
 }
 
+// Creates the group for the output snapshot `snap_idx` with an empty (extendible) dataset for every selected output
+// field. The group is left open in `save_info->group_ids`.
+int32_t create_snapshot_group(hid_t file_id, const int32_t snap_idx, const hid_t prop, struct save_info *save_info,
+                              const struct params *run_params)
+{
+    char field_names[NUM_OUTPUT_FIELDS][MAX_STRING_LEN];
+    char field_descriptions[NUM_OUTPUT_FIELDS][MAX_STRING_LEN];
+    char field_units[NUM_OUTPUT_FIELDS][MAX_STRING_LEN];
+    hsize_t field_dtypes[NUM_OUTPUT_FIELDS];
+    char full_field_name[2*MAX_STRING_LEN];
+
+    generate_field_metadata(field_names, field_descriptions, field_units, field_dtypes);
+
+    // Create a snapshot group.
+    snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "Snap_%d", run_params->ListOutputSnaps[snap_idx]);
+    hid_t group_id = H5Gcreate2(file_id, full_field_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                    "Failed to create the %s group.\nThe file ID was %d\n", full_field_name,
+                                    (int32_t) file_id);
+    save_info->group_ids[snap_idx] = group_id;
+
+    const float redshift = run_params->ZZ[run_params->ListOutputSnaps[snap_idx]];
+    CREATE_SINGLE_ATTRIBUTE(group_id, "redshift", redshift, H5T_NATIVE_FLOAT);
+
+    for(int32_t field_idx = 0; field_idx < NUM_OUTPUT_FIELDS; field_idx++) {
+        if(IS_OUTPUT_FIELD_SELECTED(run_params->OutputFieldsMask, field_idx) == 0) {
+            continue;
+        }
+
+        // Then create each field inside. The datasets start empty and are extended before every write.
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1,"Snap_%d/%s", run_params->ListOutputSnaps[snap_idx], field_names[field_idx]);
+        const int32_t status = create_extendible_dataset(file_id, full_field_name, field_dtypes[field_idx], prop);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+
+        // Set metadata attributes for each dataset.
+        hid_t dataset_id = H5Dopen2(file_id, full_field_name, H5P_DEFAULT);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(dataset_id, (int32_t) dataset_id,
+                                        "Could not open the '%s' dataset.\n", full_field_name);
+        CREATE_STRING_ATTRIBUTE(dataset_id, "Description", field_descriptions[field_idx], MAX_STRING_LEN);
+        CREATE_STRING_ATTRIBUTE(dataset_id, "Units", field_units[field_idx], MAX_STRING_LEN);
+
+        herr_t h5_status = H5Dclose(dataset_id);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(h5_status, (int32_t) h5_status,
+                                        "Failed to close field number %d for output snapshot number %d\n"
+                                        "The dataset ID was %d\n", field_idx, snap_idx,
+                                        (int32_t) dataset_id);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Creates the (empty) dataset `dataset_name` with an unlimited maximum size.
+int32_t create_extendible_dataset(hid_t file_id, const char *dataset_name, const hid_t h5_dtype, const hid_t prop)
+{
+    const hsize_t dims[1] = {0};
+    const hsize_t maxdims[1] = {H5S_UNLIMITED};
+    hid_t dataspace_id = H5Screate_simple(1, dims, maxdims);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(dataspace_id, (int32_t) dataspace_id,
+                                    "Could not create a dataspace for the '%s' dataset.\n"
+                                    "The requested initial size was 0 with an unlimited maximum upper bound.", dataset_name);
+
+    hid_t dataset_id = H5Dcreate2(file_id, dataset_name, h5_dtype, dataspace_id, H5P_DEFAULT, prop, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(dataset_id, (int32_t) dataset_id,
+                                    "Could not create the '%s' dataset.\n", dataset_name);
+
+    herr_t status = H5Dclose(dataset_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Failed to close the '%s' dataset.\nThe dataset ID was %d\n", dataset_name, (int32_t) dataset_id);
+    status = H5Sclose(dataspace_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Failed to close the dataspace for the '%s' dataset.\n", dataset_name);
+
+    return EXIT_SUCCESS;
+}
+
+// Opens the group for the output snapshot `snap_idx` in a file written by a previous run (that wrote a checkpoint)
+// and shrinks the datasets to the `ngals` galaxies written before the checkpoint.
+int32_t reopen_snapshot_group(hid_t file_id, const int32_t snap_idx, const int64_t ngals, struct save_info *save_info,
+                              const struct params *run_params)
+{
+    char full_field_name[2*MAX_STRING_LEN];
+    snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "Snap_%d", run_params->ListOutputSnaps[snap_idx]);
+    hid_t group_id = H5Gopen2(file_id, full_field_name, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(group_id, (int32_t) group_id,
+                                    "Failed to open the %s group.\nThe file ID was %d\n", full_field_name,
+                                    (int32_t) file_id);
+    save_info->group_ids[snap_idx] = group_id;
+
+    // The number of galaxies is added when the file is finalized.
+    if(H5Aexists(group_id, "num_gals") > 0) {
+        herr_t status = H5Adelete(group_id, "num_gals");
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Failed to remove the num_gals attribute from the %s group.\n", full_field_name);
+    }
+
+    for(int32_t field_idx = 0; field_idx < save_info->num_output_fields; field_idx++) {
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1,"Snap_%d/%s", run_params->ListOutputSnaps[snap_idx], save_info->name_output_fields[field_idx]);
+        const int32_t status = shrink_dataset(file_id, full_field_name, ngals);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Shrinks the dataset `dataset_name` to its first `new_size` elements (i.e., the ones written before the checkpoint).
+int32_t shrink_dataset(hid_t file_id, const char *dataset_name, const int64_t new_size)
+{
+    hid_t dataset_id = H5Dopen2(file_id, dataset_name, H5P_DEFAULT);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(dataset_id, (int32_t) dataset_id,
+                                    "Could not open the '%s' dataset.\n", dataset_name);
+
+    hid_t dataspace_id = H5Dget_space(dataset_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(dataspace_id, (int32_t) dataspace_id,
+                                    "Could not retrieve the dataspace of the '%s' dataset.\n", dataset_name);
+    hsize_t curr_dims[1];
+    int ndims = H5Sget_simple_extent_dims(dataspace_id, curr_dims, NULL);
+    herr_t status = H5Sclose(dataspace_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Failed to close the dataspace of the '%s' dataset.\n", dataset_name);
+    XRETURN(ndims == 1 && curr_dims[0] >= (hsize_t) new_size, FILE_READ_ERROR,
+            "Error: The '%s' dataset does not contain the %"PRId64" elements written before the checkpoint\n",
+            dataset_name, new_size);
+
+    const hsize_t dims[1] = {(hsize_t) new_size};
+    status = H5Dset_extent(dataset_id, dims);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Could not resize the '%s' dataset to %"PRId64" elements.\n", dataset_name, new_size);
+
+    status = H5Dclose(dataset_id);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Failed to close the '%s' dataset.\n", dataset_name);
+
+    return EXIT_SUCCESS;
+}
+
+// Sets up the chunking and the (optional) filters for the galaxy datasets. The datasets need to be
+// resizeable, which requires chunking; the chunk size is set by 'HDF5ChunkSize' and is independent
+// of the number of galaxies buffered before each write. Compression is lossless -- the shuffle filter
+// groups the bytes of each value by significance, which makes the floats far more compressible by deflate.
+int32_t set_galaxy_dataset_properties(hid_t prop, const hsize_t chunk_size, const struct params *run_params)
+{
+    const hsize_t chunk_dims[1] = {chunk_size};
+    herr_t status = H5Pset_chunk(prop, 1, chunk_dims);
+    CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                    "Could not set the HDF5 chunking for the galaxy fields. Chunk size was %"PRIu64".\n",
+                                    (uint64_t) chunk_size);
+
+    if(run_params->HDF5DeflateLevel > 0) {
+        XRETURN(H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0, -1,
+                "Error: Requested compression with HDF5DeflateLevel = %d but the deflate filter is not available in this HDF5 library\n",
+                run_params->HDF5DeflateLevel);
+        if(run_params->HDF5Shuffle) {
+            status = H5Pset_shuffle(prop);
+            CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                            "Could not set the shuffle filter for the galaxy fields.\n");
+        }
+        status = H5Pset_deflate(prop, (unsigned) run_params->HDF5DeflateLevel);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not set the deflate filter (with compression level = %d) for the galaxy fields.\n",
+                                        run_params->HDF5DeflateLevel);
+    }
+
+    if(run_params->HDF5Fletcher32) {
+        status = H5Pset_fletcher32(prop);
+        CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,
+                                        "Could not set the Fletcher32 checksum filter for the galaxy fields.\n");
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Allocates the arrays **inside** one HDF5_GALAXY_OUTPUT struct for the output fields in `mask`.
+int32_t allocate_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer, const int32_t buffer_size, const uint64_t mask)
+{
+    memset(buffer, 0, sizeof(*buffer));
+
+    // The cpu-local forest number is not an output field.
+    buffer->TaskForestNr = malloc(buffer_size * sizeof(buffer->TaskForestNr[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(buffer->TaskForestNr, "Failed to allocate %d elements of size %zu for the TaskForestNr field",
+                                     buffer_size, sizeof(buffer->TaskForestNr[0]));
+
+    // This parameter is incremented in every Macro call (the fields are in the same order as the datasets).
+    int32_t field_idx = 0;
+#ifdef USE_SAGE_IN_MCMC_MODE
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SnapNum);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(StellarMass);
+#else
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SnapNum);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Type);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(GalaxyIndex);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(CentralGalaxyIndex);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SAGEHaloIndex);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SAGETreeIndex);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SimulationHaloIndex);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeType);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoID);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoSnapNum);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(dT);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posx);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posy);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posz);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Velx);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vely);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Velz);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spinx);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spiny);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spinz);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Len);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Mvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(CentralMvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Rvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vmax);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(VelDisp);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(ColdGas);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(StellarMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(BulgeMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(HotGas);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(EjectedMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(BlackHoleMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(ICS);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsColdGas);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsStellarMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsBulgeMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsHotGas);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsEjectedMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsICS);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrDisk);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrBulge);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrDiskZ);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrBulgeZ);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(DiskScaleRadius);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Cooling);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(Heating);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(QuasarModeBHaccretionMass);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMajorMerger);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMinorMerger);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(OutflowRate);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallMvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallVvir);
+    MALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallVmax);
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+void free_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer)
+{
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SnapNum);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Type);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(GalaxyIndex);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(CentralGalaxyIndex);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SAGEHaloIndex);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SAGETreeIndex);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SimulationHaloIndex);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(TaskForestNr);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(mergeType);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoID);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoSnapNum);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(dT);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Posx);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Posy);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Posz);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Velx);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Vely);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Velz);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Spinx);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Spiny);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Spinz);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Len);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Mvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(CentralMvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Rvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Vvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Vmax);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(VelDisp);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(ColdGas);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(StellarMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(BulgeMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(HotGas);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(EjectedMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(BlackHoleMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(ICS);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsColdGas);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsStellarMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsBulgeMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsHotGas);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsEjectedMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(MetalsICS);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SfrDisk);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SfrBulge);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SfrDiskZ);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(SfrBulgeZ);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(DiskScaleRadius);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Cooling);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(Heating);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(QuasarModeBHaccretionMass);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMajorMerger);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMinorMerger);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(OutflowRate);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(infallMvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(infallVvir);
+    FREE_GALAXY_OUTPUT_INNER_ARRAY(infallVmax);
+}
+
+// Grows the (allocated) arrays **inside** one HDF5_GALAXY_OUTPUT struct to `new_size` elements.
+int32_t grow_galaxy_output_buffer(struct HDF5_GALAXY_OUTPUT *buffer, const int32_t new_size)
+{
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(TaskForestNr);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SnapNum);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Type);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(GalaxyIndex);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(CentralGalaxyIndex);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SAGEHaloIndex);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SAGETreeIndex);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SimulationHaloIndex);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeType);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoID);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(mergeIntoSnapNum);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(dT);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posx);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posy);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Posz);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Velx);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vely);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Velz);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spinx);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spiny);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Spinz);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Len);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Mvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(CentralMvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Rvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Vmax);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(VelDisp);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(ColdGas);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(StellarMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(BulgeMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(HotGas);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(EjectedMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(BlackHoleMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(ICS);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsColdGas);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsStellarMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsBulgeMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsHotGas);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsEjectedMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(MetalsICS);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrDisk);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrBulge);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrDiskZ);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(SfrBulgeZ);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(DiskScaleRadius);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Cooling);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(Heating);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(QuasarModeBHaccretionMass);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMajorMerger);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(TimeOfLastMinorMerger);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(OutflowRate);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallMvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallVvir);
+    REALLOC_GALAXY_OUTPUT_INNER_ARRAY(infallVmax);
+
+    return EXIT_SUCCESS;
+}
+
+#undef MALLOC_GALAXY_OUTPUT_INNER_ARRAY
+#undef FREE_GALAXY_OUTPUT_INNER_ARRAY
+#undef REALLOC_GALAXY_OUTPUT_INNER_ARRAY
+
+// Only the fields that are written (i.e., selected with 'OutputFields') have been allocated. The value of
+// any other field is not even computed.
+/* Assumes 'buffer' and 'gals_in_buffer' are set appropriately before invoking the macro */
+#define SET_GALAXY_OUTPUT_FIELD(field_name, value) {                    \
+        if(buffer->field_name != NULL) {                                \
+            buffer->field_name[gals_in_buffer] = value;                 \
+        }                                                               \
+    }
+
 // Take all the properties of the galaxy `*g` and add them to the buffered galaxies
 // properties `save_info->buffer_output_gals`.
 int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct save_info *save_info,
@@ -836,123 +1930,165 @@ int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct save_info
 
     int64_t gals_in_buffer = save_info->num_gals_in_buffer[output_snap_idx];
     //fprintf(stderr, "Task %d, Snap %d, has %"PRId64" gals in buffer.\n", run_params->ThisTask, output_snap_idx, gals_in_buffer);
+    struct HDF5_GALAXY_OUTPUT *buffer = &save_info->buffer_output_gals[output_snap_idx];
 
-    save_info->buffer_output_gals[output_snap_idx].SnapNum[gals_in_buffer] = g->SnapNum;
+    SET_GALAXY_OUTPUT_FIELD(SnapNum, g->SnapNum);
 
     if(g->Type < SHRT_MIN || g->Type > SHRT_MAX) {
         fprintf(stderr,"Error: Galaxy type = %d can not be represented in 2 bytes\n", g->Type);
         fprintf(stderr,"Converting galaxy type while saving from integer to short will result in data corruption");
         return EXIT_FAILURE;
     }
-    save_info->buffer_output_gals[output_snap_idx].Type[gals_in_buffer] = g->Type;
-
-    save_info->buffer_output_gals[output_snap_idx].GalaxyIndex[gals_in_buffer] = g->GalaxyIndex;
-    save_info->buffer_output_gals[output_snap_idx].CentralGalaxyIndex[gals_in_buffer] = g->CentralGalaxyIndex;
-
-    save_info->buffer_output_gals[output_snap_idx].SAGEHaloIndex[gals_in_buffer] = g->HaloNr;
-    save_info->buffer_output_gals[output_snap_idx].SAGETreeIndex[gals_in_buffer] = original_treenr;
-    save_info->buffer_output_gals[output_snap_idx].SimulationHaloIndex[gals_in_buffer] = llabs(halos[g->HaloNr].MostBoundID);
-    save_info->buffer_output_gals[output_snap_idx].TaskForestNr[gals_in_buffer] = task_forestnr;
-
-    save_info->buffer_output_gals[output_snap_idx].mergeType[gals_in_buffer] = g->mergeType;
-    save_info->buffer_output_gals[output_snap_idx].mergeIntoID[gals_in_buffer] = g->mergeIntoID;
-    save_info->buffer_output_gals[output_snap_idx].mergeIntoSnapNum[gals_in_buffer] = g->mergeIntoSnapNum;
-    save_info->buffer_output_gals[output_snap_idx].dT[gals_in_buffer] = g->dT * run_params->UnitTime_in_s / SEC_PER_MEGAYEAR;
-
-    save_info->buffer_output_gals[output_snap_idx].Posx[gals_in_buffer] = g->Pos[0];
-    save_info->buffer_output_gals[output_snap_idx].Posy[gals_in_buffer] = g->Pos[1];
-    save_info->buffer_output_gals[output_snap_idx].Posz[gals_in_buffer] = g->Pos[2];
-
-    save_info->buffer_output_gals[output_snap_idx].Velx[gals_in_buffer] = g->Vel[0];
-    save_info->buffer_output_gals[output_snap_idx].Vely[gals_in_buffer] = g->Vel[1];
-    save_info->buffer_output_gals[output_snap_idx].Velz[gals_in_buffer] = g->Vel[2];
-
-    save_info->buffer_output_gals[output_snap_idx].Spinx[gals_in_buffer] = halos[g->HaloNr].Spin[0];
-    save_info->buffer_output_gals[output_snap_idx].Spiny[gals_in_buffer] = halos[g->HaloNr].Spin[1];
-    save_info->buffer_output_gals[output_snap_idx].Spinz[gals_in_buffer] = halos[g->HaloNr].Spin[2];
-
-    save_info->buffer_output_gals[output_snap_idx].Len[gals_in_buffer] = g->Len;
-    save_info->buffer_output_gals[output_snap_idx].Mvir[gals_in_buffer] = g->Mvir;
-    save_info->buffer_output_gals[output_snap_idx].CentralMvir[gals_in_buffer] = get_virial_mass(halos[g->HaloNr].FirstHaloInFOFgroup, halos, run_params);
-    save_info->buffer_output_gals[output_snap_idx].Rvir[gals_in_buffer] = get_virial_radius(g->HaloNr, halos, run_params);  // output the actual Rvir, not the maximum Rvir
-    save_info->buffer_output_gals[output_snap_idx].Vvir[gals_in_buffer] = get_virial_velocity(g->HaloNr, halos, run_params);  // output the actual Vvir, not the maximum Vvir
-    save_info->buffer_output_gals[output_snap_idx].Vmax[gals_in_buffer] = g->Vmax;
-    save_info->buffer_output_gals[output_snap_idx].VelDisp[gals_in_buffer] = halos[g->HaloNr].VelDisp;
-
-    save_info->buffer_output_gals[output_snap_idx].ColdGas[gals_in_buffer] = g->ColdGas;
-    save_info->buffer_output_gals[output_snap_idx].StellarMass[gals_in_buffer] = g->StellarMass;
-    save_info->buffer_output_gals[output_snap_idx].BulgeMass[gals_in_buffer] = g->BulgeMass;
-    save_info->buffer_output_gals[output_snap_idx].HotGas[gals_in_buffer] = g->HotGas;
-    save_info->buffer_output_gals[output_snap_idx].EjectedMass[gals_in_buffer] = g->EjectedMass;
-    save_info->buffer_output_gals[output_snap_idx].BlackHoleMass[gals_in_buffer] = g->BlackHoleMass;
-    save_info->buffer_output_gals[output_snap_idx].ICS[gals_in_buffer] = g->ICS;
-
-    save_info->buffer_output_gals[output_snap_idx].MetalsColdGas[gals_in_buffer] = g->MetalsColdGas;
-    save_info->buffer_output_gals[output_snap_idx].MetalsStellarMass[gals_in_buffer] = g->MetalsStellarMass;
-    save_info->buffer_output_gals[output_snap_idx].MetalsBulgeMass[gals_in_buffer] = g->MetalsBulgeMass;
-    save_info->buffer_output_gals[output_snap_idx].MetalsHotGas[gals_in_buffer] = g->MetalsHotGas;
-    save_info->buffer_output_gals[output_snap_idx].MetalsEjectedMass[gals_in_buffer] = g->MetalsEjectedMass;
-    save_info->buffer_output_gals[output_snap_idx].MetalsICS[gals_in_buffer] = g->MetalsICS;
-
-    float tmp_SfrDisk = 0.0;
-    float tmp_SfrBulge = 0.0;
-    float tmp_SfrDiskZ = 0.0;
-    float tmp_SfrBulgeZ = 0.0;
-
-    // NOTE: in Msun/yr
-    for(int step = 0; step < STEPS; step++) {
-        tmp_SfrDisk += g->SfrDisk[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
-        tmp_SfrBulge += g->SfrBulge[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
-
-        if(g->SfrDiskColdGas[step] > 0.0) {
-            tmp_SfrDiskZ += g->SfrDiskColdGasMetals[step] / g->SfrDiskColdGas[step] / STEPS;
-        }
+    SET_GALAXY_OUTPUT_FIELD(Type, g->Type);
+
+    SET_GALAXY_OUTPUT_FIELD(GalaxyIndex, g->GalaxyIndex);
+    SET_GALAXY_OUTPUT_FIELD(CentralGalaxyIndex, g->CentralGalaxyIndex);
+
+    SET_GALAXY_OUTPUT_FIELD(SAGEHaloIndex, g->HaloNr);
+    SET_GALAXY_OUTPUT_FIELD(SAGETreeIndex, original_treenr);
+    SET_GALAXY_OUTPUT_FIELD(SimulationHaloIndex, llabs(halos[g->HaloNr].MostBoundID));
+    SET_GALAXY_OUTPUT_FIELD(TaskForestNr, task_forestnr);
+
+    SET_GALAXY_OUTPUT_FIELD(mergeType, g->mergeType);
+    SET_GALAXY_OUTPUT_FIELD(mergeIntoID, g->mergeIntoID);
+    SET_GALAXY_OUTPUT_FIELD(mergeIntoSnapNum, g->mergeIntoSnapNum);
+    SET_GALAXY_OUTPUT_FIELD(dT, g->dT * run_params->UnitTime_in_s / SEC_PER_MEGAYEAR);
+
+    SET_GALAXY_OUTPUT_FIELD(Posx, g->Pos[0]);
+    SET_GALAXY_OUTPUT_FIELD(Posy, g->Pos[1]);
+    SET_GALAXY_OUTPUT_FIELD(Posz, g->Pos[2]);
+
+    SET_GALAXY_OUTPUT_FIELD(Velx, g->Vel[0]);
+    SET_GALAXY_OUTPUT_FIELD(Vely, g->Vel[1]);
+    SET_GALAXY_OUTPUT_FIELD(Velz, g->Vel[2]);
+
+    SET_GALAXY_OUTPUT_FIELD(Spinx, halos[g->HaloNr].Spin[0]);
+    SET_GALAXY_OUTPUT_FIELD(Spiny, halos[g->HaloNr].Spin[1]);
+    SET_GALAXY_OUTPUT_FIELD(Spinz, halos[g->HaloNr].Spin[2]);
+
+    SET_GALAXY_OUTPUT_FIELD(Len, g->Len);
+    SET_GALAXY_OUTPUT_FIELD(Mvir, g->Mvir);
+    SET_GALAXY_OUTPUT_FIELD(CentralMvir, get_virial_mass(halos[g->HaloNr].FirstHaloInFOFgroup, halos, run_params));
+    SET_GALAXY_OUTPUT_FIELD(Rvir, get_virial_radius(g->HaloNr, halos, run_params));  // output the actual Rvir, not the maximum Rvir
+    SET_GALAXY_OUTPUT_FIELD(Vvir, get_virial_velocity(g->HaloNr, halos, run_params));  // output the actual Vvir, not the maximum Vvir
+    SET_GALAXY_OUTPUT_FIELD(Vmax, g->Vmax);
+    SET_GALAXY_OUTPUT_FIELD(VelDisp, halos[g->HaloNr].VelDisp);
+
+    SET_GALAXY_OUTPUT_FIELD(ColdGas, g->ColdGas);
+    SET_GALAXY_OUTPUT_FIELD(StellarMass, g->StellarMass);
+    SET_GALAXY_OUTPUT_FIELD(BulgeMass, g->BulgeMass);
+    SET_GALAXY_OUTPUT_FIELD(HotGas, g->HotGas);
+    SET_GALAXY_OUTPUT_FIELD(EjectedMass, g->EjectedMass);
+    SET_GALAXY_OUTPUT_FIELD(BlackHoleMass, g->BlackHoleMass);
+    SET_GALAXY_OUTPUT_FIELD(ICS, g->ICS);
+
+    SET_GALAXY_OUTPUT_FIELD(MetalsColdGas, g->MetalsColdGas);
+    SET_GALAXY_OUTPUT_FIELD(MetalsStellarMass, g->MetalsStellarMass);
+    SET_GALAXY_OUTPUT_FIELD(MetalsBulgeMass, g->MetalsBulgeMass);
+    SET_GALAXY_OUTPUT_FIELD(MetalsHotGas, g->MetalsHotGas);
+    SET_GALAXY_OUTPUT_FIELD(MetalsEjectedMass, g->MetalsEjectedMass);
+    SET_GALAXY_OUTPUT_FIELD(MetalsICS, g->MetalsICS);
+
+    if(buffer->SfrDisk != NULL || buffer->SfrBulge != NULL || buffer->SfrDiskZ != NULL || buffer->SfrBulgeZ != NULL) {
+        float tmp_SfrDisk = 0.0;
+        float tmp_SfrBulge = 0.0;
+        float tmp_SfrDiskZ = 0.0;
+        float tmp_SfrBulgeZ = 0.0;
+
+        // NOTE: in Msun/yr
+        for(int step = 0; step < STEPS; step++) {
+            tmp_SfrDisk += g->SfrDisk[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
+            tmp_SfrBulge += g->SfrBulge[step] * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS / STEPS;
+
+            if(g->SfrDiskColdGas[step] > 0.0) {
+                tmp_SfrDiskZ += g->SfrDiskColdGasMetals[step] / g->SfrDiskColdGas[step] / STEPS;
+            }
 
-        if(g->SfrBulgeColdGas[step] > 0.0) {
-            tmp_SfrBulgeZ += g->SfrBulgeColdGasMetals[step] / g->SfrBulgeColdGas[step] / STEPS;
+            if(g->SfrBulgeColdGas[step] > 0.0) {
+                tmp_SfrBulgeZ += g->SfrBulgeColdGasMetals[step] / g->SfrBulgeColdGas[step] / STEPS;
+            }
         }
+
+        SET_GALAXY_OUTPUT_FIELD(SfrDisk, tmp_SfrDisk);
+        SET_GALAXY_OUTPUT_FIELD(SfrBulge, tmp_SfrBulge);
+        SET_GALAXY_OUTPUT_FIELD(SfrDiskZ, tmp_SfrDiskZ);
+        SET_GALAXY_OUTPUT_FIELD(SfrBulgeZ, tmp_SfrBulgeZ);
     }
 
-    save_info->buffer_output_gals[output_snap_idx].SfrDisk[gals_in_buffer] = tmp_SfrDisk;
-    save_info->buffer_output_gals[output_snap_idx].SfrBulge[gals_in_buffer] = tmp_SfrBulge;
-    save_info->buffer_output_gals[output_snap_idx].SfrDiskZ[gals_in_buffer] = tmp_SfrDiskZ;
-    save_info->buffer_output_gals[output_snap_idx].SfrBulgeZ[gals_in_buffer] = tmp_SfrBulgeZ;
+    SET_GALAXY_OUTPUT_FIELD(DiskScaleRadius, g->DiskScaleRadius);
 
-    save_info->buffer_output_gals[output_snap_idx].DiskScaleRadius[gals_in_buffer] = g->DiskScaleRadius;
+    SET_GALAXY_OUTPUT_FIELD(Cooling, g->Cooling > 0.0 ? log10(g->Cooling * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s):0.0);
+    SET_GALAXY_OUTPUT_FIELD(Heating, g->Heating > 0.0 ? log10(g->Heating * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s):0.0);
 
-    if (g->Cooling > 0.0) {
-        save_info->buffer_output_gals[output_snap_idx].Cooling[gals_in_buffer] = log10(g->Cooling * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s);
-    } else {
-        save_info->buffer_output_gals[output_snap_idx].Cooling[gals_in_buffer] = 0.0;
-    }
+    SET_GALAXY_OUTPUT_FIELD(QuasarModeBHaccretionMass, g->QuasarModeBHaccretionMass);
 
-    if (g->Heating > 0.0) {
-        save_info->buffer_output_gals[output_snap_idx].Heating[gals_in_buffer] = log10(g->Heating * run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s);
-    } else {
-        save_info->buffer_output_gals[output_snap_idx].Heating[gals_in_buffer] = 0.0;
-    }
+    SET_GALAXY_OUTPUT_FIELD(TimeOfLastMajorMerger, g->TimeOfLastMajorMerger * run_params->UnitTime_in_Megayears);
+    SET_GALAXY_OUTPUT_FIELD(TimeOfLastMinorMerger, g->TimeOfLastMinorMerger * run_params->UnitTime_in_Megayears);
 
-    save_info->buffer_output_gals[output_snap_idx].QuasarModeBHaccretionMass[gals_in_buffer] = g->QuasarModeBHaccretionMass;
+    SET_GALAXY_OUTPUT_FIELD(OutflowRate, g->OutflowRate * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
 
-    save_info->buffer_output_gals[output_snap_idx].TimeOfLastMajorMerger[gals_in_buffer] = g->TimeOfLastMajorMerger * run_params->UnitTime_in_Megayears;
-    save_info->buffer_output_gals[output_snap_idx].TimeOfLastMinorMerger[gals_in_buffer] = g->TimeOfLastMinorMerger * run_params->UnitTime_in_Megayears;
+    //infall properties
+    SET_GALAXY_OUTPUT_FIELD(infallMvir, g->Type != 0 ? g->infallMvir:0.0);
+    SET_GALAXY_OUTPUT_FIELD(infallVvir, g->Type != 0 ? g->infallVvir:0.0);
+    SET_GALAXY_OUTPUT_FIELD(infallVmax, g->Type != 0 ? g->infallVmax:0.0);
 
-    save_info->buffer_output_gals[output_snap_idx].OutflowRate[gals_in_buffer] = g->OutflowRate * run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS;
+    return EXIT_SUCCESS;
+}
 
-    //infall properties
-    if(g->Type != 0) {
-        save_info->buffer_output_gals[output_snap_idx].infallMvir[gals_in_buffer] = g->infallMvir;
-        save_info->buffer_output_gals[output_snap_idx].infallVvir[gals_in_buffer] = g->infallVvir;
-        save_info->buffer_output_gals[output_snap_idx].infallVmax[gals_in_buffer] = g->infallVmax;
-    } else {
-        save_info->buffer_output_gals[output_snap_idx].infallMvir[gals_in_buffer] = 0.0;
-        save_info->buffer_output_gals[output_snap_idx].infallVvir[gals_in_buffer] = 0.0;
-        save_info->buffer_output_gals[output_snap_idx].infallVmax[gals_in_buffer] = 0.0;
+#undef SET_GALAXY_OUTPUT_FIELD
+
+
+// Writes out the first `num_to_write` galaxies in the buffer for this snapshot. With an async writer, the
+// buffer is handed over to the writer thread and the (already written out) spare buffer takes its place.
+int32_t write_galaxy_buffer(const int32_t snap_idx, const int32_t num_to_write, struct save_info *save_info,
+                            const struct params *run_params)
+{
+    int32_t status;
+#ifdef USE_ASYNC_WRITE
+    if(save_info->async_writer != NULL) {
+        // The spare buffer can only be re-filled once its previous contents have been written
+        status = wait_for_async_write(save_info->async_writer, &save_info->buffer_in_flight[snap_idx]);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+
+        struct hdf5_buffer_write_job *job = &save_info->buffer_write_jobs[snap_idx];
+        job->snap_idx = snap_idx;
+        job->num_to_write = num_to_write;
+        job->num_already_written = save_info->tot_ngals[snap_idx];
+        job->buffer = save_info->buffer_output_gals[snap_idx];
+        job->save_info = save_info;
+        job->run_params = run_params;
+
+        save_info->buffer_output_gals[snap_idx] = save_info->spare_output_gals[snap_idx];
+        save_info->spare_output_gals[snap_idx] = job->buffer;
+
+        status = submit_async_write(save_info->async_writer, hdf5_buffer_write_job, job, &save_info->buffer_in_flight[snap_idx]);
+    } else
+#endif
+    {
+        status = trigger_buffer_write(snap_idx, &save_info->buffer_output_gals[snap_idx], num_to_write,
+                                      save_info->tot_ngals[snap_idx], save_info, run_params);
     }
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    // We've performed a write, so future galaxies will overwrite the old data.
+    save_info->num_gals_in_buffer[snap_idx] = 0;
+    save_info->tot_ngals[snap_idx] += num_to_write;
 
     return EXIT_SUCCESS;
 }
 
+#ifdef USE_ASYNC_WRITE
+int hdf5_buffer_write_job(void *arg)
+{
+    const struct hdf5_buffer_write_job *job = (const struct hdf5_buffer_write_job *) arg;
+    return trigger_buffer_write(job->snap_idx, &job->buffer, job->num_to_write, job->num_already_written,
+                                job->save_info, job->run_params);
+}
+#endif
 
 /*MS: 23/9/2019 Yes, there appears to be a NULL pointer dereference in the 'SIZEOF_STRUCT_FIELD' but
   the expression is a compile time constant and there is no invalid memory access. That said, C really shouold
@@ -967,8 +2103,9 @@ int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct save_info
 // -> Create a dataspace that will hold the data -> Write the data to the group using the new spaces.
 // Please refer to the HDF5 documentation for comprehensive explanations. I've probably butchered this...
 
-/* Assumes 'snap_idx', 'field_idx' are set appropriately before invoking the macro */
-#define EXTEND_AND_WRITE_GALAXY_DATASET(field_name) {                   \
+/* Assumes 'snap_idx', 'field_idx' are set appropriately before invoking the macro. Fields that are
+   not written (i.e., not selected with 'OutputFields') have not been allocated and are skipped */
+#define EXTEND_AND_WRITE_GALAXY_DATASET(field_name) if(buffer->field_name != NULL) { \
     char full_field_name[2*MAX_STRING_LEN];                           \
     snprintf(full_field_name, 2*MAX_STRING_LEN - 1,"Snap_%d/%s", run_params->ListOutputSnaps[snap_idx], save_info->name_output_fields[field_idx]); \
     hid_t dataset_id = H5Dopen2(save_info->file_id, full_field_name, H5P_DEFAULT); \
@@ -1011,7 +2148,7 @@ int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct save_info
                 "The length of the dataspace we attempted to created was %d.\n", snap_idx, (int32_t) dims_extend[0]); \
         return (int32_t) memspace;                                      \
     }                                                                   \
-    status = H5Dwrite(dataset_id, h5_dtype, memspace, filespace, H5P_DEFAULT, (save_info->buffer_output_gals[snap_idx]).field_name); \
+    status = H5Dwrite(dataset_id, h5_dtype, memspace, filespace, H5P_DEFAULT, buffer->field_name); \
     CHECK_STATUS_AND_RETURN_ON_FAIL(status, (int32_t) status,           \
             "Could not write the dataset for the " #field_name" field for output snapshot %d.\n" \
             "The dataset ID value is %d.\n"                             \
@@ -1048,8 +2185,9 @@ int32_t prepare_galaxy_for_hdf5_output(const struct GALAXY *g, struct save_info
 // Extend the length of each dataset in our file and write the data to it.
 // We have to specify the number of items to write `num_to_write` because this function is called
 // both when we reach the buffer limit and during finalization where we write the remaining galaxies.
-int32_t trigger_buffer_write(const int32_t snap_idx, const int32_t num_to_write, const int64_t num_already_written,
-                             struct save_info *save_info, const struct params *run_params)
+int32_t trigger_buffer_write(const int32_t snap_idx, const struct HDF5_GALAXY_OUTPUT *buffer, const int32_t num_to_write,
+                             const int64_t num_already_written, const struct save_info *save_info,
+                             const struct params *run_params)
 {
     herr_t status;
 
@@ -1070,7 +2208,7 @@ int32_t trigger_buffer_write(const int32_t snap_idx, const int32_t num_to_write,
     hsize_t new_dims[1];
     new_dims[0] = old_dims[0] + dims_extend[0];
 
-    // This parameter is incremented in every Macro call. It is used to ensure we are
+    // This parameter is incremented in every Macro call that writes a dataset. It is used to ensure we are
     // accessing the correct dataset.
     int32_t field_idx = 0;
 
@@ -1136,15 +2274,115 @@ int32_t trigger_buffer_write(const int32_t snap_idx, const int32_t num_to_write,
     EXTEND_AND_WRITE_GALAXY_DATASET(infallVvir);
     EXTEND_AND_WRITE_GALAXY_DATASET(infallVmax);
 #endif
-    // We've performed a write, so future galaxies will overwrite the old data.
-    save_info->num_gals_in_buffer[snap_idx] = 0;
-    save_info->tot_ngals[snap_idx] += num_to_write;
 
     return EXIT_SUCCESS;
 }
 
+/* Assumes 'snap_idx', 'field_idx' are set appropriately before invoking the macro. Fields that are
+   not written (i.e., not selected with 'OutputFields') have not been allocated and are skipped */
+#define WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(field_name) if(buffer->field_name != NULL) { \
+    const hid_t h5_dtype = (hid_t) save_info->field_dtypes[field_idx];  \
+    XRETURN(SIZEOF_STRUCT_FIELD(field_name) == H5Tget_size(h5_dtype), -1, \
+            "Error while writing field " #field_name"\nThe HDF5 datatype has size %zu bytes but the struct element has size = %zu bytes\n", \
+            H5Tget_size(h5_dtype), SIZEOF_STRUCT_FIELD(field_name));    \
+    snprintf(full_field_name, 2*MAX_STRING_LEN - 1,"Snap_%d/%s", run_params->ListOutputSnaps[snap_idx], save_info->name_output_fields[field_idx]); \
+    const int32_t field_status = extend_and_write_dataset(file_id, full_field_name, buffer->field_name, my_counts[snap_idx], \
+                                                          offsets[snap_idx], new_sizes[snap_idx], h5_dtype); \
+    if(field_status != EXIT_SUCCESS) {                                  \
+        return field_status;                                            \
+    }                                                                   \
+    field_idx++;                                                        \
+}
+
+// Writes the galaxies of this task in the buffers, the number of galaxies per tree and the forest number of each tree
+// into the single file. Each task writes `my_counts` elements at `offsets` after extending the datasets to `new_sizes`.
+int32_t write_task_galaxies_into_single_file(hid_t file_id, const struct save_info *save_info, const int64_t *my_counts,
+                                             const int64_t *offsets, const int64_t *new_sizes, const struct params *run_params)
+{
+    const int32_t nsnaps = run_params->NumSnapOutputs;
+    const int64_t nforests_written = save_info->single_file->nforests_written;
+    char full_field_name[2*MAX_STRING_LEN];
+
+    for(int32_t snap_idx = 0; snap_idx < nsnaps; snap_idx++) {
+        const struct HDF5_GALAXY_OUTPUT *buffer = &save_info->buffer_output_gals[snap_idx];
+
+        // This parameter is incremented in every Macro call that writes a dataset.
+        int32_t field_idx = 0;
+#ifdef USE_SAGE_IN_MCMC_MODE
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SnapNum);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(StellarMass);
+#else
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SnapNum);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Type);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(GalaxyIndex);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(CentralGalaxyIndex);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SAGEHaloIndex);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SAGETreeIndex);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SimulationHaloIndex);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(mergeType);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(mergeIntoID);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(mergeIntoSnapNum);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(dT);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Posx);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Posy);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Posz);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Velx);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Vely);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Velz);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Spinx);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Spiny);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Spinz);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Len);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Mvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(CentralMvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Rvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Vvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Vmax);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(VelDisp);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(ColdGas);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(StellarMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(BulgeMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(HotGas);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(EjectedMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(BlackHoleMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(ICS);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsColdGas);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsStellarMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsBulgeMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsHotGas);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsEjectedMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(MetalsICS);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SfrDisk);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SfrBulge);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SfrDiskZ);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(SfrBulgeZ);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(DiskScaleRadius);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Cooling);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(Heating);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(QuasarModeBHaccretionMass);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(TimeOfLastMajorMerger);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(TimeOfLastMinorMerger);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(OutflowRate);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(infallMvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(infallVvir);
+        WRITE_GALAXY_DATASET_INTO_SINGLE_FILE(infallVmax);
+#endif
+
+        snprintf(full_field_name, 2*MAX_STRING_LEN - 1, "TreeInfo/Snap_%d/NumGalsPerTreePerSnap", run_params->ListOutputSnaps[snap_idx]);
+        const int32_t status = extend_and_write_dataset(file_id, full_field_name, save_info->forest_ngals[snap_idx] + nforests_written,
+                                                        my_counts[nsnaps], offsets[nsnaps], new_sizes[nsnaps], H5T_NATIVE_INT);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    }
+
+    return extend_and_write_dataset(file_id, "TreeInfo/ForestNr", save_info->forestnr_per_tree + nforests_written, my_counts[nsnaps],
+                                    offsets[nsnaps], new_sizes[nsnaps], H5T_NATIVE_INT64);
+}
+
 #undef SIZEOF_STRUCT_FIELD
 #undef EXTEND_AND_WRITE_GALAXY_DATASET
+#undef WRITE_GALAXY_DATASET_INTO_SINGLE_FILE
 
 int32_t write_header(hid_t file_id, const struct forest_info *forest_info, const struct params *run_params) {
 
@@ -92,10 +92,15 @@ struct HDF5_GALAXY_OUTPUT
     // Proto-Types //
     extern int32_t initialize_hdf5_galaxy_files(const int filenr, struct save_info *save_info, const struct params *run_params);
     
-    extern int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int32_t num_gals, struct forest_info *forest_info,
-                                      struct halo_data *halos, struct halo_aux_data *haloaux, struct GALAXY *halogal,
+    extern int32_t save_hdf5_galaxies(const int64_t task_forestnr, const int64_t tree_idx, const int32_t num_gals, struct forest_info *forest_info,
+                                      struct halo_data *halos, const int32_t *OutputGalSnapIdx, struct GALAXY *halogal,
                                       struct save_info *save_info, const struct params *run_params);
 
+    extern int32_t flush_hdf5_galaxy_files(struct save_info *save_info, const struct params *run_params);
+
+    extern int32_t sync_hdf5_single_file(const struct forest_info *forest_info, struct save_info *save_info, const int checkpoint_due,
+                                         const struct params *run_params);
+
     extern int32_t finalize_hdf5_galaxy_files(const struct forest_info *forest_info, struct save_info *save_info,
                                               const struct params *run_params);
 
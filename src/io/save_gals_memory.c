@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "save_gals_memory.h"
+#include "save_gals_binary.h"
+#include "../core_allvars.h"
+#include "../macros.h"
+
+// Local Proto-Types //
+static int32_t grow_catalogue_columns(struct galaxy_catalogue *catalogue, const int32_t snap_idx, const int64_t min_ngals);
+
+// Externally Visible Functions //
+
+// The columns of the catalogue are allocated the first time (and kept for any following runs). Every
+// run starts with an empty catalogue. The memory is allocated outside of mymalloc since the catalogue
+// is handed back to the caller and lives until the params are freed.
+int32_t initialize_memory_galaxy_catalogue(struct save_info *save_info, const struct params *run_params)
+{
+    (void) save_info;
+
+    struct galaxy_catalogue *catalogue = run_params->catalogue;
+    XRETURN(catalogue != NULL, EXIT_FAILURE, "Error: The galaxy catalogue for the 'sage_memory' output has not been allocated\n");
+
+    if(catalogue->columns == NULL) {
+        catalogue->num_snaps = run_params->NumSnapOutputs;
+        catalogue->num_fields = get_num_galaxy_output_fields();
+        catalogue->ngals = calloc(catalogue->num_snaps, sizeof(catalogue->ngals[0]));
+        catalogue->max_ngals = calloc(catalogue->num_snaps, sizeof(catalogue->max_ngals[0]));
+        catalogue->columns = calloc(catalogue->num_snaps, sizeof(catalogue->columns[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(catalogue->ngals, "Failed to allocate %d elements of size %zu for catalogue->ngals",
+                                         catalogue->num_snaps, sizeof(catalogue->ngals[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(catalogue->max_ngals, "Failed to allocate %d elements of size %zu for catalogue->max_ngals",
+                                         catalogue->num_snaps, sizeof(catalogue->max_ngals[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(catalogue->columns, "Failed to allocate %d elements of size %zu for catalogue->columns",
+                                         catalogue->num_snaps, sizeof(catalogue->columns[0]));
+        for(int32_t snap_idx = 0; snap_idx < catalogue->num_snaps; snap_idx++) {
+            catalogue->columns[snap_idx] = calloc(catalogue->num_fields, sizeof(catalogue->columns[snap_idx][0]));
+            CHECK_POINTER_AND_RETURN_ON_NULL(catalogue->columns[snap_idx], "Failed to allocate %d elements of size %zu for "
+                                             "catalogue->columns[%d]", catalogue->num_fields, sizeof(catalogue->columns[snap_idx][0]),
+                                             snap_idx);
+        }
+    }
+    XRETURN(catalogue->num_snaps == run_params->NumSnapOutputs, EXIT_FAILURE,
+            "Error: The galaxy catalogue was setup for %d output snapshots but there are now %d output snapshots\n",
+            catalogue->num_snaps, run_params->NumSnapOutputs);
+
+    for(int32_t snap_idx = 0; snap_idx < catalogue->num_snaps; snap_idx++) {
+        catalogue->ngals[snap_idx] = 0;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+// Appends the galaxies of one forest to the columns of their output snapshot (in the same order as the galaxies
+// are written to the 'sage_binary' output).
+int32_t save_memory_galaxies(const int64_t task_forestnr, const int64_t tree_idx, const int32_t num_gals,
+                             struct forest_info *forest_info, struct halo_data *halos, const int32_t *OutputGalSnapIdx,
+                             struct GALAXY *halogal, struct save_info *save_info, const struct params *run_params)
+{
+    struct galaxy_catalogue *catalogue = run_params->catalogue;
+
+    for(int32_t gal_idx = 0; gal_idx < num_gals; gal_idx++) {
+        const int32_t snap_idx = OutputGalSnapIdx[gal_idx];
+        if(snap_idx < 0) {
+            continue;
+        }
+
+        struct GALAXY_OUTPUT galaxy_output;
+        int32_t status = prepare_galaxy_for_output(&halogal[gal_idx], &galaxy_output, halos,
+                                                   forest_info->original_treenr[task_forestnr], NULL, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+
+        const int64_t gal_pos = catalogue->ngals[snap_idx];
+        if(gal_pos == catalogue->max_ngals[snap_idx]) {
+            status = grow_catalogue_columns(catalogue, snap_idx, gal_pos + 1);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+        }
+
+        const char *src = (const char *) &galaxy_output;
+        for(int32_t field_idx = 0; field_idx < catalogue->num_fields; field_idx++) {
+            const struct galaxy_output_field *field = get_galaxy_output_field(field_idx);
+            memcpy((char *) catalogue->columns[snap_idx][field_idx] + gal_pos * field->size, src + field->offset, field->size);
+        }
+
+        catalogue->ngals[snap_idx]++;
+        save_info->tot_ngals[snap_idx]++;
+        save_info->forest_ngals[snap_idx][tree_idx]++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+void free_galaxy_catalogue(struct galaxy_catalogue *catalogue)
+{
+    if(catalogue == NULL) {
+        return;
+    }
+
+    if(catalogue->columns != NULL) {
+        for(int32_t snap_idx = 0; snap_idx < catalogue->num_snaps; snap_idx++) {
+            if(catalogue->columns[snap_idx] == NULL) continue;
+            for(int32_t field_idx = 0; field_idx < catalogue->num_fields; field_idx++) {
+                free(catalogue->columns[snap_idx][field_idx]);
+            }
+            free(catalogue->columns[snap_idx]);
+        }
+    }
+    free(catalogue->columns);
+    free(catalogue->max_ngals);
+    free(catalogue->ngals);
+    free(catalogue);
+}
+
+
+int32_t get_num_memory_output_fields(void)
+{
+    return get_num_galaxy_output_fields();
+}
+
+
+int32_t get_memory_output_field_info(const int32_t field_idx, const char **name, const char **dtype)
+{
+    XRETURN(field_idx >= 0 && field_idx < get_num_galaxy_output_fields(), EXIT_FAILURE,
+            "Error: field_idx = %d must be within [0, %d)\n", field_idx, get_num_galaxy_output_fields());
+    const struct galaxy_output_field *field = get_galaxy_output_field(field_idx);
+    *name = field->name;
+    *dtype = field->dtype;
+
+    return EXIT_SUCCESS;
+}
+
+
+// Returns the column for the field 'field_name' at output snapshot 'snap_idx' (i.e., ListOutputSnaps[snap_idx]).
+// The column remains valid until the next run (or until the params are freed).
+int32_t get_memory_output_field(const struct galaxy_catalogue *catalogue, const int32_t snap_idx, const char *field_name,
+                                void **data, int64_t *ngals)
+{
+    XRETURN(catalogue != NULL && catalogue->columns != NULL, EXIT_FAILURE,
+            "Error: There is no galaxy catalogue. Please run sage with OutputFormat = 'sage_memory' first\n");
+    XRETURN(snap_idx >= 0 && snap_idx < catalogue->num_snaps, EXIT_FAILURE,
+            "Error: snap_idx = %d must be within [0, %d)\n", snap_idx, catalogue->num_snaps);
+
+    for(int32_t field_idx = 0; field_idx < catalogue->num_fields; field_idx++) {
+        if(strcmp(field_name, get_galaxy_output_field(field_idx)->name) == 0) {
+            *data = catalogue->columns[snap_idx][field_idx];
+            *ngals = catalogue->ngals[snap_idx];
+            return EXIT_SUCCESS;
+        }
+    }
+
+    fprintf(stderr,"Error: Could not find the field '%s' in the galaxy catalogue\n", field_name);
+    return EXIT_FAILURE;
+}
+
+// Local Functions //
+
+// Grows all the columns of one output snapshot (geometrically) so that they hold at least 'min_ngals' galaxies
+static int32_t grow_catalogue_columns(struct galaxy_catalogue *catalogue, const int32_t snap_idx, const int64_t min_ngals)
+{
+    int64_t new_max_ngals = catalogue->max_ngals[snap_idx] > 0 ? catalogue->max_ngals[snap_idx]:1024;
+    while(new_max_ngals < min_ngals) {
+        new_max_ngals *= 2;
+    }
+
+    for(int32_t field_idx = 0; field_idx < catalogue->num_fields; field_idx++) {
+        const struct galaxy_output_field *field = get_galaxy_output_field(field_idx);
+        void *column = realloc(catalogue->columns[snap_idx][field_idx], new_max_ngals * field->size);
+        CHECK_POINTER_AND_RETURN_ON_NULL(column, "Failed to grow the column for field '%s' (output snapshot index = %d) to "
+                                         "%"PRId64" elements of size %zu", field->name, snap_idx,
+                                         new_max_ngals, field->size);
+        catalogue->columns[snap_idx][field_idx] = column;
+    }
+    catalogue->max_ngals[snap_idx] = new_max_ngals;
+
+    return EXIT_SUCCESS;
+}
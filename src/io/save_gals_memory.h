@@ -0,0 +1,35 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../core_allvars.h"
+
+/* The galaxies of every output snapshot, kept in memory as one array per output field (i.e., the same
+   columns as the 'sage_hdf5' output). The arrays are re-used (and only ever grow) between repeated runs */
+struct galaxy_catalogue {
+    int32_t num_snaps;
+    int32_t num_fields;
+    int64_t *ngals;/* number of galaxies at each output snapshot */
+    int64_t *max_ngals;/* number of galaxies that fit into the (allocated) columns of each output snapshot */
+    void ***columns;/* columns[snap_idx][field_idx] */
+};
+
+    /* Functions in save_gals_memory.c */
+    extern int32_t initialize_memory_galaxy_catalogue(struct save_info *save_info, const struct params *run_params);
+
+    extern int32_t save_memory_galaxies(const int64_t task_forestnr, const int64_t tree_idx, const int32_t num_gals,
+                                        struct forest_info *forest_info, struct halo_data *halos, const int32_t *OutputGalSnapIdx,
+                                        struct GALAXY *halogal, struct save_info *save_info, const struct params *run_params);
+
+    extern void free_galaxy_catalogue(struct galaxy_catalogue *catalogue);
+
+    extern int32_t get_num_memory_output_fields(void);
+    extern int32_t get_memory_output_field_info(const int32_t field_idx, const char **name, const char **dtype);
+    extern int32_t get_memory_output_field(const struct galaxy_catalogue *catalogue, const int32_t snap_idx, const char *field_name,
+                                           void **data, int64_t *ngals);
+
+#ifdef __cplusplus
+}
+#endif
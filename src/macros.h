@@ -6,6 +6,8 @@
 #define  NDIM             3
 #define  STEPS            10         /* Number of integration intervals between two snapshots */
 #define  MAXGALFAC        1
+#define  MINGALS          1000  /* Smallest number of galaxies allocated for a forest (the arrays grow geometrically) */
+#define  GALGROWTHFAC     2     /* Factor by which the galaxy arrays grow when full */
 #define  ABSOLUTEMAXSNAPS 1000  /* The largest number of snapshots for any simulation */
 
 #define  GRAVITY     6.672e-8
@@ -14,7 +14,9 @@ int main(int argc, char **argv)
     int NTasks = 1;
 
 #ifdef MPI
-    MPI_Init(&argc, &argv);
+    /* With HDF5SingleFile, the galaxies are written into the single file from within the OpenMP threads (one at a time) */
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
     MPI_Comm_size(MPI_COMM_WORLD, &NTasks);
 #endif
@@ -10,73 +10,97 @@
 #include "model_cooling_heating.h"
 #include "model_misc.h"
 
-
-double cooling_recipe(const int gal, const double dt, struct GALAXY *galaxies, const struct params *run_params)
+static double do_AGN_heating(double coolingGas, const int32_t i, const double dt, const double x, const double rcool,
+                             struct galaxy_batch *gals, const struct params *run_params);
+static void cool_gas_onto_galaxy(const int32_t i, const double coolingGas, struct galaxy_batch *gals);
+
+
+/*
+  Cools the hot gas for all galaxies in the batch over their current substep (gals->dt).
+  The galaxies in the batch are completely independent of each other, and the
+  calculation is split into separate passes over the (contiguous) arrays so that
+  the passes without table lookups or branches can be vectorised
+*/
+void cool_gas_in_galaxies(struct galaxy_batch *gals, const struct params *run_params)
 {
-    double coolingGas;
+    const int32_t n = gals->n;
 
-    if(galaxies[gal].HotGas > 0.0 && galaxies[gal].Vvir > 0.0) {
-        const double tcool = galaxies[gal].Rvir / galaxies[gal].Vvir;
-        const double temp = 35.9 * galaxies[gal].Vvir * galaxies[gal].Vvir;         // in Kelvin
+    // the temperature and metallicity of the hot gas
+    for(int32_t i = 0; i < n; i++) {
+        const double temp = 35.9 * gals->Vvir[i] * gals->Vvir[i];         // in Kelvin
+        gals->logTemp[i] = temp > 0.0 ? log10(temp):0.0;
 
-        double logZ = -10.0;
-        if(galaxies[gal].MetalsHotGas > 0) {
-            logZ = log10(galaxies[gal].MetalsHotGas / galaxies[gal].HotGas);
+        gals->logZ[i] = -10.0;
+        if(gals->HotGas[i] > 0.0 && gals->MetalsHotGas[i] > 0) {
+            gals->logZ[i] = log10(gals->MetalsHotGas[i] / gals->HotGas[i]);
         }
+    }
 
-        double lambda = get_metaldependent_cooling_rate(log10(temp), logZ);
-        double x = PROTONMASS * BOLTZMANN * temp / lambda;        // now this has units sec g/cm^3
-        x /= (run_params->UnitDensity_in_cgs * run_params->UnitTime_in_s);         // now in internal units
-        const double rho_rcool = x / tcool * 0.885;  // 0.885 = 3/2 * mu, mu=0.59 for a fully ionized gas
+    // the cooling function (only used for galaxies with hot gas and a non-zero virial velocity)
+    get_metaldependent_cooling_rates(n, gals->logTemp, gals->logZ, gals->lambda);
 
-        // an isothermal density profile for the hot gas is assumed here
-        const double rho0 = galaxies[gal].HotGas / (4 * M_PI * galaxies[gal].Rvir);
-        const double rcool = sqrt(rho0 / rho_rcool);
+    for(int32_t i = 0; i < n; i++) {
+        const double dt = gals->dt[i];
+        double coolingGas;
 
-        coolingGas = 0.0;
-        if(rcool > galaxies[gal].Rvir) {
-            // "cold accretion" regime
-            coolingGas = galaxies[gal].HotGas / (galaxies[gal].Rvir / galaxies[gal].Vvir) * dt;
-        } else {
-            // "hot halo cooling" regime
-            coolingGas = (galaxies[gal].HotGas / galaxies[gal].Rvir) * (rcool / (2.0 * tcool)) * dt;
-        }
+        if(gals->HotGas[i] > 0.0 && gals->Vvir[i] > 0.0) {
+            const double tcool = gals->Rvir[i] / gals->Vvir[i];
+            const double temp = 35.9 * gals->Vvir[i] * gals->Vvir[i];         // in Kelvin
 
-        if(coolingGas > galaxies[gal].HotGas) {
-            coolingGas = galaxies[gal].HotGas;
-        } else {
-			if(coolingGas < 0.0) coolingGas = 0.0;
-        }
+            double x = PROTONMASS * BOLTZMANN * temp / gals->lambda[i];        // now this has units sec g/cm^3
+            x /= (run_params->UnitDensity_in_cgs * run_params->UnitTime_in_s);         // now in internal units
+            const double rho_rcool = x / tcool * 0.885;  // 0.885 = 3/2 * mu, mu=0.59 for a fully ionized gas
 
-		// at this point we have calculated the maximal cooling rate
-		// if AGNrecipeOn we now reduce it in line with past heating before proceeding
+            // an isothermal density profile for the hot gas is assumed here
+            const double rho0 = gals->HotGas[i] / (4 * M_PI * gals->Rvir[i]);
+            const double rcool = sqrt(rho0 / rho_rcool);
 
-		if(run_params->AGNrecipeOn > 0 && coolingGas > 0.0) {
-			coolingGas = do_AGN_heating(coolingGas, gal, dt, x, rcool, galaxies, run_params);
-        }
+            coolingGas = 0.0;
+            if(rcool > gals->Rvir[i]) {
+                // "cold accretion" regime
+                coolingGas = gals->HotGas[i] / (gals->Rvir[i] / gals->Vvir[i]) * dt;
+            } else {
+                // "hot halo cooling" regime
+                coolingGas = (gals->HotGas[i] / gals->Rvir[i]) * (rcool / (2.0 * tcool)) * dt;
+            }
+
+            if(coolingGas > gals->HotGas[i]) {
+                coolingGas = gals->HotGas[i];
+            } else {
+                if(coolingGas < 0.0) coolingGas = 0.0;
+            }
 
-		if (coolingGas > 0.0) {
-			galaxies[gal].Cooling += 0.5 * coolingGas * galaxies[gal].Vvir * galaxies[gal].Vvir;
+            // at this point we have calculated the maximal cooling rate
+            // if AGNrecipeOn we now reduce it in line with past heating before proceeding
+
+            if(run_params->AGNrecipeOn > 0 && coolingGas > 0.0) {
+                coolingGas = do_AGN_heating(coolingGas, i, dt, x, rcool, gals, run_params);
+            }
+
+            if (coolingGas > 0.0) {
+                gals->Cooling[i] += 0.5 * coolingGas * gals->Vvir[i] * gals->Vvir[i];
+            }
+        } else {
+            coolingGas = 0.0;
         }
-	} else {
-		coolingGas = 0.0;
-    }
 
-	XASSERT(coolingGas >= 0.0, -1,
-            "Error: Cooling gas mass = %g should be >= 0.0", coolingGas);
-    return coolingGas;
+        XASSERT(coolingGas >= 0.0, -1,
+                "Error: Cooling gas mass = %g should be >= 0.0", coolingGas);
 
+        cool_gas_onto_galaxy(i, coolingGas, gals);
+    }
 }
 
 
 
-double do_AGN_heating(double coolingGas, const int centralgal, const double dt, const double x, const double rcool, struct GALAXY *galaxies, const struct params *run_params)
+static double do_AGN_heating(double coolingGas, const int32_t i, const double dt, const double x, const double rcool,
+                             struct galaxy_batch *gals, const struct params *run_params)
 {
     double AGNrate, EDDrate, AGNaccreted, AGNcoeff, AGNheating, metallicity;
 
 	// first update the cooling rate based on the past AGN heating
-	if(galaxies[centralgal].r_heat < rcool) {
-		coolingGas = (1.0 - galaxies[centralgal].r_heat / rcool) * coolingGas;
+	if(gals->r_heat[i] < rcool) {
+		coolingGas = (1.0 - gals->r_heat[i] / rcool) * coolingGas;
     } else {
 		coolingGas = 0.0;
     }
@@ -85,31 +109,31 @@ double do_AGN_heating(double coolingGas, const int centralgal, const double dt,
             "Error: Cooling gas mass = %g should be >= 0.0", coolingGas);
 
 	// now calculate the new heating rate
-    if(galaxies[centralgal].HotGas > 0.0) {
+    if(gals->HotGas[i] > 0.0) {
         if(run_params->AGNrecipeOn == 2) {
             // Bondi-Hoyle accretion recipe
-            AGNrate = (2.5 * M_PI * run_params->G) * (0.375 * 0.6 * x) * galaxies[centralgal].BlackHoleMass * run_params->RadioModeEfficiency;
+            AGNrate = (2.5 * M_PI * run_params->G) * (0.375 * 0.6 * x) * gals->BlackHoleMass[i] * run_params->RadioModeEfficiency;
         } else if(run_params->AGNrecipeOn == 3) {
             // Cold cloud accretion: trigger: rBH > 1.0e-4 Rsonic, and accretion rate = 0.01% cooling rate
-            if(galaxies[centralgal].BlackHoleMass > 0.0001 * galaxies[centralgal].Mvir * CUBE(rcool/galaxies[centralgal].Rvir)) {
+            if(gals->BlackHoleMass[i] > 0.0001 * gals->Mvir[i] * CUBE(rcool/gals->Rvir[i])) {
                 AGNrate = 0.0001 * coolingGas / dt;
             } else {
                 AGNrate = 0.0;
             }
         } else {
             // empirical (standard) accretion recipe
-            if(galaxies[centralgal].Mvir > 0.0) {
+            if(gals->Mvir[i] > 0.0) {
                 AGNrate = run_params->RadioModeEfficiency / (run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS)
-                    * (galaxies[centralgal].BlackHoleMass / 0.01) * CUBE(galaxies[centralgal].Vvir / 200.0)
-                    * ((galaxies[centralgal].HotGas / galaxies[centralgal].Mvir) / 0.1);
+                    * (gals->BlackHoleMass[i] / 0.01) * CUBE(gals->Vvir[i] / 200.0)
+                    * ((gals->HotGas[i] / gals->Mvir[i]) / 0.1);
             } else {
                 AGNrate = run_params->RadioModeEfficiency / (run_params->UnitMass_in_g / run_params->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS)
-                    * (galaxies[centralgal].BlackHoleMass / 0.01) * CUBE(galaxies[centralgal].Vvir / 200.0);
+                    * (gals->BlackHoleMass[i] / 0.01) * CUBE(gals->Vvir[i] / 200.0);
             }
         }
 
         // Eddington rate
-        EDDrate = (1.3e38 * galaxies[centralgal].BlackHoleMass * 1e10 / run_params->Hubble_h) / (run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s) / (0.1 * 9e10);
+        EDDrate = (1.3e38 * gals->BlackHoleMass[i] * 1e10 / run_params->Hubble_h) / (run_params->UnitEnergy_in_cgs / run_params->UnitTime_in_s) / (0.1 * 9e10);
 
         // accretion onto BH is always limited by the Eddington rate
         if(AGNrate > EDDrate) {
@@ -120,13 +144,13 @@ double do_AGN_heating(double coolingGas, const int centralgal, const double dt,
         AGNaccreted = AGNrate * dt;
 
         // cannot accrete more mass than is available!
-        if(AGNaccreted > galaxies[centralgal].HotGas) {
-            AGNaccreted = galaxies[centralgal].HotGas;
+        if(AGNaccreted > gals->HotGas[i]) {
+            AGNaccreted = gals->HotGas[i];
         }
 
         // coefficient to heat the cooling gas back to the virial temperature of the halo
         // 1.34e5 = sqrt(2*eta*c^2), eta=0.1 (standard efficiency) and c in km/s
-        AGNcoeff = (1.34e5 / galaxies[centralgal].Vvir) * (1.34e5 / galaxies[centralgal].Vvir);
+        AGNcoeff = (1.34e5 / gals->Vvir[i]) * (1.34e5 / gals->Vvir[i]);
 
         // cooling mass that can be suppresed from AGN heating
         AGNheating = AGNcoeff * AGNaccreted;
@@ -138,21 +162,21 @@ double do_AGN_heating(double coolingGas, const int centralgal, const double dt,
         }
 
         // accreted mass onto black hole
-        metallicity = get_metallicity(galaxies[centralgal].HotGas, galaxies[centralgal].MetalsHotGas);
-        galaxies[centralgal].BlackHoleMass += AGNaccreted;
-        galaxies[centralgal].HotGas -= AGNaccreted;
-        galaxies[centralgal].MetalsHotGas -= metallicity * AGNaccreted;
+        metallicity = get_metallicity(gals->HotGas[i], gals->MetalsHotGas[i]);
+        gals->BlackHoleMass[i] += AGNaccreted;
+        gals->HotGas[i] -= AGNaccreted;
+        gals->MetalsHotGas[i] -= metallicity * AGNaccreted;
 
         // update the heating radius as needed
-        if(galaxies[centralgal].r_heat < rcool && coolingGas > 0.0) {
+        if(gals->r_heat[i] < rcool && coolingGas > 0.0) {
             double r_heat_new = (AGNheating / coolingGas) * rcool;
-            if(r_heat_new > galaxies[centralgal].r_heat) {
-                galaxies[centralgal].r_heat = r_heat_new;
+            if(r_heat_new > gals->r_heat[i]) {
+                gals->r_heat[i] = r_heat_new;
             }
         }
 
         if (AGNheating > 0.0) {
-            galaxies[centralgal].Heating += 0.5 * AGNheating * galaxies[centralgal].Vvir * galaxies[centralgal].Vvir;
+            gals->Heating[i] += 0.5 * AGNheating * gals->Vvir[i] * gals->Vvir[i];
         }
     }
 
@@ -161,21 +185,21 @@ double do_AGN_heating(double coolingGas, const int centralgal, const double dt,
 
 
 
-void cool_gas_onto_galaxy(const int centralgal, const double coolingGas, struct GALAXY *galaxies)
+static void cool_gas_onto_galaxy(const int32_t i, const double coolingGas, struct galaxy_batch *gals)
 {
     // add the fraction 1/STEPS of the total cooling gas to the cold disk
     if(coolingGas > 0.0) {
-        if(coolingGas < galaxies[centralgal].HotGas) {
-            const double metallicity = get_metallicity(galaxies[centralgal].HotGas, galaxies[centralgal].MetalsHotGas);
-            galaxies[centralgal].ColdGas += coolingGas;
-            galaxies[centralgal].MetalsColdGas += metallicity * coolingGas;
-            galaxies[centralgal].HotGas -= coolingGas;
-            galaxies[centralgal].MetalsHotGas -= metallicity * coolingGas;
+        if(coolingGas < gals->HotGas[i]) {
+            const double metallicity = get_metallicity(gals->HotGas[i], gals->MetalsHotGas[i]);
+            gals->ColdGas[i] += coolingGas;
+            gals->MetalsColdGas[i] += metallicity * coolingGas;
+            gals->HotGas[i] -= coolingGas;
+            gals->MetalsHotGas[i] -= metallicity * coolingGas;
         } else {
-            galaxies[centralgal].ColdGas += galaxies[centralgal].HotGas;
-            galaxies[centralgal].MetalsColdGas += galaxies[centralgal].MetalsHotGas;
-            galaxies[centralgal].HotGas = 0.0;
-            galaxies[centralgal].MetalsHotGas = 0.0;
+            gals->ColdGas[i] += gals->HotGas[i];
+            gals->MetalsColdGas[i] += gals->MetalsHotGas[i];
+            gals->HotGas[i] = 0.0;
+            gals->MetalsHotGas[i] = 0.0;
         }
     }
 }
@@ -7,10 +7,7 @@ extern "C" {
     #include "core_allvars.h"
 
     /* functions in model_cooling_heating.c */
-    extern double cooling_recipe(const int gal, const double dt, struct GALAXY *galaxies, const struct params *run_params);
-    extern void cool_gas_onto_galaxy(const int centralgal, const double coolingGas, struct GALAXY *galaxies);
-    extern double do_AGN_heating(double coolingGas, const int centralgal, const double dt, const double x, const double rcool,
-                                 struct GALAXY *galaxies, const struct params *run_params);
+    extern void cool_gas_in_galaxies(struct galaxy_batch *gals, const struct params *run_params);
 
 #ifdef __cplusplus
 }
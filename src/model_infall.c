@@ -10,7 +10,7 @@
 #include "model_misc.h"
 
 
-double infall_recipe(const int centralgal, const int ngal, const double Zcurr, struct GALAXY *galaxies, const struct params *run_params)
+double infall_recipe(const int centralgal, const int ngal, const int snapnum, struct GALAXY *galaxies, const struct params *run_params)
 {
     double tot_stellarMass, tot_BHMass, tot_coldMass, tot_hotMass, tot_ejected, tot_ICS;
     double tot_ejectedMetals, tot_ICSMetals;
@@ -42,7 +42,7 @@ double infall_recipe(const int centralgal, const int ngal, const double Zcurr, s
 
     // include reionization if necessary
     if(run_params->ReionizationOn) {
-        reionization_modifier = do_reionization(centralgal, Zcurr, galaxies, run_params);
+        reionization_modifier = do_reionization(centralgal, snapnum, galaxies, run_params);
     } else {
         reionization_modifier = 1.0;
     }
@@ -88,40 +88,45 @@ double infall_recipe(const int centralgal, const int ngal, const double Zcurr, s
 
 
 
-void strip_from_satellite(const int centralgal, const int gal, const double Zcurr, struct GALAXY *galaxies, const struct params *run_params)
+void strip_from_satellites(struct galaxy_batch *sats, const int snapnum, const struct params *run_params)
 {
-    double reionization_modifier;
+    /* the reionization mass-scale only depends on the redshift -> same for all satellites */
+    const double reionization_mass = run_params->ReionizationMass[snapnum];
 
-    if(run_params->ReionizationOn) {
-        /* reionization_modifier = do_reionization(gal, ZZ[halos[halonr].SnapNum]); */
-        reionization_modifier = do_reionization(gal, Zcurr, galaxies, run_params);
-    } else {
-        reionization_modifier = 1.0;
-    }
+    for(int32_t i = 0; i < sats->n; i++) {
+        sats->strippedGas[i] = 0.0;
+        sats->strippedGasMetals[i] = 0.0;
 
-    double strippedGas = -1.0 *
-        (reionization_modifier * run_params->BaryonFrac * galaxies[gal].Mvir - (galaxies[gal].StellarMass + galaxies[gal].ColdGas + galaxies[gal].HotGas + galaxies[gal].EjectedMass + galaxies[gal].BlackHoleMass + galaxies[gal].ICS) ) / STEPS;
-    // ( reionization_modifier * run_params->BaryonFrac * galaxies[gal].deltaMvir ) / STEPS;
+        if(!(sats->Type[i] == 1 && sats->HotGas[i] > 0.0)) {
+            continue;
+        }
 
-    if(strippedGas > 0.0) {
-        const double metallicity = get_metallicity(galaxies[gal].HotGas, galaxies[gal].MetalsHotGas);
-        double strippedGasMetals = strippedGas * metallicity;
+        const double reionization_modifier = run_params->ReionizationOn ? 1.0 / CUBE(1.0 + 0.26 * (reionization_mass / sats->Mvir[i])):1.0;
 
-        if(strippedGas > galaxies[gal].HotGas) strippedGas = galaxies[gal].HotGas;
-        if(strippedGasMetals > galaxies[gal].MetalsHotGas) strippedGasMetals = galaxies[gal].MetalsHotGas;
+        double strippedGas = -1.0 *
+            (reionization_modifier * run_params->BaryonFrac * sats->Mvir[i] - (sats->StellarMass[i] + sats->ColdGas[i] + sats->HotGas[i] + sats->EjectedMass[i] + sats->BlackHoleMass[i] + sats->ICS[i]) ) / STEPS;
+        // ( reionization_modifier * run_params->BaryonFrac * galaxies[gal].deltaMvir ) / STEPS;
 
-        galaxies[gal].HotGas -= strippedGas;
-        galaxies[gal].MetalsHotGas -= strippedGasMetals;
+        if(strippedGas > 0.0) {
+            const double metallicity = get_metallicity(sats->HotGas[i], sats->MetalsHotGas[i]);
+            double strippedGasMetals = strippedGas * metallicity;
 
-        galaxies[centralgal].HotGas += strippedGas;
-        galaxies[centralgal].MetalsHotGas += strippedGas * metallicity;
-    }
+            if(strippedGas > sats->HotGas[i]) strippedGas = sats->HotGas[i];
+            if(strippedGasMetals > sats->MetalsHotGas[i]) strippedGasMetals = sats->MetalsHotGas[i];
 
+            sats->HotGas[i] -= strippedGas;
+            sats->MetalsHotGas[i] -= strippedGasMetals;
+
+            /* the stripped gas is added to the central galaxy by the caller (in the same order as the satellites) */
+            sats->strippedGas[i] = strippedGas;
+            sats->strippedGasMetals[i] = strippedGas * metallicity;
+        }
+    }
 }
 
 
 
-double do_reionization(const int gal, const double Zcurr, struct GALAXY *galaxies, const struct params *run_params)
+double get_reionization_mass_scale(const double Zcurr, const struct params *run_params)
 {
     double f_of_a;
 
@@ -166,11 +171,17 @@ double do_reionization(const int gal, const double Zcurr, struct GALAXY *galaxie
     const double Mchar = Vchar * Vchar * Vchar / (run_params->G * HubbleZ * sqrt(0.5 * deltacritZ));
 
     // we use the maximum of Mfiltering and Mchar
-    const double mass_to_use = dmax(Mfiltering, Mchar);
+    return dmax(Mfiltering, Mchar);
+
+}
+
+
+double do_reionization(const int gal, const int snapnum, struct GALAXY *galaxies, const struct params *run_params)
+{
+    const double mass_to_use = run_params->ReionizationMass[snapnum];
     const double modifier = 1.0 / CUBE(1.0 + 0.26 * (mass_to_use / galaxies[gal].Mvir));
 
     return modifier;
-
 }
 
 
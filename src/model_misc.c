@@ -20,6 +20,7 @@ void init_galaxy(const int p, const int halonr, int *galaxycounter, const struct
 
     galaxies[p].GalaxyNr = *galaxycounter;
     (*galaxycounter)++;
+    galaxies[p].HaloGalIndex = -1;
 
     galaxies[p].HaloNr = halonr;
     galaxies[p].MostBoundID = halos[halonr].MostBoundID;
@@ -104,19 +105,6 @@ double get_disk_radius(const int halonr, const int p, const struct halo_data *ha
 
 
 
-double get_metallicity(const double gas, const double metals)
-{
-  double metallicity = 0.0;
-
-  if(gas > 0.0 && metals > 0.0) {
-      metallicity = metals / gas;
-      metallicity = metallicity >= 1.0 ? 1.0:metallicity;
-  }
-
-  return metallicity;
-}
-
-
 
 double dmax(const double x, const double y)
 {
@@ -152,15 +140,20 @@ double get_virial_radius(const int halonr, const struct halo_data *halos, const
 {
   // return halos[halonr].Rvir;  // Used for Bolshoi
   const int snapnum = halos[halonr].SnapNum;
-  const double zplus1 = 1.0 + run_params->ZZ[snapnum];
+  return cbrt(get_virial_mass(halonr, halos, run_params) * run_params->VirialRadiusFac[snapnum]);
+}
+
+
+
+double get_virial_radius_factor(const double Zcurr, const struct params *run_params)
+{
+  const double zplus1 = 1.0 + Zcurr;
   const double hubble_of_z_sq =
       run_params->Hubble * run_params->Hubble *(run_params->Omega * zplus1 * zplus1 * zplus1 + (1.0 - run_params->Omega - run_params->OmegaLambda) * zplus1 * zplus1 +
                                               run_params->OmegaLambda);
 
   const double rhocrit = 3.0 * hubble_of_z_sq / (8.0 * M_PI * run_params->G);
-  const double fac = 1.0 / (200.0 * 4.0 * M_PI / 3.0 * rhocrit);
-
-  return cbrt(get_virial_mass(halonr, halos, run_params) * fac);
+  return 1.0 / (200.0 * 4.0 * M_PI / 3.0 * rhocrit);
 }
 
 
@@ -8,13 +8,26 @@ extern "C" {
 
     /* functions in model_misc.c */
     extern void init_galaxy(const int p, const int halonr, int *galaxycounter, const struct halo_data *halos, struct GALAXY *galaxies, const struct params *run_params);
-    extern double get_metallicity(const double gas, const double metals);
     extern double get_virial_velocity(const int halonr, const struct halo_data *halos, const struct params *run_params);
     extern double get_virial_radius(const int halonr, const struct halo_data *halos, const struct params *run_params);
+    extern double get_virial_radius_factor(const double Zcurr, const struct params *run_params);
     extern double get_virial_mass(const int halonr, const struct halo_data *halos, const struct params *run_params);
     extern double get_disk_radius(const int halonr, const int p, const struct halo_data *halos, const struct GALAXY *galaxies);
     extern double dmax(const double x, const double y);
 
+    /* inline so that the batched (per-satellite) loops in the physics recipes can be vectorised */
+    static inline double get_metallicity(const double gas, const double metals)
+    {
+        double metallicity = 0.0;
+
+        if(gas > 0.0 && metals > 0.0) {
+            metallicity = metals / gas;
+            metallicity = metallicity >= 1.0 ? 1.0:metallicity;
+        }
+
+        return metallicity;
+    }
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,11 @@
 #include <mpi.h>
 #endif
 
+#ifdef OPENMP
+#include <omp.h>
+#include <pthread.h>
+#endif
+
 #include "sage.h"
 #include "core_allvars.h"
 #include "core_init.h"
@@ -23,56 +28,296 @@
 #include "core_utils.h"
 #include "progressbar.h"
 #include "core_tree_utils.h"
+#include "io/forest_utils.h"
+#include "io/save_gals_memory.h"
 
 #ifdef HDF5
 #include "io/save_gals_hdf5.h"
 #endif
 
+/* Everything about a forest that needs to survive from the
+   galaxy evolution stage until the galaxies have been saved */
+struct forest_galaxies
+{
+    struct halo_data *Halo;
+    struct halo_aux_data *HaloAux;
+    struct GALAXY *HaloGal;
+    int numgals;
+    struct sage_arena *arena;/* holds HaloAux and HaloGal (and the scratch galaxies); reset once the forest is saved */
+};
+
 /* main sage -> not exposed externally */
 int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
-                        struct forest_info *forest_info, struct params *run_params);
+                        struct forest_info *forest_info, struct sage_arena *arena, struct params *run_params);
+static int32_t evolve_forest(const int64_t forestnr, const int64_t nhalos, struct forest_galaxies *fg, struct params *run_params);
+static int32_t save_forest(const int64_t forestnr, struct forest_galaxies *fg, struct save_info *save_info,
+                           struct forest_info *forest_info, struct params *run_params);
+static void record_forest_timing(const int64_t forestnr, const int64_t nhalos, const struct timeval tstart,
+                                 struct forest_info *forest_info);
+static int32_t write_forest_timings(const int64_t Nforests, const struct forest_info *forest_info, const int append,
+                                    const struct params *run_params);
+static int32_t sage_all_forests_dynamic(struct forest_scheduler *scheduler, struct save_info *save_info, struct forest_info *forest_info,
+                                        struct params *run_params);
+#ifdef OPENMP
+static int32_t sage_all_forests_openmp(const int64_t Nforests, const int64_t *forestnrs, struct save_info *save_info,
+                                       struct forest_info *forest_info, struct params *run_params);
+#endif
+static int32_t setup_forests(struct forest_info *forest_info, struct params *run_params);
+static int32_t run_forests(struct forest_info *forest_info, struct params *run_params);
+static int32_t process_forests_on_task(struct forest_info *forest_info, struct params *run_params);
+static void cleanup_sage(struct forest_info *forest_info, struct params *run_params);
+
 /* additional functionality to convert *any* support mergertree format into the lhalo-binary format */
 int convert_trees_to_lhalo(const int ThisTask, const int NTasks, struct params *run_params, struct forest_info *forest_info);
 
 
 int run_sage(const int ThisTask, const int NTasks, const char *param_file, void **params)
 {
+    int32_t status = sage_params_from_file(ThisTask, NTasks, param_file, params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+    struct params *run_params = (struct params *) *params;
+
+    struct forest_info forest_info;
+    status = setup_forests(&forest_info, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    /* If we are converting the input mergertree into the lhalo-binary format,
+       then we just run the relevant converter: MS 12/10/2022 */
+    if(run_params->OutputFormat == lhalo_binary_output) {
+        return convert_trees_to_lhalo(ThisTask, NTasks, run_params, &forest_info);
+    }
+
+    /* If we are here, then we need to run the SAM */
+    init(run_params);
+
+    status = run_forests(&forest_info, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    /* sage is done running -> do the cleanup */
+    cleanup_sage(&forest_info, run_params);
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Allocates the run params that are passed (as an opaque pointer) through the API */
+static struct params *allocate_params(const int ThisTask, const int NTasks, void **params)
+{
+    *params = NULL;
     struct params *run_params = malloc(sizeof(*run_params));
     if(run_params == NULL) {
         fprintf(stderr,"Error: On ThisTask = %d (out of NTasks = %d), failed to allocate memory "\
                 "for the C-struct to to hold the run params. Requested size = %zu bytes...returning\n",
                 ThisTask, NTasks, sizeof(*run_params));
-        return MALLOC_FAILURE;
+        return NULL;
     }
     run_params->ThisTask = ThisTask;
     run_params->NTasks = NTasks;
+    run_params->forest_info = NULL;
+    run_params->catalogue = NULL;
     *params = run_params;
 
+    return run_params;
+}
+
+
+/* The (empty) galaxy catalogue is allocated as soon as the output format is known */
+static int32_t allocate_galaxy_catalogue(struct params *run_params)
+{
+    if(run_params->OutputFormat != sage_memory) {
+        return EXIT_SUCCESS;
+    }
+
+    run_params->catalogue = calloc(1, sizeof(*(run_params->catalogue)));
+    CHECK_POINTER_AND_RETURN_ON_NULL(run_params->catalogue, "Failed to allocate %zu bytes for the galaxy catalogue",
+                                     sizeof(*(run_params->catalogue)));
+
+    return EXIT_SUCCESS;
+}
+
+
+int sage_params_from_file(const int ThisTask, const int NTasks, const char *param_file, void **params)
+{
+    struct params *run_params = allocate_params(ThisTask, NTasks, params);
+    if(run_params == NULL) {
+        return MALLOC_FAILURE;
+    }
+
     int32_t status = read_parameter_file(param_file, run_params);
     if(status != EXIT_SUCCESS) {
+        /* the caller may try again with corrected parameters */
+        free(run_params);
+        *params = NULL;
         return status;
     }
 
-    /* Now start the model */
-    struct timeval tstart;
-    gettimeofday(&tstart, NULL);
+    return allocate_galaxy_catalogue(run_params);
+}
 
-    struct forest_info forest_info;
-    memset(&forest_info, 0, sizeof(struct forest_info));
-    forest_info.totnforests = 0;
-    forest_info.totnhalos = 0;
-    forest_info.nforests_this_task = 0;
-    forest_info.nhalos_this_task = 0;
+
+int sage_params_from_keyvalues(const int ThisTask, const int NTasks, const int nparams,
+                               const char * const *keys, const char * const *values, void **params)
+{
+    struct params *run_params = allocate_params(ThisTask, NTasks, params);
+    if(run_params == NULL) {
+        return MALLOC_FAILURE;
+    }
+
+    int32_t status = read_parameter_keyvalues(nparams, keys, values, run_params);
+    if(status != EXIT_SUCCESS) {
+        /* the caller may try again with corrected parameters */
+        free(run_params);
+        *params = NULL;
+        return status;
+    }
+
+    return allocate_galaxy_catalogue(run_params);
+}
+
+
+int sage_set_param(void *params, const char *key, const char *value)
+{
+    return set_recipe_parameter(key, value, (struct params *) params);
+}
+
+
+/* Everything that stays the same between runs: the forests are setup (and distributed over the tasks),
+   and the snapshot list, ages and cooling tables are read/computed */
+int sage_init_context(void *params)
+{
+    struct params *run_params = (struct params *) params;
+    XRETURN(run_params != NULL && run_params->forest_info == NULL, EXIT_FAILURE,
+            "Error: sage_init_context must be called exactly once on the params returned by sage_params_from_file "
+            "or sage_params_from_keyvalues. params = %p\n", params);
+    XRETURN(run_params->OutputFormat != lhalo_binary_output, EXIT_FAILURE,
+            "Error: Converting the mergertrees into the lhalo-binary format is not supported for repeated runs. "
+            "Please use run_sage instead\n");
+    XRETURN(run_params->RestartFromCheckpoint == 0, EXIT_FAILURE,
+            "Error: RestartFromCheckpoint is not supported for repeated runs. Please use run_sage instead\n");
+
+    struct forest_info *forest_info = malloc(sizeof(*forest_info));
+    CHECK_POINTER_AND_RETURN_ON_NULL(forest_info, "Failed to allocate %zu bytes for the forest info", sizeof(*forest_info));
+
+    int32_t status = setup_forests(forest_info, run_params);
+    if(status != EXIT_SUCCESS) {
+        free(forest_info);
+        return status;
+    }
+
+    /* the forests read during the first run are kept in memory, so that the following runs skip the I/O */
+    if(run_params->ResidentForestsMB != 0) {
+        status = setup_resident_forests(run_params->ResidentForestsMB, forest_info);
+        if(status != EXIT_SUCCESS) {
+            cleanup_forests_io(run_params->TreeType, forest_info);
+            free(forest_info);
+            return status;
+        }
+    }
+
+    init(run_params);
+    run_params->forest_info = forest_info;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* One complete run over all the forests with the current recipe parameters. The output is
+   (over-)written to the same files as a regular run, and needs sage_finalize_run afterwards */
+int sage_run(void *params)
+{
+    struct params *run_params = (struct params *) params;
+    XRETURN(run_params != NULL && run_params->forest_info != NULL, EXIT_FAILURE,
+            "Error: sage_init_context must be called before sage_run. params = %p\n", params);
+
+    init_recipe_quantities(run_params);
+
+    return run_forests(run_params->forest_info, run_params);
+}
+
+
+int sage_free_context(void *params)
+{
+    struct params *run_params = (struct params *) params;
+    if(run_params == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    if(run_params->forest_info != NULL) {
+        cleanup_sage(run_params->forest_info, run_params);
+        free(run_params->forest_info);
+        run_params->forest_info = NULL;
+    }
+    free_galaxy_catalogue(run_params->catalogue);
+    free(run_params);
+
+    return EXIT_SUCCESS;
+}
+
+
+int sage_get_num_output_fields(void)
+{
+    return get_num_memory_output_fields();
+}
+
+
+int sage_get_output_field_info(const int field_idx, const char **name, const char **dtype)
+{
+    return get_memory_output_field_info(field_idx, name, dtype);
+}
+
+
+/* The galaxies at output snapshot ListOutputSnaps[snap_idx] (i.e., the output snapshots sorted in descending order)
+   from the most recent run with OutputFormat = 'sage_memory'. 'data' points to 'ngals' values of the type given by
+   sage_get_output_field_info, and remains valid until the next run (or sage_free_context) */
+int sage_get_output_field(void *params, const int snap_idx, const char *field_name, void **data, int64_t *ngals)
+{
+    const struct params *run_params = (const struct params *) params;
+    XRETURN(run_params != NULL && field_name != NULL && data != NULL && ngals != NULL, EXIT_FAILURE,
+            "Error: Could not validate input parameters. params = %p field_name = %p data = %p ngals = %p\n",
+            params, field_name, data, ngals);
+
+    return get_memory_output_field(run_params->catalogue, snap_idx, field_name, data, ngals);
+}
+
+
+int sage_get_output_snapshots(void *params, int *num_snaps, const int32_t **snapnums)
+{
+    const struct params *run_params = (const struct params *) params;
+    XRETURN(run_params != NULL && num_snaps != NULL && snapnums != NULL, EXIT_FAILURE,
+            "Error: Could not validate input parameters. params = %p num_snaps = %p snapnums = %p\n",
+            params, num_snaps, snapnums);
+
+    *num_snaps = run_params->NumSnapOutputs;
+    *snapnums = run_params->ListOutputSnaps;
+
+    return EXIT_SUCCESS;
+}
+
+
+static int32_t setup_forests(struct forest_info *forest_info, struct params *run_params)
+{
+    int32_t status;
+    memset(forest_info, 0, sizeof(struct forest_info));
+    forest_info->totnforests = 0;
+    forest_info->totnhalos = 0;
+    forest_info->nforests_this_task = 0;
+    forest_info->nhalos_this_task = 0;
 
     /* setup the forests reading, and then distribute the forests over the Ntasks */
-    status = setup_forests_io(run_params, &forest_info, ThisTask, NTasks);
+    status = setup_forests_io(run_params, forest_info, run_params->ThisTask, run_params->NTasks);
     if(status != EXIT_SUCCESS) {
         return status;
     }
 
-    if(forest_info.totnforests < 0 || forest_info.nforests_this_task < 0) {
+    if(forest_info->totnforests < 0 || forest_info->nforests_this_task < 0) {
         fprintf(stderr,"Error: Bug in code totnforests = %"PRId64" and nforests (on this task) = %"PRId64" should both be at least 0\n",
-                forest_info.totnforests, forest_info.nforests_this_task);
+                forest_info->totnforests, forest_info->nforests_this_task);
         return EXIT_FAILURE;
     }
 
@@ -80,33 +325,72 @@ int run_sage(const int ThisTask, const int NTasks, const char *param_file, void
     // If we're creating a binary output, we need to be careful.
     // The binary output contains an 32 bit header that contains the number of trees processed.
     // Hence let's make sure that the number of trees assigned to this task doesn't exceed an 32 bit number.
-    if((run_params->OutputFormat == sage_binary) && (forest_info.nforests_this_task > INT_MAX)) {
+    if((run_params->OutputFormat == sage_binary) && (forest_info->nforests_this_task > INT_MAX)) {
         fprintf(stderr, "When creating the binary output, we must write a 32 bit header describing the number of trees processed.\n"
                         "However, task %d is processing %"PRId64" forests which is above the 32 bit limit.\n"
                         "Either change the output format to HDF5 or increase the number of cores processing your trees.\n",
-                        ThisTask, forest_info.nforests_this_task);
+                        run_params->ThisTask, forest_info->nforests_this_task);
         return EXIT_FAILURE;
     }
 
-    /* If we are converting the input mergertree into the lhalo-binary format,
-       then we just run the relevant converter: MS 12/10/2022 */
-    if(run_params->OutputFormat == lhalo_binary_output) {
-        return convert_trees_to_lhalo(ThisTask, NTasks, run_params, &forest_info);
+    /* With dynamic scheduling, the forests are setup chunk by chunk on the task that processes the chunk
+       (see sage_all_forests_dynamic) -> only keep the totals over all forests */
+    if(run_params->DynamicForestScheduling) {
+        struct forest_info all_forests;
+        memset(&all_forests, 0, sizeof(all_forests));
+        all_forests.totnforests = forest_info->totnforests;
+        all_forests.totnhalos = forest_info->totnhalos;
+        all_forests.firstfile = forest_info->firstfile;
+        all_forests.lastfile = forest_info->lastfile;
+        cleanup_forests_io(run_params->TreeType, forest_info);
+        *forest_info = all_forests;
     }
 
-    /* If we are here, then we need to run the SAM */
-    init(run_params);
+    return EXIT_SUCCESS;
+}
+
 
-    /* init needs to run before (potentially) jumping to 'cleanup' ->
-       otherwise unallocated run_params->Age will get freed and result
-       in an error. MS 12/10/2022
-    */
-    if(forest_info.nforests_this_task == 0) {
+/* Processes (and saves) all the forests assigned to this task */
+static int32_t run_forests(struct forest_info *forest_info, struct params *run_params)
+{
+    /* dynamic scheduling updates these to only cover the forests processed on this task -> restore
+       them (even when the run failed) for any following run over the same forests */
+    const int64_t nforests_this_task = forest_info->nforests_this_task;
+    const double frac_volume_processed = forest_info->frac_volume_processed;
+
+    int32_t status = process_forests_on_task(forest_info, run_params);
+
+    forest_info->nforests_this_task = nforests_this_task;
+    forest_info->frac_volume_processed = frac_volume_processed;
+
+    return status;
+}
+
+
+static int32_t process_forests_on_task(struct forest_info *forest_info, struct params *run_params)
+{
+    const int ThisTask = run_params->ThisTask;
+#if defined(MPI) && defined(VERBOSE)
+    const int NTasks = run_params->NTasks;
+#endif
+    int32_t status;
+
+#ifdef VERBOSE
+    struct timeval tstart;
+    gettimeofday(&tstart, NULL);
+#endif
+
+    /* All the tasks write the single hdf5 file together -> every task takes part, even without any forests */
+    const int write_single_file = run_params->OutputFormat == sage_hdf5 && run_params->HDF5SingleFile;
+    if(forest_info->nforests_this_task == 0 && run_params->DynamicForestScheduling == 0 && write_single_file == 0) {
         fprintf(stderr,"ThisTask=%d no forests to process...skipping\n",ThisTask);
-        goto cleanup;
+        return EXIT_SUCCESS;
     }
 
-    const int64_t Nforests = forest_info.nforests_this_task;
+    /* With dynamic scheduling, there are no forests on this task until the first chunk of forests is
+       requested -> the per-forest arrays grow as the chunks are processed (see sage_all_forests_dynamic) */
+    const int64_t Nforests = forest_info->nforests_this_task;
+    const int64_t nforests_alloc = Nforests > 0 ? Nforests:1;
 
     struct save_info save_info;
     // Allocate memory for the total number of galaxies for each output snapshot (across all forests).
@@ -122,29 +406,51 @@ int run_sage(const int ThisTask, const int NTasks, const char *param_file, void
                                      "Failed to allocate %d elements of size %zu for save_info.tot_ngals", run_params->NumSnapOutputs,
                                      sizeof(*(save_info.forest_ngals)));
 
+    save_info.nforests_saved = 0;
+    save_info.single_file_nrounds = 0;
+    save_info.forestnr_per_tree = NULL;
+    if(run_params->DynamicForestScheduling || write_single_file) {
+        save_info.forestnr_per_tree = mymalloc(nforests_alloc * sizeof(*(save_info.forestnr_per_tree)));
+        CHECK_POINTER_AND_RETURN_ON_NULL(save_info.forestnr_per_tree,
+                                         "Failed to allocate %"PRId64" elements of size %zu for save_info.forestnr_per_tree", nforests_alloc,
+                                         sizeof(*(save_info.forestnr_per_tree)));
+    }
+
     for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
         // Using calloc removes the need to zero out the memory explicitly.
-        save_info.forest_ngals[snap_idx] = mycalloc(Nforests, sizeof(*(save_info.forest_ngals[snap_idx])));
+        save_info.forest_ngals[snap_idx] = mycalloc(nforests_alloc, sizeof(*(save_info.forest_ngals[snap_idx])));
         CHECK_POINTER_AND_RETURN_ON_NULL(save_info.forest_ngals[snap_idx],
-                                         "Failed to allocate %"PRId64" elements of size %zu for save_info.tot_ngals[%d]", Nforests,
+                                         "Failed to allocate %"PRId64" elements of size %zu for save_info.tot_ngals[%d]", nforests_alloc,
                                          sizeof(*(save_info.forest_ngals[snap_idx])), snap_idx);
     }
 
 #ifdef VERBOSE
     fprintf(stdout,"Task %d working on %"PRId64" forests covering %.3f fraction of the volume\n",
-            ThisTask, Nforests, forest_info.frac_volume_processed);
+            ThisTask, Nforests, forest_info->frac_volume_processed);
     fflush(stdout);
 #endif
 
+    /* with dynamic scheduling, the timings are written after every chunk */
+    if(run_params->WriteForestTimings && run_params->DynamicForestScheduling == 0) {
+        forest_info->timings = mymalloc(nforests_alloc * sizeof(forest_info->timings[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(forest_info->timings,
+                                         "Failed to allocate %"PRId64" elements of size %zu for forest_info->timings", nforests_alloc,
+                                         sizeof(forest_info->timings[0]));
+        for(int64_t i=0;i<Nforests;i++) {
+            forest_info->timings[i].nhalos = -1;
+            forest_info->timings[i].seconds = 0.0;
+        }
+    }
+
     /* open all the output files corresponding to this tree file (specified by rank) */
-    status = initialize_galaxy_files(ThisTask, &forest_info, &save_info, run_params);
+    status = initialize_galaxy_files(ThisTask, forest_info, &save_info, run_params);
     if(status != EXIT_SUCCESS) {
         return status;
     }
 
     run_params->interrupted = 0;
 #ifdef VERBOSE
-    if(ThisTask == 0) {
+    if(ThisTask == 0 && run_params->DynamicForestScheduling == 0) {
         init_my_progressbar(stdout, Nforests, &(run_params->interrupted));
     }
 #endif
@@ -157,34 +463,92 @@ int run_sage(const int ThisTask, const int NTasks, const char *param_file, void
 #endif
 
 
-    for(int64_t forestnr = 0; forestnr < Nforests; forestnr++) {
+    /* The scheduler is only released once the output files have been finalized. Releasing it requires all the tasks,
+       but with HDF5SingleFile the tasks that have run out of chunks keep on writing into the single file with the others */
+    struct forest_scheduler scheduler;
+    if(run_params->DynamicForestScheduling) {
+        status = setup_forest_scheduler(&scheduler, forest_info->totnforests, run_params->NTasks, ThisTask);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+        status = sage_all_forests_dynamic(&scheduler, &save_info, forest_info, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    } else
+#ifdef OPENMP
+    if(omp_get_max_threads() > 1 && save_info.nforests_saved < Nforests) {
+        /* When restarting from a checkpoint, only the forests after the checkpoint are processed */
+        int64_t *forestnrs = NULL;
+        if(save_info.nforests_saved > 0) {
+            forestnrs = mymalloc((Nforests - save_info.nforests_saved) * sizeof(forestnrs[0]));
+            CHECK_POINTER_AND_RETURN_ON_NULL(forestnrs,
+                                             "Failed to allocate %"PRId64" elements of size %zu for forestnrs", Nforests - save_info.nforests_saved,
+                                             sizeof(forestnrs[0]));
+            for(int64_t i=save_info.nforests_saved;i<Nforests;i++) {
+                forestnrs[i - save_info.nforests_saved] = i;
+            }
+        }
+        status = sage_all_forests_openmp(Nforests - save_info.nforests_saved, forestnrs, &save_info, forest_info, run_params);
+        myfree(forestnrs);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+    } else
+#endif
+    {
+        /* All of the per-forest working memory is allocated from this arena */
+        struct sage_arena arena;
+        init_arena(&arena);
+
+        /* When restarting from a checkpoint, the forests before the checkpoint have already been saved */
+        for(int64_t forestnr = save_info.nforests_saved; forestnr < Nforests; forestnr++) {
 #ifdef VERBOSE
-        if(ThisTask == 0) {
-            my_progressbar(stdout, forestnr, &(run_params->interrupted));
-            fflush(stdout);
+            if(ThisTask == 0) {
+                my_progressbar(stdout, forestnr, &(run_params->interrupted));
+                fflush(stdout);
+            }
+#endif
+
+            /* the millennium tree is really a collection of trees, viz., a forest */
+            status = sage_per_forest(forestnr, &save_info, forest_info, &arena, run_params);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
         }
+
+#ifdef VERBOSE
+        print_arena_usage(&arena, "forests");
 #endif
+        free_arena(&arena);
+    }
 
-        /* the millennium tree is really a collection of trees, viz., a forest */
-        status = sage_per_forest(forestnr, &save_info, &forest_info, run_params);
+    if(forest_info->timings != NULL) {
+        status = write_forest_timings(Nforests, forest_info, 0, run_params);
         if(status != EXIT_SUCCESS) {
             return status;
         }
+        myfree(forest_info->timings);
+        forest_info->timings = NULL;
     }
 
-    status = finalize_galaxy_files(&forest_info, &save_info, run_params);
+    status = finalize_galaxy_files(forest_info, &save_info, run_params);
     if(status != EXIT_SUCCESS) {
         return status;
     }
+    if(run_params->DynamicForestScheduling) {
+        cleanup_forest_scheduler(&scheduler);
+    }
 
     for(int snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
         myfree(save_info.forest_ngals[snap_idx]);
     }
     myfree(save_info.forest_ngals);
+    myfree(save_info.forestnr_per_tree);
     myfree(save_info.tot_ngals);
 
 #ifdef VERBOSE
-    if(ThisTask == 0) {
+    if(ThisTask == 0 && run_params->DynamicForestScheduling == 0) {
         finish_myprogressbar(stdout, &(run_params->interrupted));
     }
 
@@ -197,23 +561,39 @@ int run_sage(const int ThisTask, const int NTasks, const char *param_file, void
     fflush(stdout);
 #endif
 
-cleanup:
-    /* sage is done running -> do the cleanup */
-    cleanup_forests_io(run_params->TreeType, &forest_info);
-    if(status == EXIT_SUCCESS) {
-        //free Ages. But first
-        //reset Age to the actual allocated address
-        run_params->Age--;
-        myfree(run_params->Age);
+    return EXIT_SUCCESS;
+}
+
+
+static void cleanup_sage(struct forest_info *forest_info, struct params *run_params)
+{
+    /* with dynamic scheduling, every chunk of forests is cleaned up once it has been processed */
+    if(run_params->DynamicForestScheduling == 0) {
+        cleanup_forests_io(run_params->TreeType, forest_info);
     }
 
-    return status;
+    //free Ages. But first
+    //reset Age to the actual allocated address
+    run_params->Age--;
+    myfree(run_params->Age);
 }
 
 
 int32_t finalize_sage(void *params)
 {
+    const int32_t status = sage_finalize_run(params);
+
+    free_galaxy_catalogue(((struct params *) params)->catalogue);
+    free(params);
+
+    return status;
+}
+
 
+/* Final (single-task) steps for the output of a run, e.g., creating the hdf5 master file. Must
+   be called after all tasks have finished the run */
+int32_t sage_finalize_run(void *params)
+{
     int32_t status;
 
     struct params *run_params = (struct params *) params;
@@ -229,7 +609,12 @@ int32_t finalize_sage(void *params)
 #ifdef HDF5
         case(sage_hdf5):
             {
-                status = create_hdf5_master_file(run_params);
+                /* the single file has already been written by all tasks (when finalizing the galaxy files) */
+                if(run_params->HDF5SingleFile) {
+                    status = EXIT_SUCCESS;
+                } else {
+                    status = create_hdf5_master_file(run_params);
+                }
 #ifdef VERBOSE
                 /* Check if anything was not cleaned up */
                 ssize_t nleaks = H5Fget_obj_count(H5F_OBJ_ALL, H5F_OBJ_ALL);
@@ -267,34 +652,50 @@ int32_t finalize_sage(void *params)
             }
         }
 
-    free(run_params);
-
     return status;
 }
 
 // Local Functions //
 
 int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
-                        struct forest_info *forest_info, struct params *run_params)
+                        struct forest_info *forest_info, struct sage_arena *arena, struct params *run_params)
+{
+    struct forest_galaxies fg;
+    fg.arena = arena;
+
+    struct timeval tstart;
+    gettimeofday(&tstart, NULL);
+
+    /* nhalos is meaning-less for consistent-trees until *AFTER* the forest has been loaded */
+    const int64_t nhalos = load_forest(run_params, forestnr, &(fg.Halo), forest_info);
+    if(nhalos < 0) {
+        fprintf(stderr,"Error during loading forestnum =  %"PRId64"...exiting\n", forestnr);
+        return nhalos;
+    }
+
+    int32_t status = evolve_forest(forestnr, nhalos, &fg, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+    record_forest_timing(forestnr, nhalos, tstart, forest_info);
+
+    return save_forest(forestnr, &fg, save_info, forest_info, run_params);
+}
+
+
+static int32_t evolve_forest(const int64_t forestnr, const int64_t nhalos, struct forest_galaxies *fg, struct params *run_params)
 {
     int32_t status = EXIT_FAILURE;
 
     /*  galaxy data  */
     struct GALAXY  *Gal = NULL, *HaloGal = NULL;
 
-    /* simulation merger-tree data */
-    struct halo_data *Halo = NULL;
+    /* simulation merger-tree data (already loaded) */
+    struct halo_data *Halo = fg->Halo;
 
     /*  auxiliary halo data  */
     struct halo_aux_data  *HaloAux = NULL;
 
-    /* nhalos is meaning-less for consistent-trees until *AFTER* the forest has been loaded */
-    const int64_t nhalos = load_forest(run_params, forestnr, &Halo, forest_info);
-    if(nhalos < 0) {
-        fprintf(stderr,"Error during loading forestnum =  %"PRId64"...exiting\n", forestnr);
-        return nhalos;
-    }
-
 #ifdef PROCESS_LHVT_STYLE
 #error Processing in Locally-horizontal vertical tree (LHVT) style not implemented yet
 
@@ -307,11 +708,13 @@ int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
 #endif
 
     int maxgals = (int)(MAXGALFAC * nhalos);
-    if(maxgals < 10000) maxgals = 10000;
+    if(maxgals < MINGALS) maxgals = MINGALS;
 
-    HaloAux = mymalloc(nhalos * sizeof(HaloAux[0]));
-    HaloGal = mymalloc(maxgals * sizeof(HaloGal[0]));
-    Gal = mymalloc(maxgals * sizeof(Gal[0]));/* used to be fof_maxgals instead of maxgals*/
+    /* allocated before the galaxies so that the galaxy arrays can still grow in place within the arena */
+    struct construct_frame *construct_stack = arena_malloc(fg->arena, nhalos * sizeof(construct_stack[0]));
+    HaloAux = arena_malloc(fg->arena, nhalos * sizeof(HaloAux[0]));
+    HaloGal = arena_malloc(fg->arena, maxgals * sizeof(HaloGal[0]));
+    Gal = arena_malloc(fg->arena, maxgals * sizeof(Gal[0]));/* used to be fof_maxgals instead of maxgals*/
 
     for(int i = 0; i < nhalos; i++) {
         HaloAux[i].HaloFlag = 0;
@@ -353,6 +756,7 @@ int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
     }
 
 #else /* PROCESS_LHVT_STYLE */
+    (void) forestnr;
 
     /*MS: This is the normal SAGE processing on a tree-by-tree (vertical) basis */
 
@@ -360,7 +764,8 @@ int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
     int32_t galaxycounter = 0;
 
     /* First run construct_galaxies outside for loop -> takes care of the main tree */
-    status = construct_galaxies(0, &numgals, &galaxycounter, &maxgals, Halo, HaloAux, &Gal, &HaloGal, run_params);
+    status = construct_galaxies(0, &numgals, &galaxycounter, &maxgals, Halo, HaloAux, &Gal, &HaloGal,
+                                construct_stack, nhalos, fg->arena, run_params);
     if(status != EXIT_SUCCESS) {
         return status;
     }
@@ -368,7 +773,8 @@ int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
     /* But there are sub-trees within one forest file that are not reachable via the recursive routine -> do those as well */
     for(int halonr = 0; halonr < nhalos; halonr++) {
         if(HaloAux[halonr].DoneFlag == 0) {
-            status = construct_galaxies(halonr, &numgals, &galaxycounter, &maxgals, Halo, HaloAux, &Gal, &HaloGal, run_params);
+            status = construct_galaxies(halonr, &numgals, &galaxycounter, &maxgals, Halo, HaloAux, &Gal, &HaloGal,
+                                        construct_stack, nhalos, fg->arena, run_params);
             if(status != EXIT_SUCCESS) {
                 return status;
             }
@@ -377,20 +783,469 @@ int32_t sage_per_forest(const int64_t forestnr, struct save_info *save_info,
 
 #endif /* PROCESS_LHVT_STYLE */
 
-    status = save_galaxies(forestnr, numgals, Halo, forest_info, HaloAux, HaloGal, save_info, run_params);
+    /* The scratch galaxies (Gal) are not required any more; everything that is needed
+       for the output lives in HaloGal and HaloAux. Gal is released when the arena is reset */
+    fg->HaloAux = HaloAux;
+    fg->HaloGal = HaloGal;
+    fg->numgals = numgals;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Stores the time taken to load and evolve a forest (saving is not included) */
+static void record_forest_timing(const int64_t forestnr, const int64_t nhalos, const struct timeval tstart,
+                                 struct forest_info *forest_info)
+{
+    if(forest_info->timings == NULL) return;
+
+    struct timeval tend;
+    gettimeofday(&tend, NULL);
+    forest_info->timings[forestnr].nhalos = nhalos;
+    forest_info->timings[forestnr].seconds = get_elapsed_seconds(tstart, tend);
+}
+
+/* Writes the timings of the forests processed on this task to '<OutputDir>/<FileNameGalaxies>_forest_timings_<ThisTask>.txt'.
+   The forests are identified by the (original) file and tree number. With 'append' set, the timings are added to the
+   file written by the previous call (e.g., for the previous chunk of forests) */
+static int32_t write_forest_timings(const int64_t Nforests, const struct forest_info *forest_info, const int append,
+                                    const struct params *run_params)
+{
+    char fname[3*MAX_STRING_LEN];
+    snprintf(fname, sizeof(fname), "%s/%s_forest_timings_%d.txt", run_params->OutputDir, run_params->FileNameGalaxies, run_params->ThisTask);
+    FILE *fp = fopen(fname, append ? "a":"w");
+    XRETURN(fp != NULL, FILE_NOT_FOUND, "Error: Could not open the file '%s' to write the forest timings\n", fname);
+
+    if(append == 0) {
+        fprintf(fp, "# Time taken to load and evolve each forest on ThisTask = %d (out of NTasks = %d)\n", run_params->ThisTask, run_params->NTasks);
+        fprintf(fp, "# FileNr TreeNr NHalos Seconds\n");
+    }
+    for(int64_t i=0;i<Nforests;i++) {
+        if(forest_info->timings[i].nhalos < 0) continue;
+        fprintf(fp, "%d %"PRId64" %"PRId64" %.6e\n", forest_info->FileNr[i], forest_info->original_treenr[i],
+                forest_info->timings[i].nhalos, forest_info->timings[i].seconds);
+    }
+
+    XRETURN(fclose(fp) == 0, FILE_WRITE_ERROR, "Error: Could not write the forest timings to the file '%s'\n", fname);
+    return EXIT_SUCCESS;
+}
+
+
+static int32_t save_forest(const int64_t forestnr, struct forest_galaxies *fg, struct save_info *save_info,
+                           struct forest_info *forest_info, struct params *run_params)
+{
+    int32_t status = save_galaxies(forestnr, fg->numgals, fg->Halo, forest_info, fg->HaloAux, fg->HaloGal, save_info, run_params);
+    if(status != EXIT_SUCCESS) {
+        return status;
+    }
+
+    /* every 'CheckpointInterval' seconds, make sure that everything saved so far is on disk (with the single hdf5
+       file, this is also where the task takes part in the rounds that write the buffered galaxies) */
+    status = checkpoint_galaxy_files(forest_info, save_info, run_params);
     if(status != EXIT_SUCCESS) {
         return status;
     }
 
-    /* free galaxies and the forest */
-    myfree(Gal);
-    myfree(HaloGal);
-    myfree(HaloAux);
-    myfree(Halo);
+    /* free the forest and then release all the galaxies in one go */
+    unload_forest(run_params, forestnr, &(fg->Halo), forest_info);
+    reset_arena(fg->arena);
+
+    fg->HaloGal = NULL;
+    fg->HaloAux = NULL;
+    fg->Halo = NULL;
 
     return EXIT_SUCCESS;
 }
 
+#ifdef OPENMP
+/* Returns the number of halos in a forest, when that is known before
+   the forest is loaded. Returns -1 if the number of halos is unknown */
+static int64_t get_nhalos_before_loading_forest(const int64_t forestnr, struct forest_info *forest_info,
+                                                const struct params *run_params)
+{
+    switch(run_params->TreeType) {
+    case lhalo_binary:
+#ifdef HDF5
+    case lhalo_hdf5:
+#endif
+        return forest_info->lht.nhalos_per_forest != NULL ? forest_info->lht.nhalos_per_forest[forestnr]:-1;
+
+#ifdef HDF5
+    case gadget4_hdf5:
+        return forest_info->gadget4.nhalos_per_forest != NULL ? forest_info->gadget4.nhalos_per_forest[forestnr]:-1;
+#endif
+
+    default:
+        return -1;
+    }
+}
+#endif
+
+/* Makes room for 'nforests' forests in the per-forest arrays of the output (the forests
+   that have not been saved yet start with no galaxies) */
+static int32_t grow_forest_arrays_in_output(const int64_t nforests, struct save_info *save_info, const struct params *run_params)
+{
+    const int64_t nsaved = save_info->nforests_saved;
+    for(int32_t snap_idx = 0; snap_idx < run_params->NumSnapOutputs; snap_idx++) {
+        int32_t *forest_ngals = myrealloc(save_info->forest_ngals[snap_idx], nforests * sizeof(forest_ngals[0]));
+        CHECK_POINTER_AND_RETURN_ON_NULL(forest_ngals, "Failed to re-allocate %"PRId64" elements of size %zu for save_info->forest_ngals[%d]",
+                                         nforests, sizeof(forest_ngals[0]), snap_idx);
+        memset(forest_ngals + nsaved, 0, (nforests - nsaved) * sizeof(forest_ngals[0]));
+        save_info->forest_ngals[snap_idx] = forest_ngals;
+    }
+
+    int64_t *forestnr_per_tree = myrealloc(save_info->forestnr_per_tree, nforests * sizeof(forestnr_per_tree[0]));
+    CHECK_POINTER_AND_RETURN_ON_NULL(forestnr_per_tree, "Failed to re-allocate %"PRId64" elements of size %zu for save_info->forestnr_per_tree",
+                                     nforests, sizeof(forestnr_per_tree[0]));
+    save_info->forestnr_per_tree = forestnr_per_tree;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+  Processes the forests in chunks that are requested from the (shared) forest scheduler (set up by
+  the caller), until all the chunks have been handed out to the tasks. Every chunk is a contiguous range of forests
+  and only the task that processes a chunk sets up (i.e., opens the tree files for) the forests
+  in that chunk. The forests are saved in the order they were processed on this task and the
+  forest number of each tree is stored in the output. Updates the number of forests and the
+  volume processed on this task.
+*/
+static int32_t sage_all_forests_dynamic(struct forest_scheduler *scheduler, struct save_info *save_info, struct forest_info *forest_info,
+                                        struct params *run_params)
+{
+    int32_t status;
+    struct sage_arena arena;
+    init_arena(&arena);
+
+    double frac_volume_processed = 0.0;
+    int64_t chunk, nchunks = 0;
+    while((chunk = get_next_forest_chunk(scheduler)) >= 0) {
+        struct forest_info chunk_info;
+        memset(&chunk_info, 0, sizeof(chunk_info));
+        status = setup_forests_io(run_params, &chunk_info, chunk, scheduler->nchunks);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+        const int64_t nforests_in_chunk = chunk_info.nforests_this_task;
+
+        status = grow_forest_arrays_in_output(save_info->nforests_saved + nforests_in_chunk, save_info, run_params);
+        if(status != EXIT_SUCCESS) {
+            return status;
+        }
+
+        if(run_params->WriteForestTimings) {
+            chunk_info.timings = mymalloc(nforests_in_chunk * sizeof(chunk_info.timings[0]));
+            CHECK_POINTER_AND_RETURN_ON_NULL(chunk_info.timings,
+                                             "Failed to allocate %"PRId64" elements of size %zu for chunk_info.timings", nforests_in_chunk,
+                                             sizeof(chunk_info.timings[0]));
+            for(int64_t i=0;i<nforests_in_chunk;i++) {
+                chunk_info.timings[i].nhalos = -1;
+                chunk_info.timings[i].seconds = 0.0;
+            }
+        }
+
+#ifdef OPENMP
+        /* MPI is not called from within the threads -> task 0 only serves the requests for chunks in
+           between its own chunks (unless the MPI library progresses the requests asynchronously) */
+        if(omp_get_max_threads() > 1) {
+            status = sage_all_forests_openmp(nforests_in_chunk, NULL, save_info, &chunk_info, run_params);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+        } else
+#endif
+        {
+            for(int64_t forestnr = 0; forestnr < nforests_in_chunk; forestnr++) {
+                status = sage_per_forest(forestnr, save_info, &chunk_info, &arena, run_params);
+                if(status != EXIT_SUCCESS) {
+                    return status;
+                }
+                poll_forest_scheduler(scheduler);
+            }
+        }
+
+        if(chunk_info.timings != NULL) {
+            status = write_forest_timings(nforests_in_chunk, &chunk_info, nchunks > 0, run_params);
+            if(status != EXIT_SUCCESS) {
+                return status;
+            }
+            myfree(chunk_info.timings);
+            chunk_info.timings = NULL;
+        }
+
+        frac_volume_processed += chunk_info.frac_volume_processed;
+        cleanup_forests_io(run_params->TreeType, &chunk_info);
+        nchunks++;
+    }
+
+#ifdef VERBOSE
+    print_arena_usage(&arena, "forests");
+    fprintf(stderr,"ThisTask = %d processed %"PRId64" forests in %"PRId64" chunks\n",
+            run_params->ThisTask, save_info->nforests_saved, nchunks);
+#endif
+    free_arena(&arena);
+
+    /* Only the forests processed on this task are in the output */
+    forest_info->nforests_this_task = save_info->nforests_saved;
+    forest_info->frac_volume_processed = frac_volume_processed;
+
+    return EXIT_SUCCESS;
+}
+
+#ifdef OPENMP
+struct forest_queue_item
+{
+    int64_t nhalos;
+    int64_t forestnr;
+    int64_t save_idx;/* position of the forest in the list of forests to process, i.e., the order in which forests are saved */
+};
+
+static int compare_forest_queue_items(const void *p1, const void *p2)
+{
+    const struct forest_queue_item *f1 = (const struct forest_queue_item *) p1;
+    const struct forest_queue_item *f2 = (const struct forest_queue_item *) p2;
+
+    /* largest forests first, ties are broken by the forest number */
+    if(f1->nhalos != f2->nhalos) {
+        return (f1->nhalos > f2->nhalos) ? -1:1;
+    }
+    return (f1->forestnr < f2->forestnr) ? -1:((f1->forestnr > f2->forestnr) ? 1:0);
+}
+
+/* Number of forests (in addition to the ones being evolved by the threads) that can be waiting
+   to be saved, and the maximum number of forests in-flight (i.e., loaded but not yet saved) overall.
+   Every in-flight forest holds an arena and its halos (i.e., at least one entry in the mymalloc table) */
+#define MAX_STAGED_FORESTS          (16)
+#define MAX_FORESTS_IN_FLIGHT       (512)
+
+/*
+  Processes the forests on this task with OpenMP threads. Each thread repeatedly takes the
+  next forest off a shared queue, loads the forest and evolves the galaxies. The galaxies
+  are then staged until all the preceding forests have been saved, i.e., the galaxies are
+  always written out in forest order and the output is identical to the serial run.
+
+  At most 'max_inflight' forests (the number of threads plus MAX_STAGED_FORESTS, but never more
+  than MAX_FORESTS_IN_FLIGHT) are loaded but not yet saved at any time. A thread that would exceed
+  that limit waits (on a condition variable) until the oldest forest has been saved. When the
+  forest sizes are known ahead of time and the forests can be loaded in parallel, the forests
+  within each group of 'max_inflight' consecutive forests are processed largest-first. The
+  hdf5 input formats are loaded one at a time, in forest order (the hdf5 library is not thread-safe
+  and the readers cache batches of consecutive forests).
+
+  The forests processed are 'forestnrs[0]' to 'forestnrs[Nforests-1]' (and saved in that order),
+  or all forests from 0 to Nforests-1 if 'forestnrs' is NULL.
+*/
+static int32_t sage_all_forests_openmp(const int64_t Nforests, const int64_t *forestnrs, struct save_info *save_info,
+                                       struct forest_info *forest_info, struct params *run_params)
+{
+    const int nthreads = omp_get_max_threads();
+    int64_t max_inflight = (int64_t) nthreads + MAX_STAGED_FORESTS;
+    if(max_inflight > MAX_FORESTS_IN_FLIGHT) max_inflight = MAX_FORESTS_IN_FLIGHT;
+    if(max_inflight > Nforests) max_inflight = Nforests;
+
+    const int serial_load = run_params->TreeType != lhalo_binary && run_params->TreeType != consistent_trees_ascii;
+    const int lock_on_save = serial_load && run_params->OutputFormat != sage_binary;
+
+    struct forest_queue_item *queue = mymalloc(Nforests * sizeof(queue[0]));
+    struct forest_galaxies *staged = mycalloc(Nforests, sizeof(staged[0]));
+    int8_t *ready_to_save = mycalloc(Nforests, sizeof(ready_to_save[0]));
+
+    /* Each in-flight forest needs its own arena. The chunks are only allocated once an arena is used */
+    struct sage_arena *arenas = mymalloc(max_inflight * sizeof(arenas[0]));
+    struct sage_arena **free_arenas = mymalloc(max_inflight * sizeof(free_arenas[0]));
+    for(int64_t i=0;i<max_inflight;i++) {
+        init_arena(&arenas[i]);
+        free_arenas[i] = &arenas[i];
+    }
+    int64_t nfree_arenas = max_inflight;
+
+    int sizes_known = 1;
+    for(int64_t i=0;i<Nforests;i++) {
+        queue[i].forestnr = forestnrs != NULL ? forestnrs[i]:i;
+        queue[i].save_idx = i;
+        queue[i].nhalos = get_nhalos_before_loading_forest(queue[i].forestnr, forest_info, run_params);
+        if(queue[i].nhalos < 0) sizes_known = 0;
+    }
+
+    /* A forest can only be started once all the forests more than 'max_inflight' positions before it
+       have been saved -> sorting within groups of 'max_inflight' forests can never deadlock */
+    if(sizes_known && ! serial_load) {
+        for(int64_t start=0;start<Nforests;start+=max_inflight) {
+            const int64_t nitems = (start + max_inflight) > Nforests ? Nforests - start:max_inflight;
+            qsort(&queue[start], nitems, sizeof(queue[0]), compare_forest_queue_items);
+        }
+    }
+
+    /* 'sched_lock' protects next_item, next_to_load, next_to_save, the free arenas and status. Any change
+       to these is broadcast on 'sched_cond'. The (omp) 'io_lock' serialises the hdf5 library calls */
+    pthread_mutex_t sched_lock;
+    pthread_cond_t sched_cond;
+    pthread_mutex_init(&sched_lock, NULL);
+    pthread_cond_init(&sched_cond, NULL);
+    omp_lock_t io_lock;
+    omp_init_lock(&io_lock);
+
+    int64_t next_item = 0, next_to_load = 0, next_to_save = 0;
+    int32_t status = EXIT_SUCCESS;
+
+#ifdef VERBOSE
+    fprintf(stderr,"ThisTask = %d processing %"PRId64" forests with %d OpenMP threads (at most %"PRId64" forests in-flight)\n",
+            run_params->ThisTask, Nforests, nthreads, max_inflight);
+#endif
+
+#pragma omp parallel shared(queue, staged, ready_to_save, free_arenas, nfree_arenas, sched_lock, sched_cond, io_lock, \
+                            next_item, next_to_load, next_to_save, status)
+    {
+        while(1) {
+            /* Take the next forest (and an arena for it) once the forest is within 'max_inflight' of the oldest unsaved forest */
+            int64_t item = -1;
+            struct forest_galaxies fg;
+            fg.Halo = NULL;
+            fg.arena = NULL;
+            pthread_mutex_lock(&sched_lock);
+            while(status == EXIT_SUCCESS && next_item < Nforests && queue[next_item].save_idx >= next_to_save + max_inflight) {
+                pthread_cond_wait(&sched_cond, &sched_lock);
+            }
+            if(status == EXIT_SUCCESS && next_item < Nforests) {
+                item = next_item++;
+                nfree_arenas--;
+                fg.arena = free_arenas[nfree_arenas];
+            }
+            pthread_mutex_unlock(&sched_lock);
+            if(item < 0) break;
+
+            const int64_t forestnr = queue[item].forestnr;
+            const int64_t save_idx = queue[item].save_idx;
+            int32_t this_status = EXIT_SUCCESS;
+
+            /* The hdf5 inputs are loaded one at a time and in queue order */
+            if(serial_load) {
+                pthread_mutex_lock(&sched_lock);
+                while(status == EXIT_SUCCESS && next_to_load != item) {
+                    pthread_cond_wait(&sched_cond, &sched_lock);
+                }
+                if(status != EXIT_SUCCESS) this_status = status;
+                pthread_mutex_unlock(&sched_lock);
+            }
+
+            int64_t nhalos = 0;
+            struct timeval tstart;
+            if(this_status == EXIT_SUCCESS) {
+                gettimeofday(&tstart, NULL);
+                if(serial_load) omp_set_lock(&io_lock);
+                nhalos = load_forest(run_params, forestnr, &(fg.Halo), forest_info);
+                if(serial_load) omp_unset_lock(&io_lock);
+                if(nhalos < 0) {
+                    fprintf(stderr,"Error during loading forestnum =  %"PRId64"...exiting\n", forestnr);
+                    this_status = (int32_t) nhalos;
+                    fg.Halo = NULL;
+                }
+            }
+            if(serial_load && this_status == EXIT_SUCCESS) {
+                pthread_mutex_lock(&sched_lock);
+                next_to_load++;
+                pthread_cond_broadcast(&sched_cond);
+                pthread_mutex_unlock(&sched_lock);
+            }
+
+            if(this_status == EXIT_SUCCESS) {
+                this_status = evolve_forest(forestnr, nhalos, &fg, run_params);
+            }
+            if(this_status != EXIT_SUCCESS) {
+                /* release this forest and stop all the threads */
+                if(fg.Halo != NULL) {
+                    unload_forest(run_params, forestnr, &(fg.Halo), forest_info);
+                }
+                pthread_mutex_lock(&sched_lock);
+                if(status == EXIT_SUCCESS) status = this_status;
+                free_arenas[nfree_arenas] = fg.arena;
+                nfree_arenas++;
+                pthread_cond_broadcast(&sched_cond);
+                pthread_mutex_unlock(&sched_lock);
+                break;
+            }
+            record_forest_timing(forestnr, nhalos, tstart, forest_info);
+            staged[save_idx] = fg;
+
+            /* Save all the forests that are now ready, in forest order */
+#pragma omp critical (sage_save_forests)
+            {
+                ready_to_save[save_idx] = 1;
+                int64_t isave = next_to_save;
+                while(isave < Nforests && ready_to_save[isave]) {
+                    pthread_mutex_lock(&sched_lock);
+                    const int32_t curr_status = status;
+                    pthread_mutex_unlock(&sched_lock);
+                    if(curr_status != EXIT_SUCCESS) break;
+#ifdef VERBOSE
+                    if(run_params->ThisTask == 0) {
+                        my_progressbar(stdout, isave, &(run_params->interrupted));
+                        fflush(stdout);
+                    }
+#endif
+                    struct sage_arena *arena = staged[isave].arena;
+                    if(lock_on_save) omp_set_lock(&io_lock);
+                    this_status = save_forest(forestnrs != NULL ? forestnrs[isave]:isave, &staged[isave], save_info, forest_info, run_params);
+                    if(lock_on_save) omp_unset_lock(&io_lock);
+
+                    pthread_mutex_lock(&sched_lock);
+                    if(this_status == EXIT_SUCCESS) {
+                        ready_to_save[isave] = 0;
+                        free_arenas[nfree_arenas] = arena;
+                        nfree_arenas++;
+                        isave++;
+                        next_to_save = isave;
+                    } else if(status == EXIT_SUCCESS) {
+                        status = this_status;
+                    }
+                    pthread_cond_broadcast(&sched_cond);
+                    pthread_mutex_unlock(&sched_lock);
+                    if(this_status != EXIT_SUCCESS) break;
+                }
+            }
+        }
+    }
+
+    /* Single cleanup path -> on error, the forests that were staged but not saved still hold their halos */
+    for(int64_t i=next_to_save;i<Nforests;i++) {
+        if(ready_to_save[i] && staged[i].Halo != NULL) {
+            unload_forest(run_params, forestnrs != NULL ? forestnrs[i]:i, &(staged[i].Halo), forest_info);
+        }
+    }
+    if(status == EXIT_SUCCESS && next_to_save != Nforests) {
+        fprintf(stderr,"Error: Bug in code. Expected all %"PRId64" forests to be saved but only %"PRId64" were saved\n",
+                Nforests, next_to_save);
+        status = EXIT_FAILURE;
+    }
+
+#ifdef VERBOSE
+    /* Report the combined usage across all the arenas */
+    struct sage_arena all_arenas;
+    init_arena(&all_arenas);
+    for(int64_t i=0;i<max_inflight;i++) {
+        if(arenas[i].peak_bytes > all_arenas.peak_bytes) all_arenas.peak_bytes = arenas[i].peak_bytes;
+        all_arenas.capacity += arenas[i].capacity;
+        all_arenas.nresets += arenas[i].nresets;
+    }
+    print_arena_usage(&all_arenas, "forests (largest peak, total capacity across all threads)");
+#endif
+    for(int64_t i=0;i<max_inflight;i++) {
+        free_arena(&arenas[i]);
+    }
+
+    omp_destroy_lock(&io_lock);
+    pthread_cond_destroy(&sched_cond);
+    pthread_mutex_destroy(&sched_lock);
+    myfree(free_arenas);
+    myfree(arenas);
+    myfree(ready_to_save);
+    myfree(staged);
+    myfree(queue);
+
+    return status;
+}
+#endif /* OPENMP */
+
 /*
 For creating the lhalo tree binary output i.e., converting from the input
 mergertree format into the lhalotree binary format.
@@ -522,7 +1377,7 @@ int convert_trees_to_lhalo(const int ThisTask, const int NTasks, struct params *
         const off_t nh_per_tree_offset = sizeof(int32_t) + sizeof(int32_t) + forestnr * sizeof(int32_t);
         PWRITE_64BIT_TO_32BIT(fd, nhalos, nh_per_tree_offset, "nhalos per tree");//pwrite does not update file offset
 
-        myfree(Halo);
+        unload_forest(run_params, forestnr, &Halo, forest_info);
         totnhalos += nhalos;
     }
 #ifdef USE_BUFFERED_WRITE
@@ -16,6 +16,26 @@ extern "C" {
     extern int run_sage(const int ThisTask, const int NTasks, const char *param_file, void **params);
     extern int finalize_sage(void *params);
 
+    /* API for running sage repeatedly on the same forests (e.g., while calibrating the recipe parameters). The
+       forests, snapshot list and cooling tables are only setup once in sage_init_context. Typical usage is
+       sage_params_from_file (or sage_params_from_keyvalues) -> sage_init_context -> [sage_set_param ->
+       sage_run -> (MPI_Barrier) -> sage_finalize_run] repeated as often as required -> sage_free_context */
+    extern int sage_params_from_file(const int ThisTask, const int NTasks, const char *param_file, void **params);
+    extern int sage_params_from_keyvalues(const int ThisTask, const int NTasks, const int nparams,
+                                          const char * const *keys, const char * const *values, void **params);
+    extern int sage_set_param(void *params, const char *key, const char *value);
+    extern int sage_init_context(void *params);
+    extern int sage_run(void *params);
+    extern int sage_finalize_run(void *params);
+    extern int sage_free_context(void *params);
+
+    /* With OutputFormat = 'sage_memory', the galaxies of the most recent run are returned as one (numpy-compatible)
+       array per output field and output snapshot. The dtype is one of "i4", "i8" or "f4" */
+    extern int sage_get_num_output_fields(void);
+    extern int sage_get_output_field_info(const int field_idx, const char **name, const char **dtype);
+    extern int sage_get_output_snapshots(void *params, int *num_snaps, const int32_t **snapnums);
+    extern int sage_get_output_field(void *params, const int snap_idx, const char *field_name, void **data, int64_t *ngals);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+"""
+Converts LHaloTree binary files into a (minimal) Consistent-Trees ASCII catalogue, i.e., the
+files 'tree_0_0_0.dat', 'locations.dat' and 'forests.list' in the output directory. Every
+LHaloTree tree becomes one forest (with one tree). Only used to test the Consistent-Trees
+reader (and its forest cache) on the Mini-Millennium trees.
+
+usage: lhalo_to_ctrees.py <snapshot list (scale factors)> <output directory> <LHaloTree file> [<LHaloTree file> ...]
+"""
+from __future__ import print_function
+
+import os
+import struct
+import sys
+
+# Descendant, FirstProgenitor, NextProgenitor, FirstHaloInFOFgroup, NextHaloInFOFgroup, Len, M_Mean200, Mvir,
+# M_TopHat, Pos[3], Vel[3], VelDisp, Vmax, Spin[3], MostBoundID, SnapNum, FileNr, SubhaloIndex, SubHalfMass
+LHALO_FMT = "<iiiiiiffffffffffffffqiiif"
+LHALO_SIZE = struct.calcsize(LHALO_FMT)
+
+CTREES_COLUMNS = ["scale", "id", "desc_scale", "desc_id", "num_prog", "pid", "upid", "desc_pid", "phantom",
+                  "sam_mvir", "mvir", "rvir", "rs", "vrms", "mmp?", "scale_of_last_MM", "vmax", "x", "y", "z",
+                  "vx", "vy", "vz", "Jx", "Jy", "Jz", "Spin", "Breadth_first_ID", "Depth_first_ID",
+                  "Tree_root_ID", "Orig_halo_ID", "Snap_idx", "M200b", "M200c"]
+
+
+def read_lhalo_trees(fnames):
+    for fname in fnames:
+        with open(fname, "rb") as fp:
+            ntrees, _ = struct.unpack("<ii", fp.read(8))
+            nhalos_per_tree = struct.unpack("<{0}i".format(ntrees), fp.read(4*ntrees))
+            for nhalos in nhalos_per_tree:
+                yield [struct.unpack(LHALO_FMT, fp.read(LHALO_SIZE)) for _ in range(nhalos)]
+
+
+def convert(alist_fname, outdir, lhalo_fnames):
+
+    with open(alist_fname, "r") as fp:
+        scale_factors = [float(a) for a in fp.read().split()]
+
+    trees = list(read_lhalo_trees(lhalo_fnames))
+    header = "#" + " ".join("{0}({1})".format(name, i) for i, name in enumerate(CTREES_COLUMNS))
+
+    with open(os.path.join(outdir, "tree_0_0_0.dat"), "wb") as out, \
+         open(os.path.join(outdir, "locations.dat"), "w") as locations, \
+         open(os.path.join(outdir, "forests.list"), "w") as forests:
+
+        out.write("{0}\n#Consistent Trees (converted from LHaloTree)\n{1}\n".format(header, len(trees)).encode())
+        locations.write("#TreeRootID FileID Offset Filename\n")
+        forests.write("#TreeRootID ForestID\n")
+
+        next_id = 1
+        for halos in trees:
+            ids = list(range(next_id, next_id + len(halos)))
+            next_id += len(halos)
+            root_id = ids[0]
+
+            out.write("#tree {0}\n".format(root_id).encode())
+            locations.write("{0} 0 {1} tree_0_0_0.dat\n".format(root_id, out.tell()))
+            forests.write("{0} {0}\n".format(root_id))
+
+            # Consistent-Trees lists the halos from the last snapshot backwards
+            lines = []
+            for i in sorted(range(len(halos)), key=lambda i: -halos[i][21]):
+                (desc, _, _, fof, _, _, m_mean200, mvir, m_tophat) = halos[i][0:9]
+                pos, vel = halos[i][9:12], halos[i][12:15]
+                veldisp, vmax, spin = halos[i][15], halos[i][16], halos[i][17:20]
+                mostboundid, snap = halos[i][20], halos[i][21]
+
+                pid = -1 if fof == i else ids[fof]
+                mass = mvir * 1e10
+                values = ["{0:.5f}".format(scale_factors[snap]), ids[i],
+                          "{0:.5f}".format(scale_factors[halos[desc][21]]) if desc >= 0 else "0.00000",
+                          ids[desc] if desc >= 0 else -1, 1, pid, pid, -1, 0, repr(mass), repr(mass), 100.0, 10.0,
+                          repr(veldisp), 1, 0.1, repr(vmax)]
+                values += [repr(v) for v in pos] + [repr(v) for v in vel] + [repr(s*mass) for s in spin]
+                values += [0.03, ids[i], ids[i], root_id, mostboundid, snap, repr(m_mean200*1e10), repr(m_tophat*1e10)]
+                lines.append(" ".join(str(v) for v in values))
+            out.write(("\n".join(lines) + "\n").encode())
+
+    return len(trees), next_id - 1
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        print(__doc__)
+        sys.exit(1)
+
+    ntrees, nhalos = convert(sys.argv[1], sys.argv[2], sys.argv[3:])
+    print("Converted {0} trees with {1} halos into Consistent-Trees format in '{2}'".format(ntrees, nhalos, sys.argv[2]))
@@ -10,6 +10,63 @@ try:
 except NameError:
     xrange = range
 
+# With 'OutputFields', sage writes packed records that only contain the selected fields. The records
+# are then described by a header (that follows the number of galaxies per tree) containing the magic
+# 'SAGEFLDS', the number of fields and the record size, followed by the name[32] and dtype[8] of each field.
+PACKED_OUTPUT_MAGIC = 0x53444c4645474153
+PACKED_OUTPUT_HEADER_FMT = "=Qii"
+PACKED_OUTPUT_FIELD_FMT = "=32s8s"
+
+
+def read_packed_fields(fp):
+    """
+    Read the description of the packed records (written with 'OutputFields') at the
+    current position in the file.
+
+    Returns the list of ``(name, dtype)`` for the fields and the number of bytes in the
+    description. If there is no description (i.e., the galaxies are written with all
+    the fields), ``(None, 0)`` is returned and the file position is unchanged.
+    """
+    import struct
+
+    offset = fp.tell()
+    header_size = struct.calcsize(PACKED_OUTPUT_HEADER_FMT)
+    header = fp.read(header_size)
+    if len(header) < header_size or \
+       struct.unpack(PACKED_OUTPUT_HEADER_FMT, header)[0] != PACKED_OUTPUT_MAGIC:
+        fp.seek(offset)
+        return None, 0
+
+    _, num_fields, record_size = struct.unpack(PACKED_OUTPUT_HEADER_FMT, header)
+    field_size = struct.calcsize(PACKED_OUTPUT_FIELD_FMT)
+    fields = []
+    for _ in range(num_fields):
+        name, dtype = struct.unpack(PACKED_OUTPUT_FIELD_FMT, fp.read(field_size))
+        fields.append((name.split(b"\0")[0].decode(), dtype.split(b"\0")[0].decode()))
+
+    itemsize = sum(int(dtype[1:]) for _, dtype in fields)
+    if itemsize != record_size:
+        msg = "The packed records should contain {0} bytes but the fields {1} "\
+            "add up to {2} bytes".format(record_size, fields, itemsize)
+        raise ValueError(msg)
+
+    return fields, header_size + num_fields*field_size
+
+
+def get_binary_field(gals, field):
+    """
+    Return the field from the galaxies. The multi-dimensional fields (e.g., 'Pos') of
+    the galaxy struct are split into components (e.g., 'Posx') in the packed records.
+    """
+    if field in gals.dtype.names:
+        return gals[field]
+
+    if field[:-1] in gals.dtype.names and field[-1] in "xyz":
+        return gals[field[:-1]][:, "xyz".index(field[-1])]
+
+    msg = "Field '{0}' is not in the galaxies (fields = {1})".format(field, gals.dtype.names)
+    raise KeyError(msg)
+
 
 class BinarySage(object):
 
@@ -76,6 +133,7 @@ class BinarySage(object):
         self.filename = filename
         self.num_files = num_files
         self.dtype = _galdesc
+        self.packed = False
         self.totntrees = None
         self.totngals = None
         self.ngal_per_tree = None
@@ -104,6 +162,13 @@ class BinarySage(object):
         # Read the number of gals in each tree
         ngal_per_tree = np.fromfile(fp, dtype=np.int32, count=totntrees)
 
+        # The galaxies might be packed records with only some of the fields
+        fields, packed_header_size = read_packed_fields(fp)
+        if fields is not None:
+            self.dtype = np.dtype({'names':[f[0] for f in fields],
+                                   'formats':[f[1] for f in fields]})
+            self.packed = True
+
         self.totntrees = totntrees
         self.totngals = totngals
         self.ngal_per_tree = ngal_per_tree
@@ -127,7 +192,7 @@ class BinarySage(object):
 
         # Now add the initial offset that we need to get to the
         # 0'th tree -- i.e., the size of the headers
-        header_size  = 4 + 4 + totntrees*4
+        header_size  = 4 + 4 + totntrees*4 + packed_header_size
         bytes_offset_per_tree[:] += header_size
 
         # Now assign to the instance variable
@@ -277,7 +342,7 @@ def compare_binary_hdf5_catalogs(g1, hdf5_file, multidim_fields, rtol=1e-9,
 
     # SAGE could have been run in parallel in which the HDF5 master file will have
     # multiple core datasets.
-    ncores = hdf5_file["Header"]["Misc"].attrs["num_cores"]
+    ncores = determine_num_core_groups(hdf5_file)
 
     # Load all the galaxies from all trees in the binary file.
     binary_gals = g1.read_tree(None)
@@ -293,6 +358,9 @@ def compare_binary_hdf5_catalogs(g1, hdf5_file, multidim_fields, rtol=1e-9,
               ngals_hdf5, binary_redshift, snap_key))
         raise ValueError
 
+    # Put the galaxies back into forest order (if they were written in a different order).
+    forest_order = determine_forest_order(hdf5_file, ncores, snap_key)
+
     # We will key via the binary file because the HDF5 file has some multidimensional
     # fields split across mutliple datasets.
     dim_names = ["x", "y", "z"]
@@ -314,24 +382,27 @@ def compare_binary_hdf5_catalogs(g1, hdf5_file, multidim_fields, rtol=1e-9,
         # Iterate through all the core groups and slice the data into the array.
         for core_idx in range(ncores):
 
-            core_name = "Core_{0}".format(core_idx)
-            num_gals_this_file = hdf5_file[core_name][snap_key].attrs["num_gals"]
+            core_group = get_core_group(hdf5_file, core_idx)
+            num_gals_this_file = core_group[snap_key].attrs["num_gals"]
 
             if key in multidim_fields:
                 # In the HDF5 file, the fields are named <BaseKey><x/y/z>.
                 for dim_num, dim_name in enumerate(dim_names):
                     hdf5_name = "{0}{1}".format(key, dim_name)
 
-                    data_this_file = hdf5_file[core_name][snap_key][hdf5_name][:]
+                    data_this_file = core_group[snap_key][hdf5_name][:]
                     hdf5_data[offset:offset+num_gals_this_file, dim_num] = data_this_file
 
             else:
-                data_this_file = hdf5_file[core_name][snap_key][key][:]
+                data_this_file = core_group[snap_key][key][:]
 
                 hdf5_data[offset:offset+num_gals_this_file] = data_this_file
 
             offset += num_gals_this_file
 
+        if forest_order is not None:
+            hdf5_data = hdf5_data[forest_order]
+
         binary_data = binary_gals[key]
 
         # The two arrays should now have the identical shape. Compare them.
@@ -357,12 +428,54 @@ def determine_num_gals_at_snap(hdf5_file, ncores, snap_key):
 
     for core_idx in range(ncores):
 
-        core_key = "Core_{0}".format(core_idx)
-        num_gals += hdf5_file[core_key][snap_key].attrs["num_gals"]
+        num_gals += get_core_group(hdf5_file, core_idx)[snap_key].attrs["num_gals"]
 
     return num_gals
 
 
+def determine_num_core_groups(hdf5_file):
+
+    # With 'HDF5SingleFile', the galaxies from all cores are combined into one
+    # file without any 'Core_' groups.
+    if "Core_0" not in hdf5_file:
+        return 1
+
+    return hdf5_file["Header"]["Misc"].attrs["num_cores"]
+
+
+def determine_forest_order(hdf5_file, ncores, snap_key):
+
+    # With 'HDF5SingleFile', every task appends its buffered trees in rounds during the run, and with
+    # 'DynamicForestScheduling', every task processes whichever forests it is handed. The trees are then
+    # not in forest order and 'TreeInfo/ForestNr' holds the forest of each tree (in every core group).
+    forestnr = []
+    num_gals_per_tree = []
+    for core_idx in range(ncores):
+        tree_info = get_core_group(hdf5_file, core_idx)["TreeInfo"]
+        if "ForestNr" not in tree_info:
+            return None
+
+        forestnr.append(tree_info["ForestNr"][:])
+        num_gals_per_tree.append(tree_info[snap_key]["NumGalsPerTreePerSnap"][:])
+
+    forestnr = np.concatenate(forestnr)
+    offsets = np.concatenate(([0], np.cumsum(np.concatenate(num_gals_per_tree))))
+
+    # The galaxies of each tree stay together; only the trees are reordered.
+    tree_order = np.argsort(forestnr, kind="stable")
+    galaxy_indices = [np.arange(offsets[tree], offsets[tree+1], dtype=np.int64) for tree in tree_order]
+
+    return np.concatenate([np.zeros(0, dtype=np.int64)] + galaxy_indices)
+
+
+def get_core_group(hdf5_file, core_idx):
+
+    if "Core_0" not in hdf5_file:
+        return hdf5_file
+
+    return hdf5_file["Core_{0}".format(core_idx)]
+
+
 def determine_snap_from_binary_z(hdf5_file, redshift, verbose=False):
 
     hdf5_snap_keys = []
@@ -370,8 +483,9 @@ def determine_snap_from_binary_z(hdf5_file, redshift, verbose=False):
 
     # We're handling the HDF5 master file. Hence let's look at the Core_0 group because
     # it's guaranteed to always be present.
+    core_group = get_core_group(hdf5_file, 0)
 
-    for key in hdf5_file["Core_0"].keys():
+    for key in core_group.keys():
 
         # We need to be careful here. We have a "Header" group that we don't
         # want to count when we're trying to work out the correct snapshot.
@@ -379,7 +493,7 @@ def determine_snap_from_binary_z(hdf5_file, redshift, verbose=False):
             continue
 
         hdf5_snap_keys.append(key)
-        hdf5_redshifts.append(hdf5_file["Core_0"][key].attrs["redshift"])
+        hdf5_redshifts.append(core_group[key].attrs["redshift"])
 
     # Find the snapshot that is closest to the redshift.
     z_array = np.array(hdf5_redshifts)
@@ -506,12 +620,14 @@ def compare_binary_catalogs(g1, g2, rtol=1e-9, atol=5e-5):
     gals1 = g1.read_gals()
     gals2 = g2.read_gals()
 
-    for field in g1.dtype.names:
+    # With packed records, only the fields in the packed records are compared
+    field_names = g1.dtype.names if g1.packed else g2.dtype.names
+    for field in field_names:
         if field in ignored_fields:
             continue
 
-        field1 = gals1[field]
-        field2 = gals2[field]
+        field1 = get_binary_field(gals1, field)
+        field2 = get_binary_field(gals2, field)
 
         return_value = compare_field_equality(field1, field2, field, rtol, atol)
 
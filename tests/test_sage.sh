@@ -232,6 +232,341 @@ fi
 echo "Passed: $npassed."
 echo "Failed: $nfailed."
 
+# Finally, check the HDF5 output that all the tasks write into a single file (i.e., without any per-task
+# files or 'Core_' groups). Use a different file name so that the previous HDF5 output is not overwritten.
+cd "$parent_path"/../
+tmpfile="$(mktemp)"
+sed -e '/^OutputFormat /s/.*$/OutputFormat        sage_hdf5/' \
+    -e '/^FileNameGalaxies /s/.*$/FileNameGalaxies    test_sage_single/' \
+    -e '/^HDF5SingleFile /d' "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+echo "HDF5SingleFile      1" >> ${tmpfile}
+
+${MPI_RUN_COMMAND} ./sage "${tmpfile}"
+if [[ $? != 0 ]]; then
+    echo "sage exited abnormally when writing the HDF5 output into a single file."
+    echo "Here is the input file for this run."
+    cat $tmpfile
+    echo "If the fix to this isn't obvious, please feel free to open an issue on our GitHub page."
+    echo "https://github.com/sage-home/sage-model/issues/new"
+    exit 1
+fi
+
+rm -f ${tmpfile}
+
+cd "$parent_path"/$datadir
+
+# There should not be any per-task files.
+test_file=$(ls test_sage_single.hdf5)
+if [[ $? == 0 ]] && ! ls test_sage_single_*.hdf5 1>/dev/null 2>&1; then
+    npassed_single=0
+    nfiles=0
+    nfailed_single=0
+    for f in ${correct_files[@]}; do
+        ((nfiles++))
+        python "$parent_path"/sagediff.py ${correct_files[${nfiles}-1]} ${test_file} binary-hdf5 1 1
+        if [[ $? == 0 ]]; then
+            ((npassed_single++))
+        else
+            ((nfailed_single++))
+        fi
+    done
+else
+    # Either the single file was not written or there are per-task files as well
+    npassed_single=0
+    nfailed_single=8
+fi
+echo "Passed (single HDF5 file): $npassed_single."
+echo "Failed (single HDF5 file): $nfailed_single."
+nfailed=$((nfailed + nfailed_single))
+
+# Check the binary output with only some of the fields selected (i.e., the packed records). Use a different
+# file name so that the previous binary output is not overwritten.
+cd "$parent_path"/../
+tmpfile="$(mktemp)"
+sed -e '/^OutputFormat /s/.*$/OutputFormat        sage_binary/' \
+    -e '/^FileNameGalaxies /s/.*$/FileNameGalaxies    test_sage_fields/' \
+    -e '/^OutputFields /d' "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+echo "OutputFields        SnapNum,GalaxyIndex,Posy,Mvir,CentralMvir,StellarMass,SfrDiskZ,Cooling,infallVmax" >> ${tmpfile}
+
+${MPI_RUN_COMMAND} ./sage "${tmpfile}"
+if [[ $? != 0 ]]; then
+    echo "sage exited abnormally when writing only some of the output fields."
+    echo "Here is the input file for this run."
+    cat $tmpfile
+    echo "If the fix to this isn't obvious, please feel free to open an issue on our GitHub page."
+    echo "https://github.com/sage-home/sage-model/issues/new"
+    exit 1
+fi
+
+rm -f ${tmpfile}
+
+cd "$parent_path"/$datadir
+
+npassed_fields=0
+nfailed_fields=0
+for f in ${correct_files[@]}; do
+    # The selected fields must be identical to the same fields in the full output
+    python "$parent_path"/sagediff.py ${f} test_sage_fields${f#correct-mini-millennium-output} binary-binary 1 $NUM_SAGE_PROCS
+    if [[ $? == 0 ]]; then
+        ((npassed_fields++))
+    else
+        ((nfailed_fields++))
+    fi
+done
+echo "Passed (OutputFields): $npassed_fields."
+echo "Failed (OutputFields): $nfailed_fields."
+nfailed=$((nfailed + nfailed_fields))
+
+# Check that a run that is interrupted and then restarted from its checkpoint reproduces the uninterrupted
+# run, for both the binary and the HDF5 output. With a tiny 'CheckpointInterval', a checkpoint is written after
+# every forest; the run is stopped as soon as the first checkpoint exists and is then run again to completion.
+cd "$parent_path"/../
+nfailed_restart=0
+for format in sage_binary sage_hdf5; do
+    restart_name=test_sage_restart_${format#sage_}
+    rm -f "$parent_path"/$datadir/${restart_name}_* "$parent_path"/$datadir/${restart_name}.hdf5
+
+    tmpfile="$(mktemp)"
+    sed -e "/^OutputFormat /s/.*$/OutputFormat        ${format}/" \
+        -e "/^FileNameGalaxies /s/.*$/FileNameGalaxies    ${restart_name}/" \
+        -e '/^CheckpointInterval /d' -e '/^RestartFromCheckpoint /d' \
+        "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+    echo "CheckpointInterval  1e-9" >> ${tmpfile}
+    echo "RestartFromCheckpoint 1" >> ${tmpfile}
+
+    ${MPI_RUN_COMMAND} ./sage "${tmpfile}" 1>/dev/null 2>&1 &
+    sage_pid=$!
+    while kill -0 ${sage_pid} 2>/dev/null && [ ! -f "$parent_path"/$datadir/${restart_name}_checkpoint_0.bin ]; do
+        sleep 0.05
+    done
+    # Stop the sage process(es) directly: 'mpirun' may exit on a signal without stopping the tasks first
+    pkill -TERM -f "sage ${tmpfile}"
+    wait ${sage_pid}
+
+    restart_log="$(mktemp)"
+    ${MPI_RUN_COMMAND} ./sage "${tmpfile}" > ${restart_log} 2>&1
+    if [[ $? != 0 ]]; then
+        echo "sage exited abnormally when restarting from the checkpoint (OutputFormat = ${format})."
+        cat ${restart_log}
+        ((nfailed_restart++))
+    elif ! grep -q "Restarting from the checkpoint" ${restart_log}; then
+        echo "sage was not interrupted before it finished, hence the restart from the checkpoint was not tested (OutputFormat = ${format})."
+        ((nfailed_restart++))
+    else
+        cd "$parent_path"/$datadir
+        nfiles=0
+        for f in ${correct_files[@]}; do
+            ((nfiles++))
+            if [[ ${format} == sage_binary ]]; then
+                python "$parent_path"/sagediff.py ${test_files[${nfiles}-1]} ${restart_name}${test_files[${nfiles}-1]#test_sage} binary-binary $NUM_SAGE_PROCS $NUM_SAGE_PROCS
+            else
+                python "$parent_path"/sagediff.py ${test_files[${nfiles}-1]} ${restart_name}.hdf5 binary-hdf5 $NUM_SAGE_PROCS 1
+            fi
+            if [[ $? != 0 ]]; then
+                ((nfailed_restart++))
+            fi
+        done
+        cd "$parent_path"/../
+    fi
+    rm -f ${tmpfile} ${restart_log}
+done
+echo "Failed (restart from checkpoint): $nfailed_restart."
+nfailed=$((nfailed + nfailed_restart))
+
+# Check the dynamic scheduling of the forests. Every task then processes whichever forests it is handed, so
+# the HDF5 output is compared with the (statically scheduled) binary run after ordering the trees by 'TreeInfo/ForestNr'.
+cd "$parent_path"/../
+tmpfile="$(mktemp)"
+sed -e '/^OutputFormat /s/.*$/OutputFormat        sage_hdf5/' \
+    -e '/^FileNameGalaxies /s/.*$/FileNameGalaxies    test_sage_dynamic/' \
+    -e '/^DynamicForestScheduling /d' "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+echo "DynamicForestScheduling 1" >> ${tmpfile}
+
+${MPI_RUN_COMMAND} ./sage "${tmpfile}"
+if [[ $? != 0 ]]; then
+    echo "sage exited abnormally with the dynamic scheduling of the forests."
+    echo "Here is the input file for this run."
+    cat $tmpfile
+    echo "If the fix to this isn't obvious, please feel free to open an issue on our GitHub page."
+    echo "https://github.com/sage-home/sage-model/issues/new"
+    exit 1
+fi
+
+rm -f ${tmpfile}
+
+cd "$parent_path"/$datadir
+
+npassed_dynamic=0
+nfailed_dynamic=0
+nfiles=0
+for f in ${correct_files[@]}; do
+    ((nfiles++))
+    python "$parent_path"/sagediff.py ${test_files[${nfiles}-1]} test_sage_dynamic.hdf5 binary-hdf5 $NUM_SAGE_PROCS 1
+    if [[ $? == 0 ]]; then
+        ((npassed_dynamic++))
+    else
+        ((nfailed_dynamic++))
+    fi
+done
+echo "Passed (DynamicForestScheduling): $npassed_dynamic."
+echo "Failed (DynamicForestScheduling): $nfailed_dynamic."
+nfailed=$((nfailed + nfailed_dynamic))
+
+# Check the forest timings: a run with 'WriteForestTimings' writes the time taken by every forest, and a run with
+# 'ForestTimingsFromRun' fits the cost of the forests to those timings. The fit is checked with timings that follow
+# an exact power law (made from the measured ones); with more than one task, the forests are then distributed
+# differently than with the default cost (and the galaxies must not change).
+cd "$parent_path"/../
+rm -f "$parent_path"/$datadir/test_sage_timings* "$parent_path"/$datadir/test_sage_powerlaw*
+nfailed_timings=0
+for run in timings powerlaw; do
+    tmpfile="$(mktemp)"
+    sed -e '/^OutputFormat /s/.*$/OutputFormat        sage_binary/' \
+        -e "/^FileNameGalaxies /s/.*$/FileNameGalaxies    test_sage_${run}/" \
+        -e '/^WriteForestTimings /d' -e '/^ForestTimingsFromRun /d' "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+    if [[ ${run} == timings ]]; then
+        echo "WriteForestTimings  1" >> ${tmpfile}
+    else
+        echo "ForestTimingsFromRun $parent_path/$datadir/test_sage_powerlaw" >> ${tmpfile}
+    fi
+
+    log_file="$parent_path"/$datadir/test_sage_${run}.log
+    ${MPI_RUN_COMMAND} ./sage "${tmpfile}" > ${log_file} 2>&1
+    if [[ $? != 0 ]]; then
+        echo "sage exited abnormally with the forest timings (run = ${run})."
+        cat ${log_file}
+        ((nfailed_timings++))
+        rm -f ${tmpfile}
+        break
+    fi
+    rm -f ${tmpfile}
+
+    if [[ ${run} == timings ]]; then
+        # Every task writes its timings. The seconds are replaced with 1e-6 * pow(nhalos, 3)
+        for ((task = 0; task < NUM_SAGE_PROCS; task++)); do
+            timings_file="$parent_path"/$datadir/test_sage_timings_forest_timings_${task}.txt
+            if [[ ! -f ${timings_file} ]] || ! grep -qv '^#' ${timings_file}; then
+                echo "The forest timings file '${timings_file}' is missing or empty."
+                ((nfailed_timings++))
+            fi
+            awk '/^#/ {print; next} {printf "%d %d %d %.10e\n", $1, $2, $3, 1e-6*$3*$3*$3}' ${timings_file} \
+                > "$parent_path"/$datadir/test_sage_powerlaw_forest_timings_${task}.txt
+        done
+    fi
+done
+
+cd "$parent_path"/$datadir
+if [[ $nfailed_timings == 0 ]]; then
+    if ! grep -q "pow(nhalos, 3)" test_sage_powerlaw.log; then
+        echo "The forest cost was not fitted to the timings from the previous run."
+        grep "Fitted the forest cost" test_sage_powerlaw.log
+        ((nfailed_timings++))
+    fi
+    if [[ $NUM_SAGE_PROCS -gt 1 ]] && \
+           diff -q <(grep "Assigning forest-range" test_sage_timings.log | sort) \
+                   <(grep "Assigning forest-range" test_sage_powerlaw.log | sort) 1>/dev/null; then
+        echo "The forests were distributed identically with the cost fitted to the timings."
+        ((nfailed_timings++))
+    fi
+    nfiles=0
+    for f in ${correct_files[@]}; do
+        ((nfiles++))
+        python "$parent_path"/sagediff.py ${test_files[${nfiles}-1]} test_sage_powerlaw${test_files[${nfiles}-1]#test_sage} binary-binary $NUM_SAGE_PROCS $NUM_SAGE_PROCS
+        if [[ $? != 0 ]]; then
+            ((nfailed_timings++))
+        fi
+    done
+fi
+echo "Failed (forest timings): $nfailed_timings."
+nfailed=$((nfailed + nfailed_timings))
+
+# Check the cache of the Consistent-Trees forests ('ForestCacheDir'), on the first Mini-Millennium tree file converted
+# into Consistent-Trees format. The first run writes the cache and the second run must read the forests from it. Once
+# an input file changes, the cache must be rebuilt (and then used again). The galaxies must be identical in all runs.
+cd "$parent_path"/../
+ctrees_dir="$parent_path"/$datadir/ctrees
+rm -rf "${ctrees_dir}"
+mkdir -p "${ctrees_dir}"/trees "${ctrees_dir}"/cache
+lhalo_simdir=$(awk '$1 == "SimulationDir" {print $2}' "$parent_path"/$datadir/mini-millennium.par)
+lhalo_treename=$(awk '$1 == "TreeName" {print $2}' "$parent_path"/$datadir/mini-millennium.par)
+lhalo_firstfile=$(awk '$1 == "FirstFile" {print $2}' "$parent_path"/$datadir/mini-millennium.par)
+snaplist=$(awk '$1 == "FileWithSnapList" {print $2}' "$parent_path"/$datadir/mini-millennium.par)
+
+nfailed_cache=0
+python "$parent_path"/lhalo_to_ctrees.py ${snaplist} "${ctrees_dir}"/trees ${lhalo_simdir}/${lhalo_treename}.${lhalo_firstfile}
+if [[ $? != 0 ]]; then
+    echo "Could not convert the Mini-Millennium trees into Consistent-Trees format."
+    ((nfailed_cache++))
+else
+    tmpfile="$(mktemp)"
+    for run in 1 2 3 4; do
+        sed -e '/^OutputFormat /s/.*$/OutputFormat        sage_binary/' \
+            -e "/^FileNameGalaxies /s/.*$/FileNameGalaxies    test_sage_ctrees${run}/" \
+            -e "/^OutputDir /s|.*$|OutputDir           ${ctrees_dir}/|" \
+            -e "/^SimulationDir /s|.*$|SimulationDir       ${ctrees_dir}/trees/|" \
+            -e '/^TreeName /s/.*$/TreeName            tree_0_0_0.dat/' \
+            -e '/^TreeType /s/.*$/TreeType            consistent_trees_ascii/' \
+            -e '/^NumSimulationTreeFiles /s/.*$/NumSimulationTreeFiles  1/' \
+            -e '/^FirstFile /s/.*$/FirstFile           0/' \
+            -e '/^LastFile /s/.*$/LastFile            0/' \
+            -e '/^ForestCacheDir /d' "$parent_path"/$datadir/mini-millennium.par > ${tmpfile}
+        echo "ForestCacheDir      ${ctrees_dir}/cache" >> ${tmpfile}
+
+        # Change one of the input files (without changing the forests) -> the cache must not be used
+        if [[ ${run} == 3 ]]; then
+            echo "# modified after the cache was written" >> "${ctrees_dir}"/trees/forests.list
+        fi
+
+        ${MPI_RUN_COMMAND} ./sage "${tmpfile}" > "${ctrees_dir}"/run${run}.log 2>&1
+        if [[ $? != 0 ]]; then
+            echo "sage exited abnormally with the Consistent-Trees forest cache (run ${run})."
+            cat "${ctrees_dir}"/run${run}.log
+            ((nfailed_cache++))
+            break
+        fi
+
+        grep -q "Reading the Consistent-Trees forests from the cache" "${ctrees_dir}"/run${run}.log
+        used_cache=$((1 - $?))
+        if [[ ${run} == 2 || ${run} == 4 ]] && [[ ${used_cache} == 0 ]]; then
+            echo "The Consistent-Trees forests were not read from the cache (run ${run})."
+            ((nfailed_cache++))
+        elif [[ ${run} == 1 || ${run} == 3 ]] && [[ ${used_cache} == 1 ]]; then
+            echo "The Consistent-Trees forests were read from an outdated cache (run ${run})."
+            ((nfailed_cache++))
+        fi
+        if [[ $(ls "${ctrees_dir}"/cache/*_ctrees_cache_*.bin 2>/dev/null | wc -l) != ${NUM_SAGE_PROCS} ]]; then
+            echo "Expected one forest cache file per task after run ${run}."
+            ls -l "${ctrees_dir}"/cache
+            ((nfailed_cache++))
+        fi
+
+        if [[ ${run} -gt 1 ]]; then
+            pushd "${ctrees_dir}" 1>/dev/null
+            for f in $(ls -d test_sage_ctrees1_z*_0); do
+                python "$parent_path"/sagediff.py ${f} test_sage_ctrees${run}${f#test_sage_ctrees1} binary-binary $NUM_SAGE_PROCS $NUM_SAGE_PROCS 1>/dev/null
+                if [[ $? != 0 ]]; then
+                    echo "The galaxies from run ${run} with the Consistent-Trees forest cache differ from the first run (file ${f})."
+                    ((nfailed_cache++))
+                fi
+            done
+            popd 1>/dev/null
+        fi
+    done
+    rm -f ${tmpfile}
+fi
+echo "Failed (Consistent-Trees forest cache): $nfailed_cache."
+nfailed=$((nfailed + nfailed_cache))
+
+# Check the library API: invalid key/value parameters must be returned as errors, and repeated runs with
+# different recipe parameters (on the same forests) must reproduce the galaxies when the parameters are restored
+# (also when the forests are kept in memory between the runs).
+cd "$parent_path"/../
+${MPI_RUN_COMMAND} ./tests/test_sage_api "$parent_path"/$datadir/mini-millennium.par
+if [[ $? != 0 ]]; then
+    echo "The test of the sage library API failed."
+    ((nfailed++))
+fi
+
 # restore the original working dir
 cd "$cwd"
 exit $nfailed
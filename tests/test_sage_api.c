@@ -0,0 +1,365 @@
+/* Tests the sage library API: parsing the parameters from key/value pairs (where an invalid
+   parameter must be reported back to the caller rather than terminating the process) and
+   running sage repeatedly on the same forests with different recipe parameters (and with the
+   forests kept in memory between the runs).
+
+   usage: test_sage_api <parameterfile>
+
+   The key/value pairs are taken from the parameter file, with the output kept in memory
+   (i.e., OutputFormat is replaced with 'sage_memory') */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#ifdef MPI
+#include <mpi.h>
+#endif
+
+#include "sage.h"
+
+#define MAX_TEST_PARAMS  256
+#define MAX_TEST_LINE_LEN 1024
+
+struct keyvalues {
+    int nparams;
+    char *keys[MAX_TEST_PARAMS];
+    char *values[MAX_TEST_PARAMS];
+};
+
+static int ThisTask = 0;
+static int NTasks = 1;
+
+#define TEST_ASSERT(cond, ...) {                                        \
+        if(!(cond)) {                                                   \
+            fprintf(stderr, "ThisTask = %d FAILED (%s:%d): ", ThisTask, __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                               \
+            return EXIT_FAILURE;                                        \
+        }                                                               \
+    }
+
+
+static char *strip_whitespace(char *str)
+{
+    while(isspace((unsigned char) *str)) str++;
+    char *end = str + strlen(str);
+    while(end > str && isspace((unsigned char) end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+/* Reads every "key value" line of the parameter file (the value of "->" is the rest of the line) */
+static int read_keyvalues(const char *fname, struct keyvalues *kv)
+{
+    FILE *fp = fopen(fname, "r");
+    TEST_ASSERT(fp != NULL, "Could not open the parameter file '%s'\n", fname);
+
+    char line[MAX_TEST_LINE_LEN];
+    kv->nparams = 0;
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        char *comment = strchr(line, '%');
+        if(comment != NULL) *comment = '\0';
+
+        char *key = strip_whitespace(line);
+        if(*key == '\0') continue;
+
+        char *value = key;
+        while(*value != '\0' && !isspace((unsigned char) *value)) value++;
+        if(*value != '\0') *value++ = '\0';
+        value = strip_whitespace(value);
+        if(strcmp(key, "->") != 0) {
+            /* only the first token is the value */
+            char *end = value;
+            while(*end != '\0' && !isspace((unsigned char) *end)) end++;
+            *end = '\0';
+        }
+
+        TEST_ASSERT(kv->nparams < MAX_TEST_PARAMS, "Too many parameters in '%s'\n", fname);
+        kv->keys[kv->nparams] = strdup(key);
+        kv->values[kv->nparams] = strdup(value);
+        TEST_ASSERT(kv->keys[kv->nparams] != NULL && kv->values[kv->nparams] != NULL, "strdup failed\n");
+        kv->nparams++;
+    }
+    fclose(fp);
+
+    return EXIT_SUCCESS;
+}
+
+static void free_keyvalues(struct keyvalues *kv)
+{
+    for(int i=0;i<kv->nparams;i++) {
+        free(kv->keys[i]);
+        free(kv->values[i]);
+    }
+    kv->nparams = 0;
+}
+
+static int find_key(const struct keyvalues *kv, const char *key)
+{
+    for(int i=0;i<kv->nparams;i++) {
+        if(strcmp(kv->keys[i], key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int set_value(struct keyvalues *kv, const char *key, const char *value)
+{
+    int idx = find_key(kv, key);
+    if(idx < 0) {
+        TEST_ASSERT(kv->nparams < MAX_TEST_PARAMS, "Too many parameters\n");
+        idx = kv->nparams++;
+        kv->keys[idx] = strdup(key);
+    } else {
+        free(kv->values[idx]);
+    }
+    kv->values[idx] = strdup(value);
+    TEST_ASSERT(kv->keys[idx] != NULL && kv->values[idx] != NULL, "strdup failed\n");
+
+    return EXIT_SUCCESS;
+}
+
+static int copy_keyvalues(struct keyvalues *dst, const struct keyvalues *src)
+{
+    memset(dst, 0, sizeof(*dst));
+    for(int j=0;j<src->nparams;j++) {
+        if(set_value(dst, src->keys[j], src->values[j]) != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int remove_key(struct keyvalues *kv, const char *key)
+{
+    const int idx = find_key(kv, key);
+    TEST_ASSERT(idx >= 0, "Key '%s' is not in the parameter file\n", key);
+    free(kv->keys[idx]);
+    free(kv->values[idx]);
+    kv->keys[idx] = kv->keys[kv->nparams - 1];
+    kv->values[idx] = kv->values[kv->nparams - 1];
+    kv->nparams--;
+
+    return EXIT_SUCCESS;
+}
+
+static int params_from_keyvalues(const struct keyvalues *kv, void **params)
+{
+    return sage_params_from_keyvalues(ThisTask, NTasks, kv->nparams, (const char * const *) kv->keys,
+                                      (const char * const *) kv->values, params);
+}
+
+
+/* Every invalid parameter must be returned as an error (without any params) */
+static int test_invalid_keyvalues(const struct keyvalues *valid)
+{
+    struct keyvalues kv;
+    void *params;
+
+    const char *bad_keys[] = {"NoSuchParameter", "TreeType", "OutputFormat", "ForestDistributionScheme", "NumOutputs"};
+    const char *bad_values[] = {"1", "no_such_tree_type", "no_such_output_format", "no_such_scheme", "-2"};
+    for(size_t i=0;i<sizeof(bad_keys)/sizeof(bad_keys[0]);i++) {
+        if(copy_keyvalues(&kv, valid) != EXIT_SUCCESS) return EXIT_FAILURE;
+        if(set_value(&kv, bad_keys[i], bad_values[i]) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        params = (void *) &kv;
+        const int status = params_from_keyvalues(&kv, &params);
+        free_keyvalues(&kv);
+        TEST_ASSERT(status != EXIT_SUCCESS, "'%s = %s' should have been an invalid parameter\n", bad_keys[i], bad_values[i]);
+        TEST_ASSERT(params == NULL, "params should be NULL after an invalid parameter ('%s = %s')\n", bad_keys[i], bad_values[i]);
+    }
+
+    /* a required parameter is missing */
+    if(copy_keyvalues(&kv, valid) != EXIT_SUCCESS) return EXIT_FAILURE;
+    if(remove_key(&kv, "BoxSize") != EXIT_SUCCESS) return EXIT_FAILURE;
+    params = (void *) &kv;
+    const int status = params_from_keyvalues(&kv, &params);
+    free_keyvalues(&kv);
+    TEST_ASSERT(status != EXIT_SUCCESS && params == NULL, "A missing 'BoxSize' should have been an error\n");
+
+    return EXIT_SUCCESS;
+}
+
+
+/* Runs sage and returns a copy of the stellar masses at the last output snapshot */
+static int run_and_get_stellar_mass(void *params, float **stellar_mass, int64_t *ngals)
+{
+    int status = sage_run(params);
+    TEST_ASSERT(status == EXIT_SUCCESS, "sage_run failed with status = %d\n", status);
+
+#ifdef MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    status = sage_finalize_run(params);
+    TEST_ASSERT(status == EXIT_SUCCESS, "sage_finalize_run failed with status = %d\n", status);
+
+    int num_snaps;
+    const int32_t *snapnums;
+    status = sage_get_output_snapshots(params, &num_snaps, &snapnums);
+    TEST_ASSERT(status == EXIT_SUCCESS && num_snaps > 0, "sage_get_output_snapshots failed with status = %d\n", status);
+    int last_snap_idx = 0;
+    for(int i=1;i<num_snaps;i++) {
+        if(snapnums[i] > snapnums[last_snap_idx]) last_snap_idx = i;
+    }
+
+    void *data;
+    status = sage_get_output_field(params, last_snap_idx, "StellarMass", &data, ngals);
+    TEST_ASSERT(status == EXIT_SUCCESS, "sage_get_output_field failed with status = %d\n", status);
+
+    *stellar_mass = malloc((*ngals > 0 ? *ngals:1) * sizeof(float));
+    TEST_ASSERT(*stellar_mass != NULL, "Failed to allocate %"PRId64" floats\n", *ngals);
+    memcpy(*stellar_mass, data, *ngals * sizeof(float));
+
+    return EXIT_SUCCESS;
+}
+
+/* Runs sage three times on the same forests: with the original SfrEfficiency, with a different one and with the
+   original one again -> the first and the last run must be identical */
+static int test_repeated_runs(const struct keyvalues *kv)
+{
+    void *params;
+    int status = params_from_keyvalues(kv, &params);
+    TEST_ASSERT(status == EXIT_SUCCESS, "Could not parse the (valid) key/value parameters. status = %d\n", status);
+
+    status = sage_init_context(params);
+    TEST_ASSERT(status == EXIT_SUCCESS, "sage_init_context failed with status = %d\n", status);
+
+    /* Only the recipe parameters can be changed between the runs */
+    TEST_ASSERT(sage_set_param(params, "BoxSize", "100.0") != EXIT_SUCCESS, "BoxSize should not be allowed to change\n");
+    TEST_ASSERT(sage_set_param(params, "SfrEfficiency", "not_a_number") != EXIT_SUCCESS,
+                "'not_a_number' should not be a valid SfrEfficiency\n");
+
+    const int sfr_idx = find_key(kv, "SfrEfficiency");
+    TEST_ASSERT(sfr_idx >= 0, "SfrEfficiency is not in the parameter file\n");
+    const char *orig_sfr = kv->values[sfr_idx];
+    char new_sfr[64];
+    snprintf(new_sfr, sizeof(new_sfr), "%g", 2.0 * atof(orig_sfr));
+
+    float *first = NULL, *second = NULL, *third = NULL;
+    int64_t ngals_first, ngals_second, ngals_third;
+    if(run_and_get_stellar_mass(params, &first, &ngals_first) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    TEST_ASSERT(sage_set_param(params, "SfrEfficiency", new_sfr) == EXIT_SUCCESS, "Could not set SfrEfficiency = %s\n", new_sfr);
+    if(run_and_get_stellar_mass(params, &second, &ngals_second) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    TEST_ASSERT(sage_set_param(params, "SfrEfficiency", orig_sfr) == EXIT_SUCCESS, "Could not set SfrEfficiency = %s\n", orig_sfr);
+    if(run_and_get_stellar_mass(params, &third, &ngals_third) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    TEST_ASSERT(ngals_first != ngals_second || memcmp(first, second, ngals_first * sizeof(float)) != 0,
+                "Changing SfrEfficiency from %s to %s did not change the stellar masses\n", orig_sfr, new_sfr);
+    TEST_ASSERT(ngals_first == ngals_third && memcmp(first, third, ngals_first * sizeof(float)) == 0,
+                "Restoring SfrEfficiency = %s did not reproduce the galaxies of the first run (ngals = %"PRId64" and %"PRId64")\n",
+                orig_sfr, ngals_first, ngals_third);
+
+    free(first);
+    free(second);
+    free(third);
+
+    return sage_free_context(params);
+}
+
+/* Runs sage repeatedly while keeping some ('ResidentForestsMB' = 1) and all ('ResidentForestsMB' = -1) of the forests
+   in memory between the runs -> every run must reproduce the galaxies of the runs that re-read the forests
+   ('ResidentForestsMB' = 0) */
+static int test_resident_forests(const struct keyvalues *valid)
+{
+    const char *budgets[] = {"0", "1", "-1"};
+    const int nruns = 3;
+    float *reference = NULL;
+    int64_t ngals_reference = 0;
+
+    for(size_t i=0;i<sizeof(budgets)/sizeof(budgets[0]);i++) {
+        struct keyvalues kv;
+        void *params;
+        if(copy_keyvalues(&kv, valid) != EXIT_SUCCESS) return EXIT_FAILURE;
+        if(set_value(&kv, "ResidentForestsMB", budgets[i]) != EXIT_SUCCESS) return EXIT_FAILURE;
+        int status = params_from_keyvalues(&kv, &params);
+        free_keyvalues(&kv);
+        TEST_ASSERT(status == EXIT_SUCCESS, "Could not parse the parameters with ResidentForestsMB = %s. status = %d\n", budgets[i], status);
+
+        status = sage_init_context(params);
+        TEST_ASSERT(status == EXIT_SUCCESS, "sage_init_context failed with status = %d\n", status);
+
+        for(int run=0;run<nruns;run++) {
+            float *stellar_mass = NULL;
+            int64_t ngals;
+            if(run_and_get_stellar_mass(params, &stellar_mass, &ngals) != EXIT_SUCCESS) return EXIT_FAILURE;
+            if(reference == NULL) {
+                reference = stellar_mass;
+                ngals_reference = ngals;
+                continue;
+            }
+
+            TEST_ASSERT(ngals == ngals_reference && memcmp(stellar_mass, reference, ngals * sizeof(float)) == 0,
+                        "Run %d with ResidentForestsMB = %s did not reproduce the galaxies from re-reading the forests "
+                        "(ngals = %"PRId64" and %"PRId64")\n", run, budgets[i], ngals, ngals_reference);
+            free(stellar_mass);
+        }
+
+        status = sage_free_context(params);
+        TEST_ASSERT(status == EXIT_SUCCESS, "sage_free_context failed with status = %d\n", status);
+    }
+    free(reference);
+
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char **argv)
+{
+#ifdef MPI
+    /* With HDF5SingleFile, the galaxies are written into the single file from within the OpenMP threads (one at a time) */
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTasks);
+#endif
+
+    if(argc != 2) {
+        fprintf(stderr, "\n  usage: %s <parameterfile>\n\n", argv[0]);
+        goto err;
+    }
+
+    struct keyvalues kv;
+    if(read_keyvalues(argv[1], &kv) != EXIT_SUCCESS ||
+       set_value(&kv, "OutputFormat", "sage_memory") != EXIT_SUCCESS) {
+        goto err;
+    }
+
+    if(test_invalid_keyvalues(&kv) != EXIT_SUCCESS) {
+        goto err;
+    }
+    if(ThisTask == 0) {
+        fprintf(stderr, "Passed: invalid key/value parameters are reported as errors\n");
+    }
+
+    if(test_repeated_runs(&kv) != EXIT_SUCCESS) {
+        goto err;
+    }
+    if(ThisTask == 0) {
+        fprintf(stderr, "Passed: repeated runs with sage_set_param/sage_run/sage_get_output_field\n");
+    }
+
+    if(test_resident_forests(&kv) != EXIT_SUCCESS) {
+        goto err;
+    }
+    if(ThisTask == 0) {
+        fprintf(stderr, "Passed: repeated runs with the forests kept in memory (ResidentForestsMB) match the runs that re-read them\n");
+    }
+
+    free_keyvalues(&kv);
+
+#ifdef MPI
+    MPI_Finalize();
+#endif
+    return EXIT_SUCCESS;
+
+err:
+#ifdef MPI
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    MPI_Finalize();
+#endif
+    return EXIT_FAILURE;
+}